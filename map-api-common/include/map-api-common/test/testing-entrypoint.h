@@ -106,7 +106,7 @@ class UnitTestEntryPoint : public UnitTestEntryPointBase {
   virtual ~UnitTestEntryPoint() {}
 
  private:
-  virtual void customInit();
+  virtual void customInit() {}
 };
 
 }  // namespace map_api_common
@@ -0,0 +1,85 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MAP_API_COMMON_THREAD_POOL_H_
+#define MAP_API_COMMON_THREAD_POOL_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace map_api_common {
+
+// Fixed-size pool of worker threads executing tasks in FIFO order.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_threads);
+  // Executes all queued tasks before joining the workers.
+  ~ThreadPool();
+
+  void enqueue(const std::function<void()>& task);
+  // Blocks until all tasks enqueued so far have been executed. May not be
+  // called from a task.
+  void waitForEmptyQueue() const;
+
+  size_t numThreads() const;
+  size_t numQueuedTasks() const;
+
+ private:
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void work();
+
+  std::vector<std::thread> threads_;
+  std::deque<std::function<void()>> tasks_;
+  size_t num_active_tasks_;
+  bool stop_;
+  mutable std::mutex mutex_;
+  std::condition_variable tasks_available_;
+  mutable std::condition_variable tasks_done_;
+};
+
+// Calls function(element) for all elements of the container, using up to
+// max_parallelism threads. Returns once all calls have returned.
+template <typename Container, typename Function>
+void parallelForEach(size_t max_parallelism, const Container& container,
+                     const Function& function) {
+  const size_t num_threads = std::min(max_parallelism, container.size());
+  if (num_threads <= 1u) {
+    for (const typename Container::value_type& element : container) {
+      function(element);
+    }
+    return;
+  }
+  ThreadPool pool(num_threads);
+  for (const typename Container::value_type& element : container) {
+    pool.enqueue([&function, &element]() { function(element); });
+  }
+}
+
+}  // namespace map_api_common
+
+#endif  // MAP_API_COMMON_THREAD_POOL_H_
@@ -0,0 +1,94 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include "map-api-common/thread-pool.h"
+
+#include <glog/logging.h>
+
+namespace map_api_common {
+
+ThreadPool::ThreadPool(size_t num_threads)
+    : num_active_tasks_(0u), stop_(false) {
+  CHECK_GT(num_threads, 0u);
+  for (size_t i = 0u; i < num_threads; ++i) {
+    threads_.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  tasks_available_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::enqueue(const std::function<void()>& task) {
+  CHECK(task);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(!stop_);
+    tasks_.push_back(task);
+  }
+  tasks_available_.notify_one();
+}
+
+void ThreadPool::waitForEmptyQueue() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!tasks_.empty() || num_active_tasks_ > 0u) {
+    tasks_done_.wait(lock);
+  }
+}
+
+size_t ThreadPool::numThreads() const { return threads_.size(); }
+
+size_t ThreadPool::numQueuedTasks() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return tasks_.size();
+}
+
+void ThreadPool::work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    while (tasks_.empty() && !stop_) {
+      tasks_available_.wait(lock);
+    }
+    if (tasks_.empty()) {
+      CHECK(stop_);
+      return;
+    }
+    std::function<void()> task = std::move(tasks_.front());
+    tasks_.pop_front();
+    ++num_active_tasks_;
+    lock.unlock();
+    task();
+    lock.lock();
+    --num_active_tasks_;
+    if (tasks_.empty() && num_active_tasks_ == 0u) {
+      tasks_done_.notify_all();
+    }
+  }
+}
+
+}  // namespace map_api_common
@@ -0,0 +1,123 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "map-api-common/test/testing-entrypoint.h"
+#include "map-api-common/thread-pool.h"
+
+namespace map_api_common {
+
+TEST(ThreadPoolTest, SingleThreadRunsTasksInOrder) {
+  std::vector<int> order;
+  {
+    ThreadPool pool(1u);
+    EXPECT_EQ(1u, pool.numThreads());
+    for (int i = 0; i < 100; ++i) {
+      pool.enqueue([&order, i]() { order.push_back(i); });
+    }
+    pool.waitForEmptyQueue();
+    EXPECT_EQ(0u, pool.numQueuedTasks());
+  }
+  ASSERT_EQ(100u, order.size());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(i, order[i]);
+  }
+}
+
+TEST(ThreadPoolTest, TasksRunConcurrently) {
+  constexpr size_t kNumThreads = 4u;
+  ThreadPool pool(kNumThreads);
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t num_started = 0u;
+  bool all_started = false;
+  for (size_t i = 0u; i < kNumThreads; ++i) {
+    pool.enqueue([&]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (++num_started == kNumThreads) {
+        all_started = true;
+        cv.notify_all();
+      }
+      // Only returns if all tasks are running at the same time.
+      cv.wait_for(lock, std::chrono::seconds(5),
+                  [&all_started]() { return all_started; });
+    });
+  }
+  pool.waitForEmptyQueue();
+  EXPECT_TRUE(all_started);
+}
+
+TEST(ThreadPoolTest, DestructorRunsQueuedTasks) {
+  std::atomic<size_t> num_executed(0u);
+  {
+    ThreadPool pool(2u);
+    for (size_t i = 0u; i < 100u; ++i) {
+      pool.enqueue([&num_executed]() {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        ++num_executed;
+      });
+    }
+  }
+  EXPECT_EQ(100u, num_executed);
+}
+
+TEST(ThreadPoolTest, TasksMayEnqueueTasks) {
+  std::atomic<size_t> num_executed(0u);
+  ThreadPool pool(2u);
+  pool.enqueue([&pool, &num_executed]() {
+    pool.enqueue([&num_executed]() { ++num_executed; });
+    ++num_executed;
+  });
+  pool.waitForEmptyQueue();
+  EXPECT_EQ(2u, num_executed);
+}
+
+TEST(ThreadPoolTest, ParallelForEach) {
+  std::vector<size_t> values(1000u);
+  for (size_t i = 0u; i < values.size(); ++i) {
+    values[i] = i;
+  }
+  std::atomic<size_t> sum(0u);
+  parallelForEach(8u, values, [&sum](size_t value) { sum += value; });
+  EXPECT_EQ(values.size() * (values.size() - 1u) / 2u, sum);
+
+  // A single thread runs in the caller.
+  const std::thread::id caller = std::this_thread::get_id();
+  size_t num_in_caller = 0u;
+  parallelForEach(1u, values, [&caller, &num_in_caller](size_t) {
+    if (std::this_thread::get_id() == caller) {
+      ++num_in_caller;
+    }
+  });
+  EXPECT_EQ(values.size(), num_in_caller);
+}
+
+}  // namespace map_api_common
+
+MAP_API_COMMON_UNITTEST_ENTRYPOINT
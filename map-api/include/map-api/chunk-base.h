@@ -22,17 +22,22 @@
 #ifndef MAP_API_CHUNK_BASE_H_
 #define MAP_API_CHUNK_BASE_H_
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <set>
 #include <stddef.h>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
 #include <map-api-common/unique-id.h>
 
 #include "map-api/chunk-data-container-base.h"
+#include "map-api/internal/lock-contention-statistics.h"
 
 namespace map_api {
 class ConstRevisionMap;
@@ -82,6 +87,11 @@ class ChunkBase {
   virtual void readLock() const = 0;
 
   virtual bool isWriteLocked() const = 0;
+  // Lets thread "to" act as the holder of the write lock held by thread
+  // "from", such that work under the lock can be handed to another thread.
+  // "from" must not access the chunk until the lock has been passed back.
+  virtual void passWriteLock(const std::thread::id& from,
+                             const std::thread::id& to) = 0;
 
   virtual void unlock() const = 0;
 
@@ -112,11 +122,39 @@ class ChunkBase {
   // then called at an unlock request. The tracked insertions and updates are
   // passed. Note: If the sets are empty, the lock has probably been acquired
   // to modify chunk peers.
+  // Triggers are run on a thread pool shared by all chunks, one commit after
+  // the other per chunk. With --map_api_trigger_coalescing_ms, the deltas of
+  // several commits can be merged into one call.
   // Returns position of attached trigger in trigger vector.
   size_t attachTrigger(const TriggerCallback& callback);
+  // Waits until all commits received so far have been passed to the triggers.
+  // May not be called from a trigger of this chunk.
   void waitForTriggerCompletion();
 
   virtual LogicalTime getLatestCommitTime() const = 0;
+  // Number of commits, by any peer, that have been applied to the chunk here.
+  // Counts the commits in the data the chunk was initialized with, too.
+  virtual uint64_t numCommits() const = 0;
+
+  // Discards the revisions that no reader at or after the watermark can
+  // observe. Returns the amount of bytes released.
+  virtual size_t compactHistory(const LogicalTime& watermark) = 0;
+  // Latest watermark the history of the chunk may have been compacted to,
+  // here or, as the compacted histories are passed on to joining peers, by any
+  // peer the chunk has been received from. Reads at earlier times would miss
+  // revisions.
+  virtual LogicalTime compactedUntil() const = 0;
+
+  // Passes all revisions of all items to the sink, oldest first per item.
+  // Used to checkpoint the write-ahead log.
+  virtual void dumpHistories(
+      const std::function<void(const Revision&)>& sink) const = 0;
+
+  // Wait and hold times, declines and recursion of the lock of this chunk
+  // since it has been created.
+  inline const internal::LockContentionStatistics& lockStatistics() const {
+    return lock_statistics_;
+  }
 
  protected:
   // The following three MUST be called in the right places in order for
@@ -130,6 +168,8 @@ class ChunkBase {
 
   map_api_common::Id id_;
   std::unique_ptr<ChunkDataContainerBase> data_container_;
+  // To be updated by the lock implementation.
+  mutable internal::LockContentionStatistics lock_statistics_;
 
  private:
   // Insert and update for transactions.
@@ -145,12 +185,20 @@ class ChunkBase {
   void leaveOnceShared();
   virtual void awaitShared() = 0;
 
-  void triggerWrapper(const std::unordered_set<map_api_common::Id>&& insertions,
-                      const std::unordered_set<map_api_common::Id>&& updates);
+  // Runs on the trigger thread pool and calls the triggers for the pending
+  // batches until there are none left.
+  void deliverTriggerBatches();
+
+  struct TriggerBatch {
+    map_api_common::IdSet insertions, updates;
+    std::chrono::steady_clock::time_point first_commit_time;
+  };
 
   std::vector<TriggerCallback> triggers_;
   mutable std::mutex trigger_mutex_;
-  mutable map_api_common::ReaderWriterMutex triggers_are_active_while_has_readers_;
+  std::deque<TriggerBatch> pending_trigger_batches_;
+  bool trigger_delivery_scheduled_ = false;
+  std::condition_variable triggers_idle_;
   std::unordered_set<map_api_common::Id> trigger_insertions_, trigger_updates_;
 };
 
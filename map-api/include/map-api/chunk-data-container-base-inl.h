@@ -47,11 +47,11 @@ template <typename ValueType>
 void ChunkDataContainerBase::find(int key, const ValueType& value,
                                   const LogicalTime& time,
                                   ConstRevisionMap* dest) const {
-  std::shared_ptr<Revision> valueHolder = this->getTemplate();
+  FieldPredicate predicate;
   if (key >= 0) {
-    valueHolder->set(key, value);
+    predicate.equals(key, value);
   }
-  this->findByRevision(key, *valueHolder, time, dest);
+  this->find(predicate, time, dest);
 }
 
 template <typename ValueType>
@@ -97,12 +97,11 @@ void ChunkDataContainerBase::getAvailableIds(const LogicalTime& time,
 template <typename ValueType>
 int ChunkDataContainerBase::count(int key, const ValueType& value,
                                   const LogicalTime& time) const {
-  std::shared_ptr<Revision> valueHolder = this->getTemplate();
-  CHECK(valueHolder != nullptr);
+  FieldPredicate predicate;
   if (key >= 0) {
-    valueHolder->set(key, value);
+    predicate.equals(key, value);
   }
-  return this->countByRevision(key, *valueHolder, time);
+  return this->count(predicate, time);
 }
 
 }  // namespace map_api
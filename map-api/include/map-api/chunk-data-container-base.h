@@ -22,6 +22,7 @@
 #ifndef MAP_API_CHUNK_DATA_CONTAINER_BASE_H_
 #define MAP_API_CHUNK_DATA_CONTAINER_BASE_H_
 
+#include <functional>
 #include <list>
 #include <memory>
 #include <string>
@@ -31,6 +32,8 @@
 
 #include <gflags/gflags.h>
 
+#include "map-api/field-predicate.h"
+#include "map-api/internal/item-id-filter.h"
 #include "map-api/table-descriptor.h"
 #include "./core.pb.h"
 
@@ -55,6 +58,15 @@ class ChunkDataContainerBase {
   bool isInitialized() const;
   const std::string& name() const;
   std::shared_ptr<Revision> getTemplate() const;
+  typedef std::function<void(const map_api_common::Id& item_id)>
+      NewItemCallback;
+  // The callback is called with the container locked whenever an item is
+  // written to the container for the first time.
+  void setNewItemCallback(const NewItemCallback& callback);
+  // Whether an item may ever have been written to the container. Unlike
+  // getById(), this doesn't look up any history, but may give false positives.
+  bool mayContainItem(const map_api_common::Id& item_id) const;
+  void getItemFilter(internal::ItemIdFilter* filter) const;
 
   // ====
   // READ
@@ -76,6 +88,16 @@ class ChunkDataContainerBase {
                                              const LogicalTime& time) const;
   void findByRevision(int key, const Revision& valueHolder,
                       const LogicalTime& time, ConstRevisionMap* dest) const;
+  // Finds the items that match all conditions of "predicate" in one pass.
+  void find(const FieldPredicate& predicate, const LogicalTime& time,
+            ConstRevisionMap* dest) const;
+  typedef std::function<void(const std::shared_ptr<const Revision>& item)>
+      FoundAction;
+  // Streams the items that match "predicate" to "action" instead of
+  // collecting them. The container is locked meanwhile, so "action" must not
+  // access it.
+  void forEachFound(const FieldPredicate& predicate, const LogicalTime& time,
+                    const FoundAction& action) const;
 
   // ====
   // MISC
@@ -88,6 +110,7 @@ class ChunkDataContainerBase {
   int count(int key, const ValueType& value, const LogicalTime& time) const;
   virtual int countByRevision(int key, const Revision& valueHolder,
                               const LogicalTime& time) const final;
+  int count(const FieldPredicate& predicate, const LogicalTime& time) const;
   bool getLatestUpdateTime(const map_api_common::Id& id, LogicalTime* time);
   struct ItemDebugInfo {
     std::string table;
@@ -99,6 +122,15 @@ class ChunkDataContainerBase {
  protected:
   mutable std::mutex access_mutex_;
   std::shared_ptr<TableDescriptor> descriptor_;
+  NewItemCallback new_item_callback_;
+  internal::ItemIdFilter item_filter_;
+
+  // To be called with the container locked for items written for the first
+  // time. Adds them to the item filter and reports them to the callback. Once
+  // the filter is full, it is rebuilt from getKnownItemIdsImpl() with twice
+  // the capacity, which keeps its false positive rate bounded at an amortized
+  // constant cost per item.
+  void registerNewItem(const map_api_common::Id& item_id);
 
  private:
   /**
@@ -110,15 +142,24 @@ class ChunkDataContainerBase {
   virtual bool initImpl() = 0;
   virtual std::shared_ptr<const Revision> getByIdImpl(
       const map_api_common::Id& id, const LogicalTime& time) const = 0;
-  // If key is -1, this should return all the data in the table.
-  virtual void findByRevisionImpl(int key, const Revision& valueHolder,
-                                  const LogicalTime& time,
-                                  ConstRevisionMap* dest) const = 0;
+  // If the predicate is empty, this should return all the data in the table.
+  virtual void findByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time,
+                                   ConstRevisionMap* dest) const = 0;
+  virtual void forEachFoundImpl(const FieldPredicate& predicate,
+                                const LogicalTime& time,
+                                const FoundAction& action) const = 0;
   virtual void getAvailableIdsImpl(const LogicalTime& time,
                                    std::vector<map_api_common::Id>* ids) const = 0;
-  // If key is -1, this should return all the data in the table.
-  virtual int countByRevisionImpl(int key, const Revision& valueHolder,
-                                  const LogicalTime& time) const = 0;
+  // If the predicate is empty, this should count all the data in the table.
+  virtual int countByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time) const = 0;
+  // All items that have been registered as new, removed or not.
+  virtual void getKnownItemIdsImpl(
+      std::vector<map_api_common::Id>* ids) const = 0;
+
+  // Checks that the terms of "predicate" match the fields of the table.
+  void checkPredicate(const FieldPredicate& predicate) const;
 
   bool initialized_;
 };
@@ -22,6 +22,9 @@
 #ifndef MAP_API_CHUNK_MANAGER_H_
 #define MAP_API_CHUNK_MANAGER_H_
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
@@ -29,6 +32,7 @@
 
 #include <map-api-common/unique-id.h>
 #include "./net-table.pb.h"
+#include "map-api/spatial-index.h"
 
 namespace map_api {
 class ChunkBase;
@@ -101,5 +105,102 @@ class ChunkManagerChunkSize : public ChunkManagerBase {
   int current_chunk_size_bytes_;
 };
 
+// A chunk manager that sizes chunks according to how contended they are. Commit
+// rates are sampled from the commits applied to the chunks it created, and
+// conflict rates from their lock statistics. Chunks that are written to
+// frequently or see conflicts are closed early, so hot data is spread over
+// small chunks, while cold chunks are filled up to the full size.
+class ChunkManagerAdaptive : public ChunkManagerBase {
+ public:
+  struct Options {
+    Options();
+    // Size up to which cold chunks are filled.
+    int max_chunk_size_bytes;
+    // Size at which chunks are closed once they are hot.
+    int hot_chunk_size_bytes;
+    // Rates above which a chunk is considered hot.
+    double hot_commits_per_second;
+    double hot_conflicts_per_second;
+    // Rates are smoothed exponentially with this weight for new samples.
+    double rate_smoothing;
+    std::chrono::milliseconds sample_period;
+  };
+
+  ChunkManagerAdaptive(const Options& options,
+                       map_api::NetTable* underlying_table);
+  ~ChunkManagerAdaptive() {}
+
+  virtual ChunkBase* getChunkForItem(const Revision& revision);
+
+  // Lets the application account for conflicts that the lock statistics don't
+  // see, e.g. transactions that failed their conflict check on the chunk.
+  void reportConflict(const map_api_common::Id& chunk_id);
+
+  bool isHot(const map_api_common::Id& chunk_id) const;
+  double commitRate(const map_api_common::Id& chunk_id) const;
+  double conflictRate(const map_api_common::Id& chunk_id) const;
+
+ private:
+  struct ChunkActivity {
+    ChunkActivity();
+    int size_bytes;
+    uint64_t last_num_commits;
+    uint64_t last_num_conflicts;
+    uint64_t reported_conflicts;
+    double commits_per_second;
+    double conflicts_per_second;
+  };
+  typedef std::chrono::steady_clock Clock;
+
+  void sampleRates();
+  bool isHot(const ChunkActivity& activity) const;
+  void newChunk();
+
+  const Options options_;
+  std::unordered_map<map_api_common::Id, ChunkActivity> activity_;
+  ChunkBase* current_chunk_;
+  Clock::time_point last_sample_time_;
+};
+
+// A chunk manager that groups items by the spatial index cell that contains
+// the center of their bounding box, so that bounding box queries only fetch
+// chunks of the affected cells. Each cell fills one chunk at a time up to
+// max_chunk_size_bytes. Chunks are registered in the spatial index of the
+// underlying table for every cell their items overlap.
+class ChunkManagerSpatial : public ChunkManagerBase {
+ public:
+  typedef std::function<SpatialIndex::BoundingBox(const Revision& revision)>
+      BoundingBoxFunction;
+
+  // The spatial index of the underlying table must have been created or
+  // joined.
+  ChunkManagerSpatial(int max_chunk_size_bytes,
+                      const BoundingBoxFunction& bounding_box_of,
+                      map_api::NetTable* underlying_table);
+  ~ChunkManagerSpatial() {}
+
+  virtual ChunkBase* getChunkForItem(const Revision& revision);
+
+  inline size_t numCellsWithChunks() const { return cells_.size(); }
+
+ private:
+  struct CellChunk {
+    CellChunk() : chunk(nullptr), size_bytes(0) {}
+    ChunkBase* chunk;
+    int size_bytes;
+  };
+
+  void registerInSpace(ChunkBase* chunk,
+                       const SpatialIndex::BoundingBox& bounding_box);
+
+  int max_chunk_size_bytes_;
+  BoundingBoxFunction bounding_box_of_;
+  // Current chunk for each cell index.
+  std::unordered_map<size_t, CellChunk> cells_;
+  // Cells in which each chunk has been registered so far.
+  std::unordered_map<map_api_common::Id, std::unordered_set<size_t>>
+      registered_cells_;
+};
+
 }  // namespace map_api
 #endif  // MAP_API_CHUNK_MANAGER_H_
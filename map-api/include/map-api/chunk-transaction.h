@@ -33,6 +33,7 @@
 #include "map-api/internal/combined-view.h"
 #include "map-api/internal/commit-history-view.h"
 #include "map-api/internal/delta-view.h"
+#include "map-api/internal/history-watermark.h"
 #include "map-api/logical-time.h"
 #include "map-api/net-table.h"
 #include "map-api/revision.h"
@@ -97,6 +98,14 @@ class ChunkTransaction {
   // ======================
   bool commit();
   bool hasNoConflicts();
+  /**
+   * Checks write-locked transactions of different chunks on up to
+   * --map_api_commit_check_threads threads, so auto-merge policies may be
+   * called concurrently. Once a conflict has been found, checks that haven't
+   * started yet are skipped.
+   */
+  static bool haveNoConflicts(
+      const std::vector<ChunkTransaction*>& transactions);
   void checkedCommit(const LogicalTime& time);
   /**
    * Merging and changeCount are not compatible with conflict conditions.
@@ -123,7 +132,11 @@ class ChunkTransaction {
 
   ConflictVector conflict_conditions_;
 
+  const internal::HistoryWatermark::ScopedReader history_reader_;
   LogicalTime begin_time_;
+  // Set if the history of the chunk has been compacted past the begin time
+  // of the transaction, see ChunkBase::compactedUntil().
+  const bool reads_past_begin_time_;
 
   ChunkBase* chunk_;
   NetTable* table_;
@@ -0,0 +1,109 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MAP_API_FIELD_PREDICATE_INL_H_
+#define MAP_API_FIELD_PREDICATE_INL_H_
+
+#include <glog/logging.h>
+
+namespace map_api {
+
+template <typename ValueType>
+FieldPredicate& FieldPredicate::equals(int key, const ValueType& value) {
+  addEqualsTerm(key, toField(value));
+  return *this;
+}
+
+template <typename ValueType>
+FieldPredicate& FieldPredicate::inRange(int key, const ValueType& lower,
+                                        const ValueType& upper) {
+  addRangeTerm(key, toField(lower), toField(upper));
+  return *this;
+}
+
+template <typename ValueType>
+FieldPredicate& FieldPredicate::satisfies(
+    int key, const std::function<bool(const ValueType& value)>& condition) {
+  CHECK_GE(key, 0);
+  CHECK(condition);
+  Term term;
+  term.key = key;
+  term.type = TermType::kCondition;
+  term.value.set_type(Revision::getProtobufTypeEnum<ValueType>());
+  term.hash = 0u;
+  term.matches = [condition](const proto::TableField& stored) {
+    Revision converter;
+    ValueType value;
+    CHECK(converter.get(stored, &value));
+    return condition(value);
+  };
+  terms_.push_back(term);
+  return *this;
+}
+
+inline bool FieldPredicate::matches(const Revision& revision) const {
+  for (const Term& term : terms_) {
+    if (!term.matches(
+            revision.underlying_revision_->custom_field_values(term.key))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <>
+inline int32_t FieldPredicate::numericValue<int32_t>(
+    const proto::TableField& field) {
+  return field.int_value();
+}
+template <>
+inline uint32_t FieldPredicate::numericValue<uint32_t>(
+    const proto::TableField& field) {
+  return field.unsigned_int_value();
+}
+template <>
+inline int64_t FieldPredicate::numericValue<int64_t>(
+    const proto::TableField& field) {
+  return field.long_value();
+}
+template <>
+inline uint64_t FieldPredicate::numericValue<uint64_t>(
+    const proto::TableField& field) {
+  return field.unsigned_long_value();
+}
+template <>
+inline double FieldPredicate::numericValue<double>(
+    const proto::TableField& field) {
+  return field.double_value();
+}
+
+template <typename ValueType>
+proto::TableField FieldPredicate::toField(const ValueType& value) {
+  proto::TableField field;
+  field.set_type(Revision::getProtobufTypeEnum<ValueType>());
+  Revision converter;
+  CHECK(converter.set(&field, value));
+  return field;
+}
+
+}  // namespace map_api
+
+#endif  // MAP_API_FIELD_PREDICATE_INL_H_
@@ -0,0 +1,100 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MAP_API_FIELD_PREDICATE_H_
+#define MAP_API_FIELD_PREDICATE_H_
+
+#include <functional>
+#include <vector>
+
+#include "map-api/revision.h"
+#include "./core.pb.h"
+
+namespace map_api {
+
+/**
+ * Conjunction of conditions on the custom fields of a table. Each condition is
+ * compiled once, when it is added, to a test of the stored field value of its
+ * type, so matching revisions neither dispatches on the field type nor needs a
+ * value holder revision. An empty predicate matches all revisions.
+ */
+class FieldPredicate {
+ public:
+  enum class TermType {
+    kEquals,
+    kRange,
+    kCondition
+  };
+  typedef std::function<bool(const proto::TableField& stored)> FieldCondition;
+  struct Term {
+    int key;
+    TermType type;
+    // For kEquals the value and for kRange the lower bound, stored the way a
+    // revision would store them. Only the type is set for kCondition.
+    proto::TableField value;
+    // Upper bound of kRange.
+    proto::TableField upper;
+    // For kEquals, same as Revision::fieldHash() of a matching revision.
+    size_t hash;
+    FieldCondition matches;
+  };
+
+  // Adds the condition that field "key" equals "value".
+  template <typename ValueType>
+  FieldPredicate& equals(int key, const ValueType& value);
+  // Adds the condition that field "key" equals that of "value_holder".
+  FieldPredicate& equalsFieldOf(int key, const Revision& value_holder);
+  // Adds the condition lower <= field "key" <= upper. Only for fields stored
+  // as INT32, UINT32, INT64, UINT64 or DOUBLE, which includes LogicalTime.
+  template <typename ValueType>
+  FieldPredicate& inRange(int key, const ValueType& lower,
+                          const ValueType& upper);
+  // Adds the condition that "condition" holds for the value of field "key".
+  // Can't use an index, and reads the value for every item.
+  template <typename ValueType>
+  FieldPredicate& satisfies(
+      int key, const std::function<bool(const ValueType& value)>& condition);
+
+  inline bool matches(const Revision& revision) const;
+
+  inline bool empty() const { return terms_.empty(); }
+  inline const std::vector<Term>& terms() const { return terms_; }
+
+  static bool isNumeric(proto::Type type);
+  // NumberType must be the type the field is stored as.
+  template <typename NumberType>
+  static NumberType numericValue(const proto::TableField& field);
+
+ private:
+  template <typename ValueType>
+  static proto::TableField toField(const ValueType& value);
+  void addEqualsTerm(int key, const proto::TableField& value);
+  void addRangeTerm(int key, const proto::TableField& lower,
+                    const proto::TableField& upper);
+
+  std::vector<Term> terms_;
+};
+
+}  // namespace map_api
+
+#include "./field-predicate-inl.h"
+
+#endif  // MAP_API_FIELD_PREDICATE_H_
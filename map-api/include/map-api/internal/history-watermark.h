@@ -0,0 +1,78 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef INTERNAL_HISTORY_WATERMARK_H_
+#define INTERNAL_HISTORY_WATERMARK_H_
+
+#include <mutex>
+#include <set>
+
+#include "map-api/logical-time.h"
+
+namespace map_api {
+namespace internal {
+
+// Oldest logical time at which this peer may still read the history of an
+// item. Transactions register their begin time for as long as they live.
+// Revisions that have been superseded at or before the watermark can't be
+// observed any more and may be discarded by history compaction.
+class HistoryWatermark {
+ public:
+  // Registers a begin time for the lifetime of the object. Begin times below
+  // the watermark can't be read at any more and are moved up to it.
+  class ScopedReader {
+   public:
+    explicit ScopedReader(const LogicalTime& begin_time);
+    ~ScopedReader();
+
+    // The registered begin time, which readers must use.
+    const LogicalTime& beginTime() const { return begin_time_; }
+
+   private:
+    ScopedReader(const ScopedReader&) = delete;
+    ScopedReader& operator=(const ScopedReader&) = delete;
+
+    const LogicalTime begin_time_;
+  };
+
+  // Moves the watermark to the oldest registered begin time, but never past
+  // the time sampled at the previous call minus --map_api_history_retention.
+  // Lagging by one call leaves readers whose begin time was sampled just
+  // before registering a full compaction period to register. The watermark
+  // never decreases. Returns an invalid time while nothing may be compacted.
+  static LogicalTime advance();
+  static LogicalTime get();
+
+ private:
+  // Returns the registered time.
+  static LogicalTime registerReader(const LogicalTime& begin_time);
+  static void unregisterReader(const LogicalTime& begin_time);
+
+  static std::multiset<LogicalTime> readers_;
+  static LogicalTime watermark_;
+  static LogicalTime previous_sample_;
+  static std::mutex mutex_;
+};
+
+}  // namespace internal
+}  // namespace map_api
+
+#endif  // INTERNAL_HISTORY_WATERMARK_H_
@@ -0,0 +1,79 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef INTERNAL_ITEM_ID_FILTER_H_
+#define INTERNAL_ITEM_ID_FILTER_H_
+
+#include <vector>
+
+#include <map-api-common/unique-id.h>
+
+namespace map_api {
+namespace proto {
+class ItemIdFilter;
+}  // namespace proto
+
+namespace internal {
+
+// Bloom filter of item ids. Answers whether an item may have been added, with
+// no false negatives. Filters are dimensioned for a capacity of items such
+// that they have --map_api_item_filter_false_positive_rate false positives
+// when holding that many; past it, the rate grows quickly, so owners should
+// rebuild a full() filter with a larger capacity. Items can't be taken out
+// again, so removed items remain false positives until the filter is
+// cleared. Filters can only be merged if they have the same dimensions, which
+// is the case for filters of the same capacity.
+class ItemIdFilter {
+ public:
+  // Capacity of --map_api_item_filter_min_capacity.
+  ItemIdFilter();
+  explicit ItemIdFilter(size_t capacity);
+
+  void add(const map_api_common::Id& id);
+  bool mayContain(const map_api_common::Id& id) const;
+  bool hasSameDimensions(const ItemIdFilter& other) const;
+  // Adds all items of "other".
+  void merge(const ItemIdFilter& other);
+  void clear();
+  bool empty() const;
+  // Whether as many items have been added as the filter was dimensioned for.
+  // Not known for deserialized filters, which are never full.
+  bool full() const;
+  size_t capacity() const;
+
+  void serialize(proto::ItemIdFilter* proto) const;
+  void deserialize(const proto::ItemIdFilter& proto);
+
+ private:
+  // Calls "action" with the bit index of each hash of "id".
+  template <typename Action>
+  void forEachBit(const map_api_common::Id& id, const Action& action) const;
+
+  std::vector<uint64_t> words_;
+  size_t num_hashes_;
+  size_t capacity_;
+  size_t num_added_;
+};
+
+}  // namespace internal
+}  // namespace map_api
+
+#endif  // INTERNAL_ITEM_ID_FILTER_H_
@@ -0,0 +1,121 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef INTERNAL_LOCK_CONTENTION_STATISTICS_H_
+#define INTERNAL_LOCK_CONTENTION_STATISTICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace map_api {
+namespace internal {
+
+// Lock-free histogram of durations, bucketed in powers of two of
+// microseconds. Bucket i counts durations in [2^(i-1), 2^i) us, bucket 0
+// everything below 1 us and the last bucket everything above.
+class DurationHistogram {
+ public:
+  static constexpr size_t kNumBuckets = 24u;
+
+  DurationHistogram();
+
+  void add(const std::chrono::nanoseconds& duration);
+  void merge(const DurationHistogram& other);
+
+  uint64_t count() const;
+  uint64_t totalNanoseconds() const;
+  uint64_t maxNanoseconds() const;
+  uint64_t bucketCount(size_t bucket) const;
+  // Upper bound in microseconds of the bucket that contains the given
+  // quantile, e.g. 0.99 for the 99th percentile.
+  uint64_t quantileUpperBoundMicroseconds(double quantile) const;
+
+  // One-line summary: count, mean, p50, p99 and max.
+  std::string summary() const;
+  // Multi-line rendering of the non-empty buckets.
+  std::string toString() const;
+
+ private:
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> total_ns_;
+  std::atomic<uint64_t> max_ns_;
+};
+
+// Always-on telemetry of the distributed lock of a chunk. Updates are lock-free
+// so that recording does not add contention to the lock being measured.
+// Statistics of several chunks can be merged to obtain table-level figures.
+class LockContentionStatistics {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  LockContentionStatistics();
+
+  // Time from requesting a lock until it is acquired.
+  void recordReadWait(const Clock::duration& duration);
+  void recordWriteWait(const Clock::duration& duration);
+  // Time a lock was held, from acquisition until the last unlock.
+  void recordReadHold(const Clock::duration& duration);
+  void recordWriteHold(const Clock::duration& duration);
+  // A peer declined a write lock request.
+  void recordDecline();
+  // The arbitrating peer queued a write lock request.
+  void recordQueued();
+  // A write lock attempt had to be restarted after a decline.
+  void recordRetry();
+  // A lock was acquired recursively, reaching the given depth.
+  void recordRecursion(int depth);
+
+  void merge(const LockContentionStatistics& other);
+
+  const DurationHistogram& readWait() const { return read_wait_; }
+  const DurationHistogram& writeWait() const { return write_wait_; }
+  const DurationHistogram& readHold() const { return read_hold_; }
+  const DurationHistogram& writeHold() const { return write_hold_; }
+  uint64_t numDeclines() const { return declines_; }
+  uint64_t numQueued() const { return queued_; }
+  uint64_t numRetries() const { return retries_; }
+  uint64_t numRecursiveAcquisitions() const { return recursions_; }
+  int maxRecursionDepth() const { return max_recursion_depth_; }
+
+  // Total time spent waiting for the lock, used to rank chunks by contention.
+  uint64_t totalWaitNanoseconds() const;
+
+  std::string toString() const;
+
+ private:
+  DurationHistogram read_wait_;
+  DurationHistogram write_wait_;
+  DurationHistogram read_hold_;
+  DurationHistogram write_hold_;
+  std::atomic<uint64_t> declines_;
+  std::atomic<uint64_t> queued_;
+  std::atomic<uint64_t> retries_;
+  std::atomic<uint64_t> recursions_;
+  std::atomic<int> max_recursion_depth_;
+};
+
+}  // namespace internal
+}  // namespace map_api
+
+#endif  // INTERNAL_LOCK_CONTENTION_STATISTICS_H_
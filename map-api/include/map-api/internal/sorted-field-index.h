@@ -0,0 +1,110 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef INTERNAL_SORTED_FIELD_INDEX_H_
+#define INTERNAL_SORTED_FIELD_INDEX_H_
+
+#include <map>
+#include <memory>
+
+#include <map-api-common/unique-id.h>
+
+#include "map-api/field-predicate.h"
+#include "map-api/revision.h"
+#include "./core.pb.h"
+
+namespace map_api {
+namespace internal {
+
+// Ordered index of a numeric field. Like the hash index of a field, it maps
+// each value to the items that have had it in any of their revisions, so
+// lookups at past times stay correct when candidates are verified against the
+// revision valid at that time.
+class SortedFieldIndex {
+ public:
+  virtual ~SortedFieldIndex() {}
+  static std::unique_ptr<SortedFieldIndex> create(int key, proto::Type type);
+
+  virtual void add(const Revision& revision) = 0;
+  // Removes the item from the entry of the value "revision" has.
+  virtual void remove(const Revision& revision) = 0;
+  virtual void clear() = 0;
+  // Adds the items that have had a value within the bounds of the range term
+  // to "result".
+  virtual void getCandidates(const FieldPredicate::Term& range,
+                             map_api_common::IdSet* result) const = 0;
+};
+
+template <typename NumberType>
+class TypedSortedFieldIndex : public SortedFieldIndex {
+ public:
+  explicit TypedSortedFieldIndex(int key) : key_(key) {}
+
+  virtual void add(const Revision& revision) final override {
+    NumberType value;
+    revision.get(key_, &value);
+    index_[value].emplace(revision.getId<map_api_common::Id>());
+  }
+
+  virtual void remove(const Revision& revision) final override {
+    NumberType value;
+    revision.get(key_, &value);
+    typename Index::iterator found = index_.find(value);
+    if (found == index_.end()) {
+      return;
+    }
+    found->second.erase(revision.getId<map_api_common::Id>());
+    if (found->second.empty()) {
+      index_.erase(found);
+    }
+  }
+
+  virtual void clear() final override { index_.clear(); }
+
+  virtual void getCandidates(const FieldPredicate::Term& range,
+                             map_api_common::IdSet* result) const
+      final override {
+    CHECK_NOTNULL(result);
+    CHECK(range.type == FieldPredicate::TermType::kRange);
+    const NumberType lower =
+        FieldPredicate::numericValue<NumberType>(range.value);
+    const NumberType upper =
+        FieldPredicate::numericValue<NumberType>(range.upper);
+    if (upper < lower) {
+      return;
+    }
+    const typename Index::const_iterator end = index_.upper_bound(upper);
+    for (typename Index::const_iterator it = index_.lower_bound(lower);
+         it != end; ++it) {
+      result->insert(it->second.begin(), it->second.end());
+    }
+  }
+
+ private:
+  typedef std::map<NumberType, map_api_common::IdSet> Index;
+  const int key_;
+  Index index_;
+};
+
+}  // namespace internal
+}  // namespace map_api
+
+#endif  // INTERNAL_SORTED_FIELD_INDEX_H_
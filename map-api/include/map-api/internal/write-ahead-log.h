@@ -0,0 +1,120 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+#ifndef INTERNAL_WRITE_AHEAD_LOG_H_
+#define INTERNAL_WRITE_AHEAD_LOG_H_
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <map-api-common/unique-id.h>
+
+namespace map_api {
+class Revision;
+
+namespace internal {
+
+// Durable record of the revisions committed to or patched into the chunks of
+// this peer, such that they can be restored locally after a crash. The log is
+// split into segments "wal_<number>.log". A checkpoint "checkpoint_<number>"
+// holds the histories of all chunks as of the start of segment <number> and
+// replaces all older segments and checkpoints.
+// Records are buffered by append() and written and synced in groups: the
+// first thread calling sync() writes everything appended so far while the
+// others wait for it, so concurrent commits share one fdatasync().
+class WriteAheadLog {
+ public:
+  // Revisions in update time order, per chunk and table.
+  typedef std::unordered_map<map_api_common::Id,
+                             std::vector<std::shared_ptr<Revision> > >
+      ChunkRevisions;
+  typedef std::unordered_map<std::string, ChunkRevisions> TableRevisions;
+  typedef std::function<void(const std::string& table,
+                             const Revision& revision)> RevisionSink;
+
+  static WriteAheadLog& instance();
+  // True if --map_api_wal_directory is set.
+  static bool isEnabled();
+
+  // Reads the latest checkpoint and the segments that follow it. Revisions
+  // that appear more than once, i.e. both in a checkpoint and in a segment,
+  // are returned once. Chunks left before the end of the log are omitted.
+  static void recover(const std::string& directory, TableRevisions* result);
+
+  // Starts a new segment after those already in the directory.
+  void open(const std::string& directory);
+  void close();
+  bool isOpen() const;
+
+  // Return the sequence number to pass to sync(), or 0 if the log is closed.
+  uint64_t appendRevision(const std::string& table, const Revision& revision);
+  uint64_t appendLeave(const std::string& table,
+                       const map_api_common::Id& chunk_id);
+  // Blocks until all records up to and including the given one are durable.
+  void sync(uint64_t sequence);
+
+  // Starts a new segment, then writes the histories passed to the sink by
+  // "dump" to a checkpoint. Once the checkpoint is durable, older segments
+  // and checkpoints are deleted. Revisions committed while dumping may end up
+  // in both the checkpoint and the new segment.
+  void checkpoint(const std::function<void(const RevisionSink&)>& dump);
+
+  uint32_t currentSegment() const;
+  // Number of fdatasync() calls on segments so far.
+  uint64_t numFlushes() const;
+
+ private:
+  WriteAheadLog();
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+  ~WriteAheadLog();
+
+  uint64_t append(const std::string& serialized_record);
+  // Writes and syncs everything appended so far. Requires "lock" to hold
+  // mutex_, which it temporarily releases.
+  void flush(std::unique_lock<std::mutex>* lock);
+  void openSegment(uint32_t number);
+  void closeSegment();
+
+  std::string directory_;
+  int fd_;
+  uint32_t segment_;
+
+  // Records appended but not yet handed to a flush.
+  std::string buffer_;
+  uint64_t appended_;
+  uint64_t durable_;
+  bool flushing_;
+  uint64_t num_flushes_;
+  mutable std::mutex mutex_;
+  std::condition_variable flushed_;
+  // Serializes checkpoints.
+  std::mutex checkpoint_mutex_;
+};
+
+}  // namespace internal
+}  // namespace map_api
+
+#endif  // INTERNAL_WRITE_AHEAD_LOG_H_
@@ -0,0 +1,160 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MAP_API_LEGACY_CHUNK_DATA_COLUMNAR_CONTAINER_H_
+#define MAP_API_LEGACY_CHUNK_DATA_COLUMNAR_CONTAINER_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "map-api/legacy-chunk-data-container-base.h"
+
+namespace map_api {
+
+/**
+ * Stores revisions column-wise: every custom field of the table descriptor
+ * gets a typed array, indexed by row, and each revision is one row. Revision
+ * objects are only materialized for the rows that are returned. find and
+ * count compare the queried column as a whole, in loops over plain arrays
+ * that the compiler vectorizes for numeric fields.
+ */
+class LegacyChunkDataColumnarContainer : public LegacyChunkDataContainerBase {
+ public:
+  virtual ~LegacyChunkDataColumnarContainer();
+
+ private:
+  virtual bool initImpl() final override;
+  virtual bool insertImpl(const std::shared_ptr<const Revision>& query)
+      final override;
+  virtual bool bulkInsertImpl(const MutableRevisionMap& query) final override;
+  virtual bool patchImpl(const std::shared_ptr<const Revision>& query)
+      final override;
+  virtual std::shared_ptr<const Revision> getByIdImpl(
+      const map_api_common::Id& id, const LogicalTime& time) const final override;
+  virtual void findByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time,
+                                   ConstRevisionMap* dest) const final override;
+  virtual void forEachFoundImpl(const FieldPredicate& predicate,
+                                const LogicalTime& time,
+                                const FoundAction& action) const final override;
+  virtual int countByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time) const final override;
+  virtual void getAvailableIdsImpl(const LogicalTime& time,
+                                   std::vector<map_api_common::Id>* ids) const
+      final override;
+
+  virtual bool insertUpdatedImpl(const std::shared_ptr<Revision>& query)
+      final override;
+  virtual void findHistoryByRevisionImpl(int key, const Revision& valueHolder,
+                                         const LogicalTime& time,
+                                         HistoryMap* dest) const final override;
+  virtual void chunkHistory(const map_api_common::Id& chunk_id, const LogicalTime& time,
+                            HistoryMap* dest) const final override;
+  virtual void itemHistoryImpl(const map_api_common::Id& id, const LogicalTime& time,
+                               History* dest) const final override;
+  virtual void clearImpl() final override;
+  virtual size_t compactHistoryImpl(const LogicalTime& watermark)
+      final override;
+
+  typedef size_t Row;
+  // Rows of an item, ordered by update time.
+  typedef std::vector<Row> RowHistory;
+  typedef std::unordered_map<map_api_common::Id, RowHistory> RowHistoryMap;
+  static constexpr Row kNoRow = static_cast<Row>(-1);
+
+  class Column {
+   public:
+    explicit Column(proto::Type type);
+    void append(const proto::TableField& field);
+    void get(Row row, proto::TableField* field) const;
+    // Sets matches[row] to 1 for each row whose value equals the value of
+    // "field", and to 0 for the others.
+    void scanEquals(const proto::TableField& field,
+                    std::vector<uint8_t>* matches) const;
+    // Same for values between "lower" and "upper", inclusive. Numeric columns
+    // only.
+    void scanRange(const proto::TableField& lower,
+                   const proto::TableField& upper,
+                   std::vector<uint8_t>* matches) const;
+    // Same for values that fulfill "condition".
+    void scanCondition(const FieldPredicate::FieldCondition& condition,
+                       std::vector<uint8_t>* matches) const;
+    // Keeps the rows that "new_rows" doesn't map to kNoRow, at the row it
+    // maps them to.
+    void keepRows(const std::vector<Row>& new_rows, Row num_kept);
+    void clear();
+
+   private:
+    proto::Type type_;
+    std::vector<int32_t> int32_values_;
+    std::vector<uint32_t> uint32_values_;
+    std::vector<int64_t> int64_values_;
+    std::vector<uint64_t> uint64_values_;
+    std::vector<double> double_values_;
+    // HASH128 values, split into their two 64 bit halves.
+    std::vector<uint64_t> hash_first_values_;
+    std::vector<uint64_t> hash_second_values_;
+    std::vector<std::string> string_values_;
+    // Hash strings that don't survive the conversion to HashId unchanged.
+    std::unordered_map<Row, std::string> irregular_hashes_;
+    Row size_;
+  };
+
+  Row appendRow(const Revision& revision);
+  std::shared_ptr<const Revision> materialize(Row row) const;
+  void materializeHistory(const RowHistory& rows, const LogicalTime& time,
+                          History* dest) const;
+  // Returns kNoRow if the item didn't exist or was removed at "time".
+  Row latestRowAt(const RowHistory& rows, const LogicalTime& time) const;
+  // Calls action for all items that are present at "time" and match
+  // "predicate", with what "select" makes of their row. Each term of the
+  // predicate is evaluated on its column. Large containers are scanned, and
+  // their rows selected, in parallel.
+  template <typename Selected>
+  void forEachMatchingRowAtTime(
+      const FieldPredicate& predicate, const LogicalTime& time,
+      const std::function<Selected(Row row)>& select,
+      const std::function<void(const map_api_common::Id& id,
+                               const Selected& selected)>& action) const;
+
+  RowHistoryMap items_;
+  std::unordered_map<map_api_common::Id, map_api_common::IdSet> chunk_items_;
+
+  // Row metadata.
+  std::vector<map_api_common::Id> ids_;
+  std::vector<map_api_common::Id> chunk_ids_;
+  std::vector<uint64_t> insert_times_;
+  std::vector<uint64_t> update_times_;
+  std::vector<uint8_t> removed_;
+  // Chunk tracking is rare, so it is stored separately for the rows that
+  // have it.
+  std::unordered_map<Row, std::vector<proto::TableChunkTracking>>
+      chunk_tracking_;
+
+  std::vector<Column> columns_;
+};
+
+}  // namespace map_api
+
+#endif  // MAP_API_LEGACY_CHUNK_DATA_COLUMNAR_CONTAINER_H_
@@ -22,20 +22,39 @@
 #ifndef MAP_API_LEGACY_CHUNK_DATA_CONTAINER_BASE_INL_H_
 #define MAP_API_LEGACY_CHUNK_DATA_CONTAINER_BASE_INL_H_
 
+#include <algorithm>
+#include <mutex>
+#include <numeric>
+#include <utility>
+
+#include <map-api-common/thread-pool.h>
+
 namespace map_api {
 
 LegacyChunkDataContainerBase::History::const_iterator
 LegacyChunkDataContainerBase::History::latestAt(const LogicalTime& time) const {
-  for (const_iterator it = cbegin(); it != cend(); ++it) {
-    if ((*it)->getUpdateTime() <= time) {
-      if ((*it)->isRemoved()) {
-        return cend();
-      } else {
-        return it;
-      }
-    }
+  // The revision before the first one updated after "time" is the latest.
+  const value_type* const after = firstUpdatedAfter(time);
+  if (after == data() || (*(after - 1))->isRemoved()) {
+    return cend();
   }
-  return cend();
+  return const_iterator(after);
+}
+
+LegacyChunkDataContainerBase::History::View
+LegacyChunkDataContainerBase::History::at(const LogicalTime& time) const {
+  return View(const_iterator(firstUpdatedAfter(time)), cend());
+}
+
+const LegacyChunkDataContainerBase::History::value_type*
+LegacyChunkDataContainerBase::History::firstUpdatedAfter(
+    const LogicalTime& time) const {
+  const value_type* const first = data();
+  return std::upper_bound(
+      first, first + size(), time,
+      [](const LogicalTime& time, const value_type& revision) {
+        return time < revision->getUpdateTime();
+      });
 }
 
 template <typename IdType>
@@ -49,6 +68,20 @@ void LegacyChunkDataContainerBase::itemHistory(const IdType& id,
   itemHistoryImpl(map_api_id, time, dest);
 }
 
+template <typename IdType>
+void LegacyChunkDataContainerBase::visitItemHistory(
+    const IdType& id, const LogicalTime& time,
+    const HistoryVisitor& visitor) const {
+  map_api_common::Id map_api_id;
+  map_api_common::HashId hash_id;
+  id.toHashId(&hash_id);
+  map_api_id.fromHashId(hash_id);
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  CHECK(isInitialized()) << "Attempted to read from non-initialized table";
+  CHECK(visitor);
+  visitItemHistoryImpl(map_api_id, time, visitor);
+}
+
 template <typename ValueType>
 void LegacyChunkDataContainerBase::findHistory(int key, const ValueType& value,
                                                const LogicalTime& time,
@@ -60,6 +93,52 @@ void LegacyChunkDataContainerBase::findHistory(int key, const ValueType& value,
   return this->findHistoryByRevision(key, *valueHolder, time, dest);
 }
 
+template <typename MapType, typename Selected>
+void LegacyChunkDataContainerBase::scan(
+    const MapType& map,
+    const std::function<bool(const typename MapType::value_type& entry,
+                             Selected* selected)>& select,
+    const std::function<void(const map_api_common::Id& id,
+                             const Selected& selected)>& action) const {
+  const size_t num_threads = numScanThreads(map.size());
+  Selected selected;
+  if (num_threads <= 1u) {
+    for (const typename MapType::value_type& entry : map) {
+      if (select(entry, &selected)) {
+        action(entry.first, selected);
+      }
+    }
+    return;
+  }
+  // More ranges than threads even out the varying cost of the entries.
+  constexpr size_t kRangesPerThread = 4u;
+  const size_t num_ranges = num_threads * kRangesPerThread;
+  const size_t num_buckets = map.bucket_count();
+  typedef std::vector<std::pair<const map_api_common::Id*, Selected> > Buffer;
+  std::vector<Buffer> buffers(num_ranges);
+  std::vector<size_t> ranges(num_ranges);
+  std::iota(ranges.begin(), ranges.end(), 0u);
+  map_api_common::parallelForEach(
+      num_threads, ranges, [&](const size_t range) {
+        Buffer& buffer = buffers[range];
+        Selected range_selected;
+        for (size_t bucket = num_buckets * range / num_ranges;
+             bucket < num_buckets * (range + 1u) / num_ranges; ++bucket) {
+          for (typename MapType::const_local_iterator it = map.begin(bucket);
+               it != map.end(bucket); ++it) {
+            if (select(*it, &range_selected)) {
+              buffer.emplace_back(&it->first, std::move(range_selected));
+            }
+          }
+        }
+      });
+  for (const Buffer& buffer : buffers) {
+    for (const typename Buffer::value_type& entry : buffer) {
+      action(*entry.first, entry.second);
+    }
+  }
+}
+
 template <typename IdType>
 void LegacyChunkDataContainerBase::remove(const LogicalTime& time,
                                           const IdType& id) {
@@ -22,7 +22,10 @@
 #ifndef MAP_API_LEGACY_CHUNK_DATA_CONTAINER_BASE_H_
 #define MAP_API_LEGACY_CHUNK_DATA_CONTAINER_BASE_H_
 
-#include <list>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "map-api/chunk-data-container-base.h"
@@ -60,10 +63,88 @@ class LegacyChunkDataContainerBase : public ChunkDataContainerBase {
    */
   virtual bool patch(const std::shared_ptr<const Revision>& revision) final;
 
-  class History : public std::list<std::shared_ptr<const Revision> > {
+  /**
+   * Revisions of an item, iterated from the latest to the oldest. Stored
+   * contiguously in update time order, with the first revision inline, since
+   * most items are never updated.
+   */
+  class History {
    public:
+    typedef std::shared_ptr<const Revision> value_type;
+    typedef std::reverse_iterator<value_type*> iterator;
+    typedef std::reverse_iterator<const value_type*> const_iterator;
+
+    /**
+     * The revisions of a history that had been updated at a given time,
+     * iterated from the latest like the history itself. Refers to the
+     * revisions in place, so it is only valid as long as the history is
+     * neither modified nor destroyed.
+     */
+    class View {
+     public:
+      inline View(const const_iterator& begin, const const_iterator& end)
+          : begin_(begin), end_(end) {}
+
+      inline const_iterator begin() const { return begin_; }
+      inline const_iterator end() const { return end_; }
+      inline size_t size() const { return end_ - begin_; }
+      inline bool empty() const { return begin_ == end_; }
+
+     private:
+      const_iterator begin_;
+      const_iterator end_;
+    };
+
     virtual ~History();
+
+    inline iterator begin() { return iterator(data() + size()); }
+    inline iterator end() { return iterator(data()); }
+    inline const_iterator begin() const { return cbegin(); }
+    inline const_iterator end() const { return cend(); }
+    inline const_iterator cbegin() const {
+      return const_iterator(data() + size());
+    }
+    inline const_iterator cend() const { return const_iterator(data()); }
+
+    inline size_t size() const {
+      return older_.empty() ? (oldest_ ? 1u : 0u) : older_.size();
+    }
+    inline bool empty() const { return size() == 0u; }
+    void clear();
+
+    /**
+     * Places the revision according to its update time, which must differ
+     * from the update times of the revisions already in the history.
+     * Returns false if the revision is not the latest.
+     */
+    bool insert(const value_type& revision);
+    // Removes all revisions that have been updated after the given time.
+    void trimToTime(const LogicalTime& time);
+    // Removes the revisions that have been superseded at or before the given
+    // time. Returns the summed byte size of the removed revisions.
+    size_t discardSupersededAt(const LogicalTime& time);
+    // Binary search for the revision valid at the given time; cend() if the
+    // item didn't exist or was removed at that time.
     inline const_iterator latestAt(const LogicalTime& time) const;
+    // The history as trimToTime(time) would leave it, without copying it.
+    inline View at(const LogicalTime& time) const;
+    // Replaces the contents with copies of the pointers in the view.
+    void assign(const View& view);
+
+   private:
+    // First revision, in update time order, updated after the given time.
+    inline const value_type* firstUpdatedAfter(const LogicalTime& time) const;
+    inline value_type* data() {
+      return older_.empty() ? &oldest_ : older_.data();
+    }
+    inline const value_type* data() const {
+      return older_.empty() ? &oldest_ : older_.data();
+    }
+
+    // Holds the revision if there is only one. Otherwise, all revisions are
+    // in "older_", oldest first.
+    value_type oldest_;
+    std::vector<value_type> older_;
   };
 
   // ============
@@ -80,6 +161,31 @@ class LegacyChunkDataContainerBase : public ChunkDataContainerBase {
                                      const LogicalTime& time,
                                      HistoryMap* dest) const final;
 
+  // =====================
+  // READ HISTORY IN PLACE
+  // =====================
+  /**
+   * Snapshot flavors of the above: Each history is passed to the visitor as
+   * a view bounded at "time" rather than being copied and trimmed. The
+   * container is locked for the duration of the call, so the visitor must
+   * not access it, and a view must not be used after the visitor has
+   * returned. As with the copying flavors, items inserted after "time" are
+   * visited with an empty view. Implementations that don't keep the
+   * histories in memory fall back to copying them.
+   */
+  typedef std::function<void(const map_api_common::Id& id,
+                             const History::View& history)> HistoryVisitor;
+  template <typename IdType>
+  void visitItemHistory(const IdType& id, const LogicalTime& time,
+                        const HistoryVisitor& visitor) const;
+  // Filters by the latest state of the items, like findHistoryByRevision().
+  void forEachHistory(int key, const Revision& value_holder,
+                      const LogicalTime& time,
+                      const HistoryVisitor& visitor) const;
+  void forEachChunkHistory(const map_api_common::Id& chunk_id,
+                           const LogicalTime& time,
+                           const HistoryVisitor& visitor) const;
+
   // ======
   // UPDATE
   // ======
@@ -99,22 +205,87 @@ class LegacyChunkDataContainerBase : public ChunkDataContainerBase {
   void remove(const LogicalTime& time, const IdType& id);
   void clear();
 
+  // =======
+  // COMPACT
+  // =======
+  /**
+   * Discards the revisions that no reader at or after "watermark" can observe.
+   * The revision valid at the watermark is kept even if it marks the item as
+   * removed, as conflict checking relies on the latest update time of each
+   * item. Returns the byte size of the discarded revisions.
+   */
+  size_t compactHistory(const LogicalTime& watermark);
+
+  // ======
+  // COUNTS
+  // ======
+  /**
+   * Number and summed byte size of the items that exist at "time". These are
+   * maintained on every write, so this takes constant time, but is only
+   * possible for times at or after the latest update in the container.
+   * Returns false for earlier times.
+   */
+  bool countsAt(const LogicalTime& time, size_t* num_items,
+                size_t* size_bytes) const;
+
+ protected:
+  // Recomputes the counts, for implementations that load revisions without
+  // passing through the write functions. "for_each_latest" is to pass the
+  // metadata of the latest revision of each item to its argument, such that
+  // no revision needs to be decoded.
+  typedef std::function<void(const map_api_common::Id& id,
+                             const LogicalTime& update_time, bool removed,
+                             int byte_size)> LatestRevisionAction;
+  void recount(const std::function<void(const LatestRevisionAction&)>&
+                   for_each_latest);
+
+  // ====
+  // SCAN
+  // ====
+  /**
+   * Passes each entry of "map" to "select" and, if it returns true, what it
+   * selected to "action". Maps with at least --map_api_parallel_scan_threshold
+   * entries are split into ranges of buckets that "select" processes on
+   * several threads, so it must be safe to call concurrently. Each range
+   * buffers its selection, and the buffers are passed to "action" on the
+   * calling thread once all ranges have been scanned.
+   */
+  template <typename MapType, typename Selected>
+  void scan(const MapType& map,
+            const std::function<bool(const typename MapType::value_type& entry,
+                                     Selected* selected)>& select,
+            const std::function<void(const map_api_common::Id& id,
+                                     const Selected& selected)>& action) const;
+
  private:
+  // Threads to scan a map of the given size with, 1 for a serial scan.
+  static size_t numScanThreads(size_t map_size);
+
+  // Updates the counts with a revision that has been written. Also registers
+  // items that haven't been seen before, see registerNewItem().
+  void countWritten(const Revision& revision);
+  void countWritten(const map_api_common::Id& id,
+                    const LogicalTime& update_time, bool removed,
+                    int byte_size);
+
   // =====================================
   // READ OPERATIONS INHERITED FROM PARENT
   // =====================================
   virtual bool initImpl() = 0;
   virtual std::shared_ptr<const Revision> getByIdImpl(
       const map_api_common::Id& id, const LogicalTime& time) const = 0;
-  // If key is -1, this should return all the data in the table.
-  virtual void findByRevisionImpl(int key, const Revision& valueHolder,
-                                  const LogicalTime& time,
-                                  ConstRevisionMap* dest) const = 0;
+  // If the predicate is empty, this should return all the data in the table.
+  virtual void findByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time,
+                                   ConstRevisionMap* dest) const = 0;
+  virtual void forEachFoundImpl(const FieldPredicate& predicate,
+                                const LogicalTime& time,
+                                const FoundAction& action) const = 0;
   virtual void getAvailableIdsImpl(const LogicalTime& time,
                                    std::vector<map_api_common::Id>* ids) const = 0;
-  // If key is -1, this should return all the data in the table.
-  virtual int countByRevisionImpl(int key, const Revision& valueHolder,
-                                  const LogicalTime& time) const = 0;
+  // If the predicate is empty, this should count all the data in the table.
+  virtual int countByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time) const = 0;
 
   // ======================================
   // LEGACY-CHUNK-SPECIFIC WRITE OPERATIONS
@@ -133,8 +304,34 @@ class LegacyChunkDataContainerBase : public ChunkDataContainerBase {
                             HistoryMap* dest) const = 0;
   virtual void itemHistoryImpl(const map_api_common::Id& id, const LogicalTime& time,
                                History* dest) const = 0;
+  // The default implementations visit copies obtained from the above.
+  virtual void visitItemHistoryImpl(const map_api_common::Id& id,
+                                    const LogicalTime& time,
+                                    const HistoryVisitor& visitor) const;
+  virtual void forEachHistoryImpl(int key, const Revision& value_holder,
+                                  const LogicalTime& time,
+                                  const HistoryVisitor& visitor) const;
+  virtual void forEachChunkHistoryImpl(const map_api_common::Id& chunk_id,
+                                       const LogicalTime& time,
+                                       const HistoryVisitor& visitor) const;
   virtual bool insertUpdatedImpl(const std::shared_ptr<Revision>& query) = 0;
   virtual void clearImpl() = 0;
+  virtual size_t compactHistoryImpl(const LogicalTime& watermark) = 0;
+  virtual void getKnownItemIdsImpl(
+      std::vector<map_api_common::Id>* ids) const final;
+
+  // What the counts know about the latest revision of an item, such that
+  // revisions patched in out of order are told apart and a superseded
+  // revision can be discounted without reading it back.
+  struct LatestRevision {
+    LogicalTime update_time;
+    int byte_size;
+    bool removed;
+  };
+  std::unordered_map<map_api_common::Id, LatestRevision> latest_revisions_;
+  size_t num_items_ = 0u;
+  size_t items_size_bytes_ = 0u;
+  LogicalTime latest_counted_time_;
 };
 
 }  // namespace map_api
@@ -0,0 +1,223 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MAP_API_LEGACY_CHUNK_DATA_LOG_CONTAINER_H_
+#define MAP_API_LEGACY_CHUNK_DATA_LOG_CONTAINER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "map-api/legacy-chunk-data-container-base.h"
+
+namespace map_api {
+
+/**
+ * Persists revisions in an append-only log of memory-mapped segment files in
+ * a directory of its own. Only the location and the metadata of each record
+ * are held in memory; revisions are decoded straight from the mapping when
+ * they are read.
+ *
+ * Segments are sealed when they are full, at which point the record headers
+ * are also written to an index file next to the segment. Reopening the log
+ * thus reads the index files of the sealed segments and only scans the records
+ * of the last one, without decoding any revision. Records dropped by history
+ * compaction stay in the log until their segment is rewritten, which happens
+ * once the live records take up less than --map_api_log_compaction_threshold
+ * of a sealed segment.
+ */
+class LegacyChunkDataLogContainer : public LegacyChunkDataContainerBase {
+ public:
+  // Log in a fresh directory below --map_api_log_container_directory, which
+  // is deleted with the container.
+  LegacyChunkDataLogContainer();
+  // Persistent log in the given directory. An existing log is reopened by
+  // init(), which dies if the log is already open in this or another
+  // process.
+  explicit LegacyChunkDataLogContainer(const std::string& directory);
+  virtual ~LegacyChunkDataLogContainer();
+
+  // Directory of the persistent log of the given chunk, below the directory
+  // of this peer, see --map_api_log_container_peer_name.
+  static std::string chunkDirectory(const std::string& table_name,
+                                    const map_api_common::Id& chunk_id);
+  // Chunks of the given table that have a persistent log.
+  static void persistedChunks(const std::string& table_name,
+                              std::vector<map_api_common::Id>* chunk_ids);
+
+  // Rewrites the sealed segments that are mostly taken up by discarded
+  // records. Returns the number of bytes freed on disk.
+  size_t compactSegments();
+
+  size_t numSegments() const;
+  size_t numLogBytes() const;
+  // Latest update time of any revision in the log, invalid if empty.
+  LogicalTime latestUpdateTime() const;
+
+ private:
+  virtual bool initImpl() final override;
+  virtual bool insertImpl(const std::shared_ptr<const Revision>& query)
+      final override;
+  virtual bool bulkInsertImpl(const MutableRevisionMap& query) final override;
+  virtual bool patchImpl(const std::shared_ptr<const Revision>& query)
+      final override;
+  virtual std::shared_ptr<const Revision> getByIdImpl(
+      const map_api_common::Id& id, const LogicalTime& time) const final override;
+  virtual void findByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time,
+                                   ConstRevisionMap* dest) const final override;
+  virtual void forEachFoundImpl(const FieldPredicate& predicate,
+                                const LogicalTime& time,
+                                const FoundAction& action) const final override;
+  virtual int countByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time) const final override;
+  virtual void getAvailableIdsImpl(const LogicalTime& time,
+                                   std::vector<map_api_common::Id>* ids) const
+      final override;
+  virtual bool insertUpdatedImpl(const std::shared_ptr<Revision>& query)
+      final override;
+  virtual void findHistoryByRevisionImpl(int key, const Revision& valueHolder,
+                                         const LogicalTime& time,
+                                         HistoryMap* dest) const final override;
+  virtual void chunkHistory(const map_api_common::Id& chunk_id, const LogicalTime& time,
+                            HistoryMap* dest) const final override;
+  virtual void itemHistoryImpl(const map_api_common::Id& id, const LogicalTime& time,
+                               History* dest) const final override;
+  virtual void clearImpl() final override;
+  // Also records the watermark in the log, so that the discarded records are
+  // not revived on reopen, and compacts the segments.
+  virtual size_t compactHistoryImpl(const LogicalTime& watermark)
+      final override;
+
+  struct Segment;
+  struct RecordLocation {
+    uint32_t segment_;
+    uint32_t offset_;
+    // Size of the record including header and padding.
+    uint32_t size_;
+    bool is_removed_;
+    LogicalTime update_time_;
+  };
+  // Record locations of an item, oldest first, such that the record valid at
+  // a given time is found by binary search, like in History.
+  class LogHistory {
+   public:
+    typedef std::vector<RecordLocation>::const_iterator const_iterator;
+
+    inline const_iterator begin() const { return locations_.cbegin(); }
+    inline const_iterator end() const { return locations_.cend(); }
+    inline size_t size() const { return locations_.size(); }
+    inline bool empty() const { return locations_.empty(); }
+    inline const RecordLocation& latest() const { return locations_.back(); }
+    // The record valid at "time", removed or not, or nullptr if the item
+    // hadn't been written at "time".
+    inline const RecordLocation* latestAt(const LogicalTime& time) const {
+      const std::vector<RecordLocation>::const_iterator after =
+          firstUpdatedAfter(time);
+      return after == locations_.cbegin() ? nullptr : &*(after - 1);
+    }
+    // The record with the given update time, or nullptr.
+    RecordLocation* find(const LogicalTime& update_time);
+    // Places the location according to its update time. If there already is
+    // a record with the same update time, it is replaced and passed to
+    // "replaced", and false is returned.
+    bool insert(const RecordLocation& location, RecordLocation* replaced);
+    // Removes the records that have been superseded at or before the given
+    // time, calling "discard" on each.
+    void discardSupersededAt(
+        const LogicalTime& time,
+        const std::function<void(const RecordLocation&)>& discard);
+
+    map_api_common::Id chunk_id_;
+
+   private:
+    inline std::vector<RecordLocation>::const_iterator firstUpdatedAfter(
+        const LogicalTime& time) const {
+      return std::upper_bound(
+          locations_.cbegin(), locations_.cend(), time,
+          [](const LogicalTime& time, const RecordLocation& location) {
+            return time < location.update_time_;
+          });
+    }
+
+    std::vector<RecordLocation> locations_;
+  };
+  typedef std::unordered_map<map_api_common::Id, LogHistory> LogHistoryMap;
+  typedef std::map<uint32_t, std::unique_ptr<Segment>> SegmentMap;
+
+  // Serializes the revision into the active segment and indexes it.
+  void append(const Revision& revision);
+  void appendWatermark(const LogicalTime& watermark);
+  // Returns "record_size" bytes at the end of the active segment, sealing it
+  // and starting a new one if it is full.
+  char* allocateRecord(size_t record_size, RecordLocation* location);
+  // Returns false if the item already had a record with the same update time,
+  // which is then replaced.
+  bool index(const map_api_common::Id& id, const map_api_common::Id& chunk_id,
+             const RecordLocation& location);
+  std::shared_ptr<const Revision> read(const RecordLocation& location) const;
+  // Byte size of the revision in the record, without decoding it.
+  uint32_t payloadSize(const RecordLocation& location) const;
+  void discardRecord(const RecordLocation& location);
+  size_t discardSupersededAt(const LogicalTime& watermark);
+  size_t compactSegmentsLocked();
+
+  std::string segmentPath(uint32_t number, const char* extension) const;
+  // Maps the segment file, grown to at least "min_capacity". Returns nullptr
+  // for an empty file.
+  Segment* mapSegment(uint32_t number, bool create, size_t min_capacity);
+  // Indexes the records of the segment, from its index file if "use_index"
+  // and the index is complete, otherwise by scanning and verifying the
+  // records. Returns false if the segment holds no valid record.
+  bool loadSegment(Segment* segment, bool use_index);
+  void sealSegment(Segment* segment);
+  void deleteSegment(uint32_t number);
+
+  inline void forEachItemFoundAtTime(
+      const FieldPredicate& predicate, const LogicalTime& time,
+      const std::function<void(const map_api_common::Id& id,
+                               const Revision::ConstPtr& item)>& action) const;
+  inline void trimToTime(const LogicalTime& time, HistoryMap* subject) const;
+  inline void collectHistory(const LogHistory& log_history,
+                             History* history) const;
+
+  const std::string directory_;
+  const bool is_temporary_;
+  // Held open, and locked, from init() on.
+  int directory_fd_;
+
+  LogHistoryMap data_;
+  SegmentMap segments_;
+  Segment* active_segment_;
+  LogicalTime compaction_watermark_;
+  LogicalTime latest_update_time_;
+};
+
+}  // namespace map_api
+
+#include "map-api/legacy-chunk-data-container-base-inl.h"
+
+#endif  // MAP_API_LEGACY_CHUNK_DATA_LOG_CONTAINER_H_
@@ -22,8 +22,11 @@
 #ifndef MAP_API_LEGACY_CHUNK_DATA_RAM_CONTAINER_H_
 #define MAP_API_LEGACY_CHUNK_DATA_RAM_CONTAINER_H_
 
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
+#include "map-api/internal/sorted-field-index.h"
 #include "map-api/legacy-chunk-data-container-base.h"
 
 namespace map_api {
@@ -41,11 +44,14 @@ class LegacyChunkDataRamContainer : public LegacyChunkDataContainerBase {
       final override;
   virtual std::shared_ptr<const Revision> getByIdImpl(
       const map_api_common::Id& id, const LogicalTime& time) const final override;
-  virtual void findByRevisionImpl(int key, const Revision& valueHolder,
-                                  const LogicalTime& time,
-                                  ConstRevisionMap* dest) const final override;
-  virtual int countByRevisionImpl(int key, const Revision& valueHolder,
-                                  const LogicalTime& time) const final override;
+  virtual void findByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time,
+                                   ConstRevisionMap* dest) const final override;
+  virtual void forEachFoundImpl(const FieldPredicate& predicate,
+                                const LogicalTime& time,
+                                const FoundAction& action) const final override;
+  virtual int countByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time) const final override;
   virtual void getAvailableIdsImpl(const LogicalTime& time,
                                    std::vector<map_api_common::Id>* ids) const
       final override;
@@ -59,10 +65,24 @@ class LegacyChunkDataRamContainer : public LegacyChunkDataContainerBase {
                             HistoryMap* dest) const final override;
   virtual void itemHistoryImpl(const map_api_common::Id& id, const LogicalTime& time,
                                History* dest) const final override;
+  virtual void visitItemHistoryImpl(const map_api_common::Id& id,
+                                    const LogicalTime& time,
+                                    const HistoryVisitor& visitor) const
+      final override;
+  virtual void forEachHistoryImpl(int key, const Revision& value_holder,
+                                  const LogicalTime& time,
+                                  const HistoryVisitor& visitor) const
+      final override;
+  virtual void forEachChunkHistoryImpl(const map_api_common::Id& chunk_id,
+                                       const LogicalTime& time,
+                                       const HistoryVisitor& visitor) const
+      final override;
   virtual void clearImpl() final override;
+  virtual size_t compactHistoryImpl(const LogicalTime& watermark)
+      final override;
 
   inline void forEachItemFoundAtTime(
-      int key, const Revision& value_holder, const LogicalTime& time,
+      const FieldPredicate& predicate, const LogicalTime& time,
       const std::function<void(const map_api_common::Id& id,
                                const std::shared_ptr<const Revision>& item)>&
           action) const;
@@ -71,9 +91,35 @@ class LegacyChunkDataRamContainer : public LegacyChunkDataContainerBase {
       const std::function<void(const map_api_common::Id& id,
                                const std::shared_ptr<const Revision>& item)>&
           action) const;
-  inline void trimToTime(const LogicalTime& time, HistoryMap* subject) const;
+
+  // Candidates from the hash index of the first equality term in "predicate"
+  // that has one, else from the sorted index of the first such range term,
+  // which are collected in "range_candidates". Returns nullptr if no term can
+  // use an index.
+  inline const map_api_common::IdSet* indexCandidates(
+      const FieldPredicate& predicate,
+      map_api_common::IdSet* range_candidates) const;
+  inline void indexRevision(const Revision& revision);
+  // Removes the item from the index entries of the given discarded revisions
+  // that no remaining revision shares.
+  void unindexDiscarded(const map_api_common::Id& id,
+                        const std::vector<Revision::ConstPtr>& discarded,
+                        const History& remaining);
 
   HistoryMap data_;
+
+  // Items by chunk. An item never changes its chunk, so this is maintained
+  // whenever a new item id enters "data_".
+  std::unordered_map<map_api_common::Id, map_api_common::IdSet> chunk_items_;
+
+  // For each field indexed in the table descriptor, maps value hashes to the
+  // items that have had a value with that hash in any of their revisions.
+  // This keeps lookups at past times correct; candidates are verified
+  // against the revision valid at the requested time.
+  typedef std::unordered_map<size_t, map_api_common::IdSet> FieldIndex;
+  std::unordered_map<int, FieldIndex> field_indices_;
+  std::unordered_map<int, std::unique_ptr<internal::SortedFieldIndex>>
+      sorted_indices_;
 };
 
 }  // namespace map_api
@@ -23,6 +23,7 @@
 #define MAP_API_LEGACY_CHUNK_DATA_STXXL_CONTAINER_H_
 
 #include <list>
+#include <utility>
 #include <vector>
 
 #include "map-api/legacy-chunk-data-container-base.h"
@@ -35,6 +36,10 @@ class LegacyChunkDataStxxlContainer : public LegacyChunkDataContainerBase {
   LegacyChunkDataStxxlContainer();
   virtual ~LegacyChunkDataStxxlContainer();
 
+  // Statistics of the decoded revision cache, since the last clear().
+  size_t numRevisionCacheHits() const;
+  size_t numRevisionCacheMisses() const;
+
  private:
   virtual bool initImpl() final override;
   virtual bool insertImpl(const std::shared_ptr<const Revision>& query)
@@ -44,11 +49,14 @@ class LegacyChunkDataStxxlContainer : public LegacyChunkDataContainerBase {
       final override;
   virtual std::shared_ptr<const Revision> getByIdImpl(
       const map_api_common::Id& id, const LogicalTime& time) const final override;
-  virtual void findByRevisionImpl(int key, const Revision& valueHolder,
-                                  const LogicalTime& time,
-                                  ConstRevisionMap* dest) const final override;
-  virtual int countByRevisionImpl(int key, const Revision& valueHolder,
-                                  const LogicalTime& time) const final override;
+  virtual void findByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time,
+                                   ConstRevisionMap* dest) const final override;
+  virtual void forEachFoundImpl(const FieldPredicate& predicate,
+                                const LogicalTime& time,
+                                const FoundAction& action) const final override;
+  virtual int countByPredicateImpl(const FieldPredicate& predicate,
+                                   const LogicalTime& time) const final override;
   virtual void getAvailableIdsImpl(const LogicalTime& time,
                                    std::vector<map_api_common::Id>* ids) const
       final override;
@@ -62,9 +70,14 @@ class LegacyChunkDataStxxlContainer : public LegacyChunkDataContainerBase {
   virtual void itemHistoryImpl(const map_api_common::Id& id, const LogicalTime& time,
                                History* dest) const final override;
   virtual void clearImpl() final override;
+  // Only the in-memory history entries are discarded, and only their size is
+  // reported: the revision store is append-only and keeps the serialized
+  // revisions.
+  virtual size_t compactHistoryImpl(const LogicalTime& watermark)
+      final override;
 
   inline void forEachItemFoundAtTime(
-      int key, const Revision& value_holder, const LogicalTime& time,
+      const FieldPredicate& predicate, const LogicalTime& time,
       const std::function<void(const map_api_common::Id& id,
                                const Revision::ConstPtr& item)>& action) const;
   inline void forChunkItemsAtTime(
@@ -73,6 +86,15 @@ class LegacyChunkDataStxxlContainer : public LegacyChunkDataContainerBase {
                                const Revision::ConstPtr& item)>& action) const;
   inline void trimToTime(const LogicalTime& time, HistoryMap* subject) const;
 
+  typedef std::pair<const map_api_common::Id*, const CRURevisionInformation*>
+      RevisionLocation;
+  // Retrieves the revisions in block order, a batch at a time, such that
+  // scans read the block pool forward. Sorts "locations".
+  inline void retrieveInBlockOrder(
+      std::vector<RevisionLocation>* locations,
+      const std::function<void(const map_api_common::Id& id,
+                               const Revision::ConstPtr& item)>& action) const;
+
   class STXXLHistory : public std::list<CRURevisionInformation> {
    public:
     inline const_iterator latestAt(const LogicalTime& time) const {
@@ -88,6 +110,10 @@ class LegacyChunkDataStxxlContainer : public LegacyChunkDataContainerBase {
   STXXLHistoryMap data_;
 
   static constexpr int kBlockSize = kSTXXLDefaultBlockSize;
+  // Bounds the decoded revisions held at once by scans.
+  static constexpr size_t kRetrievalBatchSize = 1024u;
+  // Declared before the store, which counts into it.
+  RevisionCacheStatistics revision_cache_statistics_;
   std::unique_ptr<STXXLRevisionStore<kBlockSize>> revision_store_;
 };
 
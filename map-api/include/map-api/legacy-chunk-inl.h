@@ -37,6 +37,8 @@ inline void LegacyChunk::syncLatestCommitTime(const Revision& item) {
   LogicalTime commit_time = item.getModificationTime();
   if (commit_time > latest_commit_time_) {
     latest_commit_time_ = commit_time;
+    // All items of a commit share its time.
+    ++num_commits_;
   }
 }
 
@@ -22,7 +22,9 @@
 #ifndef MAP_API_LEGACY_CHUNK_H_
 #define MAP_API_LEGACY_CHUNK_H_
 
+#include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <set>
@@ -85,8 +87,15 @@ class LegacyChunk : public ChunkBase {
   virtual void initializeNewImpl(
       const map_api_common::Id& id,
       const std::shared_ptr<TableDescriptor>& descriptor) override;
+  // If the request is a delta, i.e. has delta_since set, it is patched on top
+  // of the revisions recovered from the write-ahead log.
   bool init(const map_api_common::Id& id, const proto::InitRequest& request,
-            const PeerId& sender, std::shared_ptr<TableDescriptor> descriptor);
+            const PeerId& sender, std::shared_ptr<TableDescriptor> descriptor,
+            const std::vector<std::shared_ptr<Revision> >& recovered);
+  // Restores a chunk that no other peer holds from the write-ahead log.
+  bool init(const map_api_common::Id& id,
+            const std::vector<std::shared_ptr<Revision> >& recovered,
+            std::shared_ptr<TableDescriptor> descriptor);
 
   virtual void dumpItems(const LogicalTime& time, ConstRevisionMap* items) const
       override;
@@ -102,14 +111,14 @@ class LegacyChunk : public ChunkBase {
 
   virtual int peerSize() const override;
 
-  void enableLockLogging();
-
   // Non-const intended to avoid accidental write-lock while reading.
   virtual void writeLock() override;
 
   virtual void readLock() const override;
 
   virtual bool isWriteLocked() const override;
+  virtual void passWriteLock(const std::thread::id& from,
+                             const std::thread::id& to) override;
 
   virtual void unlock() const override;
 
@@ -127,12 +136,21 @@ class LegacyChunk : public ChunkBase {
   virtual void update(const std::shared_ptr<Revision>& item) override;
 
   virtual LogicalTime getLatestCommitTime() const override;
+  virtual uint64_t numCommits() const override;
+
+  virtual size_t compactHistory(const LogicalTime& watermark) override;
+  virtual LogicalTime compactedUntil() const override;
+
+  virtual void dumpHistories(
+      const std::function<void(const Revision&)>& sink) const override;
 
   static const char kConnectRequest[];
   static const char kInitRequest[];
   static const char kInsertRequest[];
   static const char kLeaveRequest[];
   static const char kLockRequest[];
+  static const char kLockAvailableRequest[];
+  static const char kLockQueuedResponse[];
   static const char kNewPeerRequest[];
   static const char kUnlockRequest[];
   static const char kUpdateRequest[];
@@ -162,14 +180,20 @@ class LegacyChunk : public ChunkBase {
    * function should check for that themselves if it is OK by them.
    * The function returns false iff the peer is not in the swarm but refuses
    * to join it by responding with Message::kDecline.
+   * If "delta_since" is valid, only the revisions updated after it are sent.
    */
-  bool addPeer(const PeerId& peer);
+  bool addPeer(const PeerId& peer, const LogicalTime& delta_since);
   size_t addAllPeers();
   /**
    * Distributed RW lock structure. Because it is distributed, unlocking from
    * a remote peer can potentially be handled by a different thread than the
    * locking one - thus an extra layer of lock is needed. The lock state is
    * represented by an enum variable.
+   * Write lock requests are arbitrated by the peer with the lowest address in
+   * the swarm. Rather than declining requests it can't grant right away, the
+   * arbitrator queues the requesters and notifies them in FIFO order once the
+   * lock becomes available, reserving the lock for the notified peer until it
+   * repeats its request.
    */
   struct DistributedRWLock {
     enum class State {
@@ -184,7 +208,19 @@ class LegacyChunk : public ChunkBase {
     PeerId holder;
     std::thread::id thread;
     int write_recursion_depth = 0;  // the write lock is recursive
+    // For lock statistics: when the current read-locked phase started and
+    // when self acquired the write lock.
+    internal::LockContentionStatistics::Clock::time_point read_locked_since;
+    internal::LockContentionStatistics::Clock::time_point write_locked_since;
     // to avoid deadlocks, this mutex may not be locked while awaiting replies
+    // Arbitrator side: peers waiting for the lock, and the peer the lock is
+    // reserved for after having been notified. The reservation expires, lest
+    // a peer that has died blocks the lock.
+    std::deque<PeerId> waiters;
+    PeerId reserved_for;
+    internal::LockContentionStatistics::Clock::time_point reserved_until;
+    // Requester side: arbitrator we are queued at, invalid if not queued.
+    PeerId queued_at;
     std::mutex mutex;
     std::condition_variable cv;  // in case writeLock can't be acquired
     DistributedRWLock() {}
@@ -214,9 +250,39 @@ class LegacyChunk : public ChunkBase {
    */
   bool isWriter(const PeerId& peer) const;
 
-  void initRequestSetData(proto::InitRequest* request);
+  /**
+   * Returns true iff self has the lowest address in the swarm, i.e. decides
+   * the order in which write lock requests are granted. The same locking
+   * requirements as for isWriter() apply.
+   */
+  bool isArbitrator() const;
+  /**
+   * Arbitrator side: to be called once the lock has become UNLOCKED. Reserves
+   * the lock for the first waiter and notifies it. Requires lock_.mutex to be
+   * locked.
+   */
+  void passLockToNextWaiter() const;
+  /**
+   * Arbitrator side: drops the reservation if it hasn't been claimed in
+   * time, and passes the lock on. Requires lock_.mutex to be locked.
+   */
+  void expireReservation() const;
+  void notifyLockAvailable(const PeerId& waiter) const;
+
+  void initRequestSetData(const LogicalTime& delta_since,
+                          proto::InitRequest* request);
   void initRequestSetPeers(proto::InitRequest* request);
-  void prepareInitRequest(Message* request);
+  void prepareInitRequest(const LogicalTime& delta_since, Message* request);
+
+  // Patches revisions recovered from the write-ahead log, which are already
+  // in update time order per item.
+  void patchRecovered(const std::vector<std::shared_ptr<Revision> >& recovered);
+  // Appends the revision to the write-ahead log, if enabled. Returns the
+  // sequence number to sync.
+  uint64_t logAhead(const Revision& item) const;
+  // Defers syncing a record patched on behalf of the remote write lock holder
+  // until the holder unlocks, so that its commit costs a single sync.
+  void deferLogSync(uint64_t sequence);
 
   inline void syncLatestCommitTime(const Revision& item);
 
@@ -229,12 +295,19 @@ class LegacyChunk : public ChunkBase {
   /**
    * Handles insert requests
    */
-  void handleConnectRequest(const PeerId& peer, Message* response);
-  static void handleConnectRequestThread(LegacyChunk* self, const PeerId& peer);
+  void handleConnectRequest(const PeerId& peer,
+                            const LogicalTime& recovered_until,
+                            Message* response);
+  static void handleConnectRequestThread(LegacyChunk* self, const PeerId& peer,
+                                         const LogicalTime& recovered_until);
   void handleInsertRequest(const std::shared_ptr<Revision>& item,
                            Message* response);
   void handleLeaveRequest(const PeerId& leaver, Message* response);
   void handleLockRequest(const PeerId& locker, Message* response);
+  void handleLockAvailableRequest(const PeerId& arbitrator, Message* response);
+  // Arbitrator side: enqueues the locker unless it is already queued and
+  // responds accordingly. Requires lock_.mutex to be locked.
+  void queueLockRequest(const PeerId& locker, Message* response);
   void handleNewPeerRequest(const PeerId& peer, const PeerId& sender,
                             Message* response);
   void handleUnlockRequest(const PeerId& locker, Message* response);
@@ -252,27 +325,17 @@ class LegacyChunk : public ChunkBase {
   map_api_common::ReaderWriterMutex leave_lock_;
   map_api_common::Condition initialized_;
   volatile bool relinquished_ = false;
-  bool log_locking_ = false;
-  size_t self_rank_;
   LogicalTime latest_commit_time_;
-
-  static const char kLockSequenceFile[];
-  enum LockState {
-    UNLOCKED,
-    READ_ATTEMPT,
-    READ_SUCCESS,
-    WRITE_ATTEMPT,
-    WRITE_SUCCESS
-  };
-  mutable LockState current_state_;
-  typedef std::chrono::time_point<std::chrono::system_clock> TimePoint;
-  mutable TimePoint current_state_start_;
-  TimePoint global_start_;
-  std::thread::id main_thread_id_;
-
-  void startState(LockState new_state) const;
-  void logStateDuration(LockState state, const TimePoint& start,
-                        const TimePoint& end) const;
+  // Incremented whenever latest_commit_time_ advances.
+  std::atomic<uint64_t> num_commits_{0u};
+  LogicalTime compacted_until_;
+  mutable std::mutex m_compacted_until_;
+  // Write-ahead log records of the transaction holding the write lock, synced
+  // before the lock is released.
+  mutable uint64_t unsynced_log_sequence_ = 0u;
+  // Write-ahead log records patched for the remote write lock holder, synced
+  // when it unlocks. Guarded by lock_.mutex.
+  uint64_t unsynced_patch_log_sequence_ = 0u;
 };
 
 }  // namespace map_api
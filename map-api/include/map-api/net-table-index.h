@@ -25,13 +25,12 @@
 #include <string>
 #include <unordered_set>
 
+#include <map-api-common/unique-id.h>
+
 #include "map-api/chord-index.h"
+#include "map-api/internal/item-id-filter.h"
 #include "map-api/peer-handler.h"
 
-namespace map_api_common {
-class Id;
-}  // namespace common
-
 namespace map_api {
 class NetTableIndex : public ChordIndex {
  public:
@@ -47,6 +46,23 @@ class NetTableIndex : public ChordIndex {
   void announcePosession(const map_api_common::Id& chunk_id);
   void renouncePosession(const map_api_common::Id& chunk_id);
 
+  /**
+   * The item filter of a chunk is stored next to its peer list, under the
+   * chunk id followed by kItemFilterKeySuffix. Like the peer lists, filters
+   * are kept without guarantee of consistency. All holders of a chunk
+   * announce filters of the same items, and each announcement is merged into
+   * the stored filter, so an update lost to a concurrent one only misses the
+   * items until the next announcement. The filter of a chunk is dropped once
+   * its last holder renounces possession.
+   */
+  void announceItemFilter(const map_api_common::Id& chunk_id,
+                          const internal::ItemIdFilter& filter);
+  // Returns false if no filter is announced for the chunk.
+  bool seekItemFilter(const map_api_common::Id& chunk_id,
+                      internal::ItemIdFilter* filter);
+
+  static const char kItemFilterKeySuffix[];
+
   static const char kRoutedChordRequest[];
   static const char kPeerResponse[];
   static const char kGetClosestPrecedingFingerRequest[];
@@ -74,6 +90,8 @@ class NetTableIndex : public ChordIndex {
 
   bool rpc(const PeerId& to, const Message& request, Message* response);
 
+  void dropItemFilter(const map_api_common::Id& chunk_id);
+
   virtual bool getClosestPrecedingFingerRpc(const PeerId& to, const Key& key,
                                             PeerId* closest_preceding)
       final override;
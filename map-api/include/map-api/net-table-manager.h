@@ -22,8 +22,12 @@
 #ifndef MAP_API_NET_TABLE_MANAGER_H_
 #define MAP_API_NET_TABLE_MANAGER_H_
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <map-api-common/reader-writer-lock.h>
@@ -66,6 +70,25 @@ class NetTableManager {
   void tableList(std::vector<std::string>* tables) const;
 
   void printStatistics() const;
+  void printLockContentionReport(size_t num_top_chunks_per_table) const;
+
+  // Advances the history watermark and compacts the histories of all tables.
+  // Runs periodically if --map_api_history_compaction_period_ms is set.
+  // Returns the amount of bytes released.
+  size_t compactHistories();
+  inline size_t numBytesReleasedByCompaction() const {
+    return num_bytes_released_by_compaction_;
+  }
+
+  // If --map_api_wal_directory is set, restores the chunks that this peer held
+  // before it crashed from the write-ahead log and starts logging. Must be
+  // called once all tables have been added and before writing to any chunk.
+  // Records of tables that haven't been added are discarded by the next
+  // checkpoint, which is taken every --map_api_wal_checkpoint_period_s.
+  void recoverFromWriteAheadLog();
+  // Starts a new log segment and dumps the histories of all chunks, replacing
+  // the older segments.
+  void checkpointWriteAheadLog();
 
   void listenToPeersJoiningTable(const std::string& table_name);
   void listenToPeersJoiningTable(const NetTable& table);
@@ -107,6 +130,8 @@ class NetTableManager {
   static void handleInsertRequest(const Message& request, Message* response);
   static void handleLeaveRequest(const Message& request, Message* response);
   static void handleLockRequest(const Message& request, Message* response);
+  static void handleLockAvailableRequest(const Message& request,
+                                         Message* response);
   static void handleNewPeerRequest(const Message& request, Message* response);
   static void handleUnlockRequest(const Message& request, Message* response);
   static void handleUpdateRequest(const Message& request, Message* response);
@@ -133,6 +158,11 @@ class NetTableManager {
   NetTableManager& operator=(const NetTableManager&) = delete;
   ~NetTableManager() = default;
 
+  void startHistoryCompactor();
+  void stopHistoryCompactor();
+  void startCheckpointer();
+  void stopCheckpointer();
+
   bool syncTableDefinition(const TableDescriptor& descriptor, bool* first,
                            PeerId* entry_point, PeerIdList* listeners);
 
@@ -169,6 +199,17 @@ class NetTableManager {
   mutable map_api_common::ReaderWriterMutex tables_lock_;
 
   NetTable* metatable_;
+
+  std::thread history_compactor_;
+  bool stop_history_compactor_;
+  std::mutex history_compactor_mutex_;
+  std::condition_variable history_compactor_cv_;
+  std::atomic<size_t> num_bytes_released_by_compaction_;
+
+  std::thread checkpointer_;
+  bool stop_checkpointer_;
+  std::mutex checkpointer_mutex_;
+  std::condition_variable checkpointer_cv_;
 };
 
 }  // namespace map_api
@@ -50,23 +50,39 @@ std::shared_ptr<const Revision> NetTableTransaction::getById(
 template <typename ValueType>
 void NetTableTransaction::find(int key, const ValueType& value,
                                ConstRevisionMap* result) {
-  CHECK_NOTNULL(result);
-  // TODO(tcies) Also search in uncommitted.
-  // TODO(tcies) Also search in previously committed.
-  workspace_.forEachChunk([&, this](const ChunkBase& chunk) {
-    ConstRevisionMap chunk_result;
-    chunk.constData()->find(key, value, begin_time_, &chunk_result);
-    result->insert(chunk_result.begin(), chunk_result.end());
-  });
+  FieldPredicate predicate;
+  if (key >= 0) {
+    predicate.equals(key, value);
+  }
+  find(predicate, result);
+}
+
+template <typename ValueType>
+void NetTableTransaction::findRange(int key, const ValueType& lower,
+                                    const ValueType& upper,
+                                    ConstRevisionMap* result) {
+  FieldPredicate predicate;
+  predicate.inRange(key, lower, upper);
+  find(predicate, result);
+}
+
+template <typename ValueType>
+void NetTableTransaction::findIf(
+    int key, const std::function<bool(const ValueType& value)>& condition,
+    ConstRevisionMap* result) {
+  FieldPredicate predicate;
+  predicate.satisfies(key, condition);
+  find(predicate, result);
 }
 
 template <typename IdType>
 void NetTableTransaction::getAvailableIds(std::vector<IdType>* ids) {
   CHECK_NOTNULL(ids)->clear();
-  ids->reserve(item_id_to_chunk_id_map_.size());
-  for (const ItemIdToChunkIdMap::value_type& item_chunk_ids :
-       item_id_to_chunk_id_map_) {
-    ids->push_back(item_chunk_ids.first.toIdType<IdType>());
+  std::vector<map_api_common::Id> common_ids;
+  getAvailableCommonIds(&common_ids);
+  ids->reserve(common_ids.size());
+  for (const map_api_common::Id& common_id : common_ids) {
+    ids->push_back(common_id.toIdType<IdType>());
   }
 }
 
@@ -96,13 +112,16 @@ template <typename IdType>
 ChunkBase* NetTableTransaction::chunkOf(const IdType& id) const {
   map_api_common::Id common_id;
   id.toHashId(&common_id);
+  map_api_common::Id chunk_id;
   ItemIdToChunkIdMap::const_iterator found =
-      item_id_to_chunk_id_map_.find(common_id);
-  if (found == item_id_to_chunk_id_map_.end()) {
+      inserted_item_chunk_ids_.find(common_id);
+  if (found != inserted_item_chunk_ids_.end()) {
+    chunk_id = found->second;
+  } else if (!table_->getChunkIdOfItem(common_id, &chunk_id) ||
+             !workspace_.contains(chunk_id)) {
     return nullptr;
-  } else {
-    return table_->getChunk(found->second);
   }
+  return table_->getChunk(chunk_id);
 }
 
 template <typename TrackerIdType>
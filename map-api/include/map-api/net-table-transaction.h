@@ -29,6 +29,7 @@
 #include <gtest/gtest_prod.h>
 
 #include "map-api/chunk-transaction.h"
+#include "map-api/field-predicate.h"
 #include "map-api/logical-time.h"
 #include "map-api/net-table.h"
 #include "map-api/workspace.h"
@@ -68,6 +69,16 @@ class NetTableTransaction {
   void dumpActiveChunks(ConstRevisionMap* result);
   template <typename ValueType>
   void find(int key, const ValueType& value, ConstRevisionMap* result);
+  void find(const FieldPredicate& predicate, ConstRevisionMap* result);
+  template <typename ValueType>
+  void findRange(int key, const ValueType& lower, const ValueType& upper,
+                 ConstRevisionMap* result);
+  template <typename ValueType>
+  void findIf(int key,
+              const std::function<bool(const ValueType& value)>& condition,
+              ConstRevisionMap* result);
+  void forEachFound(const FieldPredicate& predicate,
+                    const ChunkDataContainerBase::FoundAction& action);
   template <typename IdType>
   void getAvailableIds(std::vector<IdType>* ids);
 
@@ -104,6 +115,8 @@ class NetTableTransaction {
   void unlock();
 
   bool hasNoConflicts();
+  // Appends the transactions of the chunks, in lock order.
+  void getChunkTransactions(std::vector<ChunkTransaction*>* result) const;
   void merge(const std::shared_ptr<NetTableTransaction>& merge_transaction,
              Conflicts* conflicts);
   size_t numChangedItems() const;
@@ -116,12 +129,11 @@ class NetTableTransaction {
   // INTERNAL
   // ========
   ChunkTransaction* transactionOf(const ChunkBase* chunk) const;
+  // Looks items up in the item directory of the table, which also covers
+  // chunks fetched after the transaction has been initialized.
   template <typename IdType>
   ChunkBase* chunkOf(const IdType& id) const;
-  // The following must be called if chunks are fetched after the transaction
-  // has been initialized, otherwise the new items can't be fetched by the
-  // transaction.
-  void refreshIdToChunkIdMap();
+  void getAvailableCommonIds(std::vector<map_api_common::Id>* ids);
 
   typedef std::unordered_map<map_api_common::Id, ChunkTransaction::TableToIdMultiMap>
       TrackedChunkToTrackersMap;
@@ -151,8 +163,10 @@ class NetTableTransaction {
   NetTable* table_;
   Workspace::TableInterface workspace_;
 
+  // Items inserted by this transaction, which the directory of the table
+  // doesn't know about before the commit.
   typedef std::unordered_map<map_api_common::Id, map_api_common::Id> ItemIdToChunkIdMap;
-  ItemIdToChunkIdMap item_id_to_chunk_id_map_;
+  ItemIdToChunkIdMap inserted_item_chunk_ids_;
 
   NetTable::NewChunkTrackerMap push_new_chunk_ids_to_tracker_overrides_;
 
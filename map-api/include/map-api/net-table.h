@@ -29,11 +29,13 @@
 #include <vector>
 
 #include <map-api-common/reader-first-reader-writer-lock.h>
+#include <map-api-common/thread-pool.h>
 #include <gtest/gtest_prod.h>
 
 #include "map-api/chunk-data-container-base.h"
 #include "map-api/app-templates.h"
 #include "map-api/chunk-base.h"
+#include "map-api/internal/write-ahead-log.h"
 #include "map-api/net-table-index.h"
 #include "map-api/spatial-index.h"
 #include "./chunk.pb.h"
@@ -93,6 +95,26 @@ class NetTable {
   void shareAllChunks(const PeerId& peer);
   void leaveAllChunks();
   void leaveAllChunksOnceShared();
+  // Chunk of an item in the active chunks. A directory of the items is kept
+  // up to date as items enter the active chunks, so this takes constant time.
+  // Returns false if no active chunk holds the item.
+  bool getChunkIdOfItem(const map_api_common::Id& item_id,
+                        map_api_common::Id* chunk_id) const;
+  // Chunks announce the filters of their item ids to the index when they are
+  // joined, and again each time --map_api_item_filter_announcement_threshold
+  // items have been added to them. This announces the filters of all active
+  // chunks right away.
+  void announceItemFilters();
+  // Those of the candidate chunks, active or not, that may hold the item
+  // according to their announced filters. A chunk is only left out if the
+  // item hadn't been written to it at its latest announcement. Costs one
+  // index lookup per candidate, and no fetch path calls this on its own:
+  // it is for callers that know candidate chunks, e.g. the ones tracked by
+  // an item, and want to fetch only those that may hold a given item.
+  void getChunksThatMayHoldItem(
+      const map_api_common::Id& item_id,
+      const map_api_common::IdSet& candidate_chunk_ids,
+      map_api_common::IdSet* chunk_ids);
 
   // =====
   // STATS
@@ -102,6 +124,26 @@ class NetTable {
   size_t numItems() const;
   size_t activeChunksItemsSizeBytes();
   std::string getStatistics();
+  // Lock statistics aggregated over all active chunks, followed by the
+  // num_top_chunks chunks that spent the most time waiting for their lock.
+  std::string getLockContentionReport(size_t num_top_chunks) const;
+
+  // ==================
+  // HISTORY COMPACTION
+  // ==================
+  // Compacts the history of each active chunk, see ChunkBase::compactHistory.
+  // Returns the amount of bytes released over all chunks.
+  size_t compactHistory(const LogicalTime& watermark);
+
+  // ==============
+  // CRASH RECOVERY
+  // ==============
+  // Restores chunks recovered from the write-ahead log. Chunks that other
+  // peers still hold are rejoined, receiving only the revisions committed
+  // after the recovered ones. The others are restored from the log alone.
+  void recoverChunks(const internal::WriteAheadLog::ChunkRevisions& chunks);
+  // Passes the histories of all active chunks to the sink.
+  void dumpHistories(const internal::WriteAheadLog::RevisionSink& sink) const;
 
   // ==============
   // CHUNK TRACKING
@@ -210,6 +252,7 @@ class NetTable {
   // ================
   // TODO(tcies) somehow unify all routing to chunks? (yes, like chord)
   void handleConnectRequest(const map_api_common::Id& chunk_id, const PeerId& peer,
+                            const LogicalTime& recovered_until,
                             Message* response);
   void handleInitRequest(const proto::InitRequest& request,
                          const PeerId& sender, Message* response);
@@ -220,6 +263,8 @@ class NetTable {
                           Message* response);
   void handleLockRequest(const map_api_common::Id& chunk_id, const PeerId& locker,
                          Message* response);
+  void handleLockAvailableRequest(const map_api_common::Id& chunk_id,
+                                  const PeerId& arbitrator, Message* response);
   void handleNewPeerRequest(const map_api_common::Id& chunk_id, const PeerId& peer,
                             const PeerId& sender, Message* response);
   void handleUnlockRequest(const map_api_common::Id& chunk_id, const PeerId& locker,
@@ -257,6 +302,9 @@ class NetTable {
 
   typedef std::unordered_map<map_api_common::Id, std::unique_ptr<ChunkBase>> ChunkMap;
   ChunkBase* addInitializedChunk(std::unique_ptr<ChunkBase>&& chunk);
+  // Adds the items of the chunk to the item directory and has the chunk
+  // report the items it receives from now on.
+  void registerChunkItems(ChunkBase* chunk);
 
   bool insert(const LogicalTime& time, ChunkBase* chunk,
               const std::shared_ptr<Revision>& query);
@@ -304,12 +352,19 @@ class NetTable {
                        std::unordered_set<PeerId>* peers);
   void joinChunkHolders(const map_api_common::Id& chunk_id);
   void leaveChunkHolders(const map_api_common::Id& chunk_id);
+  // Announces the current item filter of an active chunk.
+  void announceItemFilter(const map_api_common::Id& chunk_id);
+  void countUnannouncedItem(const map_api_common::Id& chunk_id);
 
   std::shared_ptr<TableDescriptor> descriptor_;
   ChunkMap active_chunks_;
   // See issue #2391 for why we need a reader-first RW mutex here.
   mutable map_api_common::ReaderFirstReaderWriterMutex active_chunks_lock_;
 
+  // Chunk id of each item in the active chunks.
+  std::unordered_map<map_api_common::Id, map_api_common::Id> item_chunk_ids_;
+  mutable map_api_common::ReaderWriterMutex item_chunk_ids_lock_;
+
   // DO NOT USE FROM HANDLER THREAD (else TODO(tcies) mutex)
   std::unique_ptr<NetTableIndex> index_;
   std::unique_ptr<SpatialIndex> spatial_index_;
@@ -328,6 +383,20 @@ class NetTable {
   NewChunkTrackerMap new_chunk_trackers_;
 
   std::vector<Revision::AutoMergePolicy> auto_merge_policies_;
+
+  // Recovered revisions of the chunks being rejoined, consumed once the init
+  // request with the missing revisions arrives.
+  std::unordered_map<map_api_common::Id,
+                     std::vector<std::shared_ptr<Revision> > >
+      rejoining_chunks_;
+  std::mutex m_rejoining_chunks_;
+
+  // Items added to each active chunk since its filter was last announced.
+  std::unordered_map<map_api_common::Id, size_t> num_unannounced_items_;
+  std::mutex m_num_unannounced_items_;
+  // Declared last, such that queued announcements run before anything else
+  // is destroyed.
+  map_api_common::ThreadPool item_filter_announcer_;
 };
 
 }  // namespace map_api
@@ -37,8 +37,7 @@ template <typename FieldType>
 bool Revision::set(int index, const FieldType& value) {
   CHECK_LT(index, underlying_revision_->custom_field_values_size())
       << "Index out of custom field bounds";
-  proto::TableField* field =
-      underlying_revision_->mutable_custom_field_values(index);
+  proto::TableField* field = mutableCustomField(index);
   CHECK_EQ(field->type(), getProtobufTypeEnum<FieldType>())
       << "Type mismatch when trying to set field " << index;
   return set(field, value);
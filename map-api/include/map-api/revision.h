@@ -30,6 +30,8 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
+#include <gtest/gtest_prod.h>
 
 #include "./core.pb.h"
 #include "map-api/logical-time.h"
@@ -43,20 +45,28 @@ namespace gtest_case_ProtoSTLStream_ {
 template <typename gtest_TypeParam_>
 class ProtoAutoSerializationWorks;
 }  // gtest_case_ProtoSTLStream_
+template <typename gtest_TypeParam_>
+class IntTestWithInit_ChunkHistoryOfInterleavedChunks_Test;
 
 class Revision {
   friend class LegacyChunk;
   friend class ChunkDataContainerBase;
+  friend class FieldPredicate;
+  friend class LegacyChunkDataColumnarContainer;
   friend class LegacyChunkDataContainerBase;
+  friend class LegacyChunkDataLogContainer;
   template <int BlockSize>
   friend class STXXLRevisionStore;
   friend class TrackeeMultimap;
   friend class Transaction;
+  FRIEND_TEST(RevisionTest, CopyChainsAreReleased);
 
   // Friending parametrized templated test cases seems to miss from
   // gtest_prod.h.
   template <typename gtest_TypeParam_>
   friend class gtest_case_ProtoSTLStream_::ProtoAutoSerializationWorks;
+  template <typename gtest_TypeParam_>
+  friend class IntTestWithInit_ChunkHistoryOfInterleavedChunks_Test;
 
  public:
   typedef std::vector<char> Blob;
@@ -66,6 +76,8 @@ class Revision {
   Revision& operator=(const Revision& other) = delete;
 
   // Constructor and assignment replacements.
+  // The copy shares the custom field values of this revision; each field is
+  // only cloned once either revision modifies it.
   void copyForWrite(std::shared_ptr<Revision>* result) const;
   // You need to use std::move() for the unique_ptr of the following.
   static void fromProto(const std::shared_ptr<proto::Revision>& revision_proto,
@@ -74,6 +86,15 @@ class Revision {
                         std::shared_ptr<const Revision>* result);
   static std::shared_ptr<Revision> fromProtoString(
       const std::string& revision_proto_string);
+  // Parses the revision into the given arena. Revisions share ownership of
+  // their arena, which is freed with the last revision allocated on it.
+  static std::shared_ptr<Revision> fromProtoString(
+      const std::string& revision_proto_string,
+      const std::shared_ptr<google::protobuf::Arena>& arena);
+  // Arena for revisions that are received or loaded together and are likely
+  // to be released together, such as the contents of a chunk. Saves the
+  // allocation of every sub-message and string of every revision.
+  static std::shared_ptr<google::protobuf::Arena> createArena();
 
   // Defaults to blob in order to be easy to use for arbitrary protobufs.
   template <typename FieldType>
@@ -152,6 +173,10 @@ class Revision {
    * Returns true if value at key is same as with other
    */
   bool fieldMatch(const Revision& other, int index) const;
+  /**
+   * Hash of the value at key. Revisions that match at key have the same hash.
+   */
+  size_t fieldHash(int index) const;
   bool areAllCustomFieldsEqual(const Revision& other) const;
 
   std::string dumpToString() const;
@@ -208,6 +233,16 @@ class Revision {
   }
   inline void setRemoved() { underlying_revision_->set_removed(true); }
 
+  // Any modification of custom fields must go through the following, as the
+  // fields may be shared with other revisions. If the underlying revision is
+  // referenced elsewhere, it is first replaced by one that shares its fields,
+  // then the requested field is cloned if it is shared.
+  proto::TableField* mutableCustomField(int index);
+  // Same, but clones all shared fields, for modifications of the field list.
+  void ownAllCustomFields();
+
+  static size_t fieldHash(const proto::TableField& field);
+
   // Exception to parameter ordering: The standard way would make the function
   // call ambiguous if FieldType = int.
   // The default implementation assumes that the type is a protobuf.
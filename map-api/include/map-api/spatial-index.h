@@ -85,6 +85,15 @@ class SpatialIndex : public ChordIndex {
   void seekChunks(const BoundingBox& bounding_box, map_api_common::IdSet* chunk_ids);
   void listenToSpace(const BoundingBox& bounding_box);
 
+  /**
+   * Cell indices as used by the cells' chord keys. The bounding box / point
+   * must lie within the bounds of the index. Bounding boxes may have zero
+   * extent.
+   */
+  void getCellIndicesInBoundingBox(const BoundingBox& bounding_box,
+                                   std::vector<size_t>* indices) const;
+  size_t getCellIndexOfPoint(const std::vector<double>& point) const;
+
   typedef std::function<void(const map_api_common::Id& id)> TriggerCallback;
 
   // Also used as iterator for range-based for loops.
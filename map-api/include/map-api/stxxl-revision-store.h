@@ -22,10 +22,15 @@
 #ifndef MAP_API_STXXL_REVISION_STORE_H_
 #define MAP_API_STXXL_REVISION_STORE_H_
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 
+#include <map-api-common/reader-writer-lock.h>
 #include <stxxl.h>
 
 #include "map-api/proto-stl-stream.h"
@@ -55,9 +60,150 @@ struct CRURevisionInformation : public CRRevisionInformation {
 
 static constexpr int kSTXXLDefaultBlockSize = 128;
 
+struct RevisionCacheStatistics {
+  RevisionCacheStatistics() : num_hits(0u), num_misses(0u) {}
+  std::atomic<size_t> num_hits;
+  std::atomic<size_t> num_misses;
+};
+
+/**
+ * Bounded cache of decoded revisions, shared by the revision stores of a
+ * process so that its size doesn't grow with the number of chunks. Revisions
+ * are keyed by their store and their position in its block pool, which never
+ * changes as revisions are only ever appended. Evicts with the clock
+ * approximation of LRU: a hit only marks its entry as referenced, so that
+ * concurrent lookups can share the lock. Note that the containers serialize
+ * the reads of each chunk, so it is readers of different chunks that look up
+ * concurrently.
+ */
+class DecodedRevisionCache {
+ public:
+  explicit DecodedRevisionCache(size_t capacity)
+      : entries_(new Entry[capacity]),
+        capacity_(capacity),
+        size_(0u),
+        clock_hand_(0u),
+        next_store_id_(0u) {}
+
+  inline uint64_t newStoreId() { return next_store_id_++; }
+
+  inline bool lookup(uint64_t store_id, const MemoryBlockInformation& block,
+                     std::shared_ptr<const Revision>* revision) const {
+    CHECK_NOTNULL(revision);
+    if (capacity_ == 0u) {
+      return false;
+    }
+    map_api_common::ScopedReadLock lock(&mutex_);
+    IndexMap::const_iterator found = index_.find(Key(store_id, block));
+    if (found == index_.end()) {
+      return false;
+    }
+    const Entry& entry = entries_[found->second];
+    entry.referenced.store(true, std::memory_order_relaxed);
+    *revision = entry.revision;
+    return true;
+  }
+
+  inline void insert(uint64_t store_id, const MemoryBlockInformation& block,
+                     const std::shared_ptr<const Revision>& revision) {
+    if (capacity_ == 0u) {
+      return;
+    }
+    const Key key(store_id, block);
+    map_api_common::ScopedWriteLock lock(&mutex_);
+    if (index_.find(key) != index_.end()) {
+      // Decoded by a concurrent miss.
+      return;
+    }
+    size_t slot;
+    if (size_ < capacity_) {
+      slot = size_;
+      ++size_;
+    } else {
+      // Referenced entries get a second chance.
+      while (entries_[clock_hand_].referenced.exchange(false)) {
+        clock_hand_ = (clock_hand_ + 1u) % capacity_;
+      }
+      slot = clock_hand_;
+      clock_hand_ = (clock_hand_ + 1u) % capacity_;
+      index_.erase(entries_[slot].key);
+    }
+    Entry& entry = entries_[slot];
+    entry.key = key;
+    entry.revision = revision;
+    entry.referenced.store(false, std::memory_order_relaxed);
+    index_.emplace(key, slot);
+  }
+
+  // Releases the revisions of a store that is being destroyed. Their slots
+  // are reused first, as they are left unreferenced.
+  inline void evictStore(uint64_t store_id) {
+    if (capacity_ == 0u) {
+      return;
+    }
+    map_api_common::ScopedWriteLock lock(&mutex_);
+    for (size_t slot = 0u; slot < size_; ++slot) {
+      Entry& entry = entries_[slot];
+      if (entry.key.store_id == store_id && entry.revision) {
+        index_.erase(entry.key);
+        entry.revision.reset();
+        entry.referenced.store(false, std::memory_order_relaxed);
+      }
+    }
+  }
+
+ private:
+  struct Key {
+    Key() : store_id(0u) {}
+    Key(uint64_t _store_id, const MemoryBlockInformation& _block)
+        : store_id(_store_id), block(_block) {}
+    uint64_t store_id;
+    MemoryBlockInformation block;
+  };
+  struct Entry {
+    Entry() : referenced(false) {}
+    Key key;
+    std::shared_ptr<const Revision> revision;
+    mutable std::atomic<bool> referenced;
+  };
+  struct KeyHash {
+    inline size_t operator()(const Key& key) const {
+      return (std::hash<uint64_t>()(key.store_id) * 31u +
+              std::hash<int>()(key.block.block_index)) * 31u +
+             std::hash<int>()(key.block.byte_offset);
+    }
+  };
+  struct KeyEqual {
+    inline bool operator()(const Key& lhs, const Key& rhs) const {
+      return lhs.store_id == rhs.store_id &&
+             lhs.block.block_index == rhs.block.block_index &&
+             lhs.block.byte_offset == rhs.block.byte_offset;
+    }
+  };
+  typedef std::unordered_map<Key, size_t, KeyHash, KeyEqual> IndexMap;
+
+  std::unique_ptr<Entry[]> entries_;
+  const size_t capacity_;
+  size_t size_;
+  size_t clock_hand_;
+  IndexMap index_;
+  mutable map_api_common::ReaderWriterMutex mutex_;
+  std::atomic<uint64_t> next_store_id_;
+};
+
 template <int BlockSize>
 class STXXLRevisionStore {
  public:
+  // Decoded revisions are kept in "cache" for repeated reads. Lookups are
+  // counted in "statistics".
+  STXXLRevisionStore(DecodedRevisionCache* cache,
+                     RevisionCacheStatistics* statistics)
+      : cache_(*CHECK_NOTNULL(cache)),
+        store_id_(cache->newStoreId()),
+        statistics_(*CHECK_NOTNULL(statistics)) {}
+
+  ~STXXLRevisionStore() { cache_.evictStore(store_id_); }
+
   inline bool storeRevision(const Revision& revision,
                             CRRevisionInformation* revision_info) {
     CHECK_NOTNULL(revision_info);
@@ -77,10 +223,72 @@ class STXXLRevisionStore {
                                std::shared_ptr<const Revision>* revision)
       const {
     CHECK_NOTNULL(revision);
-    std::unique_lock<std::mutex> lock(mutex_);
     const MemoryBlockInformation& block_information =
         revision_info.memory_block_;
+    if (lookup(block_information, revision)) {
+      return true;
+    }
+
+    bool status;
+    {
+      // Reads go through the page cache of the STXXL vector, which they
+      // modify, so the pool can't be read concurrently.
+      std::unique_lock<std::mutex> lock(mutex_);
+      status = decode(revision_info, revision);
+    }
+    if (status) {
+      cache_.insert(store_id_, block_information, *revision);
+    }
+    return status;
+  }
+
+  // Retrieves the revisions in block order, such that the pool is read
+  // forward and each block is paged in once, under a single lock. The
+  // revisions are returned in the order of "revision_infos". Batches are
+  // typically scans, so the decoded revisions are not cached, which would
+  // evict the frequently read ones.
+  inline bool retrieveRevisions(
+      const std::vector<const CRRevisionInformation*>& revision_infos,
+      std::vector<std::shared_ptr<const Revision>>* revisions) const {
+    CHECK_NOTNULL(revisions)->clear();
+    revisions->resize(revision_infos.size());
+    std::vector<size_t> to_decode;
+    for (size_t i = 0u; i < revision_infos.size(); ++i) {
+      CHECK_NOTNULL(revision_infos[i]);
+      if (!lookup(revision_infos[i]->memory_block_, &(*revisions)[i])) {
+        to_decode.emplace_back(i);
+      }
+    }
+    std::sort(to_decode.begin(), to_decode.end(),
+              [&revision_infos](size_t lhs, size_t rhs) {
+      return revision_infos[lhs]->memory_block_ <
+             revision_infos[rhs]->memory_block_;
+    });
+
+    bool status = true;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (const size_t i : to_decode) {
+      status &= decode(*revision_infos[i], &(*revisions)[i]);
+    }
+    return status;
+  }
 
+ private:
+  inline bool lookup(const MemoryBlockInformation& block_information,
+                     std::shared_ptr<const Revision>* revision) const {
+    if (cache_.lookup(store_id_, block_information, revision)) {
+      ++statistics_.num_hits;
+      return true;
+    }
+    ++statistics_.num_misses;
+    return false;
+  }
+
+  // Requires "mutex_" to be held.
+  inline bool decode(const CRRevisionInformation& revision_info,
+                     std::shared_ptr<const Revision>* revision) const {
+    const MemoryBlockInformation& block_information =
+        revision_info.memory_block_;
     STLContainerInputStream<BlockSize, ContainerType> input_stream(
         block_information.block_index, block_information.byte_offset,
         &proto_revision_pool_);
@@ -93,7 +301,6 @@ class STXXLRevisionStore {
     return status;
   }
 
- private:
   template <typename ValueType, unsigned PageSize = 2, unsigned CachePages = 4,
             unsigned BlockSizeStxxl = 1024 * 1024,
             typename AllocStr = STXXL_DEFAULT_ALLOC_STRATEGY,
@@ -111,6 +318,9 @@ class STXXLRevisionStore {
   using ContainerType = typename VectorGenerator<T>::result;
   mutable MemoryBlockPool<BlockSize, ContainerType> proto_revision_pool_;
   mutable std::mutex mutex_;
+  DecodedRevisionCache& cache_;
+  const uint64_t store_id_;
+  RevisionCacheStatistics& statistics_;
 };
 }  // namespace map_api
 #endif  // MAP_API_STXXL_REVISION_STORE_H_
@@ -39,6 +39,8 @@ class TableDescriptor : private proto::TableDescriptor {
  public:
   virtual ~TableDescriptor();
 
+  using proto::TableDescriptor::fields;
+  using proto::TableDescriptor::fields_size;
   using proto::TableDescriptor::name;
 
   template <typename Type>
@@ -47,6 +49,15 @@ class TableDescriptor : private proto::TableDescriptor {
 
   void setName(const std::string& name);
 
+  // Chunk data containers that support it maintain a hash index on the field,
+  // which speeds up find() and count() on that field.
+  void addIndex(int field);
+  bool isIndexed(int field) const;
+  // Chunk data containers that support it maintain an ordered index on the
+  // numeric field, which speeds up range queries on that field.
+  void addSortedIndex(int field);
+  bool hasSortedIndex(int field) const;
+
   void setSpatialIndex(const SpatialIndex::BoundingBox& extent,
                        const std::vector<size_t>& subdivision);
 
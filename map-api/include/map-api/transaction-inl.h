@@ -43,6 +43,24 @@ void Transaction::find(int key, const ValueType& value, NetTable* table,
   return this->transactionOf(table)->find(key, value, result);
 }
 
+template <typename ValueType>
+void Transaction::findRange(int key, const ValueType& lower,
+                            const ValueType& upper, NetTable* table,
+                            ConstRevisionMap* result) {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(result);
+  transactionOf(table)->findRange(key, lower, upper, result);
+}
+
+template <typename ValueType>
+void Transaction::findIf(
+    int key, const std::function<bool(const ValueType& value)>& condition,
+    NetTable* table, ConstRevisionMap* result) {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(result);
+  transactionOf(table)->findIf(key, condition, result);
+}
+
 template <typename IdType>
 std::shared_ptr<const Revision> Transaction::getById(const IdType& id,
                                                      NetTable* table) const {
@@ -77,9 +95,6 @@ void Transaction::fetchAllChunksTrackedBy(const IdType& id,
 
   CHECK(tracker->fetchTrackedChunks());
 
-  refreshIdToChunkIdMaps();
-  // Id to chunk id maps must be refreshed first, otherwise getAvailableIds will
-  // nor work.
   refreshAvailableIdsInCaches();
 }
 
@@ -32,6 +32,7 @@
 #include <glog/logging.h>
 
 #include "map-api/internal/commit-future.h"
+#include "map-api/internal/history-watermark.h"
 #include "map-api/logical-time.h"
 #include "map-api/net-table-transaction.h"
 #include "map-api/workspace.h"
@@ -102,6 +103,23 @@ class Transaction {
   template <typename ValueType>
   void find(int key, const ValueType& value, NetTable* table,
             ConstRevisionMap* result);
+  // Same, with all conditions of "predicate" evaluated in one pass per chunk.
+  void find(const FieldPredicate& predicate, NetTable* table,
+            ConstRevisionMap* result);
+  // Items whose numeric field "key" is between "lower" and "upper",
+  // inclusive. Uses the sorted index of the field where there is one.
+  template <typename ValueType>
+  void findRange(int key, const ValueType& lower, const ValueType& upper,
+                 NetTable* table, ConstRevisionMap* result);
+  // Items for whose field "key" "condition" holds.
+  template <typename ValueType>
+  void findIf(int key,
+              const std::function<bool(const ValueType& value)>& condition,
+              NetTable* table, ConstRevisionMap* result);
+  // Streams the found items to "action" chunk by chunk instead of collecting
+  // them. "action" must not access "table" (see ChunkDataContainerBase).
+  void forEachFound(const FieldPredicate& predicate, NetTable* table,
+                    const ChunkDataContainerBase::FoundAction& action);
   bool fetchAllChunksTrackedByItemsInTable(NetTable* const table);
   template <typename IdType>
   void fetchAllChunksTrackedBy(const IdType& id, NetTable* const table);
@@ -178,10 +196,9 @@ class Transaction {
       const std::function<TrackerIdType(const Revision&)>&
           how_to_determine_tracker);
   // The following must be called if chunks are fetched after the transaction
-  // has been initialized, otherwise the new items can't be fetched by the
-  // transaction.
-  void refreshIdToChunkIdMaps();
-  // Same, for the caches.
+  // has been initialized, otherwise the caches don't know about the new items.
+  // The transactions themselves find them through the item directories of the
+  // tables.
   void refreshAvailableIdsInCaches();
 
  private:
@@ -227,6 +244,9 @@ class Transaction {
   typedef TransactionMap::value_type TransactionPair;
   mutable TransactionMap net_table_transactions_;
   std::shared_ptr<Workspace> workspace_;
+  // Keeps the history at begin_time_ from being compacted. Chunk transactions
+  // are created lazily, so this needs to be registered up front.
+  const internal::HistoryWatermark::ScopedReader history_reader_;
   LogicalTime begin_time_, commit_time_;
 
   // direct access vs. caching
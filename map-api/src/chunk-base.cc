@@ -21,16 +21,130 @@
 
 #include "map-api/chunk-base.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <map-api-common/backtrace.h>
+#include <map-api-common/thread-pool.h>
 
 DEFINE_bool(blame_trigger, false,
             "Print backtrace for trigger insertion and invocation.");
+DEFINE_uint64(map_api_trigger_threads, 4u,
+              "Number of threads that run chunk triggers.");
+DEFINE_uint64(map_api_trigger_coalescing_ms, 0u,
+              "If non-zero, commits to a chunk that arrive within this many "
+              "milliseconds of each other are passed to the triggers in a "
+              "single call.");
+DEFINE_uint64(map_api_trigger_max_pending_batches, 1000u,
+              "Once this many commits are waiting for their triggers across "
+              "all chunks, new commits are merged into the last pending "
+              "batch of their chunk. 0 means no limit.");
 
 namespace map_api {
 
-ChunkBase::~ChunkBase() {}
+namespace {
+
+map_api_common::ThreadPool& triggerPool() {
+  static map_api_common::ThreadPool pool(
+      std::max<size_t>(FLAGS_map_api_trigger_threads, 1u));
+  return pool;
+}
+
+// Hands tasks to the trigger pool once their deadline has passed, so that
+// batches waiting for their coalescing window don't occupy pool threads.
+class TriggerTimer {
+ public:
+  TriggerTimer() : stop_(false) {
+    // The pool must outlive the timer, which enqueues into it until joined.
+    triggerPool();
+    thread_ = std::thread(&TriggerTimer::work, this);
+  }
+
+  ~TriggerTimer() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    deadline_changed_.notify_all();
+    thread_.join();
+  }
+
+  void enqueueAt(const std::chrono::steady_clock::time_point& deadline,
+                 const std::function<void()>& task) {
+    CHECK(task);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      CHECK(!stop_);
+      tasks_.emplace(deadline, task);
+    }
+    deadline_changed_.notify_all();
+  }
+
+ private:
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      if (tasks_.empty()) {
+        if (stop_) {
+          return;
+        }
+        deadline_changed_.wait(lock);
+        continue;
+      }
+      // Tasks still pending at shutdown are released right away.
+      if (!stop_ && std::chrono::steady_clock::now() < tasks_.begin()->first) {
+        deadline_changed_.wait_until(lock, tasks_.begin()->first);
+        continue;
+      }
+      triggerPool().enqueue(tasks_.begin()->second);
+      tasks_.erase(tasks_.begin());
+    }
+  }
+
+  std::multimap<std::chrono::steady_clock::time_point, std::function<void()>>
+      tasks_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable deadline_changed_;
+  // Declared last, since the worker uses all other members.
+  std::thread thread_;
+};
+
+TriggerTimer& triggerTimer() {
+  static TriggerTimer timer;
+  return timer;
+}
+
+// Batches waiting for delivery, over all chunks.
+std::atomic<size_t> num_pending_trigger_batches(0u);
+
+void mergeIntoBatch(const map_api_common::IdSet& insertions,
+                    const map_api_common::IdSet& updates,
+                    map_api_common::IdSet* batch_insertions,
+                    map_api_common::IdSet* batch_updates) {
+  CHECK_NOTNULL(batch_insertions);
+  CHECK_NOTNULL(batch_updates);
+  batch_insertions->insert(insertions.begin(), insertions.end());
+  for (const map_api_common::Id& id : updates) {
+    // An item inserted earlier in the batch is still new to the triggers.
+    if (batch_insertions->count(id) == 0u) {
+      batch_updates->emplace(id);
+    }
+  }
+}
+
+}  // namespace
+
+ChunkBase::~ChunkBase() {
+  // Pending deliveries refer to this chunk.
+  waitForTriggerCompletion();
+}
 
 void ChunkBase::initializeNew(
     const map_api_common::Id& id, const std::shared_ptr<TableDescriptor>& descriptor) {
@@ -80,7 +194,10 @@ size_t ChunkBase::attachTrigger(const TriggerCallback& callback) {
 }
 
 void ChunkBase::waitForTriggerCompletion() {
-  map_api_common::ScopedWriteLock lock(&triggers_are_active_while_has_readers_);
+  std::unique_lock<std::mutex> lock(trigger_mutex_);
+  triggers_idle_.wait(lock, [this]() {
+    return !trigger_delivery_scheduled_ && pending_trigger_batches_.empty();
+  });
 }
 
 void ChunkBase::handleCommitInsert(const map_api_common::Id& inserted_id) {
@@ -94,15 +211,34 @@ void ChunkBase::handleCommitUpdate(const map_api_common::Id& updated_id) {
 void ChunkBase::handleCommitEnd() {
   std::lock_guard<std::mutex> trigger_lock(trigger_mutex_);
   if (!triggers_.empty()) {
-    // Must copy because of
-    // http://stackoverflow.com/questions/7895879 .
-    // "trigger_insertions_" and "trigger_updates_" are volatile.
-    triggers_are_active_while_has_readers_.acquireReadLock();
-    std::thread trigger_thread(
-        &ChunkBase::triggerWrapper, this,
-        std::move(std::unordered_set<map_api_common::Id>(trigger_insertions_)),
-        std::move(std::unordered_set<map_api_common::Id>(trigger_updates_)));
-    trigger_thread.detach();
+    const std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    bool merge = false;
+    if (!pending_trigger_batches_.empty()) {
+      // This is called from the handler thread, so rather than blocking when
+      // too many batches are pending, we let the batches grow.
+      merge = FLAGS_map_api_trigger_max_pending_batches != 0u &&
+              num_pending_trigger_batches >=
+                  FLAGS_map_api_trigger_max_pending_batches;
+      merge |= now - pending_trigger_batches_.back().first_commit_time <
+               std::chrono::milliseconds(FLAGS_map_api_trigger_coalescing_ms);
+    }
+    if (merge) {
+      TriggerBatch& batch = pending_trigger_batches_.back();
+      mergeIntoBatch(trigger_insertions_, trigger_updates_, &batch.insertions,
+                     &batch.updates);
+    } else {
+      pending_trigger_batches_.emplace_back();
+      TriggerBatch& batch = pending_trigger_batches_.back();
+      batch.insertions.swap(trigger_insertions_);
+      batch.updates.swap(trigger_updates_);
+      batch.first_commit_time = now;
+      ++num_pending_trigger_batches;
+    }
+    if (!trigger_delivery_scheduled_) {
+      trigger_delivery_scheduled_ = true;
+      triggerPool().enqueue(std::bind(&ChunkBase::deliverTriggerBatches, this));
+    }
   }
   trigger_insertions_.clear();
   trigger_updates_.clear();
@@ -122,17 +258,42 @@ void ChunkBase::leaveOnceShared() {
   leave();
 }
 
-void ChunkBase::triggerWrapper(
-    const std::unordered_set<map_api_common::Id>&& insertions,
-    const std::unordered_set<map_api_common::Id>&& updates) {
-  std::lock_guard<std::mutex> trigger_lock(trigger_mutex_);
-  VLOG(3) << triggers_.size() << " triggers called in chunk " << id();
-  for (const TriggerCallback& trigger : triggers_) {
-    CHECK(trigger);
-    trigger(insertions, updates);
+void ChunkBase::deliverTriggerBatches() {
+  std::unique_lock<std::mutex> trigger_lock(trigger_mutex_);
+  while (!pending_trigger_batches_.empty()) {
+    // Give later commits the chance to join the batch. Batches behind the
+    // first one are closed already.
+    const std::chrono::steady_clock::time_point batch_closes =
+        pending_trigger_batches_.front().first_commit_time +
+        std::chrono::milliseconds(FLAGS_map_api_trigger_coalescing_ms);
+    if (pending_trigger_batches_.size() == 1u &&
+        std::chrono::steady_clock::now() < batch_closes) {
+      // Delivery stays scheduled, so commits arriving in the meantime join
+      // the batch rather than scheduling another delivery.
+      triggerTimer().enqueueAt(
+          batch_closes, std::bind(&ChunkBase::deliverTriggerBatches, this));
+      return;
+    }
+
+    TriggerBatch batch(std::move(pending_trigger_batches_.front()));
+    pending_trigger_batches_.pop_front();
+    --num_pending_trigger_batches;
+    // Triggers are called without holding the mutex, so that they may attach
+    // triggers and don't hold up the commits that arrive in the meantime.
+    const std::vector<TriggerCallback> triggers = triggers_;
+    trigger_lock.unlock();
+
+    VLOG(3) << triggers.size() << " triggers called in chunk " << id();
+    for (const TriggerCallback& trigger : triggers) {
+      CHECK(trigger);
+      trigger(batch.insertions, batch.updates);
+    }
+    VLOG(3) << "Triggers done.";
+
+    trigger_lock.lock();
   }
-  VLOG(3) << "Triggers done.";
-  triggers_are_active_while_has_readers_.releaseReadLock();
+  trigger_delivery_scheduled_ = false;
+  triggers_idle_.notify_all();
 }
 
 }  // namespace map_api
@@ -19,6 +19,7 @@
 // You should have received a copy of the GNU General Public License
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
 #include <cstdio>
 #include <map>
 
@@ -55,45 +56,117 @@ std::shared_ptr<Revision> ChunkDataContainerBase::getTemplate() const {
   return descriptor_->getTemplate();
 }
 
+void ChunkDataContainerBase::setNewItemCallback(
+    const NewItemCallback& callback) {
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  new_item_callback_ = callback;
+}
+
+bool ChunkDataContainerBase::mayContainItem(
+    const map_api_common::Id& item_id) const {
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  return item_filter_.mayContain(item_id);
+}
+
+void ChunkDataContainerBase::getItemFilter(
+    internal::ItemIdFilter* filter) const {
+  CHECK_NOTNULL(filter);
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  *filter = item_filter_;
+}
+
+void ChunkDataContainerBase::registerNewItem(
+    const map_api_common::Id& item_id) {
+  if (item_filter_.full()) {
+    std::vector<map_api_common::Id> known_ids;
+    getKnownItemIdsImpl(&known_ids);
+    internal::ItemIdFilter grown(
+        2u * std::max(item_filter_.capacity(), known_ids.size()));
+    for (const map_api_common::Id& known_id : known_ids) {
+      grown.add(known_id);
+    }
+    item_filter_ = grown;
+  }
+  item_filter_.add(item_id);
+  if (new_item_callback_) {
+    new_item_callback_(item_id);
+  }
+}
+
 void ChunkDataContainerBase::findByRevision(int key,
                                             const Revision& valueHolder,
                                             const LogicalTime& time,
                                             ConstRevisionMap* dest) const {
+  FieldPredicate predicate;
+  if (key >= 0) {
+    predicate.equalsFieldOf(key, valueHolder);
+  }
+  find(predicate, time, dest);
+}
+
+void ChunkDataContainerBase::find(const FieldPredicate& predicate,
+                                  const LogicalTime& time,
+                                  ConstRevisionMap* dest) const {
   std::lock_guard<std::mutex> lock(access_mutex_);
   CHECK(isInitialized()) << "Attempted to find in non-initialized table";
-  // whether valueHolder contains key is implicitly checked whenever using
-  // Revision::insertPlaceHolder - for now it's a pretty safe bet that the
-  // implementation uses that - this would be rather cumbersome to check here
+  checkPredicate(predicate);
   CHECK_NOTNULL(dest);
   dest->clear();
   CHECK(time < LogicalTime::sample())
       << "Seeing the future is yet to be implemented ;)";
-  findByRevisionImpl(key, valueHolder, time, dest);
+  findByPredicateImpl(predicate, time, dest);
+}
+
+void ChunkDataContainerBase::forEachFound(const FieldPredicate& predicate,
+                                          const LogicalTime& time,
+                                          const FoundAction& action) const {
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  CHECK(isInitialized()) << "Attempted to find in non-initialized table";
+  checkPredicate(predicate);
+  CHECK(action);
+  CHECK(time < LogicalTime::sample())
+      << "Seeing the future is yet to be implemented ;)";
+  forEachFoundImpl(predicate, time, action);
 }
 
 int ChunkDataContainerBase::numAvailableIds(const LogicalTime& time) const {
-  return count(-1, 0, time);
+  return count(FieldPredicate(), time);
 }
 
 int ChunkDataContainerBase::countByRevision(int key,
                                             const Revision& valueHolder,
                                             const LogicalTime& time) const {
+  FieldPredicate predicate;
+  if (key >= 0) {
+    predicate.equalsFieldOf(key, valueHolder);
+  }
+  return count(predicate, time);
+}
+
+int ChunkDataContainerBase::count(const FieldPredicate& predicate,
+                                  const LogicalTime& time) const {
   std::lock_guard<std::mutex> lock(access_mutex_);
   CHECK(isInitialized()) << "Attempted to count items in non-initialized table";
-  // Whether valueHolder contains key is implicitly checked whenever using
-  // Revision::insertPlaceHolder - for now it's a pretty safe bet that the
-  // implementation uses that - this would be rather cumbersome to check here.
+  checkPredicate(predicate);
   CHECK(time < LogicalTime::sample())
       << "Seeing the future is yet to be implemented ;)";
-  return countByRevisionImpl(key, valueHolder, time);
+  return countByPredicateImpl(predicate, time);
 }
 
 void ChunkDataContainerBase::dump(const LogicalTime& time,
                                   ConstRevisionMap* dest) const {
   CHECK_NOTNULL(dest);
-  std::shared_ptr<Revision> valueHolder = getTemplate();
-  CHECK(valueHolder != nullptr);
-  findByRevision(-1, *valueHolder, time, dest);
+  find(FieldPredicate(), time, dest);
+}
+
+void ChunkDataContainerBase::checkPredicate(
+    const FieldPredicate& predicate) const {
+  for (const FieldPredicate::Term& term : predicate.terms()) {
+    CHECK_LT(term.key, descriptor_->fields_size())
+        << "Index out of custom field bounds";
+    CHECK_EQ(descriptor_->fields(term.key), term.value.type())
+        << "Type mismatch when trying to find by field " << term.key;
+  }
 }
 
 std::ostream& operator<<(std::ostream& stream,
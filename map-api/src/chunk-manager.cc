@@ -23,10 +23,16 @@
 
 #include <utility>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <map-api-common/thread-pool.h>
 
+#include "map-api/chunk-base.h"
+#include "map-api/internal/lock-contention-statistics.h"
 #include "map-api/net-table.h"
 
+DECLARE_uint64(map_api_chunk_sharing_parallelism);
+
 namespace map_api {
 void ChunkManagerBase::requestParticipationAllChunks() {
   if (active_chunks_.empty()) {
@@ -34,10 +40,11 @@ void ChunkManagerBase::requestParticipationAllChunks() {
   }
   VLOG(3) << "Requesting participation for " << active_chunks_.size()
           << " chunks from " << underlying_table_->name();
-  for (const std::pair<map_api_common::Id, ChunkBase*>& item : active_chunks_) {
-    CHECK_NOTNULL(item.second);
-    item.second->requestParticipation();
-  }
+  map_api_common::parallelForEach(
+      FLAGS_map_api_chunk_sharing_parallelism, active_chunks_,
+      [](const std::pair<const map_api_common::Id, ChunkBase*>& item) {
+        CHECK_NOTNULL(item.second)->requestParticipation();
+      });
   VLOG(3) << "Done. " << active_chunks_.size() << " chunks from "
           << underlying_table_->name() << " sent.";
 }
@@ -60,4 +67,189 @@ ChunkBase* ChunkManagerChunkSize::getChunkForItem(const Revision& revision) {
   return current_chunk_;
 }
 
+ChunkManagerAdaptive::Options::Options()
+    : max_chunk_size_bytes(kDefaultChunkSizeBytes),
+      hot_chunk_size_bytes(256 * 1024),
+      hot_commits_per_second(10.),
+      hot_conflicts_per_second(1.),
+      rate_smoothing(0.5),
+      sample_period(1000) {}
+
+ChunkManagerAdaptive::ChunkActivity::ChunkActivity()
+    : size_bytes(0),
+      last_num_commits(0u),
+      last_num_conflicts(0u),
+      reported_conflicts(0u),
+      commits_per_second(0.),
+      conflicts_per_second(0.) {}
+
+ChunkManagerAdaptive::ChunkManagerAdaptive(const Options& options,
+                                           map_api::NetTable* underlying_table)
+    : ChunkManagerBase(CHECK_NOTNULL(underlying_table)),
+      options_(options),
+      current_chunk_(nullptr),
+      last_sample_time_(Clock::now()) {
+  CHECK_GT(options_.hot_chunk_size_bytes, 0);
+  CHECK_LE(options_.hot_chunk_size_bytes, options_.max_chunk_size_bytes);
+  CHECK_GT(options_.rate_smoothing, 0.);
+  CHECK_LE(options_.rate_smoothing, 1.);
+  CHECK_GT(options_.sample_period.count(), 0);
+}
+
+ChunkBase* ChunkManagerAdaptive::getChunkForItem(const Revision& revision) {
+  if (Clock::now() - last_sample_time_ >= options_.sample_period) {
+    sampleRates();
+  }
+  const int item_size = revision.byteSize();
+  if (current_chunk_ == nullptr) {
+    newChunk();
+  } else {
+    const ChunkActivity& activity = activity_[current_chunk_->id()];
+    const int limit = isHot(activity) ? options_.hot_chunk_size_bytes
+                                      : options_.max_chunk_size_bytes;
+    if (activity.size_bytes + item_size > limit) {
+      VLOG(3) << "Closing chunk " << current_chunk_->id() << " at "
+              << activity.size_bytes << " bytes, "
+              << activity.commits_per_second << " commits/s and "
+              << activity.conflicts_per_second << " conflicts/s.";
+      newChunk();
+    }
+  }
+  CHECK_NOTNULL(current_chunk_);
+  activity_[current_chunk_->id()].size_bytes += item_size;
+  return current_chunk_;
+}
+
+void ChunkManagerAdaptive::reportConflict(const map_api_common::Id& chunk_id) {
+  std::unordered_map<map_api_common::Id, ChunkActivity>::iterator found =
+      activity_.find(chunk_id);
+  if (found != activity_.end()) {
+    ++found->second.reported_conflicts;
+  }
+}
+
+bool ChunkManagerAdaptive::isHot(const map_api_common::Id& chunk_id) const {
+  std::unordered_map<map_api_common::Id, ChunkActivity>::const_iterator found =
+      activity_.find(chunk_id);
+  CHECK(found != activity_.end());
+  return isHot(found->second);
+}
+
+double ChunkManagerAdaptive::commitRate(
+    const map_api_common::Id& chunk_id) const {
+  std::unordered_map<map_api_common::Id, ChunkActivity>::const_iterator found =
+      activity_.find(chunk_id);
+  CHECK(found != activity_.end());
+  return found->second.commits_per_second;
+}
+
+double ChunkManagerAdaptive::conflictRate(
+    const map_api_common::Id& chunk_id) const {
+  std::unordered_map<map_api_common::Id, ChunkActivity>::const_iterator found =
+      activity_.find(chunk_id);
+  CHECK(found != activity_.end());
+  return found->second.conflicts_per_second;
+}
+
+void ChunkManagerAdaptive::sampleRates() {
+  const Clock::time_point now = Clock::now();
+  const double seconds =
+      std::chrono::duration<double>(now - last_sample_time_).count();
+  last_sample_time_ = now;
+  if (seconds <= 0.) {
+    return;
+  }
+  const double alpha = options_.rate_smoothing;
+  for (const std::pair<const map_api_common::Id, ChunkBase*>& chunk :
+       active_chunks_) {
+    ChunkActivity& activity = activity_[chunk.first];
+    const internal::LockContentionStatistics& statistics =
+        CHECK_NOTNULL(chunk.second)->lockStatistics();
+    // Only commits of this peer hold the write lock here, so commits are
+    // counted as they are applied, which all peers of the chunk do.
+    const uint64_t num_commits = chunk.second->numCommits();
+    const uint64_t num_conflicts = statistics.numDeclines() +
+                                   statistics.numQueued() +
+                                   statistics.numRetries() +
+                                   activity.reported_conflicts;
+    activity.commits_per_second =
+        (1. - alpha) * activity.commits_per_second +
+        alpha * (num_commits - activity.last_num_commits) / seconds;
+    activity.conflicts_per_second =
+        (1. - alpha) * activity.conflicts_per_second +
+        alpha * (num_conflicts - activity.last_num_conflicts) / seconds;
+    activity.last_num_commits = num_commits;
+    activity.last_num_conflicts = num_conflicts;
+  }
+}
+
+bool ChunkManagerAdaptive::isHot(const ChunkActivity& activity) const {
+  return activity.commits_per_second > options_.hot_commits_per_second ||
+         activity.conflicts_per_second > options_.hot_conflicts_per_second;
+}
+
+void ChunkManagerAdaptive::newChunk() {
+  current_chunk_ = underlying_table_->newChunk();
+  active_chunks_.insert(std::make_pair(current_chunk_->id(), current_chunk_));
+  ChunkActivity& activity = activity_[current_chunk_->id()];
+  activity.last_num_commits = current_chunk_->numCommits();
+}
+
+ChunkManagerSpatial::ChunkManagerSpatial(
+    int max_chunk_size_bytes, const BoundingBoxFunction& bounding_box_of,
+    map_api::NetTable* underlying_table)
+    : ChunkManagerBase(CHECK_NOTNULL(underlying_table)),
+      max_chunk_size_bytes_(max_chunk_size_bytes),
+      bounding_box_of_(bounding_box_of) {
+  CHECK(bounding_box_of_);
+  CHECK_GT(max_chunk_size_bytes_, 0);
+}
+
+ChunkBase* ChunkManagerSpatial::getChunkForItem(const Revision& revision) {
+  const SpatialIndex::BoundingBox bounding_box = bounding_box_of_(revision);
+  std::vector<double> center;
+  center.reserve(bounding_box.size());
+  for (const SpatialIndex::Range& range : bounding_box) {
+    center.push_back((range.min + range.max) / 2.);
+  }
+  const size_t cell_index =
+      underlying_table_->spatial_index().getCellIndexOfPoint(center);
+
+  CellChunk& cell = cells_[cell_index];
+  const int item_size = revision.byteSize();
+  if (cell.chunk == nullptr ||
+      cell.size_bytes + item_size > max_chunk_size_bytes_) {
+    if (cell.chunk != nullptr) {
+      VLOG(3) << "Chunk of cell " << cell_index
+              << " is full, creating a new chunk.";
+    }
+    cell.chunk = underlying_table_->newChunk();
+    cell.size_bytes = 0;
+    active_chunks_.insert(std::make_pair(cell.chunk->id(), cell.chunk));
+  }
+  CHECK_NOTNULL(cell.chunk);
+  cell.size_bytes += item_size;
+  registerInSpace(cell.chunk, bounding_box);
+  return cell.chunk;
+}
+
+void ChunkManagerSpatial::registerInSpace(
+    ChunkBase* chunk, const SpatialIndex::BoundingBox& bounding_box) {
+  CHECK_NOTNULL(chunk);
+  std::vector<size_t> cell_indices;
+  underlying_table_->spatial_index().getCellIndicesInBoundingBox(
+      bounding_box, &cell_indices);
+  std::unordered_set<size_t>& registered = registered_cells_[chunk->id()];
+  bool all_registered = true;
+  for (size_t cell_index : cell_indices) {
+    all_registered &= registered.count(cell_index) != 0u;
+  }
+  // Every registration costs a round trip per cell, so only items that reach
+  // into new cells are registered.
+  if (!all_registered) {
+    underlying_table_->registerChunkInSpace(chunk->id(), bounding_box);
+    registered.insert(cell_indices.begin(), cell_indices.end());
+  }
+}
+
 }  // namespace map_api
@@ -21,23 +21,51 @@
 
 #include "map-api/chunk-transaction.h"
 
+#include <atomic>
+#include <thread>
 #include <unordered_set>
 
+#include <gflags/gflags.h>
 #include <map-api-common/accessors.h>
+#include <map-api-common/thread-pool.h>
 
 #include "map-api/conflicts.h"
 #include "map-api/internal/commit-future.h"
 #include "map-api/net-table.h"
 
+DEFINE_uint64(map_api_commit_check_threads, 4u,
+              "Number of threads that check the chunks of a commit for "
+              "conflicts. 1 checks them serially.");
+
 namespace map_api {
 
+namespace {
+
+// The history of a chunk received from another peer may have been compacted
+// beyond what the local watermark protects.
+LogicalTime readableTime(const LogicalTime& begin_time,
+                         const ChunkBase& chunk) {
+  const LogicalTime compacted_until = chunk.compactedUntil();
+  if (begin_time < compacted_until) {
+    LOG(WARNING) << "Reading chunk " << chunk.id() << " at " << compacted_until
+                 << " instead of " << begin_time << ", as it has been "
+                    "compacted by another peer. The transaction won't commit.";
+    return compacted_until;
+  }
+  return begin_time;
+}
+
+}  // namespace
+
 ChunkTransaction::ChunkTransaction(ChunkBase* chunk, NetTable* table)
     : ChunkTransaction(LogicalTime::sample(), nullptr, chunk, table) {}
 
 ChunkTransaction::ChunkTransaction(const LogicalTime& begin_time,
                                    const internal::CommitFuture* commit_future,
                                    ChunkBase* chunk, NetTable* table)
-    : begin_time_(begin_time),
+    : history_reader_(begin_time),
+      begin_time_(readableTime(history_reader_.beginTime(), *chunk)),
+      reads_past_begin_time_(begin_time_ != history_reader_.beginTime()),
       chunk_(CHECK_NOTNULL(chunk)),
       table_(CHECK_NOTNULL(table)),
       structure_reference_(chunk_->constData()->getTemplate()),
@@ -47,7 +75,7 @@ ChunkTransaction::ChunkTransaction(const LogicalTime& begin_time,
                          ? static_cast<internal::ViewBase*>(
                                new internal::CommitFuture(*commit_future))
                          : static_cast<internal::ViewBase*>(
-                               new internal::ChunkView(*chunk, begin_time))),
+                               new internal::ChunkView(*chunk, begin_time_))),
       view_before_delta_(
           new internal::CombinedView(original_view_, commit_history_view_)),
       combined_view_(view_before_delta_, delta_),
@@ -95,6 +123,12 @@ bool ChunkTransaction::commit() {
 bool ChunkTransaction::hasNoConflicts() {
   CHECK(!finalized_);  // Because checking can try to auto-merge.
   CHECK(chunk_->isWriteLocked());
+  if (reads_past_begin_time_) {
+    // What has been read from this chunk isn't consistent with the rest of
+    // the transaction.
+    VLOG(3) << "Chunk " << chunk_->id() << " has been read past begin time";
+    return false;
+  }
   std::unordered_map<map_api_common::Id, LogicalTime> update_times;
   chunk_->getUpdateTimes(&update_times);
   view_before_delta_->discardKnownUpdates(&update_times);
@@ -118,6 +152,29 @@ bool ChunkTransaction::hasNoConflicts() {
   return true;
 }
 
+bool ChunkTransaction::haveNoConflicts(
+    const std::vector<ChunkTransaction*>& transactions) {
+  const std::thread::id lock_holder = std::this_thread::get_id();
+  std::atomic<bool> has_conflict(false);
+  map_api_common::parallelForEach(
+      FLAGS_map_api_commit_check_threads, transactions,
+      [&has_conflict, &lock_holder](ChunkTransaction* transaction) {
+        if (has_conflict) {
+          return;
+        }
+        // The chunk locks are thread-bound, so the checking thread needs to
+        // hold the lock for its reads to pass.
+        ChunkBase* chunk = CHECK_NOTNULL(transaction)->chunk_;
+        const std::thread::id checker = std::this_thread::get_id();
+        chunk->passWriteLock(lock_holder, checker);
+        if (!transaction->hasNoConflicts()) {
+          has_conflict = true;
+        }
+        chunk->passWriteLock(checker, lock_holder);
+      });
+  return !has_conflict;
+}
+
 void ChunkTransaction::checkedCommit(const LogicalTime& time) {
   delta_.checkedCommitLocked(time, chunk_, &commit_history_);
 }
@@ -0,0 +1,161 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include "map-api/field-predicate.h"
+
+#include <string>
+
+#include <glog/logging.h>
+
+namespace map_api {
+
+namespace {
+
+template <typename NumberType>
+FieldPredicate::FieldCondition compileEquals(const proto::TableField& value) {
+  const NumberType number = FieldPredicate::numericValue<NumberType>(value);
+  return [number](const proto::TableField& stored) {
+    return FieldPredicate::numericValue<NumberType>(stored) == number;
+  };
+}
+
+template <typename NumberType>
+FieldPredicate::FieldCondition compileRange(const proto::TableField& lower,
+                                            const proto::TableField& upper) {
+  const NumberType low = FieldPredicate::numericValue<NumberType>(lower);
+  const NumberType high = FieldPredicate::numericValue<NumberType>(upper);
+  return [low, high](const proto::TableField& stored) {
+    const NumberType number = FieldPredicate::numericValue<NumberType>(stored);
+    return low <= number && number <= high;
+  };
+}
+
+}  // namespace
+
+FieldPredicate& FieldPredicate::equalsFieldOf(int key,
+                                              const Revision& value_holder) {
+  CHECK_LT(key, value_holder.customFieldCount());
+  addEqualsTerm(key,
+                value_holder.underlying_revision_->custom_field_values(key));
+  return *this;
+}
+
+bool FieldPredicate::isNumeric(proto::Type type) {
+  switch (type) {
+    case proto::Type::DOUBLE:
+    case proto::Type::INT32:
+    case proto::Type::UINT32:
+    case proto::Type::INT64:
+    case proto::Type::UINT64: { return true; }
+    case proto::Type::BLOB:
+    case proto::Type::HASH128:
+    case proto::Type::STRING: { return false; }
+  }
+  LOG(FATAL) << "Unknown field type " << type;
+  return false;
+}
+
+void FieldPredicate::addEqualsTerm(int key, const proto::TableField& value) {
+  CHECK_GE(key, 0);
+  Term term;
+  term.key = key;
+  term.type = TermType::kEquals;
+  term.value = value;
+  term.hash = Revision::fieldHash(value);
+  switch (value.type()) {
+    case proto::Type::BLOB: {
+      const std::string blob = value.blob_value();
+      term.matches = [blob](const proto::TableField& stored) {
+        return stored.blob_value() == blob;
+      };
+      break;
+    }
+    case proto::Type::DOUBLE: {
+      term.matches = compileEquals<double>(value);
+      break;
+    }
+    // HASH128 is stored as hex string.
+    case proto::Type::HASH128:
+    case proto::Type::STRING: {
+      const std::string string = value.string_value();
+      term.matches = [string](const proto::TableField& stored) {
+        return stored.string_value() == string;
+      };
+      break;
+    }
+    case proto::Type::INT32: {
+      term.matches = compileEquals<int32_t>(value);
+      break;
+    }
+    case proto::Type::UINT32: {
+      term.matches = compileEquals<uint32_t>(value);
+      break;
+    }
+    case proto::Type::INT64: {
+      term.matches = compileEquals<int64_t>(value);
+      break;
+    }
+    case proto::Type::UINT64: {
+      term.matches = compileEquals<uint64_t>(value);
+      break;
+    }
+  }
+  CHECK(term.matches) << "Unknown field type " << value.type();
+  terms_.push_back(term);
+}
+
+void FieldPredicate::addRangeTerm(int key, const proto::TableField& lower,
+                                  const proto::TableField& upper) {
+  CHECK_GE(key, 0);
+  CHECK(isNumeric(lower.type())) << "Range on non-numeric field " << key;
+  Term term;
+  term.key = key;
+  term.type = TermType::kRange;
+  term.value = lower;
+  term.upper = upper;
+  term.hash = 0u;
+  switch (lower.type()) {
+    case proto::Type::DOUBLE: {
+      term.matches = compileRange<double>(lower, upper);
+      break;
+    }
+    case proto::Type::INT32: {
+      term.matches = compileRange<int32_t>(lower, upper);
+      break;
+    }
+    case proto::Type::UINT32: {
+      term.matches = compileRange<uint32_t>(lower, upper);
+      break;
+    }
+    case proto::Type::INT64: {
+      term.matches = compileRange<int64_t>(lower, upper);
+      break;
+    }
+    case proto::Type::UINT64: {
+      term.matches = compileRange<uint64_t>(lower, upper);
+      break;
+    }
+    default: { LOG(FATAL) << "Unreachable"; }
+  }
+  terms_.push_back(term);
+}
+
+}  // namespace map_api
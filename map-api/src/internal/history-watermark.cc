@@ -0,0 +1,91 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include "map-api/internal/history-watermark.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+DEFINE_uint64(map_api_history_retention, 1000u,
+              "Amount of logical time ticks for which superseded revisions "
+              "are retained by history compaction, in addition to those "
+              "visible to live transactions.");
+
+namespace map_api {
+namespace internal {
+
+std::multiset<LogicalTime> HistoryWatermark::readers_;
+LogicalTime HistoryWatermark::watermark_;
+LogicalTime HistoryWatermark::previous_sample_;
+std::mutex HistoryWatermark::mutex_;
+
+HistoryWatermark::ScopedReader::ScopedReader(const LogicalTime& begin_time)
+    : begin_time_(registerReader(begin_time)) {}
+
+HistoryWatermark::ScopedReader::~ScopedReader() {
+  unregisterReader(begin_time_);
+}
+
+LogicalTime HistoryWatermark::advance() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const LogicalTime bound = previous_sample_;
+  previous_sample_ = LogicalTime::sample();
+  if (!bound.isValid() ||
+      bound.serialize() <= FLAGS_map_api_history_retention) {
+    return watermark_;
+  }
+  LogicalTime candidate(bound.serialize() - FLAGS_map_api_history_retention);
+  if (!readers_.empty() && *readers_.begin() < candidate) {
+    candidate = *readers_.begin();
+  }
+  if (watermark_ < candidate) {
+    watermark_ = candidate;
+  }
+  return watermark_;
+}
+
+LogicalTime HistoryWatermark::get() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return watermark_;
+}
+
+LogicalTime HistoryWatermark::registerReader(const LogicalTime& begin_time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  LogicalTime registered = begin_time;
+  if (watermark_.isValid() && begin_time < watermark_) {
+    LOG(WARNING) << "Reading at " << watermark_ << " instead of " << begin_time
+                 << ", as older history may have been compacted. Increase "
+                    "--map_api_history_retention to read further back.";
+    registered = watermark_;
+  }
+  readers_.insert(registered);
+  return registered;
+}
+
+void HistoryWatermark::unregisterReader(const LogicalTime& begin_time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::multiset<LogicalTime>::iterator found = readers_.find(begin_time);
+  CHECK(found != readers_.end());
+  readers_.erase(found);
+}
+
+}  // namespace internal
+}  // namespace map_api
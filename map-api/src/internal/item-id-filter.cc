@@ -0,0 +1,146 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include "map-api/internal/item-id-filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "./net-table.pb.h"
+
+DEFINE_double(map_api_item_filter_false_positive_rate, 0.01,
+              "Rate of false positives the filters of the item ids of a chunk "
+              "are dimensioned for at their capacity.");
+DEFINE_uint64(map_api_item_filter_min_capacity, 1000u,
+              "Number of items the item id filters of a chunk are dimensioned "
+              "for initially. They are rebuilt with twice the capacity each "
+              "time they fill up.");
+
+namespace map_api {
+namespace internal {
+
+namespace {
+constexpr size_t kBitsPerWord = 64u;
+}  // namespace
+
+ItemIdFilter::ItemIdFilter()
+    : ItemIdFilter(FLAGS_map_api_item_filter_min_capacity) {}
+
+ItemIdFilter::ItemIdFilter(size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1u)), num_added_(0u) {
+  const double false_positive_rate =
+      FLAGS_map_api_item_filter_false_positive_rate;
+  CHECK_GT(false_positive_rate, 0.);
+  CHECK_LT(false_positive_rate, 1.);
+  // Optimal dimensions: m = -n ln(p) / ln(2)^2 bits and k = m / n ln(2)
+  // hashes for n items and a false positive rate p.
+  const double ln2 = std::log(2.);
+  const double num_bits =
+      -static_cast<double>(capacity_) * std::log(false_positive_rate) /
+      (ln2 * ln2);
+  words_.assign(static_cast<size_t>(std::ceil(num_bits / kBitsPerWord)), 0u);
+  num_hashes_ = std::max<size_t>(
+      std::lround(words_.size() * kBitsPerWord * ln2 / capacity_), 1u);
+}
+
+void ItemIdFilter::add(const map_api_common::Id& id) {
+  ++num_added_;
+  forEachBit(id, [this](size_t bit) {
+    words_[bit / kBitsPerWord] |= uint64_t(1) << (bit % kBitsPerWord);
+  });
+}
+
+bool ItemIdFilter::mayContain(const map_api_common::Id& id) const {
+  bool result = true;
+  forEachBit(id, [this, &result](size_t bit) {
+    result &= (words_[bit / kBitsPerWord] >> (bit % kBitsPerWord)) & 1u;
+  });
+  return result;
+}
+
+bool ItemIdFilter::hasSameDimensions(const ItemIdFilter& other) const {
+  return words_.size() == other.words_.size() &&
+         num_hashes_ == other.num_hashes_;
+}
+
+void ItemIdFilter::merge(const ItemIdFilter& other) {
+  CHECK(hasSameDimensions(other));
+  for (size_t i = 0u; i < words_.size(); ++i) {
+    words_[i] |= other.words_[i];
+  }
+  num_added_ += other.num_added_;
+}
+
+void ItemIdFilter::clear() {
+  std::fill(words_.begin(), words_.end(), 0u);
+  num_added_ = 0u;
+}
+
+bool ItemIdFilter::empty() const {
+  return std::all_of(words_.begin(), words_.end(),
+                     [](uint64_t word) { return word == 0u; });
+}
+
+bool ItemIdFilter::full() const { return num_added_ >= capacity_; }
+
+size_t ItemIdFilter::capacity() const { return capacity_; }
+
+void ItemIdFilter::serialize(proto::ItemIdFilter* proto) const {
+  CHECK_NOTNULL(proto);
+  proto->set_num_hashes(num_hashes_);
+  proto->clear_words();
+  for (uint64_t word : words_) {
+    proto->add_words(word);
+  }
+}
+
+void ItemIdFilter::deserialize(const proto::ItemIdFilter& proto) {
+  CHECK_GT(proto.num_hashes(), 0u);
+  CHECK_GT(proto.words_size(), 0);
+  num_hashes_ = proto.num_hashes();
+  words_.assign(proto.words().begin(), proto.words().end());
+  capacity_ = std::numeric_limits<size_t>::max();
+  num_added_ = 0u;
+}
+
+template <typename Action>
+void ItemIdFilter::forEachBit(const map_api_common::Id& id,
+                              const Action& action) const {
+  // Ids are random, so their halves serve as two independent hashes, from
+  // which the others are derived by double hashing.
+  map_api_common::HashId hash_id;
+  id.toHashId(&hash_id);
+  uint64_t halves[2];
+  hash_id.toUint64(halves);
+  const uint64_t step = halves[1] | 1u;
+  const size_t num_bits = words_.size() * kBitsPerWord;
+  uint64_t hash = halves[0];
+  for (size_t i = 0u; i < num_hashes_; ++i, hash += step) {
+    action(hash % num_bits);
+  }
+}
+
+}  // namespace internal
+}  // namespace map_api
@@ -0,0 +1,233 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include "map-api/internal/lock-contention-statistics.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include <glog/logging.h>
+
+namespace map_api {
+namespace internal {
+
+namespace {
+
+template <typename Type>
+void atomicMax(const Type value, std::atomic<Type>* target) {
+  CHECK_NOTNULL(target);
+  Type current = target->load(std::memory_order_relaxed);
+  while (value > current &&
+         !target->compare_exchange_weak(current, value,
+                                        std::memory_order_relaxed)) {
+  }
+}
+
+inline double nanosecondsToMilliseconds(const uint64_t nanoseconds) {
+  return static_cast<double>(nanoseconds) * 1e-6;
+}
+
+}  // namespace
+
+constexpr size_t DurationHistogram::kNumBuckets;
+
+DurationHistogram::DurationHistogram()
+    : count_(0u), total_ns_(0u), max_ns_(0u) {
+  for (std::atomic<uint64_t>& bucket : buckets_) {
+    bucket.store(0u, std::memory_order_relaxed);
+  }
+}
+
+void DurationHistogram::add(const std::chrono::nanoseconds& duration) {
+  const uint64_t nanoseconds =
+      duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0u;
+  uint64_t microseconds = nanoseconds / 1000u;
+  size_t bucket = 0u;
+  while (microseconds > 0u && bucket < kNumBuckets - 1u) {
+    microseconds >>= 1;
+    ++bucket;
+  }
+  buckets_[bucket].fetch_add(1u, std::memory_order_relaxed);
+  count_.fetch_add(1u, std::memory_order_relaxed);
+  total_ns_.fetch_add(nanoseconds, std::memory_order_relaxed);
+  atomicMax(nanoseconds, &max_ns_);
+}
+
+void DurationHistogram::merge(const DurationHistogram& other) {
+  for (size_t i = 0u; i < kNumBuckets; ++i) {
+    buckets_[i].fetch_add(other.bucketCount(i), std::memory_order_relaxed);
+  }
+  count_.fetch_add(other.count(), std::memory_order_relaxed);
+  total_ns_.fetch_add(other.totalNanoseconds(), std::memory_order_relaxed);
+  atomicMax(other.maxNanoseconds(), &max_ns_);
+}
+
+uint64_t DurationHistogram::count() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t DurationHistogram::totalNanoseconds() const {
+  return total_ns_.load(std::memory_order_relaxed);
+}
+
+uint64_t DurationHistogram::maxNanoseconds() const {
+  return max_ns_.load(std::memory_order_relaxed);
+}
+
+uint64_t DurationHistogram::bucketCount(size_t bucket) const {
+  CHECK_LT(bucket, kNumBuckets);
+  return buckets_[bucket].load(std::memory_order_relaxed);
+}
+
+uint64_t DurationHistogram::quantileUpperBoundMicroseconds(
+    double quantile) const {
+  CHECK_GE(quantile, 0.);
+  CHECK_LE(quantile, 1.);
+  const uint64_t total = count();
+  if (total == 0u) {
+    return 0u;
+  }
+  const uint64_t rank =
+      std::max<uint64_t>(1u, static_cast<uint64_t>(quantile * total + 0.5));
+  // The maximum is a tighter bound for the top bucket, and the only one for
+  // the open-ended last bucket.
+  const uint64_t max_microseconds = (maxNanoseconds() + 999u) / 1000u;
+  uint64_t cumulative = 0u;
+  for (size_t i = 0u; i < kNumBuckets - 1u; ++i) {
+    cumulative += bucketCount(i);
+    if (cumulative >= rank) {
+      return std::min<uint64_t>(1u << i, max_microseconds);
+    }
+  }
+  return max_microseconds;
+}
+
+std::string DurationHistogram::summary() const {
+  std::stringstream ss;
+  const uint64_t n = count();
+  ss << std::fixed << std::setprecision(3) << "n=" << n;
+  if (n > 0u) {
+    ss << " mean=" << nanosecondsToMilliseconds(totalNanoseconds() / n)
+       << "ms p50<=" << quantileUpperBoundMicroseconds(0.5) * 1e-3
+       << "ms p99<=" << quantileUpperBoundMicroseconds(0.99) * 1e-3
+       << "ms max=" << nanosecondsToMilliseconds(maxNanoseconds()) << "ms";
+  }
+  return ss.str();
+}
+
+std::string DurationHistogram::toString() const {
+  std::stringstream ss;
+  const uint64_t n = count();
+  for (size_t i = 0u; i < kNumBuckets; ++i) {
+    const uint64_t bucket_count = bucketCount(i);
+    if (bucket_count == 0u) {
+      continue;
+    }
+    if (i == kNumBuckets - 1u) {
+      ss << "  >=" << std::setw(9) << (1u << (i - 1u)) << "us: ";
+    } else {
+      ss << "  < " << std::setw(9) << (1u << i) << "us: ";
+    }
+    const size_t bar_length = static_cast<size_t>(40. * bucket_count / n);
+    ss << std::string(bar_length, '#') << " " << bucket_count << std::endl;
+  }
+  return ss.str();
+}
+
+LockContentionStatistics::LockContentionStatistics()
+    : declines_(0u),
+      queued_(0u),
+      retries_(0u),
+      recursions_(0u),
+      max_recursion_depth_(0) {}
+
+void LockContentionStatistics::recordReadWait(
+    const Clock::duration& duration) {
+  read_wait_.add(duration);
+}
+
+void LockContentionStatistics::recordWriteWait(
+    const Clock::duration& duration) {
+  write_wait_.add(duration);
+}
+
+void LockContentionStatistics::recordReadHold(
+    const Clock::duration& duration) {
+  read_hold_.add(duration);
+}
+
+void LockContentionStatistics::recordWriteHold(
+    const Clock::duration& duration) {
+  write_hold_.add(duration);
+}
+
+void LockContentionStatistics::recordDecline() {
+  declines_.fetch_add(1u, std::memory_order_relaxed);
+}
+
+void LockContentionStatistics::recordQueued() {
+  queued_.fetch_add(1u, std::memory_order_relaxed);
+}
+
+void LockContentionStatistics::recordRetry() {
+  retries_.fetch_add(1u, std::memory_order_relaxed);
+}
+
+void LockContentionStatistics::recordRecursion(int depth) {
+  recursions_.fetch_add(1u, std::memory_order_relaxed);
+  atomicMax(depth, &max_recursion_depth_);
+}
+
+void LockContentionStatistics::merge(const LockContentionStatistics& other) {
+  read_wait_.merge(other.read_wait_);
+  write_wait_.merge(other.write_wait_);
+  read_hold_.merge(other.read_hold_);
+  write_hold_.merge(other.write_hold_);
+  declines_.fetch_add(other.numDeclines(), std::memory_order_relaxed);
+  queued_.fetch_add(other.numQueued(), std::memory_order_relaxed);
+  retries_.fetch_add(other.numRetries(), std::memory_order_relaxed);
+  recursions_.fetch_add(other.numRecursiveAcquisitions(),
+                        std::memory_order_relaxed);
+  atomicMax(other.maxRecursionDepth(), &max_recursion_depth_);
+}
+
+uint64_t LockContentionStatistics::totalWaitNanoseconds() const {
+  return read_wait_.totalNanoseconds() + write_wait_.totalNanoseconds();
+}
+
+std::string LockContentionStatistics::toString() const {
+  std::stringstream ss;
+  ss << "read wait:  " << read_wait_.summary() << std::endl;
+  ss << "read hold:  " << read_hold_.summary() << std::endl;
+  ss << "write wait: " << write_wait_.summary() << std::endl;
+  ss << write_wait_.toString();
+  ss << "write hold: " << write_hold_.summary() << std::endl;
+  ss << "declines: " << numDeclines() << ", queued: " << numQueued()
+     << ", retries: " << numRetries()
+     << ", recursive acquisitions: " << numRecursiveAcquisitions()
+     << " (max depth " << maxRecursionDepth() << ")";
+  return ss.str();
+}
+
+}  // namespace internal
+}  // namespace map_api
@@ -0,0 +1,58 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include "map-api/internal/sorted-field-index.h"
+
+#include <glog/logging.h>
+
+namespace map_api {
+namespace internal {
+
+std::unique_ptr<SortedFieldIndex> SortedFieldIndex::create(int key,
+                                                           proto::Type type) {
+  switch (type) {
+    case proto::Type::DOUBLE: {
+      return std::unique_ptr<SortedFieldIndex>(
+          new TypedSortedFieldIndex<double>(key));
+    }
+    case proto::Type::INT32: {
+      return std::unique_ptr<SortedFieldIndex>(
+          new TypedSortedFieldIndex<int32_t>(key));
+    }
+    case proto::Type::UINT32: {
+      return std::unique_ptr<SortedFieldIndex>(
+          new TypedSortedFieldIndex<uint32_t>(key));
+    }
+    case proto::Type::INT64: {
+      return std::unique_ptr<SortedFieldIndex>(
+          new TypedSortedFieldIndex<int64_t>(key));
+    }
+    case proto::Type::UINT64: {
+      return std::unique_ptr<SortedFieldIndex>(
+          new TypedSortedFieldIndex<uint64_t>(key));
+    }
+    default: { LOG(FATAL) << "No sorted index for field type " << type; }
+  }
+  return std::unique_ptr<SortedFieldIndex>();
+}
+
+}  // namespace internal
+}  // namespace map_api
@@ -0,0 +1,466 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+#include "map-api/internal/write-ahead-log.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>  // NOLINT
+#include <iterator>
+#include <map>
+#include <set>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "map-api/logical-time.h"
+#include "map-api/revision.h"
+#include "./chunk.pb.h"
+
+DEFINE_string(map_api_wal_directory, "",
+              "Directory of the write-ahead log of the chunk data held by this "
+              "peer. Empty disables the write-ahead log.");
+
+namespace map_api {
+namespace internal {
+
+namespace {
+
+struct RecordHeader {
+  uint32_t size;
+  // Of the serialized proto::WriteAheadLogRecord that follows the header.
+  uint32_t checksum;
+};
+
+constexpr char kSegmentPrefix[] = "wal_";
+constexpr char kSegmentSuffix[] = ".log";
+constexpr char kCheckpointPrefix[] = "checkpoint_";
+constexpr char kTemporarySuffix[] = ".tmp";
+constexpr size_t kCheckpointWriteSize = 1u << 20;
+
+// 32 bit FNV-1a.
+uint32_t checksum(const std::string& data) {
+  uint32_t hash = 2166136261u;
+  for (const char character : data) {
+    hash ^= static_cast<unsigned char>(character);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void frameRecord(const proto::WriteAheadLogRecord& record,
+                 std::string* destination) {
+  CHECK_NOTNULL(destination);
+  const std::string payload = record.SerializeAsString();
+  RecordHeader header;
+  header.size = payload.size();
+  header.checksum = checksum(payload);
+  destination->append(reinterpret_cast<const char*>(&header), sizeof(header));
+  destination->append(payload);
+}
+
+std::string segmentPath(const std::string& directory, uint32_t number) {
+  char name[32];
+  snprintf(name, sizeof(name), "%s%08u%s", kSegmentPrefix, number,
+           kSegmentSuffix);
+  return directory + "/" + name;
+}
+
+std::string checkpointPath(const std::string& directory, uint32_t number) {
+  char name[32];
+  snprintf(name, sizeof(name), "%s%08u", kCheckpointPrefix, number);
+  return directory + "/" + name;
+}
+
+// Returns false if the directory doesn't exist.
+bool listFiles(const std::string& directory_path, std::set<uint32_t>* segments,
+               std::set<uint32_t>* checkpoints) {
+  CHECK_NOTNULL(segments)->clear();
+  CHECK_NOTNULL(checkpoints)->clear();
+  DIR* directory = opendir(directory_path.c_str());
+  if (directory == nullptr) {
+    CHECK_EQ(ENOENT, errno) << directory_path;
+    return false;
+  }
+  while (const dirent* entry = readdir(directory)) {
+    unsigned int number;
+    char suffix[8];
+    if (sscanf(entry->d_name, "wal_%u%7s", &number, suffix) == 2 &&
+        strcmp(suffix, kSegmentSuffix) == 0) {
+      segments->insert(number);
+    } else if (sscanf(entry->d_name, "checkpoint_%u%7s", &number, suffix) ==
+               1) {
+      // Temporary checkpoints have a suffix and are incomplete.
+      checkpoints->insert(number);
+    }
+  }
+  CHECK_EQ(0, closedir(directory)) << errno;
+  return true;
+}
+
+void makeDirectories(const std::string& path) {
+  for (size_t end = path.find('/', 1u);; end = path.find('/', end + 1u)) {
+    const std::string prefix = path.substr(0u, end);
+    if (mkdir(prefix.c_str(), 0755) == -1) {
+      CHECK_EQ(EEXIST, errno) << prefix;
+    }
+    if (end == std::string::npos) {
+      break;
+    }
+  }
+}
+
+// Makes created, renamed and deleted files durable.
+void syncDirectory(const std::string& directory) {
+  const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  CHECK_NE(-1, fd) << directory << ": " << errno;
+  CHECK_EQ(0, fsync(fd)) << errno;
+  CHECK_EQ(0, ::close(fd)) << errno;
+}
+
+void writeFully(int fd, const std::string& data) {
+  size_t written = 0u;
+  while (written < data.size()) {
+    const ssize_t result =
+        write(fd, data.data() + written, data.size() - written);
+    if (result == -1) {
+      CHECK_EQ(EINTR, errno);
+      continue;
+    }
+    written += result;
+  }
+}
+
+// Deletes the segments and checkpoints replaced by checkpoint "number".
+void deleteOlderThan(const std::string& directory, uint32_t number) {
+  std::set<uint32_t> segments, checkpoints;
+  CHECK(listFiles(directory, &segments, &checkpoints));
+  for (const uint32_t segment : segments) {
+    if (segment < number) {
+      CHECK_EQ(0, unlink(segmentPath(directory, segment).c_str())) << errno;
+    }
+  }
+  for (const uint32_t checkpoint : checkpoints) {
+    if (checkpoint < number) {
+      CHECK_EQ(0, unlink(checkpointPath(directory, checkpoint).c_str()))
+          << errno;
+    }
+  }
+  syncDirectory(directory);
+}
+
+// Revisions by update time, per item, chunk and table.
+typedef std::map<LogicalTime, std::shared_ptr<Revision> > ItemRevisions;
+typedef std::unordered_map<
+    std::string,
+    std::unordered_map<map_api_common::Id,
+                       std::unordered_map<map_api_common::Id, ItemRevisions> > >
+    RecoveredState;
+
+// Replays the records of a file. A torn record can only be at the end of the
+// last segment, reading stops there. Returns false if the file doesn't end
+// with a complete record.
+bool replayFile(const std::string& path, RecoveredState* state,
+                LogicalTime* latest_time) {
+  CHECK_NOTNULL(state);
+  CHECK_NOTNULL(latest_time);
+  std::ifstream file(path, std::ios::binary);
+  CHECK(file.is_open()) << path;
+  const std::string data((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+  // The revisions of a file are likely to stay in memory together.
+  const std::shared_ptr<google::protobuf::Arena> arena =
+      Revision::createArena();
+  size_t offset = 0u;
+  proto::WriteAheadLogRecord record;
+  while (offset + sizeof(RecordHeader) <= data.size()) {
+    RecordHeader header;
+    memcpy(&header, data.data() + offset, sizeof(header));
+    if (header.size > data.size() - offset - sizeof(header)) {
+      break;
+    }
+    const std::string payload =
+        data.substr(offset + sizeof(header), header.size);
+    if (checksum(payload) != header.checksum ||
+        !record.ParseFromString(payload)) {
+      break;
+    }
+    offset += sizeof(header) + header.size;
+
+    if (record.has_left_chunk_id()) {
+      (*state)[record.table()].erase(
+          map_api_common::Id(record.left_chunk_id()));
+      continue;
+    }
+    std::shared_ptr<Revision> revision =
+        Revision::fromProtoString(record.serialized_revision(), arena);
+    const LogicalTime update_time = revision->getUpdateTime();
+    if (*latest_time < update_time) {
+      *latest_time = update_time;
+    }
+    (*state)[record.table()][revision->getChunkId()]
+            [revision->getId<map_api_common::Id>()].emplace(update_time,
+                                                           revision);
+  }
+  LOG_IF(WARNING, offset < data.size()) << "Ignoring " << data.size() - offset
+                                        << " bytes of torn records in "
+                                        << path;
+  return offset == data.size();
+}
+
+}  // namespace
+
+WriteAheadLog& WriteAheadLog::instance() {
+  static WriteAheadLog instance;
+  return instance;
+}
+
+bool WriteAheadLog::isEnabled() { return !FLAGS_map_api_wal_directory.empty(); }
+
+void WriteAheadLog::recover(const std::string& directory,
+                            TableRevisions* result) {
+  CHECK_NOTNULL(result)->clear();
+  std::set<uint32_t> segments, checkpoints;
+  if (!listFiles(directory, &segments, &checkpoints)) {
+    return;
+  }
+  RecoveredState state;
+  LogicalTime latest_time;
+  uint32_t first_segment = 0u;
+  if (!checkpoints.empty()) {
+    first_segment = *checkpoints.rbegin();
+    // Checkpoints only get their final name once complete.
+    CHECK(replayFile(checkpointPath(directory, first_segment), &state,
+                     &latest_time));
+  }
+  for (std::set<uint32_t>::const_iterator it =
+           segments.lower_bound(first_segment);
+       it != segments.end(); ++it) {
+    replayFile(segmentPath(directory, *it), &state, &latest_time);
+  }
+
+  for (RecoveredState::value_type& table : state) {
+    for (RecoveredState::mapped_type::value_type& chunk : table.second) {
+      std::vector<std::shared_ptr<Revision> >& revisions =
+          (*result)[table.first][chunk.first];
+      for (RecoveredState::mapped_type::mapped_type::value_type& item :
+           chunk.second) {
+        for (ItemRevisions::value_type& revision : item.second) {
+          revisions.emplace_back(std::move(revision.second));
+        }
+      }
+    }
+  }
+  if (latest_time.isValid()) {
+    // Commits after recovery must be later than the recovered ones.
+    LogicalTime::synchronize(latest_time);
+  }
+}
+
+WriteAheadLog::WriteAheadLog()
+    : fd_(-1),
+      segment_(0u),
+      appended_(0u),
+      durable_(0u),
+      flushing_(false),
+      num_flushes_(0u) {}
+
+WriteAheadLog::~WriteAheadLog() {
+  if (isOpen()) {
+    close();
+  }
+}
+
+void WriteAheadLog::open(const std::string& directory) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK_EQ(-1, fd_) << "Write-ahead log already open at " << directory_;
+  makeDirectories(directory);
+  directory_ = directory;
+  std::set<uint32_t> segments, checkpoints;
+  CHECK(listFiles(directory_, &segments, &checkpoints));
+  uint32_t last = 0u;
+  if (!segments.empty()) {
+    last = *segments.rbegin();
+  }
+  if (!checkpoints.empty()) {
+    last = std::max(last, *checkpoints.rbegin());
+  }
+  openSegment(last + 1u);
+}
+
+void WriteAheadLog::close() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (flushing_ || !buffer_.empty()) {
+    if (flushing_) {
+      flushed_.wait(lock);
+    } else {
+      flush(&lock);
+    }
+  }
+  closeSegment();
+  directory_.clear();
+}
+
+bool WriteAheadLog::isOpen() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return fd_ != -1;
+}
+
+uint64_t WriteAheadLog::appendRevision(const std::string& table,
+                                       const Revision& revision) {
+  proto::WriteAheadLogRecord record;
+  record.set_table(table);
+  record.set_serialized_revision(revision.serializeUnderlying());
+  std::string framed;
+  frameRecord(record, &framed);
+  return append(framed);
+}
+
+uint64_t WriteAheadLog::appendLeave(const std::string& table,
+                                    const map_api_common::Id& chunk_id) {
+  proto::WriteAheadLogRecord record;
+  record.set_table(table);
+  chunk_id.serialize(record.mutable_left_chunk_id());
+  std::string framed;
+  frameRecord(record, &framed);
+  return append(framed);
+}
+
+void WriteAheadLog::sync(uint64_t sequence) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (durable_ < sequence) {
+    if (flushing_) {
+      flushed_.wait(lock);
+    } else {
+      flush(&lock);
+    }
+  }
+}
+
+void WriteAheadLog::checkpoint(
+    const std::function<void(const RevisionSink&)>& dump) {
+  std::lock_guard<std::mutex> checkpoint_lock(checkpoint_mutex_);
+  uint32_t number;
+  std::string directory;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    CHECK_NE(-1, fd_);
+    // Flushed records must end up in the segment they were appended to.
+    // Buffered ones are written to the new segment, which is replayed after
+    // the checkpoint.
+    while (flushing_) {
+      flushed_.wait(lock);
+    }
+    closeSegment();
+    openSegment(segment_ + 1u);
+    number = segment_;
+    directory = directory_;
+  }
+
+  const std::string path = checkpointPath(directory, number);
+  const std::string temporary_path = path + kTemporarySuffix;
+  const int fd =
+      ::open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK_NE(-1, fd) << temporary_path << ": " << errno;
+  std::string buffer;
+  proto::WriteAheadLogRecord record;
+  dump([&](const std::string& table, const Revision& revision) {
+    record.set_table(table);
+    record.set_serialized_revision(revision.serializeUnderlying());
+    frameRecord(record, &buffer);
+    if (buffer.size() >= kCheckpointWriteSize) {
+      writeFully(fd, buffer);
+      buffer.clear();
+    }
+  });
+  writeFully(fd, buffer);
+  CHECK_EQ(0, fsync(fd)) << errno;
+  CHECK_EQ(0, ::close(fd)) << errno;
+  CHECK_EQ(0, rename(temporary_path.c_str(), path.c_str())) << errno;
+  syncDirectory(directory);
+  deleteOlderThan(directory, number);
+}
+
+uint32_t WriteAheadLog::currentSegment() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return segment_;
+}
+
+uint64_t WriteAheadLog::numFlushes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_flushes_;
+}
+
+uint64_t WriteAheadLog::append(const std::string& framed_record) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fd_ == -1) {
+    return 0u;
+  }
+  buffer_.append(framed_record);
+  return ++appended_;
+}
+
+void WriteAheadLog::flush(std::unique_lock<std::mutex>* lock) {
+  CHECK_NOTNULL(lock);
+  CHECK(lock->owns_lock());
+  CHECK(!flushing_);
+  CHECK_NE(-1, fd_);
+  flushing_ = true;
+  std::string batch;
+  batch.swap(buffer_);
+  const uint64_t target = appended_;
+  const int fd = fd_;
+  lock->unlock();
+  writeFully(fd, batch);
+  CHECK_EQ(0, fdatasync(fd)) << errno;
+  lock->lock();
+  durable_ = target;
+  ++num_flushes_;
+  flushing_ = false;
+  flushed_.notify_all();
+}
+
+void WriteAheadLog::openSegment(uint32_t number) {
+  CHECK_EQ(-1, fd_);
+  const std::string path = segmentPath(directory_, number);
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  CHECK_NE(-1, fd_) << path << ": " << errno;
+  syncDirectory(directory_);
+  segment_ = number;
+}
+
+void WriteAheadLog::closeSegment() {
+  if (fd_ == -1) {
+    return;
+  }
+  CHECK(!flushing_);
+  CHECK_EQ(0, ::close(fd_)) << errno;
+  fd_ = -1;
+}
+
+}  // namespace internal
+}  // namespace map_api
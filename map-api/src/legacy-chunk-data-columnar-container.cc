@@ -0,0 +1,714 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include "map-api/legacy-chunk-data-columnar-container.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+#include <map-api-common/hash-id.h>
+
+namespace map_api {
+
+namespace {
+
+// Written as plain loops over arrays so that the compiler can vectorize them.
+template <typename ValueType>
+void scanColumnEquals(const std::vector<ValueType>& values,
+                      const ValueType& value, std::vector<uint8_t>* matches) {
+  const size_t size = values.size();
+  CHECK_NOTNULL(matches)->resize(size);
+  const ValueType* const in = values.data();
+  uint8_t* const out = matches->data();
+  for (size_t i = 0u; i < size; ++i) {
+    out[i] = in[i] == value;
+  }
+}
+
+template <typename ValueType>
+void scanColumnRange(const std::vector<ValueType>& values,
+                     const ValueType& lower, const ValueType& upper,
+                     std::vector<uint8_t>* matches) {
+  const size_t size = values.size();
+  CHECK_NOTNULL(matches)->resize(size);
+  const ValueType* const in = values.data();
+  uint8_t* const out = matches->data();
+  for (size_t i = 0u; i < size; ++i) {
+    out[i] = (lower <= in[i]) & (in[i] <= upper);
+  }
+}
+
+// Only accepts strings that map_api_common::HashId::hexString() reproduces.
+bool parseHash(const std::string& hex_string, uint64_t* first,
+               uint64_t* second) {
+  CHECK_NOTNULL(first);
+  CHECK_NOTNULL(second);
+  if (hex_string.size() != 32u ||
+      hex_string.find_first_not_of("0123456789abcdef") != std::string::npos) {
+    return false;
+  }
+  map_api_common::HashId hash;
+  CHECK(hash.fromHexString(hex_string));
+  uint64_t halves[2];
+  hash.toUint64(halves);
+  *first = halves[0];
+  *second = halves[1];
+  return true;
+}
+
+std::string hashString(uint64_t first, uint64_t second) {
+  const uint64_t halves[2] = {first, second};
+  return map_api_common::HashId(halves).hexString();
+}
+
+// Moves each value to the row that "new_rows" assigns to it and drops the
+// values of the rows that are mapped to "discarded". Kept rows must keep
+// their order. Empty arrays belong to unused types and are left alone.
+template <typename ValueType>
+void keepValues(const std::vector<size_t>& new_rows, size_t discarded,
+                std::vector<ValueType>* values) {
+  CHECK_NOTNULL(values);
+  if (values->empty()) {
+    return;
+  }
+  CHECK_EQ(values->size(), new_rows.size());
+  size_t num_kept = 0u;
+  for (size_t row = 0u; row < new_rows.size(); ++row) {
+    if (new_rows[row] == discarded) {
+      continue;
+    }
+    if (new_rows[row] != row) {
+      (*values)[new_rows[row]] = std::move((*values)[row]);
+    }
+    ++num_kept;
+  }
+  values->resize(num_kept);
+  values->shrink_to_fit();
+}
+
+}  // namespace
+
+constexpr LegacyChunkDataColumnarContainer::Row
+    LegacyChunkDataColumnarContainer::kNoRow;
+
+LegacyChunkDataColumnarContainer::~LegacyChunkDataColumnarContainer() {}
+
+LegacyChunkDataColumnarContainer::Column::Column(proto::Type type)
+    : type_(type), size_(0u) {}
+
+void LegacyChunkDataColumnarContainer::Column::append(
+    const proto::TableField& field) {
+  switch (type_) {
+    case proto::Type::BLOB: {
+      string_values_.push_back(field.blob_value());
+      break;
+    }
+    case proto::Type::DOUBLE: {
+      double_values_.push_back(field.double_value());
+      break;
+    }
+    case proto::Type::HASH128: {
+      uint64_t first = 0u, second = 0u;
+      if (!parseHash(field.string_value(), &first, &second)) {
+        irregular_hashes_.emplace(size_, field.string_value());
+      }
+      hash_first_values_.push_back(first);
+      hash_second_values_.push_back(second);
+      break;
+    }
+    case proto::Type::INT32: {
+      int32_values_.push_back(field.int_value());
+      break;
+    }
+    case proto::Type::UINT32: {
+      uint32_values_.push_back(field.unsigned_int_value());
+      break;
+    }
+    case proto::Type::INT64: {
+      int64_values_.push_back(field.long_value());
+      break;
+    }
+    case proto::Type::UINT64: {
+      uint64_values_.push_back(field.unsigned_long_value());
+      break;
+    }
+    case proto::Type::STRING: {
+      string_values_.push_back(field.string_value());
+      break;
+    }
+    default: { LOG(FATAL) << "Unknown field type " << type_; }
+  }
+  ++size_;
+}
+
+void LegacyChunkDataColumnarContainer::Column::get(
+    Row row, proto::TableField* field) const {
+  CHECK_NOTNULL(field);
+  CHECK_LT(row, size_);
+  field->set_type(type_);
+  switch (type_) {
+    case proto::Type::BLOB: {
+      field->set_blob_value(string_values_[row]);
+      return;
+    }
+    case proto::Type::DOUBLE: {
+      field->set_double_value(double_values_[row]);
+      return;
+    }
+    case proto::Type::HASH128: {
+      std::unordered_map<Row, std::string>::const_iterator irregular =
+          irregular_hashes_.find(row);
+      if (irregular != irregular_hashes_.end()) {
+        field->set_string_value(irregular->second);
+      } else {
+        field->set_string_value(
+            hashString(hash_first_values_[row], hash_second_values_[row]));
+      }
+      return;
+    }
+    case proto::Type::INT32: {
+      field->set_int_value(int32_values_[row]);
+      return;
+    }
+    case proto::Type::UINT32: {
+      field->set_unsigned_int_value(uint32_values_[row]);
+      return;
+    }
+    case proto::Type::INT64: {
+      field->set_long_value(int64_values_[row]);
+      return;
+    }
+    case proto::Type::UINT64: {
+      field->set_unsigned_long_value(uint64_values_[row]);
+      return;
+    }
+    case proto::Type::STRING: {
+      field->set_string_value(string_values_[row]);
+      return;
+    }
+  }
+  LOG(FATAL) << "Unknown field type " << type_;
+}
+
+void LegacyChunkDataColumnarContainer::Column::scanEquals(
+    const proto::TableField& field, std::vector<uint8_t>* matches) const {
+  CHECK_NOTNULL(matches);
+  switch (type_) {
+    case proto::Type::BLOB: {
+      scanColumnEquals(string_values_, field.blob_value(), matches);
+      return;
+    }
+    case proto::Type::DOUBLE: {
+      scanColumnEquals(double_values_, field.double_value(), matches);
+      return;
+    }
+    case proto::Type::HASH128: {
+      uint64_t first, second;
+      if (parseHash(field.string_value(), &first, &second)) {
+        std::vector<uint8_t> second_matches;
+        scanColumnEquals(hash_first_values_, first, matches);
+        scanColumnEquals(hash_second_values_, second, &second_matches);
+        for (size_t i = 0u; i < size_; ++i) {
+          (*matches)[i] &= second_matches[i];
+        }
+        // Irregular rows hold zeros in the value columns.
+        for (const std::unordered_map<Row, std::string>::value_type&
+                 irregular : irregular_hashes_) {
+          (*matches)[irregular.first] = 0u;
+        }
+      } else {
+        matches->assign(size_, 0u);
+        for (const std::unordered_map<Row, std::string>::value_type&
+                 irregular : irregular_hashes_) {
+          (*matches)[irregular.first] =
+              irregular.second == field.string_value();
+        }
+      }
+      return;
+    }
+    case proto::Type::INT32: {
+      scanColumnEquals(int32_values_, field.int_value(), matches);
+      return;
+    }
+    case proto::Type::UINT32: {
+      scanColumnEquals(uint32_values_, field.unsigned_int_value(), matches);
+      return;
+    }
+    case proto::Type::INT64: {
+      scanColumnEquals(int64_values_, field.long_value(), matches);
+      return;
+    }
+    case proto::Type::UINT64: {
+      scanColumnEquals(uint64_values_, field.unsigned_long_value(), matches);
+      return;
+    }
+    case proto::Type::STRING: {
+      scanColumnEquals(string_values_, field.string_value(), matches);
+      return;
+    }
+  }
+  LOG(FATAL) << "Unknown field type " << type_;
+}
+
+void LegacyChunkDataColumnarContainer::Column::scanRange(
+    const proto::TableField& lower, const proto::TableField& upper,
+    std::vector<uint8_t>* matches) const {
+  CHECK_NOTNULL(matches);
+  switch (type_) {
+    case proto::Type::DOUBLE: {
+      scanColumnRange(double_values_, lower.double_value(),
+                      upper.double_value(), matches);
+      return;
+    }
+    case proto::Type::INT32: {
+      scanColumnRange(int32_values_, lower.int_value(), upper.int_value(),
+                      matches);
+      return;
+    }
+    case proto::Type::UINT32: {
+      scanColumnRange(uint32_values_, lower.unsigned_int_value(),
+                      upper.unsigned_int_value(), matches);
+      return;
+    }
+    case proto::Type::INT64: {
+      scanColumnRange(int64_values_, lower.long_value(), upper.long_value(),
+                      matches);
+      return;
+    }
+    case proto::Type::UINT64: {
+      scanColumnRange(uint64_values_, lower.unsigned_long_value(),
+                      upper.unsigned_long_value(), matches);
+      return;
+    }
+    default: { LOG(FATAL) << "Range scan on non-numeric column " << type_; }
+  }
+}
+
+void LegacyChunkDataColumnarContainer::Column::scanCondition(
+    const FieldPredicate::FieldCondition& condition,
+    std::vector<uint8_t>* matches) const {
+  CHECK_NOTNULL(matches)->resize(size_);
+  proto::TableField field;
+  for (Row row = 0u; row < size_; ++row) {
+    get(row, &field);
+    (*matches)[row] = condition(field);
+  }
+}
+
+void LegacyChunkDataColumnarContainer::Column::keepRows(
+    const std::vector<Row>& new_rows, Row num_kept) {
+  CHECK_EQ(new_rows.size(), size_);
+  keepValues(new_rows, kNoRow, &int32_values_);
+  keepValues(new_rows, kNoRow, &uint32_values_);
+  keepValues(new_rows, kNoRow, &int64_values_);
+  keepValues(new_rows, kNoRow, &uint64_values_);
+  keepValues(new_rows, kNoRow, &double_values_);
+  keepValues(new_rows, kNoRow, &hash_first_values_);
+  keepValues(new_rows, kNoRow, &hash_second_values_);
+  keepValues(new_rows, kNoRow, &string_values_);
+  std::unordered_map<Row, std::string> irregular_hashes;
+  for (std::pair<const Row, std::string>& irregular : irregular_hashes_) {
+    if (new_rows[irregular.first] != kNoRow) {
+      irregular_hashes.emplace(new_rows[irregular.first],
+                               std::move(irregular.second));
+    }
+  }
+  irregular_hashes_.swap(irregular_hashes);
+  size_ = num_kept;
+}
+
+void LegacyChunkDataColumnarContainer::Column::clear() {
+  int32_values_.clear();
+  uint32_values_.clear();
+  int64_values_.clear();
+  uint64_values_.clear();
+  double_values_.clear();
+  hash_first_values_.clear();
+  hash_second_values_.clear();
+  string_values_.clear();
+  irregular_hashes_.clear();
+  size_ = 0u;
+}
+
+bool LegacyChunkDataColumnarContainer::initImpl() {
+  clearImpl();
+  columns_.clear();
+  for (int i = 0; i < descriptor_->fields_size(); ++i) {
+    columns_.emplace_back(descriptor_->fields(i));
+  }
+  return true;
+}
+
+bool LegacyChunkDataColumnarContainer::insertImpl(
+    const Revision::ConstPtr& query) {
+  CHECK(query != nullptr);
+  const map_api_common::Id id = query->getId<map_api_common::Id>();
+  if (items_.find(id) != items_.end()) {
+    return false;
+  }
+  items_[id].push_back(appendRow(*query));
+  chunk_items_[query->getChunkId()].emplace(id);
+  return true;
+}
+
+bool LegacyChunkDataColumnarContainer::bulkInsertImpl(
+    const MutableRevisionMap& query) {
+  for (const MutableRevisionMap::value_type& pair : query) {
+    if (items_.find(pair.first) != items_.end()) {
+      return false;
+    }
+  }
+  for (const MutableRevisionMap::value_type& pair : query) {
+    items_[pair.first].push_back(appendRow(*pair.second));
+    chunk_items_[pair.second->getChunkId()].emplace(pair.first);
+  }
+  return true;
+}
+
+bool LegacyChunkDataColumnarContainer::patchImpl(
+    const Revision::ConstPtr& query) {
+  CHECK(query != nullptr);
+  const map_api_common::Id id = query->getId<map_api_common::Id>();
+  const uint64_t time = query->getUpdateTime().serialize();
+  RowHistoryMap::iterator found = items_.find(id);
+  if (found == items_.end()) {
+    found = items_.emplace(id, RowHistory()).first;
+    chunk_items_[query->getChunkId()].emplace(id);
+  }
+  RowHistory& rows = found->second;
+  RowHistory::iterator after = std::upper_bound(
+      rows.begin(), rows.end(), time, [this](uint64_t time, Row row) {
+        return time < update_times_[row];
+      });
+  if (after != rows.begin()) {
+    CHECK_NE(time, update_times_[*(after - 1)]);
+  }
+  if (after != rows.end()) {
+    LOG(WARNING) << "Patching, not in front!";  // shouldn't usually be the case
+  }
+  rows.insert(after, appendRow(*query));
+  return true;
+}
+
+Revision::ConstPtr LegacyChunkDataColumnarContainer::getByIdImpl(
+    const map_api_common::Id& id, const LogicalTime& time) const {
+  RowHistoryMap::const_iterator found = items_.find(id);
+  if (found == items_.end()) {
+    return Revision::ConstPtr();
+  }
+  const Row row = latestRowAt(found->second, time);
+  if (row == kNoRow) {
+    return Revision::ConstPtr();
+  }
+  return materialize(row);
+}
+
+void LegacyChunkDataColumnarContainer::findByPredicateImpl(
+    const FieldPredicate& predicate, const LogicalTime& time,
+    ConstRevisionMap* dest) const {
+  CHECK_NOTNULL(dest)->clear();
+  forEachMatchingRowAtTime<Revision::ConstPtr>(
+      predicate, time, [this](Row row) { return materialize(row); },
+      [&dest](const map_api_common::Id& id, const Revision::ConstPtr& item) {
+        CHECK(dest->emplace(id, item).second);
+      });
+}
+
+int LegacyChunkDataColumnarContainer::countByPredicateImpl(
+    const FieldPredicate& predicate, const LogicalTime& time) const {
+  int count = 0;
+  forEachMatchingRowAtTime<Row>(
+      predicate, time, [](Row row) { return row; },
+      [&count](const map_api_common::Id& /*id*/, const Row& /*row*/) {
+        ++count;
+      });
+  return count;
+}
+
+void LegacyChunkDataColumnarContainer::forEachFoundImpl(
+    const FieldPredicate& predicate, const LogicalTime& time,
+    const FoundAction& action) const {
+  forEachMatchingRowAtTime<Revision::ConstPtr>(
+      predicate, time, [this](Row row) { return materialize(row); },
+      [&action](const map_api_common::Id& /*id*/,
+                const Revision::ConstPtr& item) { action(item); });
+}
+
+void LegacyChunkDataColumnarContainer::getAvailableIdsImpl(
+    const LogicalTime& time, std::vector<map_api_common::Id>* ids) const {
+  CHECK_NOTNULL(ids)->clear();
+  ids->reserve(items_.size());
+  scan<RowHistoryMap, Row>(
+      items_,
+      [this, &time](const RowHistoryMap::value_type& item, Row* row) {
+        *row = latestRowAt(item.second, time);
+        return *row != kNoRow;
+      },
+      [ids](const map_api_common::Id& id, const Row& /*row*/) {
+        ids->emplace_back(id);
+      });
+}
+
+bool LegacyChunkDataColumnarContainer::insertUpdatedImpl(
+    const std::shared_ptr<Revision>& query) {
+  return patchImpl(query);
+}
+
+void LegacyChunkDataColumnarContainer::findHistoryByRevisionImpl(
+    int key, const Revision& value_holder, const LogicalTime& time,
+    HistoryMap* dest) const {
+  CHECK_NOTNULL(dest)->clear();
+  std::vector<uint8_t> matches;
+  if (key >= 0) {
+    CHECK_LT(static_cast<size_t>(key), columns_.size());
+    columns_[key].scanEquals(
+        value_holder.underlying_revision_->custom_field_values(key), &matches);
+  }
+  for (const RowHistoryMap::value_type& item : items_) {
+    // using current state for filter
+    if (key < 0 || matches[item.second.back()]) {
+      materializeHistory(item.second, time, &(*dest)[item.first]);
+    }
+  }
+}
+
+void LegacyChunkDataColumnarContainer::chunkHistory(
+    const map_api_common::Id& chunk_id, const LogicalTime& time,
+    HistoryMap* dest) const {
+  CHECK_NOTNULL(dest)->clear();
+  std::unordered_map<map_api_common::Id, map_api_common::IdSet>::const_iterator
+      chunk = chunk_items_.find(chunk_id);
+  if (chunk == chunk_items_.end()) {
+    return;
+  }
+  dest->reserve(chunk->second.size());
+  for (const map_api_common::Id& id : chunk->second) {
+    RowHistoryMap::const_iterator found = items_.find(id);
+    CHECK(found != items_.end());
+    materializeHistory(found->second, time, &(*dest)[id]);
+  }
+}
+
+void LegacyChunkDataColumnarContainer::itemHistoryImpl(
+    const map_api_common::Id& id, const LogicalTime& time,
+    History* dest) const {
+  CHECK_NOTNULL(dest)->clear();
+  RowHistoryMap::const_iterator found = items_.find(id);
+  CHECK(found != items_.end());
+  materializeHistory(found->second, time, dest);
+}
+
+void LegacyChunkDataColumnarContainer::clearImpl() {
+  items_.clear();
+  chunk_items_.clear();
+  ids_.clear();
+  chunk_ids_.clear();
+  insert_times_.clear();
+  update_times_.clear();
+  removed_.clear();
+  chunk_tracking_.clear();
+  for (Column& column : columns_) {
+    column.clear();
+  }
+}
+
+size_t LegacyChunkDataColumnarContainer::compactHistoryImpl(
+    const LogicalTime& watermark) {
+  const uint64_t serialized_watermark = watermark.serialize();
+  std::vector<uint8_t> keep(ids_.size(), 1u);
+  size_t num_bytes = 0u;
+  for (RowHistoryMap::value_type& item : items_) {
+    RowHistory& rows = item.second;
+    RowHistory::iterator after = std::upper_bound(
+        rows.begin(), rows.end(), serialized_watermark,
+        [this](uint64_t time, Row row) { return time < update_times_[row]; });
+    if (after - rows.begin() < 2) {
+      continue;
+    }
+    for (RowHistory::iterator it = rows.begin(); it != after - 1; ++it) {
+      keep[*it] = 0u;
+      num_bytes += materialize(*it)->byteSize();
+    }
+    rows.erase(rows.begin(), after - 1);
+  }
+  if (num_bytes == 0u) {
+    return 0u;
+  }
+
+  // Each array is compacted in place: the kept rows move down, in order, to
+  // close the gaps of the discarded ones.
+  std::vector<Row> new_rows(keep.size(), kNoRow);
+  Row num_kept = 0u;
+  for (Row row = 0u; row < keep.size(); ++row) {
+    if (keep[row]) {
+      new_rows[row] = num_kept;
+      ++num_kept;
+    }
+  }
+  keepValues(new_rows, kNoRow, &ids_);
+  keepValues(new_rows, kNoRow, &chunk_ids_);
+  keepValues(new_rows, kNoRow, &insert_times_);
+  keepValues(new_rows, kNoRow, &update_times_);
+  keepValues(new_rows, kNoRow, &removed_);
+  std::unordered_map<Row, std::vector<proto::TableChunkTracking>>
+      chunk_tracking;
+  for (std::pair<const Row, std::vector<proto::TableChunkTracking>>& tracking :
+       chunk_tracking_) {
+    if (new_rows[tracking.first] != kNoRow) {
+      chunk_tracking.emplace(new_rows[tracking.first],
+                             std::move(tracking.second));
+    }
+  }
+  chunk_tracking_.swap(chunk_tracking);
+  for (Column& column : columns_) {
+    column.keepRows(new_rows, num_kept);
+  }
+  for (RowHistoryMap::value_type& item : items_) {
+    for (Row& row : item.second) {
+      row = new_rows[row];
+      CHECK_NE(row, kNoRow);
+    }
+  }
+  return num_bytes;
+}
+
+LegacyChunkDataColumnarContainer::Row
+LegacyChunkDataColumnarContainer::appendRow(const Revision& revision) {
+  const proto::Revision& revision_proto = *revision.underlying_revision_;
+  CHECK_LE(static_cast<size_t>(revision_proto.custom_field_values_size()),
+           columns_.size());
+  const Row row = ids_.size();
+  ids_.push_back(revision.getId<map_api_common::Id>());
+  chunk_ids_.push_back(revision.getChunkId());
+  insert_times_.push_back(revision.getInsertTime().serialize());
+  update_times_.push_back(revision.getUpdateTime().serialize());
+  removed_.push_back(revision.isRemoved());
+  for (size_t i = 0u; i < columns_.size(); ++i) {
+    if (i < static_cast<size_t>(revision_proto.custom_field_values_size())) {
+      columns_[i].append(revision_proto.custom_field_values(i));
+    } else {
+      columns_[i].append(proto::TableField());
+    }
+  }
+  if (revision_proto.chunk_tracking_size() > 0) {
+    chunk_tracking_[row].assign(revision_proto.chunk_tracking().begin(),
+                                revision_proto.chunk_tracking().end());
+  }
+  return row;
+}
+
+Revision::ConstPtr LegacyChunkDataColumnarContainer::materialize(
+    Row row) const {
+  CHECK_LT(row, ids_.size());
+  std::shared_ptr<proto::Revision> revision_proto(new proto::Revision);
+  ids_[row].serialize(revision_proto->mutable_id());
+  revision_proto->set_insert_time(insert_times_[row]);
+  revision_proto->set_update_time(update_times_[row]);
+  if (removed_[row]) {
+    revision_proto->set_removed(true);
+  }
+  if (chunk_ids_[row].isValid()) {
+    chunk_ids_[row].serialize(revision_proto->mutable_chunk_id());
+  }
+  for (const Column& column : columns_) {
+    column.get(row, revision_proto->add_custom_field_values());
+  }
+  std::unordered_map<Row, std::vector<proto::TableChunkTracking>>::
+      const_iterator tracking = chunk_tracking_.find(row);
+  if (tracking != chunk_tracking_.end()) {
+    for (const proto::TableChunkTracking& table_tracking : tracking->second) {
+      revision_proto->add_chunk_tracking()->CopyFrom(table_tracking);
+    }
+  }
+  Revision::ConstPtr result;
+  Revision::fromProto(revision_proto, &result);
+  return result;
+}
+
+void LegacyChunkDataColumnarContainer::materializeHistory(
+    const RowHistory& rows, const LogicalTime& time, History* dest) const {
+  CHECK_NOTNULL(dest)->clear();
+  const uint64_t serialized_time = time.serialize();
+  for (Row row : rows) {
+    if (update_times_[row] <= serialized_time) {
+      dest->insert(materialize(row));
+    }
+  }
+}
+
+LegacyChunkDataColumnarContainer::Row
+LegacyChunkDataColumnarContainer::latestRowAt(const RowHistory& rows,
+                                              const LogicalTime& time) const {
+  RowHistory::const_iterator after = std::upper_bound(
+      rows.begin(), rows.end(), time.serialize(),
+      [this](uint64_t time, Row row) { return time < update_times_[row]; });
+  if (after == rows.begin() || removed_[*(after - 1)]) {
+    return kNoRow;
+  }
+  return *(after - 1);
+}
+
+template <typename Selected>
+void LegacyChunkDataColumnarContainer::forEachMatchingRowAtTime(
+    const FieldPredicate& predicate, const LogicalTime& time,
+    const std::function<Selected(Row row)>& select,
+    const std::function<void(const map_api_common::Id& id,
+                             const Selected& selected)>& action) const {
+  const bool filter = !predicate.empty();
+  std::vector<uint8_t> matches;
+  std::vector<uint8_t> term_matches;
+  for (const FieldPredicate::Term& term : predicate.terms()) {
+    CHECK_LT(static_cast<size_t>(term.key), columns_.size());
+    std::vector<uint8_t>* out = matches.empty() ? &matches : &term_matches;
+    const Column& column = columns_[term.key];
+    switch (term.type) {
+      case FieldPredicate::TermType::kEquals: {
+        column.scanEquals(term.value, out);
+        break;
+      }
+      case FieldPredicate::TermType::kRange: {
+        column.scanRange(term.value, term.upper, out);
+        break;
+      }
+      case FieldPredicate::TermType::kCondition: {
+        column.scanCondition(term.matches, out);
+        break;
+      }
+    }
+    if (out != &matches) {
+      for (size_t i = 0u; i < matches.size(); ++i) {
+        matches[i] &= term_matches[i];
+      }
+    }
+  }
+  scan<RowHistoryMap, Selected>(
+      items_, [this, filter, &time, &matches, &select](
+                  const RowHistoryMap::value_type& item, Selected* selected) {
+        const Row row = latestRowAt(item.second, time);
+        if (row == kNoRow || (filter && !matches[row])) {
+          return false;
+        }
+        *selected = select(row);
+        return true;
+      }, action);
+}
+
+}  // namespace map_api
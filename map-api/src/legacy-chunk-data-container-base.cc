@@ -21,8 +21,31 @@
 
 #include "map-api/legacy-chunk-data-container-base.h"
 
+#include <algorithm>
+#include <thread>
+#include <utility>
+
+#include <gflags/gflags.h>
+
+DEFINE_uint64(map_api_parallel_scan_threshold, 100000u,
+              "Containers with at least this many items are scanned on "
+              "several threads by find, count, dump and getAvailableIds.");
+DEFINE_uint64(map_api_parallel_scan_threads, 0u,
+              "Amount of threads scanning a large container. 0 uses all "
+              "hardware threads.");
+
 namespace map_api {
 
+size_t LegacyChunkDataContainerBase::numScanThreads(size_t map_size) {
+  if (map_size < FLAGS_map_api_parallel_scan_threshold) {
+    return 1u;
+  }
+  if (FLAGS_map_api_parallel_scan_threads > 0u) {
+    return FLAGS_map_api_parallel_scan_threads;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
 bool LegacyChunkDataContainerBase::insert(
     const LogicalTime& time, const std::shared_ptr<Revision>& query) {
   std::lock_guard<std::mutex> lock(access_mutex_);
@@ -35,7 +58,11 @@ bool LegacyChunkDataContainerBase::insert(
       << "Attempted to insert element with invalid ID";
   query->setInsertTime(time);
   query->setUpdateTime(time);
-  return insertImpl(query);
+  if (!insertImpl(query)) {
+    return false;
+  }
+  countWritten(*query);
+  return true;
 }
 
 bool LegacyChunkDataContainerBase::bulkInsert(const LogicalTime& time,
@@ -54,7 +81,13 @@ bool LegacyChunkDataContainerBase::bulkInsert(const LogicalTime& time,
     id_revision.second->setInsertTime(time);
     id_revision.second->setUpdateTime(time);
   }
-  return bulkInsertImpl(query);
+  if (!bulkInsertImpl(query)) {
+    return false;
+  }
+  for (const MutableRevisionMap::value_type& id_revision : query) {
+    countWritten(*id_revision.second);
+  }
+  return true;
 }
 
 bool LegacyChunkDataContainerBase::patch(
@@ -66,11 +99,104 @@ bool LegacyChunkDataContainerBase::patch(
   CHECK(query->structureMatch(*reference)) << "Bad structure of patch revision";
   CHECK(query->getId<map_api_common::Id>().isValid())
       << "Attempted to insert element with invalid ID";
-  return patchImpl(query);
+  if (!patchImpl(query)) {
+    return false;
+  }
+  countWritten(*query);
+  return true;
 }
 
 LegacyChunkDataContainerBase::History::~History() {}
 
+void LegacyChunkDataContainerBase::History::clear() {
+  oldest_.reset();
+  older_.clear();
+}
+
+bool LegacyChunkDataContainerBase::History::insert(
+    const value_type& revision) {
+  CHECK(revision != nullptr);
+  if (empty()) {
+    oldest_ = revision;
+    return true;
+  }
+  if (older_.empty()) {
+    older_.reserve(2u);
+    older_.emplace_back(std::move(oldest_));
+  }
+  const LogicalTime time = revision->getUpdateTime();
+  std::vector<value_type>::iterator after = std::upper_bound(
+      older_.begin(), older_.end(), time,
+      [](const LogicalTime& time, const value_type& revision) {
+        return time < revision->getUpdateTime();
+      });
+  if (after != older_.begin()) {
+    CHECK_NE(time, (*(after - 1))->getUpdateTime());
+  }
+  const bool is_latest = after == older_.end();
+  older_.insert(after, revision);
+  return is_latest;
+}
+
+void LegacyChunkDataContainerBase::History::trimToTime(
+    const LogicalTime& time) {
+  if (older_.empty()) {
+    if (oldest_ && time < oldest_->getUpdateTime()) {
+      oldest_.reset();
+    }
+    return;
+  }
+  older_.erase(std::upper_bound(older_.begin(), older_.end(), time,
+                                [](const LogicalTime& time,
+                                   const value_type& revision) {
+                                  return time < revision->getUpdateTime();
+                                }),
+               older_.end());
+  if (older_.size() == 1u) {
+    oldest_ = std::move(older_.front());
+    std::vector<value_type>().swap(older_);
+  }
+}
+
+void LegacyChunkDataContainerBase::History::assign(const View& view) {
+  clear();
+  if (view.size() == 1u) {
+    oldest_ = *view.begin();
+    return;
+  }
+  // The underlying pointers of the reverse iterators are in update time order.
+  older_.assign(view.end().base(), view.begin().base());
+}
+
+size_t LegacyChunkDataContainerBase::History::discardSupersededAt(
+    const LogicalTime& time) {
+  if (older_.empty()) {
+    return 0u;
+  }
+  std::vector<value_type>::iterator after = std::upper_bound(
+      older_.begin(), older_.end(), time,
+      [](const LogicalTime& time, const value_type& revision) {
+        return time < revision->getUpdateTime();
+      });
+  if (after - older_.begin() < 2) {
+    return 0u;
+  }
+  const std::vector<value_type>::iterator valid_at_time = after - 1;
+  size_t num_bytes = 0u;
+  for (std::vector<value_type>::iterator it = older_.begin();
+       it != valid_at_time; ++it) {
+    num_bytes += (*it)->byteSize();
+  }
+  older_.erase(older_.begin(), valid_at_time);
+  if (older_.size() == 1u) {
+    oldest_ = std::move(older_.front());
+    std::vector<value_type>().swap(older_);
+  } else {
+    older_.shrink_to_fit();
+  }
+  return num_bytes;
+}
+
 void LegacyChunkDataContainerBase::findHistoryByRevision(
     int key, const Revision& valueHolder, const LogicalTime& time,
     HistoryMap* dest) const {
@@ -81,8 +207,28 @@ void LegacyChunkDataContainerBase::findHistoryByRevision(
   return findHistoryByRevisionImpl(key, valueHolder, time, dest);
 }
 
+void LegacyChunkDataContainerBase::forEachHistory(
+    int key, const Revision& value_holder, const LogicalTime& time,
+    const HistoryVisitor& visitor) const {
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  CHECK(isInitialized()) << "Attempted to find in non-initialized table";
+  CHECK(visitor);
+  CHECK(time < LogicalTime::sample());
+  forEachHistoryImpl(key, value_holder, time, visitor);
+}
+
+void LegacyChunkDataContainerBase::forEachChunkHistory(
+    const map_api_common::Id& chunk_id, const LogicalTime& time,
+    const HistoryVisitor& visitor) const {
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  CHECK(isInitialized()) << "Attempted to read from non-initialized table";
+  CHECK(visitor);
+  forEachChunkHistoryImpl(chunk_id, time, visitor);
+}
+
 void LegacyChunkDataContainerBase::update(
     const LogicalTime& time, const std::shared_ptr<Revision>& query) {
+  std::lock_guard<std::mutex> lock(access_mutex_);
   CHECK(query != nullptr);
   CHECK(isInitialized()) << "Attempted to update in non-initialized table";
   std::shared_ptr<Revision> reference = getTemplate();
@@ -93,10 +239,12 @@ void LegacyChunkDataContainerBase::update(
   LogicalTime update_time = time;
   query->setUpdateTime(update_time);
   CHECK(insertUpdatedImpl(query));
+  countWritten(*query);
 }
 
 void LegacyChunkDataContainerBase::remove(
     const LogicalTime& time, const std::shared_ptr<Revision>& query) {
+  std::lock_guard<std::mutex> lock(access_mutex_);
   CHECK(query != nullptr);
   CHECK(isInitialized());
   std::shared_ptr<Revision> reference = getTemplate();
@@ -106,11 +254,128 @@ void LegacyChunkDataContainerBase::remove(
   query->setUpdateTime(update_time);
   query->setRemoved();
   CHECK(insertUpdatedImpl(query));
+  countWritten(*query);
 }
 
 void LegacyChunkDataContainerBase::clear() {
   std::lock_guard<std::mutex> lock(access_mutex_);
   clearImpl();
+  latest_revisions_.clear();
+  num_items_ = 0u;
+  items_size_bytes_ = 0u;
+  latest_counted_time_ = LogicalTime();
+  item_filter_ = internal::ItemIdFilter();
+}
+
+size_t LegacyChunkDataContainerBase::compactHistory(
+    const LogicalTime& watermark) {
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  CHECK(isInitialized());
+  CHECK(watermark.isValid());
+  return compactHistoryImpl(watermark);
+}
+
+bool LegacyChunkDataContainerBase::countsAt(const LogicalTime& time,
+                                            size_t* num_items,
+                                            size_t* size_bytes) const {
+  CHECK_NOTNULL(num_items);
+  CHECK_NOTNULL(size_bytes);
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  if (time < latest_counted_time_) {
+    return false;
+  }
+  *num_items = num_items_;
+  *size_bytes = items_size_bytes_;
+  return true;
+}
+
+void LegacyChunkDataContainerBase::recount(
+    const std::function<void(const LatestRevisionAction&)>& for_each_latest) {
+  latest_revisions_.clear();
+  num_items_ = 0u;
+  items_size_bytes_ = 0u;
+  latest_counted_time_ = LogicalTime();
+  item_filter_ = internal::ItemIdFilter();
+  for_each_latest([this](const map_api_common::Id& id,
+                         const LogicalTime& update_time, bool removed,
+                         int byte_size) {
+    countWritten(id, update_time, removed, byte_size);
+  });
+}
+
+void LegacyChunkDataContainerBase::countWritten(const Revision& revision) {
+  countWritten(revision.getId<map_api_common::Id>(), revision.getUpdateTime(),
+               revision.isRemoved(), revision.byteSize());
+}
+
+void LegacyChunkDataContainerBase::countWritten(
+    const map_api_common::Id& id, const LogicalTime& update_time,
+    bool removed, int byte_size) {
+  std::pair<std::unordered_map<map_api_common::Id, LatestRevision>::iterator,
+            bool> emplaced = latest_revisions_.emplace(id, LatestRevision());
+  LatestRevision& latest = emplaced.first->second;
+  if (!emplaced.second) {
+    if (update_time < latest.update_time) {
+      // Patched in behind the latest revision.
+      return;
+    }
+    if (!latest.removed) {
+      --num_items_;
+      items_size_bytes_ -= latest.byte_size;
+    }
+  } else {
+    registerNewItem(emplaced.first->first);
+  }
+  latest.update_time = update_time;
+  latest.removed = removed;
+  latest.byte_size = removed ? 0 : byte_size;
+  if (!latest.removed) {
+    ++num_items_;
+    items_size_bytes_ += latest.byte_size;
+  }
+  if (latest_counted_time_ < update_time) {
+    latest_counted_time_ = update_time;
+  }
+}
+
+void LegacyChunkDataContainerBase::getKnownItemIdsImpl(
+    std::vector<map_api_common::Id>* ids) const {
+  CHECK_NOTNULL(ids)->clear();
+  ids->reserve(latest_revisions_.size());
+  for (const std::unordered_map<map_api_common::Id, LatestRevision>::value_type&
+           id_latest : latest_revisions_) {
+    ids->emplace_back(id_latest.first);
+  }
+}
+
+void LegacyChunkDataContainerBase::visitItemHistoryImpl(
+    const map_api_common::Id& id, const LogicalTime& time,
+    const HistoryVisitor& visitor) const {
+  History history;
+  itemHistoryImpl(id, time, &history);
+  visitor(id, History::View(history.begin(), history.end()));
+}
+
+void LegacyChunkDataContainerBase::forEachHistoryImpl(
+    int key, const Revision& value_holder, const LogicalTime& time,
+    const HistoryVisitor& visitor) const {
+  HistoryMap histories;
+  findHistoryByRevisionImpl(key, value_holder, time, &histories);
+  for (const HistoryMap::value_type& history : histories) {
+    visitor(history.first,
+            History::View(history.second.begin(), history.second.end()));
+  }
+}
+
+void LegacyChunkDataContainerBase::forEachChunkHistoryImpl(
+    const map_api_common::Id& chunk_id, const LogicalTime& time,
+    const HistoryVisitor& visitor) const {
+  HistoryMap histories;
+  chunkHistory(chunk_id, time, &histories);
+  for (const HistoryMap::value_type& history : histories) {
+    visitor(history.first,
+            History::View(history.second.begin(), history.second.end()));
+  }
 }
 
 }  // namespace map_api
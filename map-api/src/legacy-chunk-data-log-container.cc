@@ -0,0 +1,920 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include "map-api/legacy-chunk-data-log-container.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>  // NOLINT
+#include <limits>
+#include <set>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <map-api-common/unique-id.h>
+
+#include "map-api/peer-id.h"
+#include "./core.pb.h"
+
+DEFINE_string(map_api_log_container_directory, "/tmp/map_api_log",
+              "Root directory of the chunk logs of "
+              "LegacyChunkDataLogContainer.");
+DEFINE_string(map_api_log_container_peer_name, "",
+              "Directory below --map_api_log_container_directory that holds "
+              "the chunk logs of this peer. Defaults to the address of the "
+              "peer. A peer needs a name that outlives it to recover its "
+              "chunks after a restart.");
+DEFINE_uint64(map_api_log_segment_size_mb, 64u,
+              "Size of the segment files of LegacyChunkDataLogContainer.");
+DEFINE_double(map_api_log_compaction_threshold, 0.5,
+              "Sealed log segments are rewritten once their live records take "
+              "up less than this fraction of them.");
+
+namespace map_api {
+
+struct LegacyChunkDataLogContainer::Segment {
+  ~Segment();
+
+  uint32_t number;
+  int fd;
+  char* data;
+  // Mapped bytes.
+  size_t capacity;
+  // Bytes taken up by records.
+  size_t size;
+  // Bytes taken up by records that are still indexed.
+  size_t live_bytes;
+  bool sealed;
+};
+
+namespace {
+
+constexpr uint32_t kRecordMagic = 0x4c50414d;  // "MAPL"
+enum RecordType : uint32_t {
+  kRevisionRecord = 1u,
+  kWatermarkRecord = 2u
+};
+constexpr char kLogExtension[] = "log";
+constexpr char kIndexExtension[] = "idx";
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t type;
+  // Size of the serialized revision that follows the header.
+  uint32_t payload_size;
+  uint32_t is_removed;
+  // Of the header, with the checksum set to 0, and of the payload.
+  uint64_t checksum;
+  uint64_t id[2];
+  uint64_t chunk_id[2];
+  // For watermark records, the compaction watermark.
+  uint64_t update_time;
+};
+static_assert(sizeof(RecordHeader) == 64u, "Unexpected record header size.");
+
+struct IndexEntry {
+  RecordHeader header;
+  uint64_t offset;
+};
+
+// Records are padded such that all headers are aligned.
+inline size_t recordSize(size_t payload_size) {
+  return sizeof(RecordHeader) + ((payload_size + 7u) & ~size_t(7u));
+}
+
+inline size_t segmentCapacity() {
+  return FLAGS_map_api_log_segment_size_mb << 20;
+}
+
+// 64 bit FNV-1a.
+inline uint64_t checksum(const char* data, size_t size, uint64_t hash) {
+  for (size_t i = 0u; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+uint64_t recordChecksum(const RecordHeader& header, const char* payload) {
+  RecordHeader unsummed = header;
+  unsummed.checksum = 0u;
+  return checksum(payload, header.payload_size,
+                  checksum(reinterpret_cast<const char*>(&unsummed),
+                           sizeof(unsummed), 14695981039346656037ull));
+}
+
+// Returns the header of the record at "offset", or nullptr if there is no
+// complete record.
+const RecordHeader* recordAt(const char* data, size_t size, size_t offset,
+                             bool verify) {
+  if (offset + sizeof(RecordHeader) > size) {
+    return nullptr;
+  }
+  const RecordHeader* header =
+      reinterpret_cast<const RecordHeader*>(data + offset);
+  if (header->magic != kRecordMagic ||
+      recordSize(header->payload_size) > size - offset) {
+    return nullptr;
+  }
+  if (verify &&
+      header->checksum !=
+          recordChecksum(*header, data + offset + sizeof(RecordHeader))) {
+    return nullptr;
+  }
+  return header;
+}
+
+std::string tableDirectory(const std::string& table_name) {
+  const std::string peer_name = FLAGS_map_api_log_container_peer_name.empty()
+                                    ? PeerId::self().ipPort()
+                                    : FLAGS_map_api_log_container_peer_name;
+  return FLAGS_map_api_log_container_directory + "/" + peer_name + "/" +
+         table_name;
+}
+
+void makeDirectories(const std::string& path) {
+  for (size_t end = path.find('/', 1u);; end = path.find('/', end + 1u)) {
+    const std::string prefix = path.substr(0u, end);
+    if (mkdir(prefix.c_str(), 0755) == -1) {
+      CHECK_EQ(EEXIST, errno) << prefix;
+    }
+    if (end == std::string::npos) {
+      break;
+    }
+  }
+}
+
+}  // namespace
+
+LegacyChunkDataLogContainer::Segment::~Segment() {
+  if (data != nullptr) {
+    CHECK_EQ(0, munmap(data, capacity)) << errno;
+  }
+  CHECK_EQ(0, close(fd)) << errno;
+}
+
+LegacyChunkDataLogContainer::LegacyChunkDataLogContainer()
+    : directory_(FLAGS_map_api_log_container_directory + "/tmp_" +
+                 map_api_common::createRandomId<map_api_common::Id>()
+                     .hexString()),
+      is_temporary_(true),
+      directory_fd_(-1),
+      active_segment_(nullptr) {}
+
+LegacyChunkDataLogContainer::LegacyChunkDataLogContainer(
+    const std::string& directory)
+    : directory_(directory),
+      is_temporary_(false),
+      directory_fd_(-1),
+      active_segment_(nullptr) {}
+
+LegacyChunkDataLogContainer::~LegacyChunkDataLogContainer() {
+  if (is_temporary_) {
+    while (!segments_.empty()) {
+      deleteSegment(segments_.begin()->first);
+    }
+    if (rmdir(directory_.c_str()) == -1) {
+      CHECK_EQ(ENOENT, errno) << directory_;
+    }
+  } else if (active_segment_ != nullptr) {
+    CHECK_EQ(0, msync(active_segment_->data, active_segment_->capacity,
+                      MS_SYNC)) << errno;
+    // The unused capacity is allocated again when the log is reopened.
+    CHECK_EQ(0, ftruncate(active_segment_->fd, active_segment_->size))
+        << errno;
+  }
+  segments_.clear();
+  if (directory_fd_ != -1) {
+    // Also releases the lock on the directory.
+    CHECK_EQ(0, close(directory_fd_)) << errno;
+  }
+}
+
+std::string LegacyChunkDataLogContainer::chunkDirectory(
+    const std::string& table_name, const map_api_common::Id& chunk_id) {
+  return tableDirectory(table_name) + "/" + chunk_id.hexString();
+}
+
+void LegacyChunkDataLogContainer::persistedChunks(
+    const std::string& table_name, std::vector<map_api_common::Id>* chunk_ids) {
+  CHECK_NOTNULL(chunk_ids)->clear();
+  const std::string table_directory = tableDirectory(table_name);
+  DIR* directory = opendir(table_directory.c_str());
+  if (directory == nullptr) {
+    CHECK_EQ(ENOENT, errno) << table_directory;
+    return;
+  }
+  while (const dirent* entry = readdir(directory)) {
+    const std::string name(entry->d_name);
+    if (name.size() != 2u * sizeof(uint64_t[2]) ||
+        !std::all_of(name.begin(), name.end(), [](char character) {
+          return std::isxdigit(static_cast<unsigned char>(character));
+        })) {
+      continue;
+    }
+    chunk_ids->emplace_back();
+    CHECK(chunk_ids->back().fromHexString(name));
+  }
+  CHECK_EQ(0, closedir(directory)) << errno;
+}
+
+size_t LegacyChunkDataLogContainer::compactSegments() {
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  CHECK(isInitialized());
+  return compactSegmentsLocked();
+}
+
+size_t LegacyChunkDataLogContainer::numSegments() const {
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  return segments_.size();
+}
+
+size_t LegacyChunkDataLogContainer::numLogBytes() const {
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  size_t result = 0u;
+  for (const SegmentMap::value_type& segment : segments_) {
+    result += segment.second->size;
+  }
+  return result;
+}
+
+LogicalTime LegacyChunkDataLogContainer::latestUpdateTime() const {
+  std::lock_guard<std::mutex> lock(access_mutex_);
+  return latest_update_time_;
+}
+
+bool LegacyChunkDataLogContainer::initImpl() {
+  makeDirectories(directory_);
+  // Whoever else appends to the same log would corrupt it.
+  directory_fd_ = open(directory_.c_str(), O_RDONLY | O_DIRECTORY);
+  CHECK_GE(directory_fd_, 0) << directory_ << ": " << errno;
+  CHECK_EQ(0, flock(directory_fd_, LOCK_EX | LOCK_NB))
+      << "The log in " << directory_ << " is already open, e.g. by another "
+      << "peer with the same --map_api_log_container_peer_name: " << errno;
+  std::set<uint32_t> numbers;
+  DIR* directory = opendir(directory_.c_str());
+  CHECK(directory != nullptr) << directory_ << ": " << errno;
+  while (const dirent* entry = readdir(directory)) {
+    unsigned int number;
+    char extension[4];
+    if (sscanf(entry->d_name, "segment_%u.%3s", &number, extension) == 2 &&
+        strcmp(extension, kLogExtension) == 0) {
+      numbers.insert(number);
+    }
+  }
+  CHECK_EQ(0, closedir(directory)) << errno;
+
+  for (const uint32_t number : numbers) {
+    // Only the last segment can still be appended to. It is also the only
+    // one that can end in a torn record, so its records are verified.
+    const bool reopen_for_append =
+        number == *numbers.rbegin() &&
+        access(segmentPath(number, kIndexExtension).c_str(), F_OK) == -1;
+    Segment* segment = mapSegment(
+        number, false, reopen_for_append ? segmentCapacity() : 0u);
+    if (segment == nullptr || !loadSegment(segment, !reopen_for_append)) {
+      deleteSegment(number);
+      continue;
+    }
+    if (reopen_for_append) {
+      // Zeroes whatever follows the last valid record, such that the records
+      // appended in its place can't be followed by stale ones.
+      CHECK_EQ(0, ftruncate(segment->fd, segment->size)) << errno;
+      CHECK_EQ(0, ftruncate(segment->fd, segment->capacity)) << errno;
+      active_segment_ = segment;
+    } else if (!segment->sealed) {
+      sealSegment(segment);
+    }
+  }
+  if (compaction_watermark_.isValid()) {
+    discardSupersededAt(compaction_watermark_);
+  }
+  if (latest_update_time_.isValid()) {
+    LogicalTime::synchronize(latest_update_time_);
+    // The loaded revisions haven't been counted. Their metadata is in memory,
+    // and their size in the record headers, so they needn't be decoded.
+    recount([this](const LatestRevisionAction& action) {
+      for (const LogHistoryMap::value_type& item : data_) {
+        if (!item.second.empty()) {
+          const RecordLocation& latest = item.second.latest();
+          action(item.first, latest.update_time_, latest.is_removed_,
+                 payloadSize(latest));
+        }
+      }
+    });
+  }
+  return true;
+}
+
+bool LegacyChunkDataLogContainer::insertImpl(const Revision::ConstPtr& query) {
+  CHECK(query != nullptr);
+  if (data_.find(query->getId<map_api_common::Id>()) != data_.end()) {
+    return false;
+  }
+  append(*query);
+  return true;
+}
+
+bool LegacyChunkDataLogContainer::bulkInsertImpl(
+    const MutableRevisionMap& query) {
+  for (const MutableRevisionMap::value_type& pair : query) {
+    if (data_.find(pair.first) != data_.end()) {
+      return false;
+    }
+  }
+  for (const MutableRevisionMap::value_type& pair : query) {
+    append(*pair.second);
+  }
+  return true;
+}
+
+bool LegacyChunkDataLogContainer::patchImpl(const Revision::ConstPtr& query) {
+  CHECK(query != nullptr);
+  append(*query);
+  return true;
+}
+
+Revision::ConstPtr LegacyChunkDataLogContainer::getByIdImpl(
+    const map_api_common::Id& id, const LogicalTime& time) const {
+  LogHistoryMap::const_iterator found = data_.find(id);
+  if (found == data_.end()) {
+    return std::shared_ptr<Revision>();
+  }
+  const RecordLocation* latest = found->second.latestAt(time);
+  if (latest == nullptr || latest->is_removed_) {
+    return std::shared_ptr<Revision>();
+  }
+  return read(*latest);
+}
+
+void LegacyChunkDataLogContainer::findByPredicateImpl(
+    const FieldPredicate& predicate, const LogicalTime& time,
+    ConstRevisionMap* dest) const {
+  CHECK_NOTNULL(dest);
+  dest->clear();
+  forEachItemFoundAtTime(
+      predicate, time,
+      [&dest](const map_api_common::Id& id, const Revision::ConstPtr& item) {
+        CHECK(dest->emplace(id, item).second);
+      });
+}
+
+void LegacyChunkDataLogContainer::forEachFoundImpl(
+    const FieldPredicate& predicate, const LogicalTime& time,
+    const FoundAction& action) const {
+  forEachItemFoundAtTime(
+      predicate, time,
+      [&action](const map_api_common::Id& /*id*/,
+                const Revision::ConstPtr& item) { action(item); });
+}
+
+void LegacyChunkDataLogContainer::getAvailableIdsImpl(
+    const LogicalTime& time, std::vector<map_api_common::Id>* ids) const {
+  CHECK_NOTNULL(ids);
+  ids->clear();
+  std::vector<std::pair<map_api_common::Id, RecordLocation> > ids_and_location;
+  ids_and_location.reserve(data_.size());
+  for (const LogHistoryMap::value_type& pair : data_) {
+    const RecordLocation* latest = pair.second.latestAt(time);
+    if (latest != nullptr && !latest->is_removed_) {
+      ids_and_location.emplace_back(pair.first, *latest);
+    }
+  }
+  // Log order, such that reading the items in order reads the log forward.
+  std::sort(ids_and_location.begin(), ids_and_location.end(),
+            [](const std::pair<map_api_common::Id, RecordLocation>& lhs,
+               const std::pair<map_api_common::Id, RecordLocation>& rhs) {
+    return lhs.second.segment_ < rhs.second.segment_ ||
+           (lhs.second.segment_ == rhs.second.segment_ &&
+            lhs.second.offset_ < rhs.second.offset_);
+  });
+  ids->reserve(ids_and_location.size());
+  for (const std::pair<map_api_common::Id, RecordLocation>& pair :
+       ids_and_location) {
+    ids->emplace_back(pair.first);
+  }
+}
+
+int LegacyChunkDataLogContainer::countByPredicateImpl(
+    const FieldPredicate& predicate, const LogicalTime& time) const {
+  if (predicate.empty()) {
+    // Needs no revision to be read.
+    int count = 0;
+    for (const LogHistoryMap::value_type& pair : data_) {
+      const RecordLocation* latest = pair.second.latestAt(time);
+      if (latest != nullptr && !latest->is_removed_) {
+        ++count;
+      }
+    }
+    return count;
+  }
+  int count = 0;
+  forEachItemFoundAtTime(
+      predicate, time,
+      [&count](const map_api_common::Id& /*id*/,
+               const Revision::ConstPtr& /*item*/) { ++count; });
+  return count;
+}
+
+bool LegacyChunkDataLogContainer::insertUpdatedImpl(
+    const std::shared_ptr<Revision>& query) {
+  return patchImpl(query);
+}
+
+void LegacyChunkDataLogContainer::findHistoryByRevisionImpl(
+    int key, const Revision& valueHolder, const LogicalTime& time,
+    HistoryMap* dest) const {
+  CHECK_NOTNULL(dest);
+  dest->clear();
+  for (const LogHistoryMap::value_type& pair : data_) {
+    // using current state for filter
+    if (key < 0 || valueHolder.fieldMatch(*read(pair.second.latest()), key)) {
+      collectHistory(pair.second, &(*dest)[pair.first]);
+    }
+  }
+  trimToTime(time, dest);
+}
+
+void LegacyChunkDataLogContainer::chunkHistory(
+    const map_api_common::Id& chunk_id, const LogicalTime& time,
+    HistoryMap* dest) const {
+  CHECK_NOTNULL(dest)->clear();
+  for (const LogHistoryMap::value_type& pair : data_) {
+    if (pair.second.chunk_id_ == chunk_id) {
+      collectHistory(pair.second, &(*dest)[pair.first]);
+    }
+  }
+  trimToTime(time, dest);
+}
+
+void LegacyChunkDataLogContainer::itemHistoryImpl(
+    const map_api_common::Id& id, const LogicalTime& time,
+    History* dest) const {
+  CHECK_NOTNULL(dest)->clear();
+  LogHistoryMap::const_iterator found = data_.find(id);
+  CHECK(found != data_.end());
+  collectHistory(found->second, dest);
+  dest->trimToTime(time);
+}
+
+void LegacyChunkDataLogContainer::clearImpl() {
+  data_.clear();
+  while (!segments_.empty()) {
+    deleteSegment(segments_.begin()->first);
+  }
+  compaction_watermark_ = LogicalTime();
+  latest_update_time_ = LogicalTime();
+}
+
+size_t LegacyChunkDataLogContainer::compactHistoryImpl(
+    const LogicalTime& watermark) {
+  const size_t num_bytes = discardSupersededAt(watermark);
+  if (num_bytes > 0u) {
+    appendWatermark(watermark);
+  }
+  compactSegmentsLocked();
+  return num_bytes;
+}
+
+void LegacyChunkDataLogContainer::append(const Revision& revision) {
+  const proto::Revision& revision_proto = *revision.underlying_revision_;
+  const size_t payload_size = revision_proto.ByteSize();
+  RecordLocation location;
+  char* record = allocateRecord(recordSize(payload_size), &location);
+  char* payload = record + sizeof(RecordHeader);
+  revision_proto.SerializeWithCachedSizesToArray(
+      reinterpret_cast<google::protobuf::uint8*>(payload));
+
+  const map_api_common::Id id = revision.getId<map_api_common::Id>();
+  const map_api_common::Id chunk_id = revision.getChunkId();
+  location.is_removed_ = revision.isRemoved();
+  location.update_time_ = revision.getModificationTime();
+  RecordHeader* header = reinterpret_cast<RecordHeader*>(record);
+  header->magic = kRecordMagic;
+  header->type = kRevisionRecord;
+  header->payload_size = payload_size;
+  header->is_removed = location.is_removed_;
+  map_api_common::HashId hash_id;
+  id.toHashId(&hash_id);
+  hash_id.toUint64(header->id);
+  chunk_id.toHashId(&hash_id);
+  hash_id.toUint64(header->chunk_id);
+  header->update_time = location.update_time_.serialize();
+  header->checksum = recordChecksum(*header, payload);
+  CHECK(index(id, chunk_id, location))
+      << "Item " << id << " already has a revision at "
+      << location.update_time_;
+}
+
+void LegacyChunkDataLogContainer::appendWatermark(
+    const LogicalTime& watermark) {
+  RecordLocation location;
+  RecordHeader* header =
+      reinterpret_cast<RecordHeader*>(allocateRecord(recordSize(0u), &location));
+  memset(header, 0, sizeof(*header));
+  header->magic = kRecordMagic;
+  header->type = kWatermarkRecord;
+  header->update_time = watermark.serialize();
+  header->checksum = recordChecksum(*header, nullptr);
+  if (compaction_watermark_ < watermark) {
+    compaction_watermark_ = watermark;
+  }
+}
+
+char* LegacyChunkDataLogContainer::allocateRecord(size_t record_size,
+                                                  RecordLocation* location) {
+  CHECK_NOTNULL(location);
+  if (active_segment_ != nullptr &&
+      active_segment_->capacity - active_segment_->size < record_size) {
+    sealSegment(active_segment_);
+    active_segment_ = nullptr;
+  }
+  if (active_segment_ == nullptr) {
+    const uint32_t number =
+        segments_.empty() ? 0u : segments_.rbegin()->first + 1u;
+    active_segment_ =
+        mapSegment(number, true, std::max(segmentCapacity(), record_size));
+  }
+  CHECK_LE(active_segment_->size + record_size,
+           std::numeric_limits<uint32_t>::max());
+  location->segment_ = active_segment_->number;
+  location->offset_ = active_segment_->size;
+  location->size_ = record_size;
+  active_segment_->size += record_size;
+  return active_segment_->data + location->offset_;
+}
+
+LegacyChunkDataLogContainer::RecordLocation*
+LegacyChunkDataLogContainer::LogHistory::find(const LogicalTime& update_time) {
+  const std::vector<RecordLocation>::const_iterator after =
+      firstUpdatedAfter(update_time);
+  if (after == locations_.cbegin() ||
+      (after - 1)->update_time_ != update_time) {
+    return nullptr;
+  }
+  return &locations_[after - 1 - locations_.cbegin()];
+}
+
+bool LegacyChunkDataLogContainer::LogHistory::insert(
+    const RecordLocation& location, RecordLocation* replaced) {
+  CHECK_NOTNULL(replaced);
+  const size_t after =
+      firstUpdatedAfter(location.update_time_) - locations_.cbegin();
+  if (after > 0u &&
+      locations_[after - 1u].update_time_ == location.update_time_) {
+    *replaced = locations_[after - 1u];
+    locations_[after - 1u] = location;
+    return false;
+  }
+  locations_.insert(locations_.begin() + after, location);
+  return true;
+}
+
+void LegacyChunkDataLogContainer::LogHistory::discardSupersededAt(
+    const LogicalTime& time,
+    const std::function<void(const RecordLocation&)>& discard) {
+  const size_t after = firstUpdatedAfter(time) - locations_.cbegin();
+  if (after < 2u) {
+    return;
+  }
+  // All but the record valid at "time".
+  const std::vector<RecordLocation>::iterator valid_at_time =
+      locations_.begin() + (after - 1u);
+  for (std::vector<RecordLocation>::iterator it = locations_.begin();
+       it != valid_at_time; ++it) {
+    discard(*it);
+  }
+  locations_.erase(locations_.begin(), valid_at_time);
+  locations_.shrink_to_fit();
+}
+
+bool LegacyChunkDataLogContainer::index(const map_api_common::Id& id,
+                                        const map_api_common::Id& chunk_id,
+                                        const RecordLocation& location) {
+  LogHistory& history = data_[id];
+  if (history.empty()) {
+    history.chunk_id_ = chunk_id;
+  }
+  segments_.at(location.segment_)->live_bytes += location.size_;
+  if (latest_update_time_ < location.update_time_) {
+    latest_update_time_ = location.update_time_;
+  }
+  RecordLocation replaced;
+  if (!history.insert(location, &replaced)) {
+    discardRecord(replaced);
+    return false;
+  }
+  return true;
+}
+
+Revision::ConstPtr LegacyChunkDataLogContainer::read(
+    const RecordLocation& location) const {
+  SegmentMap::const_iterator segment = segments_.find(location.segment_);
+  CHECK(segment != segments_.end());
+  const char* record = segment->second->data + location.offset_;
+  const RecordHeader& header = *reinterpret_cast<const RecordHeader*>(record);
+  DCHECK_EQ(kRecordMagic, header.magic);
+  // Decoded straight from the mapped segment.
+  std::shared_ptr<proto::Revision> revision_proto(new proto::Revision);
+  CHECK(revision_proto->ParseFromArray(record + sizeof(RecordHeader),
+                                       header.payload_size));
+  Revision::ConstPtr revision;
+  Revision::fromProto(revision_proto, &revision);
+  return revision;
+}
+
+uint32_t LegacyChunkDataLogContainer::payloadSize(
+    const RecordLocation& location) const {
+  SegmentMap::const_iterator segment = segments_.find(location.segment_);
+  CHECK(segment != segments_.end());
+  const RecordHeader& header = *reinterpret_cast<const RecordHeader*>(
+      segment->second->data + location.offset_);
+  DCHECK_EQ(kRecordMagic, header.magic);
+  return header.payload_size;
+}
+
+void LegacyChunkDataLogContainer::discardRecord(
+    const RecordLocation& location) {
+  Segment* segment = segments_.at(location.segment_).get();
+  CHECK_GE(segment->live_bytes, location.size_);
+  segment->live_bytes -= location.size_;
+}
+
+size_t LegacyChunkDataLogContainer::discardSupersededAt(
+    const LogicalTime& watermark) {
+  size_t num_bytes = 0u;
+  const std::function<void(const RecordLocation&)> discard =
+      [this, &num_bytes](const RecordLocation& location) {
+        discardRecord(location);
+        num_bytes += location.size_;
+      };
+  for (LogHistoryMap::value_type& item : data_) {
+    if (item.second.size() > 1u) {
+      item.second.discardSupersededAt(watermark, discard);
+    }
+  }
+  return num_bytes;
+}
+
+size_t LegacyChunkDataLogContainer::compactSegmentsLocked() {
+  std::set<uint32_t> compacted;
+  for (const SegmentMap::value_type& segment : segments_) {
+    if (segment.second->sealed &&
+        segment.second->live_bytes <
+            FLAGS_map_api_log_compaction_threshold * segment.second->size) {
+      compacted.insert(segment.first);
+    }
+  }
+  if (compacted.empty()) {
+    return 0u;
+  }
+  // Live records are copied as they are, without decoding them. Only the
+  // records of the compacted segments are visited: A record is live if the
+  // history of its item still points to it.
+  for (const uint32_t number : compacted) {
+    const Segment& segment = *segments_.at(number);
+    for (size_t offset = 0u; offset < segment.size;) {
+      const RecordHeader& header = *CHECK_NOTNULL(
+          recordAt(segment.data, segment.size, offset, false));
+      const size_t record_offset = offset;
+      offset += recordSize(header.payload_size);
+      if (header.type != kRevisionRecord) {
+        continue;
+      }
+      map_api_common::Id id;
+      id.fromHashId(map_api_common::HashId(header.id));
+      LogHistoryMap::iterator found = data_.find(id);
+      if (found == data_.end()) {
+        continue;
+      }
+      RecordLocation* location =
+          found->second.find(LogicalTime(header.update_time));
+      if (location == nullptr || location->segment_ != number ||
+          location->offset_ != record_offset) {
+        continue;
+      }
+      RecordLocation moved = *location;
+      memcpy(allocateRecord(location->size_, &moved),
+             segment.data + record_offset, location->size_);
+      segments_.at(moved.segment_)->live_bytes += moved.size_;
+      location->segment_ = moved.segment_;
+      location->offset_ = moved.offset_;
+    }
+  }
+  if (compaction_watermark_.isValid()) {
+    appendWatermark(compaction_watermark_);
+  }
+  // The copies must be persisted before the originals are deleted.
+  if (active_segment_ != nullptr) {
+    CHECK_EQ(0, msync(active_segment_->data, active_segment_->capacity,
+                      MS_SYNC)) << errno;
+  }
+  size_t num_bytes = 0u;
+  for (const uint32_t number : compacted) {
+    num_bytes += segments_.at(number)->size;
+    deleteSegment(number);
+  }
+  VLOG(3) << "Compacted " << compacted.size() << " segments of "
+          << directory_ << ", freeing " << num_bytes << " bytes";
+  return num_bytes;
+}
+
+std::string LegacyChunkDataLogContainer::segmentPath(
+    uint32_t number, const char* extension) const {
+  char file_name[32];
+  snprintf(file_name, sizeof(file_name), "segment_%08u.%s", number, extension);
+  return directory_ + "/" + file_name;
+}
+
+LegacyChunkDataLogContainer::Segment* LegacyChunkDataLogContainer::mapSegment(
+    uint32_t number, bool create, size_t min_capacity) {
+  const std::string path = segmentPath(number, kLogExtension);
+  std::unique_ptr<Segment> segment(new Segment);
+  segment->number = number;
+  segment->fd = open(path.c_str(), O_RDWR | (create ? O_CREAT | O_TRUNC : 0),
+                     0644);
+  CHECK_GE(segment->fd, 0) << path << ": " << errno;
+  segment->data = nullptr;
+  struct stat status;
+  CHECK_EQ(0, fstat(segment->fd, &status)) << errno;
+  segment->capacity =
+      std::max(static_cast<size_t>(status.st_size), min_capacity);
+  if (segment->capacity == 0u) {
+    return nullptr;
+  }
+  if (segment->capacity > static_cast<size_t>(status.st_size)) {
+    CHECK_EQ(0, ftruncate(segment->fd, segment->capacity)) << errno;
+  }
+  void* data = mmap(nullptr, segment->capacity, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, segment->fd, 0);
+  CHECK(data != MAP_FAILED) << path << ": " << errno;
+  segment->data = static_cast<char*>(data);
+  segment->size = 0u;
+  segment->live_bytes = 0u;
+  segment->sealed = false;
+  Segment* result = segment.get();
+  CHECK(segments_.emplace(number, std::move(segment)).second);
+  return result;
+}
+
+bool LegacyChunkDataLogContainer::loadSegment(Segment* segment,
+                                              bool use_index) {
+  CHECK_NOTNULL(segment);
+  auto replay = [this, segment](const RecordHeader& header, size_t offset) {
+    if (header.type == kWatermarkRecord) {
+      if (compaction_watermark_ < LogicalTime(header.update_time)) {
+        compaction_watermark_ = LogicalTime(header.update_time);
+      }
+      return;
+    }
+    CHECK_EQ(kRevisionRecord, header.type);
+    RecordLocation location;
+    location.segment_ = segment->number;
+    location.offset_ = offset;
+    location.size_ = recordSize(header.payload_size);
+    location.is_removed_ = header.is_removed != 0u;
+    location.update_time_ = LogicalTime(header.update_time);
+    // Duplicates remain if compaction or sealing were interrupted.
+    map_api_common::Id id, chunk_id;
+    id.fromHashId(map_api_common::HashId(header.id));
+    chunk_id.fromHashId(map_api_common::HashId(header.chunk_id));
+    index(id, chunk_id, location);
+  };
+
+  if (use_index) {
+    std::ifstream index_file(segmentPath(segment->number, kIndexExtension),
+                             std::ios::binary);
+    IndexEntry entry;
+    while (index_file.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+      if (entry.offset != segment->size ||
+          recordAt(segment->data, segment->capacity, entry.offset, false) ==
+              nullptr) {
+        break;
+      }
+      replay(entry.header, entry.offset);
+      segment->size = entry.offset + recordSize(entry.header.payload_size);
+    }
+    // Sealed segments are truncated to their records.
+    if (segment->size > 0u && segment->size == segment->capacity) {
+      segment->sealed = true;
+      return true;
+    }
+    LOG(WARNING) << "Index of segment " << segment->number << " in "
+                 << directory_ << " is incomplete, scanning the segment.";
+  }
+
+  size_t offset = 0u;
+  while (const RecordHeader* header =
+             recordAt(segment->data, segment->capacity, offset, true)) {
+    replay(*header, offset);
+    offset += recordSize(header->payload_size);
+  }
+  segment->size = offset;
+  return segment->size > 0u;
+}
+
+void LegacyChunkDataLogContainer::sealSegment(Segment* segment) {
+  CHECK_NOTNULL(segment);
+  CHECK_EQ(0, msync(segment->data, segment->capacity, MS_SYNC)) << errno;
+  const std::string index_path =
+      segmentPath(segment->number, kIndexExtension);
+  const std::string temporary_path = index_path + ".tmp";
+  {
+    std::ofstream index_file(temporary_path,
+                             std::ios::binary | std::ios::trunc);
+    CHECK(index_file.is_open()) << temporary_path;
+    size_t offset = 0u;
+    while (offset < segment->size) {
+      IndexEntry entry;
+      entry.header = *CHECK_NOTNULL(
+          recordAt(segment->data, segment->size, offset, false));
+      entry.offset = offset;
+      index_file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+      offset += recordSize(entry.header.payload_size);
+    }
+    CHECK(index_file.good()) << temporary_path;
+  }
+  CHECK_EQ(0, rename(temporary_path.c_str(), index_path.c_str())) << errno;
+  CHECK_EQ(0, ftruncate(segment->fd, segment->size)) << errno;
+  segment->sealed = true;
+}
+
+void LegacyChunkDataLogContainer::deleteSegment(uint32_t number) {
+  SegmentMap::iterator found = segments_.find(number);
+  if (found != segments_.end()) {
+    if (found->second.get() == active_segment_) {
+      active_segment_ = nullptr;
+    }
+    segments_.erase(found);
+  }
+  for (const char* extension : {kLogExtension, kIndexExtension}) {
+    const std::string path = segmentPath(number, extension);
+    if (unlink(path.c_str()) == -1) {
+      CHECK_EQ(ENOENT, errno) << path;
+    }
+  }
+}
+
+inline void LegacyChunkDataLogContainer::forEachItemFoundAtTime(
+    const FieldPredicate& predicate, const LogicalTime& time,
+    const std::function<void(const map_api_common::Id& id,
+                             const Revision::ConstPtr& item)>& action) const {
+  // Decoding dominates, and reads of the mapped segments don't contend.
+  scan<LogHistoryMap, Revision::ConstPtr>(
+      data_, [this, &predicate, &time](const LogHistoryMap::value_type& pair,
+                                       Revision::ConstPtr* revision) {
+        const RecordLocation* latest = pair.second.latestAt(time);
+        // Removed items are skipped without decoding them.
+        if (latest == nullptr || latest->is_removed_) {
+          return false;
+        }
+        *revision = read(*latest);
+        return predicate.matches(**revision);
+      }, action);
+}
+
+inline void LegacyChunkDataLogContainer::trimToTime(
+    const LogicalTime& time, HistoryMap* subject) const {
+  CHECK_NOTNULL(subject);
+  for (HistoryMap::value_type& pair : *subject) {
+    pair.second.trimToTime(time);
+  }
+}
+
+inline void LegacyChunkDataLogContainer::collectHistory(
+    const LogHistory& log_history, History* history) const {
+  CHECK_NOTNULL(history);
+  for (const RecordLocation& location : log_history) {
+    history->insert(read(location));
+  }
+}
+
+}  // namespace map_api
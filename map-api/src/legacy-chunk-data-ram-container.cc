@@ -21,11 +21,26 @@
 
 #include "map-api/legacy-chunk-data-ram-container.h"
 
+#include <unordered_set>
+
 namespace map_api {
 
 LegacyChunkDataRamContainer::~LegacyChunkDataRamContainer() {}
 
-bool LegacyChunkDataRamContainer::initImpl() { return true; }
+bool LegacyChunkDataRamContainer::initImpl() {
+  field_indices_.clear();
+  sorted_indices_.clear();
+  for (int i = 0; i < descriptor_->fields_size(); ++i) {
+    if (descriptor_->isIndexed(i)) {
+      field_indices_[i];
+    }
+    if (descriptor_->hasSortedIndex(i)) {
+      sorted_indices_[i] =
+          internal::SortedFieldIndex::create(i, descriptor_->fields(i));
+    }
+  }
+  return true;
+}
 
 bool LegacyChunkDataRamContainer::insertImpl(const Revision::ConstPtr& query) {
   CHECK(query != nullptr);
@@ -34,7 +49,9 @@ bool LegacyChunkDataRamContainer::insertImpl(const Revision::ConstPtr& query) {
   if (found != data_.end()) {
     return false;
   }
-  data_[id].push_front(query);
+  data_[id].insert(query);
+  chunk_items_[query->getChunkId()].emplace(id);
+  indexRevision(*query);
   return true;
 }
 
@@ -46,7 +63,9 @@ bool LegacyChunkDataRamContainer::bulkInsertImpl(
     }
   }
   for (const MutableRevisionMap::value_type& pair : query) {
-    data_[pair.first].push_front(pair.second);
+    data_[pair.first].insert(pair.second);
+    chunk_items_[pair.second->getChunkId()].emplace(pair.first);
+    indexRevision(*pair.second);
   }
   return true;
 }
@@ -58,17 +77,12 @@ bool LegacyChunkDataRamContainer::patchImpl(const Revision::ConstPtr& query) {
   HistoryMap::iterator found = data_.find(id);
   if (found == data_.end()) {
     found = data_.insert(std::make_pair(id, History())).first;
+    chunk_items_[query->getChunkId()].emplace(id);
   }
-  for (History::iterator it = found->second.begin(); it != found->second.end();
-       ++it) {
-    if ((*it)->getUpdateTime() <= time) {
-      CHECK_NE(time, (*it)->getUpdateTime());
-      found->second.insert(it, query);
-      return true;
-    }
+  indexRevision(*query);
+  if (!found->second.insert(query)) {
     LOG(WARNING) << "Patching, not in front!";  // shouldn't usually be the case
   }
-  found->second.push_back(query);
   return true;
 }
 
@@ -85,37 +99,53 @@ Revision::ConstPtr LegacyChunkDataRamContainer::getByIdImpl(
   return *latest;
 }
 
-void LegacyChunkDataRamContainer::findByRevisionImpl(
-    int key, const Revision& value_holder, const LogicalTime& time,
+void LegacyChunkDataRamContainer::findByPredicateImpl(
+    const FieldPredicate& predicate, const LogicalTime& time,
     ConstRevisionMap* dest) const {
   CHECK_NOTNULL(dest);
   dest->clear();
   forEachItemFoundAtTime(
-      key, value_holder, time,
+      predicate, time,
       [&dest](const map_api_common::Id& id, const Revision::ConstPtr& item) {
         CHECK(dest->find(id) == dest->end());
         CHECK(dest->emplace(id, item).second);
       });
 }
 
+void LegacyChunkDataRamContainer::forEachFoundImpl(
+    const FieldPredicate& predicate, const LogicalTime& time,
+    const FoundAction& action) const {
+  forEachItemFoundAtTime(
+      predicate, time,
+      [&action](const map_api_common::Id& /*id*/,
+                const Revision::ConstPtr& item) { action(item); });
+}
+
 void LegacyChunkDataRamContainer::getAvailableIdsImpl(
     const LogicalTime& time, std::vector<map_api_common::Id>* ids) const {
   CHECK_NOTNULL(ids);
   ids->clear();
   ids->reserve(data_.size());
-  for (const HistoryMap::value_type& pair : data_) {
-    History::const_iterator latest = pair.second.latestAt(time);
-    if (latest != pair.second.cend()) {
-      ids->emplace_back(pair.first);
-    }
-  }
+  scan<HistoryMap, Revision::ConstPtr>(
+      data_,
+      [&time](const HistoryMap::value_type& pair, Revision::ConstPtr* latest) {
+        History::const_iterator found = pair.second.latestAt(time);
+        if (found == pair.second.cend()) {
+          return false;
+        }
+        *latest = *found;
+        return true;
+      },
+      [ids](const map_api_common::Id& id, const Revision::ConstPtr& /*item*/) {
+        ids->emplace_back(id);
+      });
 }
 
-int LegacyChunkDataRamContainer::countByRevisionImpl(
-    int key, const Revision& value_holder, const LogicalTime& time) const {
+int LegacyChunkDataRamContainer::countByPredicateImpl(
+    const FieldPredicate& predicate, const LogicalTime& time) const {
   int count = 0;
   forEachItemFoundAtTime(
-      key, value_holder, time,
+      predicate, time,
       [&count](const map_api_common::Id& /*id*/,
                const Revision::ConstPtr& /*item*/) { ++count; });
   return count;
@@ -131,25 +161,28 @@ void LegacyChunkDataRamContainer::findHistoryByRevisionImpl(
     HistoryMap* dest) const {
   CHECK_NOTNULL(dest);
   dest->clear();
-  for (const HistoryMap::value_type& pair : data_) {
-    // using current state for filter
-    if (key < 0 || valueHolder.fieldMatch(**pair.second.begin(), key)) {
-      CHECK(dest->insert(pair).second);
-    }
-  }
-  trimToTime(time, dest);
+  forEachHistoryImpl(key, valueHolder, time,
+                     [dest](const map_api_common::Id& id,
+                            const History::View& history) {
+    (*dest)[id].assign(history);
+  });
 }
 
 void LegacyChunkDataRamContainer::chunkHistory(const map_api_common::Id& chunk_id,
                                                const LogicalTime& time,
                                                HistoryMap* dest) const {
   CHECK_NOTNULL(dest)->clear();
-  for (const HistoryMap::value_type& pair : data_) {
-    if ((*pair.second.begin())->getChunkId() == chunk_id) {
-      CHECK(dest->emplace(pair).second);
-    }
+  std::unordered_map<map_api_common::Id, map_api_common::IdSet>::const_iterator
+      chunk = chunk_items_.find(chunk_id);
+  if (chunk == chunk_items_.end()) {
+    return;
   }
-  trimToTime(time, dest);
+  dest->reserve(chunk->second.size());
+  forEachChunkHistoryImpl(chunk_id, time,
+                          [dest](const map_api_common::Id& id,
+                                 const History::View& history) {
+    (*dest)[id].assign(history);
+  });
 }
 
 void LegacyChunkDataRamContainer::itemHistoryImpl(const map_api_common::Id& id,
@@ -158,49 +191,234 @@ void LegacyChunkDataRamContainer::itemHistoryImpl(const map_api_common::Id& id,
   CHECK_NOTNULL(dest)->clear();
   HistoryMap::const_iterator found = data_.find(id);
   CHECK(found != data_.end());
-  *dest = History(found->second);
-  dest->remove_if([&time](const Revision::ConstPtr& item) {
-    return item->getUpdateTime() > time;
-  });
+  dest->assign(found->second.at(time));
 }
 
-void LegacyChunkDataRamContainer::clearImpl() { data_.clear(); }
+void LegacyChunkDataRamContainer::visitItemHistoryImpl(
+    const map_api_common::Id& id, const LogicalTime& time,
+    const HistoryVisitor& visitor) const {
+  HistoryMap::const_iterator found = data_.find(id);
+  CHECK(found != data_.end());
+  visitor(id, found->second.at(time));
+}
 
-inline void LegacyChunkDataRamContainer::forEachItemFoundAtTime(
+void LegacyChunkDataRamContainer::forEachHistoryImpl(
     int key, const Revision& value_holder, const LogicalTime& time,
+    const HistoryVisitor& visitor) const {
+  FieldPredicate predicate;
+  if (key >= 0) {
+    predicate.equalsFieldOf(key, value_holder);
+  }
+  map_api_common::IdSet range_candidates;
+  const map_api_common::IdSet* candidates =
+      indexCandidates(predicate, &range_candidates);
+  if (candidates != nullptr) {
+    for (const map_api_common::Id& id : *candidates) {
+      HistoryMap::const_iterator found = data_.find(id);
+      CHECK(found != data_.end());
+      // using current state for filter
+      if (predicate.matches(**found->second.begin())) {
+        visitor(id, found->second.at(time));
+      }
+    }
+    return;
+  }
+  for (const HistoryMap::value_type& pair : data_) {
+    // using current state for filter
+    if (predicate.matches(**pair.second.begin())) {
+      visitor(pair.first, pair.second.at(time));
+    }
+  }
+}
+
+void LegacyChunkDataRamContainer::forEachChunkHistoryImpl(
+    const map_api_common::Id& chunk_id, const LogicalTime& time,
+    const HistoryVisitor& visitor) const {
+  std::unordered_map<map_api_common::Id, map_api_common::IdSet>::const_iterator
+      chunk = chunk_items_.find(chunk_id);
+  if (chunk == chunk_items_.end()) {
+    return;
+  }
+  for (const map_api_common::Id& id : chunk->second) {
+    HistoryMap::const_iterator found = data_.find(id);
+    CHECK(found != data_.end());
+    visitor(id, found->second.at(time));
+  }
+}
+
+void LegacyChunkDataRamContainer::clearImpl() {
+  data_.clear();
+  chunk_items_.clear();
+  for (std::unordered_map<int, FieldIndex>::value_type& field_index :
+       field_indices_) {
+    field_index.second.clear();
+  }
+  for (std::unordered_map<int, std::unique_ptr<internal::SortedFieldIndex>>::
+           value_type& sorted_index : sorted_indices_) {
+    sorted_index.second->clear();
+  }
+}
+
+size_t LegacyChunkDataRamContainer::compactHistoryImpl(
+    const LogicalTime& watermark) {
+  size_t num_bytes = 0u;
+  for (HistoryMap::value_type& item : data_) {
+    History& history = item.second;
+    if (history.size() < 2u) {
+      continue;
+    }
+    if (field_indices_.empty() && sorted_indices_.empty()) {
+      num_bytes += history.discardSupersededAt(watermark);
+      continue;
+    }
+    // Newest first, so the discarded revisions end up at the back.
+    std::vector<Revision::ConstPtr> discarded(history.begin(), history.end());
+    num_bytes += history.discardSupersededAt(watermark);
+    if (history.size() < discarded.size()) {
+      discarded.erase(discarded.begin(), discarded.begin() + history.size());
+      unindexDiscarded(item.first, discarded, history);
+    }
+  }
+  return num_bytes;
+}
+
+void LegacyChunkDataRamContainer::unindexDiscarded(
+    const map_api_common::Id& id,
+    const std::vector<Revision::ConstPtr>& discarded,
+    const History& remaining) {
+  for (std::unordered_map<int, FieldIndex>::value_type& field_index :
+       field_indices_) {
+    std::unordered_set<size_t> remaining_hashes;
+    for (const Revision::ConstPtr& revision : remaining) {
+      remaining_hashes.emplace(revision->fieldHash(field_index.first));
+    }
+    for (const Revision::ConstPtr& revision : discarded) {
+      const size_t hash = revision->fieldHash(field_index.first);
+      if (remaining_hashes.count(hash) != 0u) {
+        continue;
+      }
+      FieldIndex::iterator found = field_index.second.find(hash);
+      if (found == field_index.second.end()) {
+        continue;
+      }
+      found->second.erase(id);
+      if (found->second.empty()) {
+        field_index.second.erase(found);
+      }
+    }
+  }
+  for (std::unordered_map<int, std::unique_ptr<internal::SortedFieldIndex>>::
+           value_type& sorted_index : sorted_indices_) {
+    for (const Revision::ConstPtr& revision : discarded) {
+      bool remains = false;
+      for (const Revision::ConstPtr& remaining_revision : remaining) {
+        if (revision->fieldMatch(*remaining_revision, sorted_index.first)) {
+          remains = true;
+          break;
+        }
+      }
+      if (!remains) {
+        sorted_index.second->remove(*revision);
+      }
+    }
+  }
+}
+
+inline void LegacyChunkDataRamContainer::forEachItemFoundAtTime(
+    const FieldPredicate& predicate, const LogicalTime& time,
     const std::function<void(const map_api_common::Id& id,
                              const Revision::ConstPtr& item)>& action) const {
-  for (const HistoryMap::value_type& pair : data_) {
-    History::const_iterator latest = pair.second.latestAt(time);
-    if (latest != pair.second.cend()) {
-      if (key < 0 || value_holder.fieldMatch(**latest, key)) {
-        action(pair.first, *latest);
+  map_api_common::IdSet range_candidates;
+  const map_api_common::IdSet* candidates =
+      indexCandidates(predicate, &range_candidates);
+  if (candidates != nullptr) {
+    for (const map_api_common::Id& id : *candidates) {
+      HistoryMap::const_iterator found = data_.find(id);
+      CHECK(found != data_.end());
+      History::const_iterator latest = found->second.latestAt(time);
+      if (latest != found->second.cend() && predicate.matches(**latest)) {
+        action(id, *latest);
       }
     }
+    return;
   }
+  scan<HistoryMap, Revision::ConstPtr>(
+      data_, [&predicate, &time](const HistoryMap::value_type& pair,
+                                 Revision::ConstPtr* item) {
+        History::const_iterator latest = pair.second.latestAt(time);
+        if (latest == pair.second.cend() || !predicate.matches(**latest)) {
+          return false;
+        }
+        *item = *latest;
+        return true;
+      }, action);
 }
 
 inline void LegacyChunkDataRamContainer::forChunkItemsAtTime(
     const map_api_common::Id& chunk_id, const LogicalTime& time,
     const std::function<void(const map_api_common::Id& id,
                              const Revision::ConstPtr& item)>& action) const {
-  for (const HistoryMap::value_type& pair : data_) {
-    if ((*pair.second.begin())->getChunkId() == chunk_id) {
-      History::const_iterator latest = pair.second.latestAt(time);
-      if (latest != pair.second.cend()) {
-        action(pair.first, *latest);
-      }
+  std::unordered_map<map_api_common::Id, map_api_common::IdSet>::const_iterator
+      chunk = chunk_items_.find(chunk_id);
+  if (chunk == chunk_items_.end()) {
+    return;
+  }
+  for (const map_api_common::Id& id : chunk->second) {
+    HistoryMap::const_iterator found = data_.find(id);
+    CHECK(found != data_.end());
+    History::const_iterator latest = found->second.latestAt(time);
+    if (latest != found->second.cend()) {
+      action(id, *latest);
     }
   }
 }
 
-inline void LegacyChunkDataRamContainer::trimToTime(const LogicalTime& time,
-                                                    HistoryMap* subject) const {
-  CHECK_NOTNULL(subject);
-  for (HistoryMap::value_type& pair : *subject) {
-    pair.second.remove_if([&time](const Revision::ConstPtr& item) {
-      return item->getUpdateTime() > time;
-    });
+inline const map_api_common::IdSet*
+LegacyChunkDataRamContainer::indexCandidates(
+    const FieldPredicate& predicate,
+    map_api_common::IdSet* range_candidates) const {
+  CHECK_NOTNULL(range_candidates);
+  for (const FieldPredicate::Term& term : predicate.terms()) {
+    if (term.type != FieldPredicate::TermType::kEquals) {
+      continue;
+    }
+    std::unordered_map<int, FieldIndex>::const_iterator field_index =
+        field_indices_.find(term.key);
+    if (field_index == field_indices_.end()) {
+      continue;
+    }
+    static const map_api_common::IdSet kNoCandidates;
+    FieldIndex::const_iterator found = field_index->second.find(term.hash);
+    if (found == field_index->second.end()) {
+      return &kNoCandidates;
+    }
+    return &found->second;
+  }
+  for (const FieldPredicate::Term& term : predicate.terms()) {
+    if (term.type != FieldPredicate::TermType::kRange) {
+      continue;
+    }
+    std::unordered_map<int, std::unique_ptr<internal::SortedFieldIndex>>::
+        const_iterator sorted_index = sorted_indices_.find(term.key);
+    if (sorted_index == sorted_indices_.end()) {
+      continue;
+    }
+    sorted_index->second->getCandidates(term, range_candidates);
+    return range_candidates;
+  }
+  return nullptr;
+}
+
+inline void LegacyChunkDataRamContainer::indexRevision(
+    const Revision& revision) {
+  const map_api_common::Id id = revision.getId<map_api_common::Id>();
+  for (std::unordered_map<int, FieldIndex>::value_type& field_index :
+       field_indices_) {
+    field_index.second[revision.fieldHash(field_index.first)].emplace(id);
+  }
+  for (std::unordered_map<int, std::unique_ptr<internal::SortedFieldIndex>>::
+           value_type& sorted_index : sorted_indices_) {
+    sorted_index.second->add(revision);
   }
 }
 
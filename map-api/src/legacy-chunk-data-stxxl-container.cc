@@ -21,13 +21,44 @@
 
 #include "map-api/legacy-chunk-data-stxxl-container.h"
 
+#include <algorithm>
+#include <unordered_set>
+
+#include <gflags/gflags.h>
+
+DEFINE_uint64(map_api_stxxl_revision_cache_size, 4096u,
+              "Number of decoded revisions cached across all STXXL chunk data "
+              "containers of this process.");
+
 namespace map_api {
 
+namespace {
+
+DecodedRevisionCache* revisionCache() {
+  // Never destroyed, as containers may outlive static destruction.
+  static DecodedRevisionCache* cache =
+      new DecodedRevisionCache(FLAGS_map_api_stxxl_revision_cache_size);
+  return cache;
+}
+
+}  // namespace
+
+constexpr size_t LegacyChunkDataStxxlContainer::kRetrievalBatchSize;
+
 LegacyChunkDataStxxlContainer::LegacyChunkDataStxxlContainer()
-    : revision_store_(new STXXLRevisionStore<kBlockSize>()) {}
+    : revision_store_(new STXXLRevisionStore<kBlockSize>(
+          revisionCache(), &revision_cache_statistics_)) {}
 
 LegacyChunkDataStxxlContainer::~LegacyChunkDataStxxlContainer() {}
 
+size_t LegacyChunkDataStxxlContainer::numRevisionCacheHits() const {
+  return revision_cache_statistics_.num_hits;
+}
+
+size_t LegacyChunkDataStxxlContainer::numRevisionCacheMisses() const {
+  return revision_cache_statistics_.num_misses;
+}
+
 bool LegacyChunkDataStxxlContainer::initImpl() { return true; }
 
 bool LegacyChunkDataStxxlContainer::insertImpl(
@@ -97,19 +128,28 @@ Revision::ConstPtr LegacyChunkDataStxxlContainer::getByIdImpl(
   return revision;
 }
 
-void LegacyChunkDataStxxlContainer::findByRevisionImpl(
-    int key, const Revision& value_holder, const LogicalTime& time,
+void LegacyChunkDataStxxlContainer::findByPredicateImpl(
+    const FieldPredicate& predicate, const LogicalTime& time,
     ConstRevisionMap* dest) const {
   CHECK_NOTNULL(dest);
   dest->clear();
   forEachItemFoundAtTime(
-      key, value_holder, time,
+      predicate, time,
       [&dest](const map_api_common::Id& id, const Revision::ConstPtr& item) {
         CHECK(dest->find(id) == dest->end());
         CHECK(dest->emplace(id, item).second);
       });
 }
 
+void LegacyChunkDataStxxlContainer::forEachFoundImpl(
+    const FieldPredicate& predicate, const LogicalTime& time,
+    const FoundAction& action) const {
+  forEachItemFoundAtTime(
+      predicate, time,
+      [&action](const map_api_common::Id& /*id*/,
+                const Revision::ConstPtr& item) { action(item); });
+}
+
 void LegacyChunkDataStxxlContainer::getAvailableIdsImpl(
     const LogicalTime& time, std::vector<map_api_common::Id>* ids) const {
   CHECK_NOTNULL(ids);
@@ -136,11 +176,11 @@ void LegacyChunkDataStxxlContainer::getAvailableIdsImpl(
   }
 }
 
-int LegacyChunkDataStxxlContainer::countByRevisionImpl(
-    int key, const Revision& value_holder, const LogicalTime& time) const {
+int LegacyChunkDataStxxlContainer::countByPredicateImpl(
+    const FieldPredicate& predicate, const LogicalTime& time) const {
   int count = 0;
   forEachItemFoundAtTime(
-      key, value_holder, time,
+      predicate, time,
       [&count](const map_api_common::Id& /*id*/,
                const Revision::ConstPtr& /*item*/) { ++count; });
   return count;
@@ -156,21 +196,38 @@ void LegacyChunkDataStxxlContainer::findHistoryByRevisionImpl(
     HistoryMap* dest) const {
   CHECK_NOTNULL(dest);
   dest->clear();
-  for (const STXXLHistoryMap::value_type& pair : data_) {
+  std::vector<RevisionLocation> locations;
+  if (key >= 0) {
     // using current state for filter
-    Revision::ConstPtr revision;
-    CHECK(revision_store_->retrieveRevision(*pair.second.begin(), &revision));
-    if (key < 0 || valueHolder.fieldMatch(*revision, key)) {
-      History history;
+    std::vector<RevisionLocation> latest;
+    latest.reserve(data_.size());
+    for (const STXXLHistoryMap::value_type& pair : data_) {
+      latest.emplace_back(&pair.first, &*pair.second.begin());
+    }
+    std::unordered_set<map_api_common::Id> matching;
+    retrieveInBlockOrder(&latest, [&](const map_api_common::Id& id,
+                                      const Revision::ConstPtr& revision) {
+      if (valueHolder.fieldMatch(*revision, key)) {
+        matching.emplace(id);
+      }
+    });
+    for (const map_api_common::Id& id : matching) {
+      const STXXLHistoryMap::value_type& pair = *data_.find(id);
+      for (const CRURevisionInformation& revision_information : pair.second) {
+        locations.emplace_back(&pair.first, &revision_information);
+      }
+    }
+  } else {
+    for (const STXXLHistoryMap::value_type& pair : data_) {
       for (const CRURevisionInformation& revision_information : pair.second) {
-        Revision::ConstPtr history_entry;
-        CHECK(revision_store_->retrieveRevision(revision_information,
-                                                &history_entry));
-        history.emplace_back(history_entry);
+        locations.emplace_back(&pair.first, &revision_information);
       }
-      CHECK(dest->emplace(pair.first, history).second);
     }
   }
+  retrieveInBlockOrder(&locations, [&dest](const map_api_common::Id& id,
+                                           const Revision::ConstPtr& revision) {
+    (*dest)[id].insert(revision);
+  });
   trimToTime(time, dest);
 }
 
@@ -178,18 +235,18 @@ void LegacyChunkDataStxxlContainer::chunkHistory(const map_api_common::Id& chunk
                                                  const LogicalTime& time,
                                                  HistoryMap* dest) const {
   CHECK_NOTNULL(dest)->clear();
+  std::vector<RevisionLocation> locations;
   for (const STXXLHistoryMap::value_type& pair : data_) {
     if (pair.second.begin()->chunk_id_ == chunk_id) {
-      History history;
       for (const CRURevisionInformation& revision_information : pair.second) {
-        Revision::ConstPtr history_entry;
-        CHECK(revision_store_->retrieveRevision(revision_information,
-                                                &history_entry));
-        history.emplace_back(history_entry);
+        locations.emplace_back(&pair.first, &revision_information);
       }
-      CHECK(dest->emplace(std::make_pair(pair.first, history)).second);
     }
   }
+  retrieveInBlockOrder(&locations, [&dest](const map_api_common::Id& id,
+                                           const Revision::ConstPtr& revision) {
+    (*dest)[id].insert(revision);
+  });
   trimToTime(time, dest);
 }
 
@@ -199,67 +256,117 @@ void LegacyChunkDataStxxlContainer::itemHistoryImpl(const map_api_common::Id& id
   CHECK_NOTNULL(dest)->clear();
   STXXLHistoryMap::const_iterator found = data_.find(id);
   CHECK(found != data_.end());
-  History& history = *dest;
+  std::vector<RevisionLocation> locations;
   for (const CRURevisionInformation& revision_information : found->second) {
-    Revision::ConstPtr history_entry;
-    CHECK(revision_store_->retrieveRevision(revision_information,
-                                            &history_entry));
-    history.emplace_back(history_entry);
+    locations.emplace_back(&found->first, &revision_information);
   }
-  dest->remove_if([&time](const Revision::ConstPtr& item) {
-    return item->getUpdateTime() > time;
+  retrieveInBlockOrder(&locations,
+                       [&dest](const map_api_common::Id& /*id*/,
+                               const Revision::ConstPtr& revision) {
+    dest->insert(revision);
   });
+  dest->trimToTime(time);
 }
 
 void LegacyChunkDataStxxlContainer::clearImpl() {
   data_.clear();
-  revision_store_.reset(new STXXLRevisionStore<kBlockSize>());
+  revision_store_.reset();
+  revision_cache_statistics_.num_hits = 0u;
+  revision_cache_statistics_.num_misses = 0u;
+  revision_store_.reset(new STXXLRevisionStore<kBlockSize>(
+      revisionCache(), &revision_cache_statistics_));
+}
+
+size_t LegacyChunkDataStxxlContainer::compactHistoryImpl(
+    const LogicalTime& watermark) {
+  size_t num_entries = 0u;
+  for (STXXLHistoryMap::value_type& item : data_) {
+    STXXLHistory& history = item.second;
+    // Histories are ordered newest first.
+    STXXLHistory::iterator valid_at_watermark = history.begin();
+    while (valid_at_watermark != history.end() &&
+           watermark < valid_at_watermark->update_time_) {
+      ++valid_at_watermark;
+    }
+    if (valid_at_watermark == history.end()) {
+      continue;
+    }
+    const STXXLHistory::iterator discard_begin = std::next(valid_at_watermark);
+    num_entries += std::distance(discard_begin, history.end());
+    history.erase(discard_begin, history.end());
+  }
+  return num_entries * sizeof(STXXLHistory::value_type);
 }
 
 inline void LegacyChunkDataStxxlContainer::forEachItemFoundAtTime(
-    int key, const Revision& value_holder, const LogicalTime& time,
+    const FieldPredicate& predicate, const LogicalTime& time,
     const std::function<void(const map_api_common::Id& id,
                              const Revision::ConstPtr& item)>& action) const {
+  std::vector<RevisionLocation> locations;
+  locations.reserve(data_.size());
   for (const STXXLHistoryMap::value_type& pair : data_) {
     STXXLHistory::const_iterator latest = pair.second.latestAt(time);
-    if (latest != pair.second.cend()) {
-      Revision::ConstPtr revision;
-      CHECK(revision_store_->retrieveRevision(*latest, &revision));
-      if (key < 0 || value_holder.fieldMatch(*revision, key)) {
-        if (!revision->isRemoved()) {
-          action(pair.first, revision);
-        }
-      }
+    // Removed items are skipped without decoding them.
+    if (latest != pair.second.cend() && !latest->is_removed_) {
+      locations.emplace_back(&pair.first, &*latest);
     }
   }
+  retrieveInBlockOrder(
+      &locations, [&](const map_api_common::Id& id,
+                      const Revision::ConstPtr& revision) {
+        if (predicate.matches(*revision)) {
+          action(id, revision);
+        }
+      });
 }
 
 inline void LegacyChunkDataStxxlContainer::forChunkItemsAtTime(
     const map_api_common::Id& chunk_id, const LogicalTime& time,
     const std::function<void(const map_api_common::Id& id,
                              const Revision::ConstPtr& item)>& action) const {
+  std::vector<RevisionLocation> locations;
   for (const STXXLHistoryMap::value_type& pair : data_) {
     if (pair.second.begin()->chunk_id_ == chunk_id) {
       STXXLHistory::const_iterator latest = pair.second.latestAt(time);
-      if (latest != pair.second.cend()) {
-        Revision::ConstPtr revision;
-        CHECK(
-            revision_store_->retrieveRevision(*pair.second.begin(), &revision));
-        if (!revision->isRemoved()) {
-          action(pair.first, revision);
-        }
+      if (latest != pair.second.cend() && !latest->is_removed_) {
+        locations.emplace_back(&pair.first, &*latest);
       }
     }
   }
+  retrieveInBlockOrder(&locations, action);
+}
+
+inline void LegacyChunkDataStxxlContainer::retrieveInBlockOrder(
+    std::vector<RevisionLocation>* locations,
+    const std::function<void(const map_api_common::Id& id,
+                             const Revision::ConstPtr& item)>& action) const {
+  CHECK_NOTNULL(locations);
+  std::sort(locations->begin(), locations->end(),
+            [](const RevisionLocation& lhs, const RevisionLocation& rhs) {
+    return lhs.second->memory_block_ < rhs.second->memory_block_;
+  });
+  std::vector<const CRRevisionInformation*> batch;
+  std::vector<Revision::ConstPtr> revisions;
+  for (size_t begin = 0u; begin < locations->size();
+       begin += kRetrievalBatchSize) {
+    const size_t end =
+        std::min(begin + kRetrievalBatchSize, locations->size());
+    batch.clear();
+    for (size_t i = begin; i < end; ++i) {
+      batch.emplace_back((*locations)[i].second);
+    }
+    CHECK(revision_store_->retrieveRevisions(batch, &revisions));
+    for (size_t i = begin; i < end; ++i) {
+      action(*(*locations)[i].first, revisions[i - begin]);
+    }
+  }
 }
 
 inline void LegacyChunkDataStxxlContainer::trimToTime(
     const LogicalTime& time, HistoryMap* subject) const {
   CHECK_NOTNULL(subject);
   for (HistoryMap::value_type& pair : *subject) {
-    pair.second.remove_if([&time](const Revision::ConstPtr& item) {
-      return item->getUpdateTime() > time;
-    });
+    pair.second.trimToTime(time);
   }
 }
 
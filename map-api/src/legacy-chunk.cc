@@ -20,22 +20,32 @@
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
 #include <map-api/legacy-chunk.h>
-#include <fstream>  // NOLINT
+#include <algorithm>
 #include <unordered_set>
 
 #include <map-api-common/backtrace.h>
-#include <map-api-common/conversions.h>
+#include <map-api-common/thread-pool.h>
 
 #include "./core.pb.h"
 #include "./chunk.pb.h"
+#include "map-api/legacy-chunk-data-columnar-container.h"
+#include "map-api/legacy-chunk-data-log-container.h"
 #include "map-api/legacy-chunk-data-ram-container.h"
 #include "map-api/legacy-chunk-data-stxxl-container.h"
 #include "map-api/hub.h"
+#include "map-api/internal/write-ahead-log.h"
 #include "map-api/message.h"
 #include "map-api/net-table-manager.h"
 #include "map-api/revision-map.h"
 
 DEFINE_bool(use_external_memory, false, "STXXL vs. RAM data container.");
+DEFINE_bool(use_columnar_container, false,
+            "Store chunk data in RAM column-wise, see "
+            "LegacyChunkDataColumnarContainer.");
+DEFINE_bool(use_log_container, false,
+            "Persist chunk data in memory-mapped logs that are reopened when "
+            "a chunk of the same id is created, see "
+            "LegacyChunkDataLogContainer.");
 enum UnlockStrategy {
   REVERSE,
   FORWARD,
@@ -46,6 +56,16 @@ DEFINE_uint64(unlock_strategy, 2,
               "lock ordering, 2: randomized");
 DEFINE_bool(writelock_persist, true,
             "Enables more persisting write lock strategy");
+DEFINE_uint64(writelock_max_backoff_us, 5000u,
+              "Upper bound for the exponential backoff between write lock "
+              "requests that have been declined.");
+DEFINE_uint64(map_api_lock_reservation_timeout_ms, 1000u,
+              "Time after which the arbitrator passes the write lock of a "
+              "chunk on if the waiter it has been reserved for hasn't claimed "
+              "it. Queued waiters repeat their lock requests after this time.");
+DEFINE_uint64(map_api_lock_notification_threads, 2u,
+              "Number of threads that notify queued waiters that the write "
+              "lock of a chunk is available.");
 DEFINE_bool(map_api_time_chunk, false, "Toggle chunk timing.");
 
 DECLARE_bool(blame_trigger);
@@ -57,20 +77,56 @@ const char LegacyChunk::kInitRequest[] = "map_api_chunk_init_request";
 const char LegacyChunk::kInsertRequest[] = "map_api_chunk_insert";
 const char LegacyChunk::kLeaveRequest[] = "map_api_chunk_leave_request";
 const char LegacyChunk::kLockRequest[] = "map_api_chunk_lock_request";
+const char LegacyChunk::kLockAvailableRequest[] =
+    "map_api_chunk_lock_available_request";
+const char LegacyChunk::kLockQueuedResponse[] = "map_api_chunk_lock_queued";
 const char LegacyChunk::kNewPeerRequest[] = "map_api_chunk_new_peer_request";
 const char LegacyChunk::kUnlockRequest[] = "map_api_chunk_unlock_request";
 const char LegacyChunk::kUpdateRequest[] = "map_api_chunk_update_request";
 
-MAP_API_PROTO_MESSAGE(LegacyChunk::kConnectRequest, proto::ChunkRequestMetadata);
+MAP_API_PROTO_MESSAGE(LegacyChunk::kConnectRequest, proto::ConnectRequest);
 MAP_API_PROTO_MESSAGE(LegacyChunk::kInitRequest, proto::InitRequest);
 MAP_API_PROTO_MESSAGE(LegacyChunk::kInsertRequest, proto::PatchRequest);
 MAP_API_PROTO_MESSAGE(LegacyChunk::kLeaveRequest, proto::ChunkRequestMetadata);
 MAP_API_PROTO_MESSAGE(LegacyChunk::kLockRequest, proto::ChunkRequestMetadata);
+MAP_API_PROTO_MESSAGE(LegacyChunk::kLockAvailableRequest,
+                      proto::ChunkRequestMetadata);
 MAP_API_PROTO_MESSAGE(LegacyChunk::kNewPeerRequest, proto::NewPeerRequest);
 MAP_API_PROTO_MESSAGE(LegacyChunk::kUnlockRequest, proto::ChunkRequestMetadata);
 MAP_API_PROTO_MESSAGE(LegacyChunk::kUpdateRequest, proto::PatchRequest);
 
-const char LegacyChunk::kLockSequenceFile[] = "meas_lock_sequence.txt";
+namespace {
+
+// Exponential backoff for write lock requests that are declined rather than
+// queued, which only happens while the swarm is changing or unlocking.
+class WriteLockBackoff {
+ public:
+  WriteLockBackoff() : sleep_us_(kInitialSleepUs) {}
+
+  void sleep() {
+    usleep(sleep_us_);
+    sleep_us_ = std::min<uint64_t>(2u * sleep_us_,
+                                   FLAGS_writelock_max_backoff_us);
+  }
+
+ private:
+  static constexpr uint64_t kInitialSleepUs = 100u;
+  uint64_t sleep_us_;
+};
+
+std::chrono::milliseconds lockReservationTimeout() {
+  return std::chrono::milliseconds(FLAGS_map_api_lock_reservation_timeout_ms);
+}
+
+// Shared by all chunks. The notifications are sent from here, as they are
+// triggered from request handlers, which may not block on other peers.
+map_api_common::ThreadPool& lockNotificationPool() {
+  static map_api_common::ThreadPool pool(
+      std::max<size_t>(FLAGS_map_api_lock_notification_threads, 1u));
+  return pool;
+}
+
+}  // namespace
 
 template <>
 void LegacyChunk::fillMetadata<proto::ChunkRequestMetadata>(
@@ -79,19 +135,33 @@ void LegacyChunk::fillMetadata<proto::ChunkRequestMetadata>(
   id().serialize(destination->mutable_chunk_id());
 }
 
-LegacyChunk::~LegacyChunk() {}
+LegacyChunk::~LegacyChunk() {
+  // Chunks are destroyed before the hub is, and so are their notifications.
+  lockNotificationPool().waitForEmptyQueue();
+}
 
 bool LegacyChunk::init(const map_api_common::Id& id,
                        std::shared_ptr<TableDescriptor> descriptor,
                        bool initialize) {
   CHECK(descriptor);
   id_ = id;
+  LegacyChunkDataLogContainer* log_container = nullptr;
   if (FLAGS_use_external_memory) {
     data_container_.reset(new LegacyChunkDataStxxlContainer);
+  } else if (FLAGS_use_columnar_container) {
+    data_container_.reset(new LegacyChunkDataColumnarContainer);
+  } else if (FLAGS_use_log_container) {
+    log_container = new LegacyChunkDataLogContainer(
+        LegacyChunkDataLogContainer::chunkDirectory(descriptor->name(), id));
+    data_container_.reset(log_container);
   } else {
     data_container_.reset(new LegacyChunkDataRamContainer);
   }
   CHECK(data_container_->init(descriptor));
+  if (log_container != nullptr) {
+    // A reopened log can already hold revisions.
+    latest_commit_time_ = log_container->latestUpdateTime();
+  }
   if (initialize) {
     initialized_.notify();
   }
@@ -103,33 +173,54 @@ void LegacyChunk::initializeNewImpl(
   CHECK(init(id, descriptor, true));
 }
 
-bool LegacyChunk::init(const map_api_common::Id& id,
-                       const proto::InitRequest& init_request,
-                       const PeerId& sender,
-                       std::shared_ptr<TableDescriptor> descriptor) {
+bool LegacyChunk::init(
+    const map_api_common::Id& id, const proto::InitRequest& init_request,
+    const PeerId& sender, std::shared_ptr<TableDescriptor> descriptor,
+    const std::vector<std::shared_ptr<Revision> >& recovered) {
   CHECK(init(id, descriptor, false));
+  if (FLAGS_use_log_container) {
+    // The received histories supersede whatever this peer has persisted of
+    // the chunk.
+    static_cast<LegacyChunkDataContainerBase*>(data_container_.get())->clear();
+    latest_commit_time_ = LogicalTime();
+  }
+  if (init_request.has_delta_since()) {
+    patchRecovered(recovered);
+  }
+  if (init_request.has_compacted_until()) {
+    std::lock_guard<std::mutex> lock(m_compacted_until_);
+    compacted_until_ = LogicalTime(init_request.compacted_until());
+  }
   CHECK_GT(init_request.peer_address_size(), 0);
   for (int i = 0; i < init_request.peer_address_size(); ++i) {
     peers_.add(PeerId(init_request.peer_address(i)));
   }
   // feed data from connect_response into underlying table TODO(tcies) piecewise
+  // All received revisions are parsed into one arena, which the revisions
+  // keep alive. This replaces one allocation per revision, sub-message and
+  // string with a few large blocks.
+  const std::shared_ptr<google::protobuf::Arena> arena =
+      Revision::createArena();
+  uint64_t log_sequence = 0u;
   for (int i = 0; i < init_request.serialized_items_size(); ++i) {
-    proto::History history_proto;
-    CHECK(history_proto.ParseFromString(init_request.serialized_items(i)));
-    CHECK_GT(history_proto.revisions_size(), 0);
-    while (history_proto.revisions_size() > 0) {
-      // using ReleaseLast allows zero-copy ownership transfer to the revision
-      // object.
+    proto::History* history_proto =
+        google::protobuf::Arena::CreateMessage<proto::History>(arena.get());
+    CHECK(history_proto->ParseFromString(init_request.serialized_items(i)));
+    CHECK_GT(history_proto->revisions_size(), 0);
+    // Histories are serialized newest first; patching oldest first.
+    for (int j = history_proto->revisions_size() - 1; j >= 0; --j) {
       std::shared_ptr<Revision> data;
-      Revision::fromProto(std::unique_ptr<proto::Revision>(
-                              history_proto.mutable_revisions()->ReleaseLast()),
+      Revision::fromProto(std::shared_ptr<proto::Revision>(
+                              arena, history_proto->mutable_revisions(j)),
                           &data);
       CHECK(static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
                 ->patch(data));
       // TODO(tcies) guarantee order, then only sync latest time
       syncLatestCommitTime(*data);
+      log_sequence = logAhead(*data);
     }
   }
+  internal::WriteAheadLog::instance().sync(log_sequence);
   std::lock_guard<std::mutex> metalock(lock_.mutex);
   lock_.preempted_state = DistributedRWLock::State::UNLOCKED;
   lock_.state = DistributedRWLock::State::WRITE_LOCKED;
@@ -140,6 +231,15 @@ bool LegacyChunk::init(const map_api_common::Id& id,
   return true;
 }
 
+bool LegacyChunk::init(const map_api_common::Id& id,
+                       const std::vector<std::shared_ptr<Revision> >& recovered,
+                       std::shared_ptr<TableDescriptor> descriptor) {
+  CHECK(init(id, descriptor, false));
+  patchRecovered(recovered);
+  initialized_.notify();
+  return true;
+}
+
 void LegacyChunk::dumpItems(const LogicalTime& time,
                             ConstRevisionMap* items) const {
   CHECK_NOTNULL(items);
@@ -149,6 +249,11 @@ void LegacyChunk::dumpItems(const LogicalTime& time,
 }
 
 size_t LegacyChunk::numItems(const LogicalTime& time) const {
+  size_t num_items, size_bytes;
+  if (static_cast<const LegacyChunkDataContainerBase*>(data_container_.get())
+          ->countsAt(time, &num_items, &size_bytes)) {
+    return num_items;
+  }
   distributedReadLock();
   size_t result = data_container_->numAvailableIds(time);
   distributedUnlock();
@@ -156,6 +261,11 @@ size_t LegacyChunk::numItems(const LogicalTime& time) const {
 }
 
 size_t LegacyChunk::itemsSizeBytes(const LogicalTime& time) const {
+  size_t num_items, size_bytes;
+  if (static_cast<const LegacyChunkDataContainerBase*>(data_container_.get())
+          ->countsAt(time, &num_items, &size_bytes)) {
+    return size_bytes;
+  }
   ConstRevisionMap items;
   distributedReadLock();
   data_container_->dump(time, &items);
@@ -179,18 +289,18 @@ void LegacyChunk::getCommitTimes(const LogicalTime& sample_time,
   //  time. The expected amount of commit times << the expected amount of items,
   //  so this should be worth it.
   std::unordered_set<LogicalTime> unordered_commit_times;
-  ConstRevisionMap items;
-  LegacyChunkDataContainerBase::HistoryMap histories;
   distributedReadLock();
   static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
-      ->chunkHistory(id(), sample_time, &histories);
+      ->forEachChunkHistory(
+          id(), sample_time,
+          [&unordered_commit_times](
+              const map_api_common::Id& /*id*/,
+              const LegacyChunkDataContainerBase::History::View& history) {
+            for (const std::shared_ptr<const Revision>& revision : history) {
+              unordered_commit_times.insert(revision->getUpdateTime());
+            }
+          });
   distributedUnlock();
-  for (const LegacyChunkDataContainerBase::HistoryMap::value_type& history :
-       histories) {
-    for (const std::shared_ptr<const Revision>& revision : history.second) {
-      unordered_commit_times.insert(revision->getUpdateTime());
-    }
-  }
   commit_times->insert(unordered_commit_times.begin(),
                        unordered_commit_times.end());
 }
@@ -212,21 +322,13 @@ bool LegacyChunk::insert(const LogicalTime& time,
   request.impose<kInsertRequest>(insert_request);
   CHECK(peers_.undisputableBroadcast(&request));
   syncLatestCommitTime(*item);
+  internal::WriteAheadLog::instance().sync(logAhead(*item));
   distributedUnlock();
   return true;
 }
 
 int LegacyChunk::peerSize() const { return peers_.size(); }
 
-void LegacyChunk::enableLockLogging() {
-  log_locking_ = true;
-  self_rank_ = PeerId::selfRank();
-  std::ofstream file(kLockSequenceFile, std::ios::out | std::ios::trunc);
-  global_start_ = std::chrono::system_clock::now();
-  current_state_ = UNLOCKED;
-  main_thread_id_ = std::this_thread::get_id();
-}
-
 void LegacyChunk::leaveImpl() {
   Message request;
   proto::ChunkRequestMetadata metadata;
@@ -241,6 +343,10 @@ void LegacyChunk::leaveImpl() {
     CHECK(peers_.undisputableBroadcast(&request));
     relinquished_ = true;
   }
+  if (internal::WriteAheadLog::isEnabled()) {
+    internal::WriteAheadLog& log = internal::WriteAheadLog::instance();
+    log.sync(log.appendLeave(data_container_->name(), id()));
+  }
   distributedUnlock();  // i.e. must be able to handle unlocks from outside
   // the swarm. Should this pose problems in the future, we could tie unlocking
   // to leaving.
@@ -260,6 +366,14 @@ bool LegacyChunk::isWriteLocked() const {
   return isWriter(PeerId::self()) && lock_.thread == std::this_thread::get_id();
 }
 
+void LegacyChunk::passWriteLock(const std::thread::id& from,
+                                const std::thread::id& to) {
+  std::lock_guard<std::mutex> metalock(lock_.mutex);
+  CHECK(isWriter(PeerId::self()));
+  CHECK(lock_.thread == from);
+  lock_.thread = to;
+}
+
 void LegacyChunk::unlock() const { distributedUnlock(); }
 
 // not expressing in terms of the peer-specifying overload in order to avoid
@@ -280,7 +394,7 @@ int LegacyChunk::requestParticipation(const PeerId& peer) {
   std::set<PeerId> hub_peers;
   Hub::instance().getPeers(&hub_peers);
   if (peers_.peers().find(peer) == peers_.peers().end()) {
-    if (addPeer(peer)) {
+    if (addPeer(peer, LogicalTime())) {
       ++participant_count;
     }
   } else {
@@ -307,6 +421,7 @@ void LegacyChunk::update(const std::shared_ptr<Revision>& item) {
   request.impose<kUpdateRequest>(update_request);
   CHECK(peers_.undisputableBroadcast(&request));
   syncLatestCommitTime(*item);
+  internal::WriteAheadLog::instance().sync(logAhead(*item));
   distributedUnlock();
 }
 
@@ -317,6 +432,47 @@ LogicalTime LegacyChunk::getLatestCommitTime() const {
   return result;
 }
 
+uint64_t LegacyChunk::numCommits() const { return num_commits_; }
+
+size_t LegacyChunk::compactHistory(const LogicalTime& watermark) {
+  // Keeps local and remote commits from modifying the histories meanwhile.
+  distributedReadLock();
+  const size_t num_bytes =
+      static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
+          ->compactHistory(watermark);
+  distributedUnlock();
+  {
+    std::lock_guard<std::mutex> lock(m_compacted_until_);
+    if (compacted_until_ < watermark) {
+      compacted_until_ = watermark;
+    }
+  }
+  return num_bytes;
+}
+
+LogicalTime LegacyChunk::compactedUntil() const {
+  std::lock_guard<std::mutex> lock(m_compacted_until_);
+  return compacted_until_;
+}
+
+void LegacyChunk::dumpHistories(
+    const std::function<void(const Revision&)>& sink) const {
+  distributedReadLock();
+  static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
+      ->forEachChunkHistory(
+          id(), LogicalTime::sample(),
+          [&sink](const map_api_common::Id& /*id*/,
+                  const LegacyChunkDataContainerBase::History::View& history) {
+            for (LegacyChunkDataContainerBase::History::const_iterator it =
+                     history.end();
+                 it != history.begin();) {
+              --it;
+              sink(**it);
+            }
+          });
+  distributedUnlock();
+}
+
 void LegacyChunk::bulkInsertLocked(const MutableRevisionMap& items,
                                    const LogicalTime& time) {
   std::vector<proto::PatchRequest> insert_requests;
@@ -341,6 +497,7 @@ void LegacyChunk::bulkInsertLocked(const MutableRevisionMap& items,
     request.impose<kInsertRequest>(insert_requests[i]);
     CHECK(peers_.undisputableBroadcast(&request));
     // TODO(tcies) also bulk this
+    unsynced_log_sequence_ = logAhead(*item.second);
     ++i;
   }
 }
@@ -362,6 +519,7 @@ void LegacyChunk::updateLocked(const LogicalTime& time,
   update_request.set_serialized_revision(item->serializeUnderlying());
   request.impose<kUpdateRequest>(update_request);
   CHECK(peers_.undisputableBroadcast(&request));
+  unsynced_log_sequence_ = logAhead(*item);
 }
 
 void LegacyChunk::removeLocked(const LogicalTime& time,
@@ -379,9 +537,10 @@ void LegacyChunk::removeLocked(const LogicalTime& time,
   remove_request.set_serialized_revision(item->serializeUnderlying());
   request.impose<kUpdateRequest>(remove_request);
   CHECK(peers_.undisputableBroadcast(&request));
+  unsynced_log_sequence_ = logAhead(*item);
 }
 
-bool LegacyChunk::addPeer(const PeerId& peer) {
+bool LegacyChunk::addPeer(const PeerId& peer, const LogicalTime& delta_since) {
   std::lock_guard<std::mutex> add_peer_lock(add_peer_mutex_);
   {
     std::lock_guard<std::mutex> metalock(lock_.mutex);
@@ -392,7 +551,7 @@ bool LegacyChunk::addPeer(const PeerId& peer) {
     LOG(FATAL) << "Peer already in swarm!";
     return false;
   }
-  prepareInitRequest(&request);
+  prepareInitRequest(delta_since, &request);
   if (!Hub::instance().ackRequest(peer, &request)) {
     LOG(WARNING) << peer << " did not accept init request!";
     return false;
@@ -420,7 +579,7 @@ size_t LegacyChunk::addAllPeers() {
   Message request;
   proto::InitRequest init_request;
   fillMetadata(&init_request);
-  initRequestSetData(&init_request);
+  initRequestSetData(LogicalTime(), &init_request);
   proto::NewPeerRequest new_peer_request;
   fillMetadata(&new_peer_request);
 
@@ -448,14 +607,14 @@ size_t LegacyChunk::addAllPeers() {
 }
 
 void LegacyChunk::distributedReadLock() const {
-  if (log_locking_) {
-    startState(READ_ATTEMPT);
-  }
+  typedef internal::LockContentionStatistics::Clock Clock;
+  const Clock::time_point attempt_start = Clock::now();
   std::unique_lock<std::mutex> metalock(lock_.mutex);
   if (isWriter(PeerId::self()) && lock_.thread == std::this_thread::get_id()) {
     // special case: also succeed. This is necessary e.g. when committing
     // transactions
     ++lock_.write_recursion_depth;
+    lock_statistics_.recordRecursion(lock_.write_recursion_depth);
     metalock.unlock();
     return;
   }
@@ -464,22 +623,24 @@ void LegacyChunk::distributedReadLock() const {
     lock_.cv.wait(metalock);
   }
   CHECK(!relinquished_);
+  const Clock::time_point now = Clock::now();
+  if (lock_.state == DistributedRWLock::State::UNLOCKED) {
+    lock_.read_locked_since = now;
+  }
   lock_.state = DistributedRWLock::State::READ_LOCKED;
   ++lock_.n_readers;
   metalock.unlock();
-  if (log_locking_) {
-    startState(READ_SUCCESS);
-  }
+  lock_statistics_.recordReadWait(now - attempt_start);
 }
 
 void LegacyChunk::distributedWriteLock() {
-  if (log_locking_) {
-    startState(WRITE_ATTEMPT);
-  }
+  typedef internal::LockContentionStatistics::Clock Clock;
+  const Clock::time_point attempt_start = Clock::now();
   std::unique_lock<std::mutex> metalock(lock_.mutex);
   // case recursion TODO(tcies) abolish if possible
   if (isWriter(PeerId::self()) && lock_.thread == std::this_thread::get_id()) {
     ++lock_.write_recursion_depth;
+    lock_statistics_.recordRecursion(lock_.write_recursion_depth);
     metalock.unlock();
     return;
   }
@@ -488,13 +649,46 @@ void LegacyChunk::distributedWriteLock() {
          lock_.thread != std::this_thread::get_id()) {
     lock_.cv.wait(metalock);
   }
+  WriteLockBackoff backoff;
   while (true) {  // lock: attempt until success
-    while (lock_.state != DistributedRWLock::State::UNLOCKED &&
-           !(lock_.state == DistributedRWLock::State::ATTEMPTING &&
+    while (!(lock_.state == DistributedRWLock::State::ATTEMPTING &&
              lock_.thread == std::this_thread::get_id())) {
-      lock_.cv.wait(metalock);
+      const bool is_arbitrator = isArbitrator();
+      if (is_arbitrator) {
+        expireReservation();
+      }
+      if (lock_.state == DistributedRWLock::State::UNLOCKED &&
+          (!is_arbitrator || !lock_.reserved_for.isValid() ||
+           lock_.reserved_for == PeerId::self())) {
+        break;
+      }
+      // As arbitrator, queue up behind the remote peers that have requested
+      // the lock before us, rather than racing them for it.
+      const bool remote_contention =
+          (lock_.state == DistributedRWLock::State::WRITE_LOCKED &&
+           lock_.holder != PeerId::self()) ||
+          lock_.state == DistributedRWLock::State::UNLOCKED;
+      if (is_arbitrator && remote_contention &&
+          std::find(lock_.waiters.begin(), lock_.waiters.end(),
+                    PeerId::self()) == lock_.waiters.end()) {
+        lock_.waiters.push_back(PeerId::self());
+        lock_statistics_.recordQueued();
+      }
+      if (is_arbitrator && lock_.reserved_for.isValid() &&
+          lock_.reserved_for != PeerId::self()) {
+        // Wakes up to expire the reservation should it not be claimed.
+        lock_.cv.wait_until(metalock, lock_.reserved_until);
+      } else {
+        lock_.cv.wait(metalock);
+      }
     }
     CHECK(!relinquished_);
+    if (lock_.reserved_for == PeerId::self()) {
+      lock_.reserved_for = PeerId();
+    }
+    lock_.waiters.erase(std::remove(lock_.waiters.begin(), lock_.waiters.end(),
+                                    PeerId::self()),
+                        lock_.waiters.end());
     lock_.state = DistributedRWLock::State::ATTEMPTING;
     lock_.thread = std::this_thread::get_id();
     // unlocking metalock to avoid deadlocks when two peers try to acquire the
@@ -506,47 +700,83 @@ void LegacyChunk::distributedWriteLock() {
     fillMetadata(&lock_request);
     request.impose<kLockRequest>(lock_request);
 
-    bool declined = false;
-    if (FLAGS_writelock_persist) {
-      if (peers_.peers().size()) {
-        std::set<PeerId>::const_iterator it = peers_.peers().cbegin();
-        Hub::instance().request(*it, &request, &response);
-        if (response.isType<Message::kDecline>()) {
-          declined = true;
-        } else {
-          ++it;
-          for (; it != peers_.peers().cend(); ++it) {
-            Hub::instance().request(*it, &request, &response);
-            while (response.isType<Message::kDecline>()) {
-              usleep(5000);  // TODO(tcies) flag?
-              Hub::instance().request(*it, &request, &response);
-            }
-          }
+    std::set<PeerId>::const_iterator it = peers_.peers().cbegin();
+    if (it != peers_.peers().cend() && *it < PeerId::self()) {
+      // The arbitrator either grants the lock right away or queues us and
+      // notifies us once it is our turn to repeat the request.
+      const PeerId arbitrator = *it;
+      {
+        // Set before requesting, as the notification may overtake the
+        // response.
+        std::lock_guard<std::mutex> metalock_guard(lock_.mutex);
+        lock_.queued_at = arbitrator;
+      }
+      Hub::instance().request(arbitrator, &request, &response);
+      metalock.lock();
+      if (response.isType<kLockQueuedResponse>()) {
+        lock_statistics_.recordQueued();
+        // The request is repeated if no notification arrives in time: The
+        // notification may have been lost, or the reservation of a peer
+        // ahead of us may need to expire, which the arbitrator only notices
+        // on requests.
+        const Clock::time_point retry_at = Clock::now() +
+                                           lockReservationTimeout();
+        while (lock_.queued_at == arbitrator && Clock::now() < retry_at) {
+          lock_.cv.wait_until(metalock, retry_at);
+        }
+        if (lock_.queued_at == arbitrator) {
+          lock_.queued_at = PeerId();
         }
+        lock_statistics_.recordRetry();
+        continue;
       }
-    } else {
-      for (const PeerId& peer : peers_.peers()) {
-        Hub::instance().request(peer, &request, &response);
-        if (response.isType<Message::kDecline>()) {
-          // assuming no connection loss, a lock may only be declined by the
-          // peer with lowest address
-          declined = true;
-          break;
+      lock_.queued_at = PeerId();
+      if (response.isType<Message::kDecline>()) {
+        // Only happens if the arbitrator is leaving the swarm.
+        lock_statistics_.recordDecline();
+        lock_statistics_.recordRetry();
+        metalock.unlock();
+        backoff.sleep();
+        metalock.lock();
+        continue;
+      }
+      metalock.unlock();
+      CHECK(response.isType<Message::kAck>());
+      VLOG(3) << PeerId::self() << " got lock from arbitrator " << arbitrator;
+      ++it;
+    }
+
+    // Having passed the arbitrator, the other peers can only decline while
+    // still processing the unlock of the previous lock holder.
+    bool declined = false;
+    for (; it != peers_.peers().cend(); ++it) {
+      Hub::instance().request(*it, &request, &response);
+      if (FLAGS_writelock_persist) {
+        WriteLockBackoff peer_backoff;
+        while (response.isType<Message::kDecline>()) {
+          lock_statistics_.recordDecline();
+          peer_backoff.sleep();
+          Hub::instance().request(*it, &request, &response);
         }
-        // TODO(tcies) READ_LOCKED case - kReading & pulse - it would be
-        // favorable for peers that have the lock read-locked to respond lest
-        // they be considered disconnected due to timeout. A good solution
-        // should be to have a custom response "reading, please stand by" with
-        // lease & pulse to renew the reading lease.
-        CHECK(response.isType<Message::kAck>());
-        VLOG(3) << PeerId::self() << " got lock from " << peer;
+      } else if (response.isType<Message::kDecline>()) {
+        lock_statistics_.recordDecline();
+        declined = true;
+        break;
       }
+      // TODO(tcies) READ_LOCKED case - kReading & pulse - it would be
+      // favorable for peers that have the lock read-locked to respond lest
+      // they be considered disconnected due to timeout. A good solution
+      // should be to have a custom response "reading, please stand by" with
+      // lease & pulse to renew the reading lease.
+      CHECK(response.isType<Message::kAck>());
+      VLOG(3) << PeerId::self() << " got lock from " << *it;
     }
     if (declined) {
       // if we fail to acquire the lock we return to "conditional wait if not
       // UNLOCKED or ATTEMPTING". Either the state has changed to "locked by
       // other" until then, or we will fail again.
-      usleep(1000);
+      lock_statistics_.recordRetry();
+      backoff.sleep();
       metalock.lock();
       continue;
     }
@@ -559,9 +789,8 @@ void LegacyChunk::distributedWriteLock() {
   lock_.holder = PeerId::self();
   lock_.thread = std::this_thread::get_id();
   ++lock_.write_recursion_depth;
-  if (log_locking_) {
-    startState(WRITE_SUCCESS);
-  }
+  lock_.write_locked_since = Clock::now();
+  lock_statistics_.recordWriteWait(lock_.write_locked_since - attempt_start);
 }
 
 void LegacyChunk::distributedUnlock() const {
@@ -574,11 +803,13 @@ void LegacyChunk::distributedUnlock() const {
     case DistributedRWLock::State::READ_LOCKED: {
       if (!--lock_.n_readers) {
         lock_.state = DistributedRWLock::State::UNLOCKED;
+        passLockToNextWaiter();
+        const internal::LockContentionStatistics::Clock::duration hold_time =
+            internal::LockContentionStatistics::Clock::now() -
+            lock_.read_locked_since;
         metalock.unlock();
         lock_.cv.notify_all();
-        if (log_locking_) {
-          startState(UNLOCKED);
-        }
+        lock_statistics_.recordReadHold(hold_time);
         return;
       }
       break;
@@ -595,6 +826,17 @@ void LegacyChunk::distributedUnlock() const {
         metalock.unlock();
         return;
       }
+      if (unsynced_log_sequence_ > 0u) {
+        // Transactions are durable once they release the write lock. Other
+        // threads can't take the lock meanwhile.
+        metalock.unlock();
+        internal::WriteAheadLog::instance().sync(unsynced_log_sequence_);
+        unsynced_log_sequence_ = 0u;
+        metalock.lock();
+      }
+      lock_statistics_.recordWriteHold(
+          internal::LockContentionStatistics::Clock::now() -
+          lock_.write_locked_since);
       std::lock_guard<std::mutex> add_peer_lock(add_peer_mutex_);
       Message request, response;
       proto::ChunkRequestMetadata unlock_request;
@@ -611,10 +853,16 @@ void LegacyChunk::distributedUnlock() const {
         bool self_unlocked = false;
         // NB peers can only change if someone else has locked the chunk
         const std::set<PeerId>& peers = peers_.peers();
+        // A remote arbitrator is unlocked last, so that the next peer it lets
+        // acquire the lock finds all other peers unlocked already.
+        const bool has_remote_arbitrator = *peers.begin() < PeerId::self();
         switch (static_cast<UnlockStrategy>(FLAGS_unlock_strategy)) {
           case REVERSE: {
             for (std::set<PeerId>::const_reverse_iterator rit = peers.rbegin();
                  rit != peers.rend(); ++rit) {
+              if (has_remote_arbitrator && *rit == *peers.begin()) {
+                continue;
+              }
               if (!self_unlocked && *rit < PeerId::self()) {
                 lock_.state = DistributedRWLock::State::UNLOCKED;
                 self_unlocked = true;
@@ -629,6 +877,9 @@ void LegacyChunk::distributedUnlock() const {
             CHECK(FLAGS_writelock_persist) << "forward unlock only works with "
                                               "writelock persist";
             for (const PeerId& peer : peers) {
+              if (has_remote_arbitrator && peer == *peers.begin()) {
+                continue;
+              }
               if (!self_unlocked && PeerId::self() < peer) {
                 lock_.state = DistributedRWLock::State::UNLOCKED;
                 self_unlocked = true;
@@ -643,7 +894,10 @@ void LegacyChunk::distributedUnlock() const {
             CHECK(FLAGS_writelock_persist)
                 << "Random doesn't work without writelock-persist";
             std::srand(LogicalTime::sample().serialize());
-            std::vector<PeerId> mixed_peers(peers.cbegin(), peers.cend());
+            std::vector<PeerId> mixed_peers(
+                has_remote_arbitrator ? std::next(peers.cbegin())
+                                      : peers.cbegin(),
+                peers.cend());
             std::random_shuffle(mixed_peers.begin(), mixed_peers.end());
             for (const PeerId& peer : mixed_peers) {
               Hub::instance().request(peer, &request, &response);
@@ -653,16 +907,24 @@ void LegacyChunk::distributedUnlock() const {
             break;
           }
         }
+        if (has_remote_arbitrator) {
+          if (!self_unlocked) {
+            lock_.state = DistributedRWLock::State::UNLOCKED;
+            self_unlocked = true;
+          }
+          Hub::instance().request(*peers.begin(), &request, &response);
+          CHECK(response.isType<Message::kAck>());
+          VLOG(4) << PeerId::self() << " released lock from arbitrator "
+                  << *peers.begin();
+        }
         if (!self_unlocked) {
           // case we had the lowest address
           lock_.state = DistributedRWLock::State::UNLOCKED;
         }
       }
+      passLockToNextWaiter();
       metalock.unlock();
       lock_.cv.notify_all();
-      if (log_locking_) {
-        startState(UNLOCKED);
-      }
       return;
     }
   }
@@ -674,20 +936,97 @@ bool LegacyChunk::isWriter(const PeerId& peer) const {
           lock_.holder == peer);
 }
 
-void LegacyChunk::initRequestSetData(proto::InitRequest* request) {
-  CHECK_NOTNULL(request);
-  LegacyChunkDataContainerBase::HistoryMap data;
-  static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
-      ->chunkHistory(id(), LogicalTime::sample(), &data);
-  for (const LegacyChunkDataContainerBase::HistoryMap::value_type& data_pair :
-       data) {
-    proto::History history_proto;
-    for (const std::shared_ptr<const Revision>& revision : data_pair.second) {
-      history_proto.mutable_revisions()->AddAllocated(
-          new proto::Revision(*revision->underlying_revision_));
+bool LegacyChunk::isArbitrator() const {
+  return peers_.empty() || PeerId::self() < *peers_.peers().begin();
+}
+
+void LegacyChunk::passLockToNextWaiter() const {
+  CHECK(lock_.state == DistributedRWLock::State::UNLOCKED);
+  if (!isArbitrator()) {
+    // The swarm has changed since the waiters have been queued. They need to
+    // repeat their requests at the new arbitrator.
+    lock_.reserved_for = PeerId();
+    for (const PeerId& waiter : lock_.waiters) {
+      if (waiter != PeerId::self()) {
+        notifyLockAvailable(waiter);
+      }
+    }
+    lock_.waiters.clear();
+    return;
+  }
+  if (lock_.reserved_for.isValid() || lock_.waiters.empty()) {
+    return;
+  }
+  lock_.reserved_for = lock_.waiters.front();
+  lock_.reserved_until = internal::LockContentionStatistics::Clock::now() +
+                         lockReservationTimeout();
+  lock_.waiters.pop_front();
+  // If reserved for self, the waiting thread is woken up by the caller.
+  if (lock_.reserved_for != PeerId::self()) {
+    notifyLockAvailable(lock_.reserved_for);
+  }
+}
+
+void LegacyChunk::expireReservation() const {
+  if (!lock_.reserved_for.isValid() ||
+      internal::LockContentionStatistics::Clock::now() <
+          lock_.reserved_until) {
+    return;
+  }
+  LOG(WARNING) << "Lock of chunk " << id() << " reserved for "
+               << lock_.reserved_for << " hasn't been claimed, passing it on";
+  lock_.reserved_for = PeerId();
+  if (lock_.state == DistributedRWLock::State::UNLOCKED) {
+    passLockToNextWaiter();
+    // In case the lock has been passed to self.
+    lock_.cv.notify_all();
+  }
+}
+
+void LegacyChunk::notifyLockAvailable(const PeerId& waiter) const {
+  proto::ChunkRequestMetadata metadata;
+  fillMetadata(&metadata);
+  Message request;
+  request.impose<kLockAvailableRequest>(metadata);
+  lockNotificationPool().enqueue([waiter, request]() mutable {
+    Message response;
+    // Waiters that don't get notified repeat their request eventually.
+    if (!Hub::instance().try_request(waiter, &request, &response)) {
+      VLOG(3) << "Failed to notify " << waiter << " of available lock";
     }
-    request->add_serialized_items(history_proto.SerializeAsString());
+  });
+}
+
+void LegacyChunk::initRequestSetData(const LogicalTime& delta_since,
+                                     proto::InitRequest* request) {
+  CHECK_NOTNULL(request);
+  if (delta_since.isValid()) {
+    request->set_delta_since(delta_since.serialize());
   }
+  const LogicalTime compacted_until = compactedUntil();
+  if (compacted_until.isValid()) {
+    request->set_compacted_until(compacted_until.serialize());
+  }
+  static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
+      ->forEachChunkHistory(
+          id(), LogicalTime::sample(),
+          [&delta_since, request](
+              const map_api_common::Id& /*id*/,
+              const LegacyChunkDataContainerBase::History::View& history) {
+            proto::History history_proto;
+            // Histories are iterated from the latest revision.
+            for (const std::shared_ptr<const Revision>& revision : history) {
+              if (delta_since.isValid() &&
+                  revision->getUpdateTime() <= delta_since) {
+                break;
+              }
+              history_proto.mutable_revisions()->AddAllocated(
+                  new proto::Revision(*revision->underlying_revision_));
+            }
+            if (history_proto.revisions_size() > 0) {
+              request->add_serialized_items(history_proto.SerializeAsString());
+            }
+          });
 }
 
 void LegacyChunk::initRequestSetPeers(proto::InitRequest* request) {
@@ -699,16 +1038,19 @@ void LegacyChunk::initRequestSetPeers(proto::InitRequest* request) {
   request->add_peer_address(PeerId::self().ipPort());
 }
 
-void LegacyChunk::prepareInitRequest(Message* request) {
+void LegacyChunk::prepareInitRequest(const LogicalTime& delta_since,
+                                     Message* request) {
   CHECK_NOTNULL(request);
   proto::InitRequest init_request;
   fillMetadata(&init_request);
   initRequestSetPeers(&init_request);
-  initRequestSetData(&init_request);
+  initRequestSetData(delta_since, &init_request);
   request->impose<kInitRequest, proto::InitRequest>(init_request);
 }
 
-void LegacyChunk::handleConnectRequest(const PeerId& peer, Message* response) {
+void LegacyChunk::handleConnectRequest(const PeerId& peer,
+                                       const LogicalTime& recovered_until,
+                                       Message* response) {
   awaitInitialized();
   VLOG(3) << "Received connect request from " << peer;
   CHECK_NOTNULL(response);
@@ -724,15 +1066,16 @@ void LegacyChunk::handleConnectRequest(const PeerId& peer, Message* response) {
    * is locked, another peer will never succeed to unlock it because the
    * server thread of the RPC handler is busy.
    */
-  std::thread handle_thread(handleConnectRequestThread, this, peer);
+  std::thread handle_thread(handleConnectRequestThread, this, peer,
+                            recovered_until);
   handle_thread.detach();
 
   leave_lock_.releaseReadLock();
   response->ack();
 }
 
-void LegacyChunk::handleConnectRequestThread(LegacyChunk* self,
-                                             const PeerId& peer) {
+void LegacyChunk::handleConnectRequestThread(
+    LegacyChunk* self, const PeerId& peer, const LogicalTime& recovered_until) {
   self->awaitInitialized();
   CHECK_NOTNULL(self);
   self->leave_lock_.acquireReadLock();
@@ -746,7 +1089,7 @@ void LegacyChunk::handleConnectRequestThread(LegacyChunk* self,
   self->distributedWriteLock();
   if (self->peers_.peers().find(peer) == self->peers_.peers().end()) {
     // Peer has no reason to refuse the init request.
-    CHECK(self->addPeer(peer));
+    CHECK(self->addPeer(peer, recovered_until));
   } else {
     LOG(INFO) << "Peer requesting to join already in swarm, could have been "
                  "added by some requestParticipation() call.";
@@ -773,13 +1116,21 @@ void LegacyChunk::handleInsertRequest(const std::shared_ptr<Revision>& item,
   // locked:
   // A lock is only really WRITE_LOCKED when all peers agree that it is.
   // no further locking needed, elegantly
+  bool write_locked;
   {
     std::lock_guard<std::mutex> metalock(lock_.mutex);
     CHECK(!isWriter(PeerId::self()));
+    write_locked = lock_.state == DistributedRWLock::State::WRITE_LOCKED;
   }
   static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
       ->patch(item);
   syncLatestCommitTime(*item);
+  if (write_locked) {
+    // Part of a bulk insert, synced once the holder unlocks.
+    deferLogSync(logAhead(*item));
+  } else {
+    internal::WriteAheadLog::instance().sync(logAhead(*item));
+  }
   response->ack();
   leave_lock_.releaseReadLock();
 
@@ -798,6 +1149,18 @@ void LegacyChunk::handleLeaveRequest(const PeerId& leaver, Message* response) {
   CHECK(lock_.state == DistributedRWLock::State::WRITE_LOCKED);
   CHECK_EQ(lock_.holder, leaver);
   peers_.remove(leaver);
+  // The leaver won't claim the lock any more.
+  lock_.waiters.erase(
+      std::remove(lock_.waiters.begin(), lock_.waiters.end(), leaver),
+      lock_.waiters.end());
+  if (lock_.reserved_for == leaver) {
+    lock_.reserved_for = PeerId();
+  }
+  if (lock_.queued_at == leaver) {
+    // Repeat the lock request at the new arbitrator.
+    lock_.queued_at = PeerId();
+    lock_.cv.notify_all();
+  }
   leave_lock_.releaseReadLock();
   response->impose<Message::kAck>();
 }
@@ -819,8 +1182,20 @@ void LegacyChunk::handleLockRequest(const PeerId& locker, Message* response) {
   }
   // preempted_state MUST NOT be set here, else it might be wrongly set to
   // write_locked if two peers contend for the same lock.
+  const bool is_arbitrator = isArbitrator();
+  if (is_arbitrator) {
+    expireReservation();
+  }
   switch (lock_.state) {
     case DistributedRWLock::State::UNLOCKED:
+      if (is_arbitrator && lock_.reserved_for.isValid() &&
+          lock_.reserved_for != locker) {
+        queueLockRequest(locker, response);
+        break;
+      }
+      if (lock_.reserved_for == locker) {
+        lock_.reserved_for = PeerId();
+      }
       lock_.preempted_state = DistributedRWLock::State::UNLOCKED;
       lock_.state = DistributedRWLock::State::WRITE_LOCKED;
       lock_.holder = locker;
@@ -831,13 +1206,13 @@ void LegacyChunk::handleLockRequest(const PeerId& locker, Message* response) {
       break;
     case DistributedRWLock::State::ATTEMPTING:
       // special case: if address of requester is lower than self, may not
-      // decline. If it is higher, it may decline only if we are the lowest
+      // queue. If it is higher, it may queue only if we are the lowest
       // active peer.
       // This case occurs if two peers try to lock at the same time, and the
       // losing peer doesn't know that it's losing yet.
-      if (PeerId::self() < *peers_.peers().begin()) {
+      if (is_arbitrator) {
         CHECK(PeerId::self() < locker);
-        response->impose<Message::kDecline>();
+        queueLockRequest(locker, response);
       } else {
         // we DON'T need to roll back possible past requests. The current
         // situation can only happen if the requester has successfully achieved
@@ -850,13 +1225,41 @@ void LegacyChunk::handleLockRequest(const PeerId& locker, Message* response) {
       }
       break;
     case DistributedRWLock::State::WRITE_LOCKED:
-      response->impose<Message::kDecline>();
+      if (is_arbitrator) {
+        queueLockRequest(locker, response);
+      } else {
+        response->impose<Message::kDecline>();
+      }
       break;
   }
   metalock.unlock();
   leave_lock_.releaseReadLock();
 }
 
+void LegacyChunk::queueLockRequest(const PeerId& locker, Message* response) {
+  CHECK_NOTNULL(response);
+  if (std::find(lock_.waiters.begin(), lock_.waiters.end(), locker) ==
+      lock_.waiters.end()) {
+    lock_.waiters.push_back(locker);
+  }
+  response->impose<kLockQueuedResponse>();
+}
+
+void LegacyChunk::handleLockAvailableRequest(const PeerId& arbitrator,
+                                             Message* response) {
+  CHECK_NOTNULL(response);
+  awaitInitialized();
+  {
+    std::lock_guard<std::mutex> metalock(lock_.mutex);
+    // Notifications for requests that have been retried already are ignored.
+    if (lock_.queued_at == arbitrator) {
+      lock_.queued_at = PeerId();
+    }
+  }
+  lock_.cv.notify_all();
+  response->ack();
+}
+
 void LegacyChunk::handleNewPeerRequest(const PeerId& peer, const PeerId& sender,
                                        Message* response) {
   CHECK_NOTNULL(response);
@@ -880,10 +1283,22 @@ void LegacyChunk::handleUnlockRequest(const PeerId& locker, Message* response) {
   // should be impossible by design
   std::unique_lock<std::mutex> metalock(lock_.mutex);
   CHECK(lock_.state == DistributedRWLock::State::WRITE_LOCKED);
+  if (unsynced_patch_log_sequence_ > 0u) {
+    // The commit of the holder is durable here once it is acknowledged.
+    // Patches can't arrive meanwhile, as the holder awaits the ack.
+    const uint64_t log_sequence = unsynced_patch_log_sequence_;
+    unsynced_patch_log_sequence_ = 0u;
+    metalock.unlock();
+    internal::WriteAheadLog::instance().sync(log_sequence);
+    metalock.lock();
+  }
   CHECK(lock_.holder == locker);
   CHECK(lock_.preempted_state == DistributedRWLock::State::UNLOCKED ||
         lock_.preempted_state == DistributedRWLock::State::ATTEMPTING);
   lock_.state = lock_.preempted_state;
+  if (lock_.state == DistributedRWLock::State::UNLOCKED) {
+    passLockToNextWaiter();
+  }
   metalock.unlock();
   leave_lock_.releaseReadLock();
   lock_.cv.notify_all();
@@ -903,6 +1318,7 @@ void LegacyChunk::handleUpdateRequest(const std::shared_ptr<Revision>& item,
   static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
       ->patch(item);
   syncLatestCommitTime(*item);
+  deferLogSync(logAhead(*item));
   response->ack();
 
   // TODO(tcies) what if leave during trigger?
@@ -912,59 +1328,28 @@ void LegacyChunk::handleUpdateRequest(const std::shared_ptr<Revision>& item,
 
 void LegacyChunk::awaitInitialized() const { initialized_.wait(); }
 
-void LegacyChunk::startState(LockState new_state) const {
-  // only log main thread
-  if (std::this_thread::get_id() == main_thread_id_) {
-    switch (new_state) {
-      case LockState::UNLOCKED: {
-        if (current_state_ == READ_SUCCESS || current_state_ == WRITE_SUCCESS) {
-          logStateDuration(current_state_, current_state_start_,
-                           std::chrono::system_clock::now());
-          current_state_ = UNLOCKED;
-        } else {
-          LOG(FATAL) << "Invalid state transition: UL from " << current_state_;
-        }
-        break;
-      }
-      case LockState::READ_ATTEMPT:  // fallthrough intended
-      case LockState::WRITE_ATTEMPT: {
-        if (current_state_ == UNLOCKED) {
-          current_state_start_ = std::chrono::system_clock::now();
-          current_state_ = new_state;
-        } else {
-          LOG(FATAL) << "Invalid state transition: " << new_state << " from "
-                     << current_state_;
-        }
-        break;
-      }
-      case LockState::READ_SUCCESS:  // fallthrough intended
-      case LockState::WRITE_SUCCESS: {
-        if (current_state_ == READ_ATTEMPT || current_state_ == WRITE_ATTEMPT) {
-          logStateDuration(current_state_, current_state_start_,
-                           std::chrono::system_clock::now());
-          current_state_start_ = std::chrono::system_clock::now();
-          current_state_ = new_state;
-        } else {
-          LOG(FATAL) << "Invalid state transition: S from " << current_state_;
-        }
-        break;
-      }
-    }
+void LegacyChunk::patchRecovered(
+    const std::vector<std::shared_ptr<Revision> >& recovered) {
+  for (const std::shared_ptr<Revision>& item : recovered) {
+    CHECK_EQ(id(), item->getChunkId());
+    CHECK(static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
+              ->patch(item));
+    syncLatestCommitTime(*item);
   }
 }
 
-void LegacyChunk::logStateDuration(LockState state, const TimePoint& start,
-                                   const TimePoint& end) const {
-  std::ofstream log_file(kLockSequenceFile, std::ios::out | std::ios::app);
-  double d_start =
-      static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
-          start - global_start_).count()) *
-      kNanosecondsToSeconds;
-  double d_end =
-      static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
-          end - global_start_).count()) *
-      kNanosecondsToSeconds;
-  log_file << self_rank_ << " " << state << " " << d_start << " " << d_end
-           << std::endl;
+uint64_t LegacyChunk::logAhead(const Revision& item) const {
+  if (!internal::WriteAheadLog::isEnabled()) {
+    return 0u;
+  }
+  return internal::WriteAheadLog::instance().appendRevision(
+      data_container_->name(), item);
 }
+
+void LegacyChunk::deferLogSync(uint64_t sequence) {
+  std::lock_guard<std::mutex> metalock(lock_.mutex);
+  unsynced_patch_log_sequence_ =
+      std::max(unsynced_patch_log_sequence_, sequence);
+}
+
 }  // namespace map_api
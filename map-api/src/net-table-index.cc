@@ -89,8 +89,50 @@ void NetTableIndex::renouncePosession(const map_api_common::Id& chunk_id) {
   LOG_IF(WARNING, !found)
       << "Tried to renounce possession that was not announced!";
   CHECK(addData(chunk_id.hexString(), peers.SerializeAsString()));
+  if (peers.peers_size() == 0) {
+    dropItemFilter(chunk_id);
+  }
 }
 
+void NetTableIndex::announceItemFilter(const map_api_common::Id& chunk_id,
+                                       const internal::ItemIdFilter& filter) {
+  internal::ItemIdFilter announced;
+  if (seekItemFilter(chunk_id, &announced) &&
+      announced.hasSameDimensions(filter)) {
+    announced.merge(filter);
+  } else {
+    announced = filter;
+  }
+  proto::ItemIdFilter filter_proto;
+  announced.serialize(&filter_proto);
+  CHECK(addData(chunk_id.hexString() + kItemFilterKeySuffix,
+                filter_proto.SerializeAsString()));
+}
+
+bool NetTableIndex::seekItemFilter(const map_api_common::Id& chunk_id,
+                                   internal::ItemIdFilter* filter) {
+  CHECK_NOTNULL(filter);
+  std::string filter_string;
+  // Unlike for peer lists, missing data is expected: It means that no filter
+  // has been announced for the chunk, or that it has been dropped.
+  if (!retrieveData(chunk_id.hexString() + kItemFilterKeySuffix,
+                    &filter_string) ||
+      filter_string.empty()) {
+    return false;
+  }
+  proto::ItemIdFilter filter_proto;
+  CHECK(filter_proto.ParseFromString(filter_string));
+  filter->deserialize(filter_proto);
+  return true;
+}
+
+void NetTableIndex::dropItemFilter(const map_api_common::Id& chunk_id) {
+  // The index can't remove data, so an empty value marks dropped filters.
+  CHECK(addData(chunk_id.hexString() + kItemFilterKeySuffix, ""));
+}
+
+const char NetTableIndex::kItemFilterKeySuffix[] = "_item_filter";
+
 const char NetTableIndex::kRoutedChordRequest[] =
     "map_api_net_table_index_request";
 // Because the requests are routed, we don't need to be careful with the choice
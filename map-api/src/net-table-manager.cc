@@ -21,15 +21,33 @@
 
 #include "map-api/net-table-manager.h"
 
+#include <chrono>
 #include <iostream>  // NOLINT
 
 #include "map-api/chunk-transaction.h"
 #include "map-api/core.h"
 #include "map-api/hub.h"
+#include "map-api/internal/history-watermark.h"
+#include "map-api/internal/write-ahead-log.h"
 #include "map-api/legacy-chunk.h"
 #include "map-api/revision.h"
 #include "./net-table.pb.h"
 
+DEFINE_bool(map_api_print_lock_contention, false,
+            "Print a lock contention report of each table before the tables "
+            "are killed.");
+DEFINE_uint64(map_api_lock_contention_top_chunks, 10u,
+              "Amount of most contended chunks listed per table in the lock "
+              "contention report.");
+DEFINE_uint64(map_api_history_compaction_period_ms, 0u,
+              "Period at which superseded revisions are discarded from the "
+              "chunk histories. 0 disables history compaction.");
+DEFINE_uint64(map_api_wal_checkpoint_period_s, 600u,
+              "Period at which the write-ahead log is checkpointed. 0 disables "
+              "periodic checkpoints.");
+
+DECLARE_string(map_api_wal_directory);
+
 namespace map_api {
 
 enum MetaTableFields {
@@ -44,7 +62,11 @@ constexpr char kMetaTableChunkHexString[] = "000000000000000000000003E1A1AB7E";
 const char NetTableManager::kMetaTableName[] = "map_api_metatable";
 
 NetTableManager::NetTableManager()
-    : metatable_chunk_(nullptr), metatable_(nullptr) {}
+    : metatable_chunk_(nullptr),
+      metatable_(nullptr),
+      stop_history_compactor_(false),
+      num_bytes_released_by_compaction_(0u),
+      stop_checkpointer_(false) {}
 
 template <>
 bool NetTableManager::getTableForRequestWithStringOrDecline<std::string>(
@@ -76,6 +98,8 @@ void NetTableManager::registerHandlers() {
   Hub::instance().registerHandler(LegacyChunk::kLeaveRequest,
                                   handleLeaveRequest);
   Hub::instance().registerHandler(LegacyChunk::kLockRequest, handleLockRequest);
+  Hub::instance().registerHandler(LegacyChunk::kLockAvailableRequest,
+                                  handleLockAvailableRequest);
   Hub::instance().registerHandler(LegacyChunk::kNewPeerRequest,
                                   handleNewPeerRequest);
   Hub::instance().registerHandler(LegacyChunk::kUnlockRequest,
@@ -109,6 +133,9 @@ void NetTableManager::init(bool create_metatable_chunk) {
   tables_.clear();
   tables_lock_.releaseWriteLock();
   initMetatable(create_metatable_chunk);
+  if (FLAGS_map_api_history_compaction_period_ms > 0u) {
+    startHistoryCompactor();
+  }
 }
 
 void NetTableManager::initMetatable(bool create_metatable_chunk) {
@@ -271,6 +298,140 @@ void NetTableManager::printStatistics() const {
        tables_) {
     std::cout << pair.second->getStatistics() << std::endl;
   }
+  std::cout << "History compaction released "
+            << num_bytes_released_by_compaction_ << " bytes" << std::endl;
+}
+
+void NetTableManager::printLockContentionReport(
+    size_t num_top_chunks_per_table) const {
+  map_api_common::ScopedReadLock lock(&tables_lock_);
+  for (const std::pair<const std::string, std::unique_ptr<NetTable> >& pair :
+       tables_) {
+    std::cout << pair.second->getLockContentionReport(num_top_chunks_per_table)
+              << std::endl;
+  }
+}
+
+size_t NetTableManager::compactHistories() {
+  const LogicalTime watermark = internal::HistoryWatermark::advance();
+  if (!watermark.isValid()) {
+    return 0u;
+  }
+  size_t num_bytes = 0u;
+  {
+    map_api_common::ScopedReadLock lock(&tables_lock_);
+    for (const std::pair<const std::string, std::unique_ptr<NetTable> >& pair :
+         tables_) {
+      num_bytes += pair.second->compactHistory(watermark);
+    }
+  }
+  num_bytes_released_by_compaction_ += num_bytes;
+  VLOG(3) << "History compaction up to " << watermark << " released "
+          << num_bytes << " bytes, " << num_bytes_released_by_compaction_
+          << " bytes in total";
+  return num_bytes;
+}
+
+void NetTableManager::startHistoryCompactor() {
+  CHECK(!history_compactor_.joinable());
+  stop_history_compactor_ = false;
+  history_compactor_ = std::thread([this]() {
+    const std::chrono::milliseconds period(
+        FLAGS_map_api_history_compaction_period_ms);
+    std::unique_lock<std::mutex> lock(history_compactor_mutex_);
+    while (!history_compactor_cv_.wait_for(
+        lock, period, [this]() { return stop_history_compactor_; })) {
+      lock.unlock();
+      compactHistories();
+      lock.lock();
+    }
+  });
+}
+
+void NetTableManager::stopHistoryCompactor() {
+  if (!history_compactor_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(history_compactor_mutex_);
+    stop_history_compactor_ = true;
+  }
+  history_compactor_cv_.notify_all();
+  history_compactor_.join();
+}
+
+void NetTableManager::recoverFromWriteAheadLog() {
+  if (!internal::WriteAheadLog::isEnabled()) {
+    return;
+  }
+  internal::WriteAheadLog::TableRevisions recovered;
+  internal::WriteAheadLog::recover(FLAGS_map_api_wal_directory, &recovered);
+  internal::WriteAheadLog::instance().open(FLAGS_map_api_wal_directory);
+  // Rejoining waits for init requests, whose handlers need the tables lock.
+  typedef std::pair<NetTable*, const internal::WriteAheadLog::ChunkRevisions*>
+      TableChunks;
+  std::vector<TableChunks> tables;
+  {
+    map_api_common::ScopedReadLock lock(&tables_lock_);
+    for (const internal::WriteAheadLog::TableRevisions::value_type& table :
+         recovered) {
+      TableMap::iterator found = tables_.find(table.first);
+      if (table.first == kMetaTableName || found == tables_.end()) {
+        LOG(WARNING) << "Not recovering " << table.second.size()
+                     << " chunks of table " << table.first;
+        continue;
+      }
+      tables.emplace_back(found->second.get(), &table.second);
+    }
+  }
+  for (const TableChunks& table : tables) {
+    table.first->recoverChunks(*table.second);
+  }
+  if (FLAGS_map_api_wal_checkpoint_period_s > 0u) {
+    startCheckpointer();
+  }
+}
+
+void NetTableManager::checkpointWriteAheadLog() {
+  internal::WriteAheadLog::instance().checkpoint(
+      [this](const internal::WriteAheadLog::RevisionSink& sink) {
+        map_api_common::ScopedReadLock lock(&tables_lock_);
+        for (const std::pair<const std::string, std::unique_ptr<NetTable> >&
+                 pair : tables_) {
+          if (pair.first != kMetaTableName) {
+            pair.second->dumpHistories(sink);
+          }
+        }
+      });
+  VLOG(3) << "Checkpointed the write-ahead log up to segment "
+          << internal::WriteAheadLog::instance().currentSegment();
+}
+
+void NetTableManager::startCheckpointer() {
+  CHECK(!checkpointer_.joinable());
+  stop_checkpointer_ = false;
+  checkpointer_ = std::thread([this]() {
+    const std::chrono::seconds period(FLAGS_map_api_wal_checkpoint_period_s);
+    std::unique_lock<std::mutex> lock(checkpointer_mutex_);
+    while (!checkpointer_cv_.wait_for(
+        lock, period, [this]() { return stop_checkpointer_; })) {
+      lock.unlock();
+      checkpointWriteAheadLog();
+      lock.lock();
+    }
+  });
+}
+
+void NetTableManager::stopCheckpointer() {
+  if (!checkpointer_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(checkpointer_mutex_);
+    stop_checkpointer_ = true;
+  }
+  checkpointer_cv_.notify_all();
+  checkpointer_.join();
 }
 
 void NetTableManager::listenToPeersJoiningTable(const std::string& table_name) {
@@ -299,6 +460,11 @@ void NetTableManager::listenToPeersJoiningTable(const NetTable& table)
 }
 
 void NetTableManager::kill() {
+  stopHistoryCompactor();
+  stopCheckpointer();
+  if (FLAGS_map_api_print_lock_contention) {
+    printLockContentionReport(FLAGS_map_api_lock_contention_top_chunks);
+  }
   tables_lock_.acquireReadLock();
   for (const std::pair<const std::string, std::unique_ptr<NetTable> >& table :
        tables_) {
@@ -307,9 +473,14 @@ void NetTableManager::kill() {
   CHECK(tables_lock_.upgradeToWriteLock());
   tables_.clear();
   tables_lock_.releaseWriteLock();
+  if (internal::WriteAheadLog::instance().isOpen()) {
+    internal::WriteAheadLog::instance().close();
+  }
 }
 
 void NetTableManager::killOnceShared() {
+  stopHistoryCompactor();
+  stopCheckpointer();
   tables_lock_.acquireReadLock();
   for (const std::pair<const std::string, std::unique_ptr<NetTable> >& table :
        tables_) {
@@ -318,6 +489,9 @@ void NetTableManager::killOnceShared() {
   CHECK(tables_lock_.upgradeToWriteLock());
   tables_.clear();
   tables_lock_.releaseWriteLock();
+  if (internal::WriteAheadLog::instance().isOpen()) {
+    internal::WriteAheadLog::instance().close();
+  }
 }
 
 NetTableManager::Iterator::Iterator(const TableMap::iterator& base,
@@ -350,10 +524,12 @@ bool NetTableManager::Iterator::operator!=(const Iterator& other) const {
 void NetTableManager::handleConnectRequest(const Message& request,
                                            Message* response) {
   CHECK_NOTNULL(response);
-  proto::ChunkRequestMetadata metadata;
-  request.extract<LegacyChunk::kConnectRequest>(&metadata);
-  const std::string& table = metadata.table();
-  map_api_common::Id chunk_id(metadata.chunk_id());
+  proto::ConnectRequest connect_request;
+  request.extract<LegacyChunk::kConnectRequest>(&connect_request);
+  const std::string& table = connect_request.metadata().table();
+  map_api_common::Id chunk_id(connect_request.metadata().chunk_id());
+  // Invalid unless the requester rejoins a chunk recovered from its log.
+  const LogicalTime recovered_until(connect_request.recovered_until());
   CHECK_NOTNULL(Core::instance());
   map_api_common::ScopedReadLock lock(&instance().tables_lock_);
   std::unordered_map<std::string, std::unique_ptr<NetTable> >::iterator found =
@@ -363,7 +539,7 @@ void NetTableManager::handleConnectRequest(const Message& request,
     return;
   }
   found->second->handleConnectRequest(chunk_id, PeerId(request.sender()),
-                                      response);
+                                      recovered_until, response);
 }
 
 void NetTableManager::handleInitRequest(const Message& request,
@@ -413,6 +589,17 @@ void NetTableManager::handleLockRequest(const Message& request,
   }
 }
 
+void NetTableManager::handleLockAvailableRequest(const Message& request,
+                                                 Message* response) {
+  TableMap::iterator found;
+  map_api_common::Id chunk_id;
+  PeerId peer;
+  if (getTableForMetadataRequestOrDecline<LegacyChunk::kLockAvailableRequest>(
+          request, response, &found, &chunk_id, &peer)) {
+    found->second->handleLockAvailableRequest(chunk_id, peer, response);
+  }
+}
+
 void NetTableManager::handleNewPeerRequest(const Message& request,
                                            Message* response) {
   proto::NewPeerRequest new_peer_request;
@@ -52,8 +52,6 @@ NetTableTransaction::NetTableTransaction(const LogicalTime& begin_time,
               chunk_commit_futures.first, table));
     }
   }
-
-  refreshIdToChunkIdMap();
 }
 
 void NetTableTransaction::dumpChunk(const ChunkBase* chunk,
@@ -75,12 +73,33 @@ void NetTableTransaction::dumpActiveChunks(ConstRevisionMap* result) {
   });
 }
 
+void NetTableTransaction::find(const FieldPredicate& predicate,
+                               ConstRevisionMap* result) {
+  CHECK_NOTNULL(result);
+  // TODO(tcies) Also search in uncommitted.
+  // TODO(tcies) Also search in previously committed.
+  workspace_.forEachChunk([&, this](const ChunkBase& chunk) {
+    ConstRevisionMap chunk_result;
+    chunk.constData()->find(predicate, begin_time_, &chunk_result);
+    result->insert(chunk_result.begin(), chunk_result.end());
+  });
+}
+
+void NetTableTransaction::forEachFound(
+    const FieldPredicate& predicate,
+    const ChunkDataContainerBase::FoundAction& action) {
+  // TODO(tcies) Also search in uncommitted.
+  workspace_.forEachChunk([&, this](const ChunkBase& chunk) {
+    chunk.constData()->forEachFound(predicate, begin_time_, action);
+  });
+}
+
 void NetTableTransaction::insert(ChunkBase* chunk,
                                  std::shared_ptr<Revision> revision) {
   CHECK_NOTNULL(chunk);
   CHECK(!finalized_);
   transactionOf(chunk)->insert(revision);
-  CHECK(item_id_to_chunk_id_map_.emplace(revision->getId<map_api_common::Id>(),
+  CHECK(inserted_item_chunk_ids_.emplace(revision->getId<map_api_common::Id>(),
                                          chunk->id()).second);
 }
 
@@ -141,12 +160,17 @@ void NetTableTransaction::unlock() {
 }
 
 bool NetTableTransaction::hasNoConflicts() {
+  std::vector<ChunkTransaction*> transactions;
+  getChunkTransactions(&transactions);
+  return ChunkTransaction::haveNoConflicts(transactions);
+}
+
+void NetTableTransaction::getChunkTransactions(
+    std::vector<ChunkTransaction*>* result) const {
+  CHECK_NOTNULL(result);
   for (const TransactionPair& chunk_transaction : chunk_transactions_) {
-    if (!chunk_transaction.second->hasNoConflicts()) {
-      return false;
-    }
+    result->emplace_back(chunk_transaction.second.get());
   }
-  return true;
 }
 
 void NetTableTransaction::merge(
@@ -222,9 +246,9 @@ ChunkTransaction* NetTableTransaction::transactionOf(const ChunkBase* chunk)
   return chunk_transaction->second.get();
 }
 
-void NetTableTransaction::refreshIdToChunkIdMap() {
-  CHECK(!finalized_);
-  item_id_to_chunk_id_map_.clear();
+void NetTableTransaction::getAvailableCommonIds(
+    std::vector<map_api_common::Id>* ids) {
+  CHECK_NOTNULL(ids)->clear();
   if (FLAGS_map_api_dump_available_chunk_contents) {
     std::cout << table_->name() << " chunk contents:" << std::endl;
   }
@@ -233,15 +257,16 @@ void NetTableTransaction::refreshIdToChunkIdMap() {
     chunk.constData()->getAvailableIds(begin_time_, &chunk_result);
     if (FLAGS_map_api_dump_available_chunk_contents) {
       std::cout << "\tChunk " << chunk.id().hexString() << ":" << std::endl;
-    }
-    for (const map_api_common::Id& item_id : chunk_result) {
-      CHECK(item_id_to_chunk_id_map_.emplace(item_id, chunk.id()).second)
-          << table_->name() << " has redundant item id " << item_id;
-      if (FLAGS_map_api_dump_available_chunk_contents) {
+      for (const map_api_common::Id& item_id : chunk_result) {
         std::cout << "\t\tItem " << item_id.hexString() << std::endl;
       }
     }
+    ids->insert(ids->end(), chunk_result.begin(), chunk_result.end());
   });
+  for (const ItemIdToChunkIdMap::value_type& inserted :
+       inserted_item_chunk_ids_) {
+    ids->emplace_back(inserted.first);
+  }
 }
 
 void NetTableTransaction::getChunkTrackers(
@@ -20,11 +20,13 @@
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
 #include <map-api/net-table.h>
+#include <algorithm>
 #include <glog/logging.h>
 #include <map-api/legacy-chunk-data-ram-container.h>
 #include <map-api/legacy-chunk-data-stxxl-container.h>
 
 #include <map-api-common/backtrace.h>
+#include <map-api-common/thread-pool.h>
 
 #include "map-api/core.h"
 #include "map-api/hub.h"
@@ -33,6 +35,13 @@
 #include "map-api/transaction.h"
 
 DEFINE_bool(use_raft, false, "Toggles use of Raft chunks.");
+DEFINE_uint64(map_api_chunk_sharing_parallelism, 8u,
+              "Maximum number of chunks that are shared or left concurrently "
+              "by bulk operations such as NetTable::shareAllChunks().");
+DEFINE_uint64(map_api_item_filter_announcement_threshold, 1000u,
+              "Number of items that are added to an active chunk before its "
+              "item filter is announced to the net table index again. 0 "
+              "only announces filters when chunk holders join.");
 
 namespace map_api {
 
@@ -45,7 +54,7 @@ const char NetTable::kAnnounceToListeners[] =
 MAP_API_STRING_MESSAGE(NetTable::kPushNewChunksRequest);
 MAP_API_STRING_MESSAGE(NetTable::kAnnounceToListeners);
 
-NetTable::NetTable() {}
+NetTable::NetTable() : item_filter_announcer_(1u) {}
 
 bool NetTable::init(std::shared_ptr<TableDescriptor> descriptor) {
   descriptor_ = descriptor;
@@ -108,6 +117,7 @@ ChunkBase* NetTable::addInitializedChunk(std::unique_ptr<ChunkBase>&& chunk) {
       active_chunks_.emplace(chunk->id(), std::move(chunk));
   CHECK(emplaced.second);
   ChunkBase* final_chunk_ptr = emplaced.first->second.get();
+  registerChunkItems(final_chunk_ptr);
   // Attach triggers from triggers_to_attach_to_future_chunks_.
   attachTriggers(final_chunk_ptr);
   // Run callback for chunk acquisition.
@@ -181,6 +191,43 @@ ChunkBase* NetTable::getChunk(const map_api_common::Id& chunk_id) {
   return result;
 }
 
+bool NetTable::getChunkIdOfItem(const map_api_common::Id& item_id,
+                                map_api_common::Id* chunk_id) const {
+  CHECK_NOTNULL(chunk_id);
+  map_api_common::ScopedReadLock lock(&item_chunk_ids_lock_);
+  std::unordered_map<map_api_common::Id, map_api_common::Id>::const_iterator
+      found = item_chunk_ids_.find(item_id);
+  if (found == item_chunk_ids_.end()) {
+    return false;
+  }
+  *chunk_id = found->second;
+  return true;
+}
+
+void NetTable::announceItemFilters() {
+  std::set<map_api_common::Id> chunk_ids;
+  getActiveChunkIds(&chunk_ids);
+  for (const map_api_common::Id& chunk_id : chunk_ids) {
+    announceItemFilter(chunk_id);
+  }
+}
+
+void NetTable::getChunksThatMayHoldItem(
+    const map_api_common::Id& item_id,
+    const map_api_common::IdSet& candidate_chunk_ids,
+    map_api_common::IdSet* chunk_ids) {
+  CHECK_NOTNULL(chunk_ids)->clear();
+  map_api_common::ScopedReadLock lock(&index_lock_);
+  CHECK_NOTNULL(index_.get());
+  internal::ItemIdFilter filter;
+  for (const map_api_common::Id& chunk_id : candidate_chunk_ids) {
+    if (index_->seekItemFilter(chunk_id, &filter) &&
+        filter.mayContain(item_id)) {
+      chunk_ids->emplace(chunk_id);
+    }
+  }
+}
+
 bool NetTable::ensureHasChunks(const map_api_common::IdSet& chunks_to_ensure) {
   bool success = true;
   for (const map_api_common::Id& chunk_id : chunks_to_ensure) {
@@ -400,10 +447,25 @@ void NetTable::dumpActiveChunksAtCurrentTime(ConstRevisionMap* destination) {
 ChunkBase* NetTable::connectTo(const map_api_common::Id& chunk_id, const PeerId& peer) {
   Message request, response;
   // sends request of chunk info to peer
-  proto::ChunkRequestMetadata metadata;
-  metadata.set_table(descriptor_->name());
-  chunk_id.serialize(metadata.mutable_chunk_id());
-  request.impose<LegacyChunk::kConnectRequest>(metadata);
+  proto::ConnectRequest connect_request;
+  connect_request.mutable_metadata()->set_table(descriptor_->name());
+  chunk_id.serialize(connect_request.mutable_metadata()->mutable_chunk_id());
+  {
+    std::lock_guard<std::mutex> lock(m_rejoining_chunks_);
+    std::unordered_map<map_api_common::Id,
+                       std::vector<std::shared_ptr<Revision> > >::const_iterator
+        found = rejoining_chunks_.find(chunk_id);
+    if (found != rejoining_chunks_.end()) {
+      LogicalTime recovered_until;
+      for (const std::shared_ptr<Revision>& revision : found->second) {
+        if (recovered_until < revision->getUpdateTime()) {
+          recovered_until = revision->getUpdateTime();
+        }
+      }
+      connect_request.set_recovered_until(recovered_until.serialize());
+    }
+  }
+  request.impose<LegacyChunk::kConnectRequest>(connect_request);
   // TODO(tcies) add to local peer subset as well?
   VLOG(5) << "Connecting to " << peer << " for chunk " << chunk_id;
   Hub::instance().request(peer, &request, &response);
@@ -447,7 +509,7 @@ size_t NetTable::numItems() const {
   size_t result = 0;
   LogicalTime count_time = LogicalTime::sample();
   forEachActiveChunk([&](const ChunkBase& chunk) {
-    result += chunk.constData()->numAvailableIds(count_time);
+    result += chunk.numItems(count_time);
   });
   return result;
 }
@@ -475,42 +537,60 @@ void NetTable::killOnceShared() {
   leaveIndices();
 }
 
+// Each chunk is locked and transferred independently, so the chunks are
+// processed concurrently.
 void NetTable::shareAllChunks() {
   active_chunks_lock_.acquireReadLock();
-  for (const ChunkMap::value_type& chunk : active_chunks_) {
-    chunk.second->requestParticipation();
-  }
+  map_api_common::parallelForEach(
+      FLAGS_map_api_chunk_sharing_parallelism, active_chunks_,
+      [](const ChunkMap::value_type& chunk) {
+        chunk.second->requestParticipation();
+      });
   active_chunks_lock_.releaseReadLock();
 }
 
 void NetTable::shareAllChunks(const PeerId& peer) {
   active_chunks_lock_.acquireReadLock();
-  for (const ChunkMap::value_type& chunk : active_chunks_) {
-    chunk.second->requestParticipation(peer);
-  }
+  map_api_common::parallelForEach(
+      FLAGS_map_api_chunk_sharing_parallelism, active_chunks_,
+      [&peer](const ChunkMap::value_type& chunk) {
+        chunk.second->requestParticipation(peer);
+      });
   active_chunks_lock_.releaseReadLock();
 }
 
 void NetTable::leaveAllChunks() {
   active_chunks_lock_.acquireReadLock();
-  for (const ChunkMap::value_type& chunk : active_chunks_) {
-    chunk.second->leave();
-    leaveChunkHolders(chunk.first);
-  }
+  map_api_common::parallelForEach(
+      FLAGS_map_api_chunk_sharing_parallelism, active_chunks_,
+      [this](const ChunkMap::value_type& chunk) {
+        chunk.second->leave();
+        leaveChunkHolders(chunk.first);
+      });
   CHECK(active_chunks_lock_.upgradeToWriteLock());
   active_chunks_.clear();
   active_chunks_lock_.releaseWriteLock();
+  map_api_common::ScopedWriteLock lock(&item_chunk_ids_lock_);
+  item_chunk_ids_.clear();
+  std::lock_guard<std::mutex> count_lock(m_num_unannounced_items_);
+  num_unannounced_items_.clear();
 }
 
 void NetTable::leaveAllChunksOnceShared() {
   active_chunks_lock_.acquireReadLock();
-  for (const ChunkMap::value_type& chunk : active_chunks_) {
-    chunk.second->leaveOnceShared();
-    leaveChunkHolders(chunk.first);
-  }
+  map_api_common::parallelForEach(
+      FLAGS_map_api_chunk_sharing_parallelism, active_chunks_,
+      [this](const ChunkMap::value_type& chunk) {
+        chunk.second->leaveOnceShared();
+        leaveChunkHolders(chunk.first);
+      });
   CHECK(active_chunks_lock_.upgradeToWriteLock());
   active_chunks_.clear();
   active_chunks_lock_.releaseWriteLock();
+  map_api_common::ScopedWriteLock lock(&item_chunk_ids_lock_);
+  item_chunk_ids_.clear();
+  std::lock_guard<std::mutex> count_lock(m_num_unannounced_items_);
+  num_unannounced_items_.clear();
 }
 
 std::string NetTable::getStatistics() {
@@ -521,6 +601,91 @@ std::string NetTable::getStatistics() {
   return ss.str();
 }
 
+std::string NetTable::getLockContentionReport(size_t num_top_chunks) const {
+  internal::LockContentionStatistics table_statistics;
+  std::vector<std::pair<uint64_t, const ChunkBase*>> chunks_by_wait_time;
+  map_api_common::ScopedReadLock lock(&active_chunks_lock_);
+  for (const ChunkMap::value_type& chunk : active_chunks_) {
+    const internal::LockContentionStatistics& chunk_statistics =
+        chunk.second->lockStatistics();
+    table_statistics.merge(chunk_statistics);
+    chunks_by_wait_time.emplace_back(chunk_statistics.totalWaitNanoseconds(),
+                                     chunk.second.get());
+  }
+  num_top_chunks = std::min(num_top_chunks, chunks_by_wait_time.size());
+  std::partial_sort(
+      chunks_by_wait_time.begin(), chunks_by_wait_time.begin() + num_top_chunks,
+      chunks_by_wait_time.end(),
+      [](const std::pair<uint64_t, const ChunkBase*>& a,
+         const std::pair<uint64_t, const ChunkBase*>& b) {
+        return a.first > b.first;
+      });
+
+  std::stringstream ss;
+  ss << "Lock contention of table " << name() << " (" << active_chunks_.size()
+     << " chunks):" << std::endl << table_statistics.toString() << std::endl;
+  for (size_t i = 0u; i < num_top_chunks; ++i) {
+    const ChunkBase& chunk = *chunks_by_wait_time[i].second;
+    ss << "#" << i + 1 << " chunk " << chunk.id().hexString() << ", "
+       << chunks_by_wait_time[i].first * 1e-6 << "ms waited:" << std::endl
+       << chunk.lockStatistics().toString() << std::endl;
+  }
+  return ss.str();
+}
+
+size_t NetTable::compactHistory(const LogicalTime& watermark) {
+  size_t num_bytes = 0u;
+  map_api_common::ScopedReadLock lock(&active_chunks_lock_);
+  for (const ChunkMap::value_type& chunk : active_chunks_) {
+    num_bytes += chunk.second->compactHistory(watermark);
+  }
+  return num_bytes;
+}
+
+void NetTable::recoverChunks(
+    const internal::WriteAheadLog::ChunkRevisions& chunks) {
+  for (const internal::WriteAheadLog::ChunkRevisions::value_type& chunk :
+       chunks) {
+    active_chunks_lock_.acquireReadLock();
+    const bool is_active =
+        active_chunks_.find(chunk.first) != active_chunks_.end();
+    active_chunks_lock_.releaseReadLock();
+    if (is_active) {
+      LOG(WARNING) << "Chunk " << chunk.first << " of " << name()
+                   << " has been acquired before it could be recovered.";
+      continue;
+    }
+    std::unordered_set<PeerId> peers;
+    getChunkHolders(chunk.first, &peers);
+    peers.erase(PeerId::self());
+    if (peers.empty()) {
+      std::unique_ptr<LegacyChunk> restored(new LegacyChunk);
+      CHECK(restored->init(chunk.first, chunk.second, descriptor_));
+      addInitializedChunk(std::move(restored));
+      joinChunkHolders(chunk.first);
+      VLOG(3) << "Restored chunk " << chunk.first << " of " << name()
+              << " from the write-ahead log";
+    } else {
+      {
+        std::lock_guard<std::mutex> lock(m_rejoining_chunks_);
+        rejoining_chunks_[chunk.first] = chunk.second;
+      }
+      connectTo(chunk.first, *peers.begin());
+      VLOG(3) << "Rejoined chunk " << chunk.first << " of " << name()
+              << " at " << *peers.begin();
+    }
+  }
+}
+
+void NetTable::dumpHistories(
+    const internal::WriteAheadLog::RevisionSink& sink) const {
+  map_api_common::ScopedReadLock lock(&active_chunks_lock_);
+  for (const ChunkMap::value_type& chunk : active_chunks_) {
+    chunk.second->dumpHistories(
+        [this, &sink](const Revision& revision) { sink(name(), revision); });
+  }
+}
+
 void NetTable::getActiveChunkIds(std::set<map_api_common::Id>* chunk_ids) const {
   CHECK_NOTNULL(chunk_ids);
   chunk_ids->clear();
@@ -574,13 +739,15 @@ void NetTable::forEachActiveChunkUntil(const std::function<
 }
 
 void NetTable::handleConnectRequest(const map_api_common::Id& chunk_id,
-                                    const PeerId& peer, Message* response) {
+                                    const PeerId& peer,
+                                    const LogicalTime& recovered_until,
+                                    Message* response) {
   ChunkMap::iterator found;
   active_chunks_lock_.acquireReadLock();
   if (routingBasics(chunk_id, response, &found)) {
     LegacyChunk* chunk = CHECK_NOTNULL(
         dynamic_cast<LegacyChunk*>(found->second.get()));  // NOLINT
-    chunk->handleConnectRequest(peer, response);
+    chunk->handleConnectRequest(peer, recovered_until, response);
   }
   active_chunks_lock_.releaseReadLock();
 }
@@ -589,9 +756,21 @@ void NetTable::handleInitRequest(const proto::InitRequest& request,
                                  const PeerId& sender, Message* response) {
   CHECK_NOTNULL(response);
   map_api_common::Id chunk_id(request.metadata().chunk_id());
+  std::vector<std::shared_ptr<Revision> > recovered;
+  {
+    std::lock_guard<std::mutex> lock(m_rejoining_chunks_);
+    std::unordered_map<map_api_common::Id,
+                       std::vector<std::shared_ptr<Revision> > >::iterator
+        found = rejoining_chunks_.find(chunk_id);
+    if (found != rejoining_chunks_.end()) {
+      recovered.swap(found->second);
+      rejoining_chunks_.erase(found);
+    }
+  }
+  CHECK(!request.has_delta_since() || !recovered.empty());
   std::unique_ptr<LegacyChunk> chunk =
       std::unique_ptr<LegacyChunk>(new LegacyChunk);
-  CHECK(chunk->init(chunk_id, request, sender, descriptor_));
+  CHECK(chunk->init(chunk_id, request, sender, descriptor_, recovered));
   addInitializedChunk(std::move(chunk));
   response->ack();
   std::thread(&NetTable::joinChunkHolders, this, chunk_id).detach();
@@ -634,6 +813,19 @@ void NetTable::handleLockRequest(const map_api_common::Id& chunk_id,
   active_chunks_lock_.releaseReadLock();
 }
 
+void NetTable::handleLockAvailableRequest(const map_api_common::Id& chunk_id,
+                                          const PeerId& arbitrator,
+                                          Message* response) {
+  ChunkMap::iterator found;
+  active_chunks_lock_.acquireReadLock();
+  if (routingBasics(chunk_id, response, &found)) {
+    LegacyChunk* chunk = CHECK_NOTNULL(
+        dynamic_cast<LegacyChunk*>(found->second.get()));  // NOLINT
+    chunk->handleLockAvailableRequest(arbitrator, response);
+  }
+  active_chunks_lock_.releaseReadLock();
+}
+
 void NetTable::handleNewPeerRequest(const map_api_common::Id& chunk_id,
                                     const PeerId& peer, const PeerId& sender,
                                     Message* response) {
@@ -725,6 +917,26 @@ bool NetTable::routingBasics(const map_api_common::Id& chunk_id, Message* respon
   return true;
 }
 
+void NetTable::registerChunkItems(ChunkBase* chunk) {
+  CHECK_NOTNULL(chunk);
+  const map_api_common::Id chunk_id = chunk->id();
+  // The callback goes first, such that no item can slip in between.
+  chunk->data_container_->setNewItemCallback(
+      [this, chunk_id](const map_api_common::Id& item_id) {
+        {
+          map_api_common::ScopedWriteLock lock(&item_chunk_ids_lock_);
+          item_chunk_ids_.emplace(item_id, chunk_id);
+        }
+        countUnannouncedItem(chunk_id);
+      });
+  std::vector<map_api_common::Id> item_ids;
+  chunk->data_container_->getAvailableIds(LogicalTime::sample(), &item_ids);
+  map_api_common::ScopedWriteLock lock(&item_chunk_ids_lock_);
+  for (const map_api_common::Id& item_id : item_ids) {
+    item_chunk_ids_.emplace(item_id, chunk_id);
+  }
+}
+
 void NetTable::attachTriggers(ChunkBase* chunk) {
   CHECK_NOTNULL(chunk);
   std::lock_guard<std::mutex> lock(m_triggers_to_attach_);
@@ -770,10 +982,13 @@ void NetTable::getChunkHolders(const map_api_common::Id& chunk_id,
 }
 
 void NetTable::joinChunkHolders(const map_api_common::Id& chunk_id) {
-  map_api_common::ScopedReadLock lock(&index_lock_);
-  CHECK_NOTNULL(index_.get());
-  VLOG(5) << "Joining " << chunk_id.hexString() << " holders";
-  index_->announcePosession(chunk_id);
+  {
+    map_api_common::ScopedReadLock lock(&index_lock_);
+    CHECK_NOTNULL(index_.get());
+    VLOG(5) << "Joining " << chunk_id.hexString() << " holders";
+    index_->announcePosession(chunk_id);
+  }
+  announceItemFilter(chunk_id);
 }
 
 void NetTable::leaveChunkHolders(const map_api_common::Id& chunk_id) {
@@ -783,4 +998,41 @@ void NetTable::leaveChunkHolders(const map_api_common::Id& chunk_id) {
   index_->renouncePosession(chunk_id);
 }
 
+void NetTable::announceItemFilter(const map_api_common::Id& chunk_id) {
+  {
+    std::lock_guard<std::mutex> lock(m_num_unannounced_items_);
+    num_unannounced_items_[chunk_id] = 0u;
+  }
+  internal::ItemIdFilter item_filter;
+  {
+    map_api_common::ScopedReadLock lock(&active_chunks_lock_);
+    ChunkMap::const_iterator found = active_chunks_.find(chunk_id);
+    if (found == active_chunks_.end()) {
+      return;
+    }
+    found->second->data_container_->getItemFilter(&item_filter);
+  }
+  // An empty filter says as much as no filter, so new chunks skip this.
+  if (item_filter.empty()) {
+    return;
+  }
+  map_api_common::ScopedReadLock lock(&index_lock_);
+  // Queued announcements may run after the index has been left.
+  if (index_.get() != nullptr) {
+    index_->announceItemFilter(chunk_id, item_filter);
+  }
+}
+
+void NetTable::countUnannouncedItem(const map_api_common::Id& chunk_id) {
+  std::lock_guard<std::mutex> lock(m_num_unannounced_items_);
+  // Called with the data container locked, so the filter is announced from
+  // the pool. Only the item that reaches the threshold queues the
+  // announcement, which resets the count.
+  if (++num_unannounced_items_[chunk_id] ==
+      FLAGS_map_api_item_filter_announcement_threshold) {
+    item_filter_announcer_.enqueue(
+        std::bind(&NetTable::announceItemFilter, this, chunk_id));
+  }
+}
+
 }  // namespace map_api
@@ -199,6 +199,9 @@ bool ProtoTableFileIO::restoreTableContents(
     return false;
   }
 
+  // Revisions loaded from the same file share an arena.
+  const std::shared_ptr<google::protobuf::Arena> arena =
+      Revision::createArena();
   for (size_t i = 0; i < message_count; ++i) {
     uint32_t msg_size;
     if (!coded_in.ReadVarint32(&msg_size)) {
@@ -223,7 +226,7 @@ bool ProtoTableFileIO::restoreTableContents(
     }
 
     std::shared_ptr<Revision> revision =
-        Revision::fromProtoString(input_string);
+        Revision::fromProtoString(input_string, arena);
 
     map_api_common::Id chunk_id = revision->getChunkId();
     ChunkBase* chunk = nullptr;
@@ -21,6 +21,10 @@
 
 #include <map-api/revision.h>
 
+#include <functional>
+#include <memory>
+#include <vector>
+
 #include <glog/logging.h>
 #include <map-api/logical-time.h>
 #include <map-api/net-table-manager.h>
@@ -30,10 +34,88 @@
 
 namespace map_api {
 
+// Larger than the protobuf default, so that large chunks don't end up in
+// thousands of small blocks.
+constexpr size_t kArenaMaxBlockSize = 1u << 20;
+
+namespace {
+
+// Deletes a revision whose custom field values are owned individually by
+// "fields", so that they can be shared with other revisions. A field shared
+// from a revision that owns its fields itself keeps that revision alive, but
+// only that one: fields shared from a sharing revision are taken over from
+// its deleter, so copies of copies never form a chain of revisions.
+struct SharedFieldsDeleter {
+  std::vector<std::shared_ptr<proto::TableField>> fields;
+
+  bool isShared(int index) const { return fields[index].use_count() > 1; }
+
+  void operator()(proto::Revision* revision) {
+    // Releases the fields without deleting them.
+    revision->mutable_custom_field_values()->UnsafeArenaExtractSubrange(
+        0, revision->custom_field_values_size(), nullptr);
+    delete revision;
+    fields.clear();
+  }
+};
+
+// Copies everything but the custom field values.
+void copyMetadata(const proto::Revision& source, proto::Revision* destination) {
+  CHECK_NOTNULL(destination);
+  DCHECK_EQ(proto::Revision::descriptor()->field_count(), 7)
+      << "Update copyMetadata() to the fields of proto::Revision!";
+  if (source.has_id()) {
+    destination->mutable_id()->CopyFrom(source.id());
+  }
+  if (source.has_insert_time()) {
+    destination->set_insert_time(source.insert_time());
+  }
+  if (source.has_update_time()) {
+    destination->set_update_time(source.update_time());
+  }
+  if (source.has_removed()) {
+    destination->set_removed(source.removed());
+  }
+  if (source.has_chunk_id()) {
+    destination->mutable_chunk_id()->CopyFrom(source.chunk_id());
+  }
+  destination->mutable_chunk_tracking()->CopyFrom(source.chunk_tracking());
+}
+
+std::shared_ptr<proto::Revision> shareCustomFields(
+    const std::shared_ptr<proto::Revision>& source) {
+  CHECK(source);
+  SharedFieldsDeleter deleter;
+  const SharedFieldsDeleter* source_deleter =
+      std::get_deleter<SharedFieldsDeleter>(source);
+  if (source_deleter != nullptr) {
+    deleter.fields = source_deleter->fields;
+  } else {
+    for (int i = 0; i < source->custom_field_values_size(); ++i) {
+      // Aliasing constructor: owns the source, points to its field.
+      deleter.fields.emplace_back(source,
+                                  source->mutable_custom_field_values(i));
+    }
+  }
+  proto::Revision* sharer = new proto::Revision;
+  copyMetadata(*source, sharer);
+  for (const std::shared_ptr<proto::TableField>& field : deleter.fields) {
+    sharer->mutable_custom_field_values()->UnsafeArenaAddAllocated(
+        field.get());
+  }
+  return std::shared_ptr<proto::Revision>(sharer, deleter);
+}
+
+}  // namespace
+
 void Revision::copyForWrite(std::shared_ptr<Revision>* result) const {
   CHECK_NOTNULL(result);
-  std::shared_ptr<proto::Revision> copy(
-      new proto::Revision(*underlying_revision_));
+  std::shared_ptr<proto::Revision> copy;
+  if (underlying_revision_->custom_field_values_size() == 0) {
+    copy.reset(new proto::Revision(*underlying_revision_));
+  } else {
+    copy = shareCustomFields(underlying_revision_);
+  }
   return fromProto(copy, result);
 }
 
@@ -62,13 +144,35 @@ std::shared_ptr<Revision> Revision::fromProtoString(
   return result;
 }
 
+std::shared_ptr<Revision> Revision::fromProtoString(
+    const std::string& revision_proto_string,
+    const std::shared_ptr<google::protobuf::Arena>& arena) {
+  CHECK(arena);
+  proto::Revision* revision_proto =
+      google::protobuf::Arena::CreateMessage<proto::Revision>(arena.get());
+  CHECK(revision_proto->ParseFromString(revision_proto_string));
+  std::shared_ptr<Revision> result(new Revision);
+  // Aliasing constructor: owns the arena, points to the revision.
+  result->underlying_revision_ =
+      std::shared_ptr<proto::Revision>(arena, revision_proto);
+  return result;
+}
+
+std::shared_ptr<google::protobuf::Arena> Revision::createArena() {
+  google::protobuf::ArenaOptions options;
+  options.max_block_size = kArenaMaxBlockSize;
+  return std::make_shared<google::protobuf::Arena>(options);
+}
+
 void Revision::addField(int index, proto::Type type) {
   CHECK_EQ(underlying_revision_->custom_field_values_size(), index)
       << "Custom fields must be added in-order!";
+  ownAllCustomFields();
   underlying_revision_->add_custom_field_values()->set_type(type);
 }
 void Revision::removeLastField() {
   CHECK_GT(underlying_revision_->custom_field_values_size(), 0);
+  ownAllCustomFields();
   underlying_revision_->mutable_custom_field_values()->RemoveLast();
 }
 
@@ -81,6 +185,19 @@ proto::Type Revision::getFieldType(int index) const {
 }
 
 void Revision::clearCustomFieldValues() {
+  if (underlying_revision_.use_count() > 1 ||
+      std::get_deleter<SharedFieldsDeleter>(underlying_revision_) != nullptr) {
+    // Rather than cloning the shared fields only to clear them, start over
+    // with empty fields. This also releases the shared ones.
+    std::shared_ptr<proto::Revision> cleared(new proto::Revision);
+    copyMetadata(*underlying_revision_, cleared.get());
+    for (const proto::TableField& custom_field :
+         underlying_revision_->custom_field_values()) {
+      cleared->add_custom_field_values()->set_type(custom_field.type());
+    }
+    underlying_revision_ = cleared;
+    return;
+  }
   for (proto::TableField& custom_field :
        *underlying_revision_->mutable_custom_field_values()) {
     proto::Type type = custom_field.type();
@@ -89,6 +206,30 @@ void Revision::clearCustomFieldValues() {
   }
 }
 
+proto::TableField* Revision::mutableCustomField(int index) {
+  CHECK_LT(index, underlying_revision_->custom_field_values_size());
+  if (underlying_revision_.use_count() > 1) {
+    underlying_revision_ = shareCustomFields(underlying_revision_);
+  }
+  SharedFieldsDeleter* deleter =
+      std::get_deleter<SharedFieldsDeleter>(underlying_revision_);
+  if (deleter != nullptr && deleter->isShared(index)) {
+    // Replaces the field by a clone that is owned by this revision only.
+    deleter->fields[index].reset(
+        new proto::TableField(*deleter->fields[index]));
+    underlying_revision_->mutable_custom_field_values()->mutable_data()[index] =
+        deleter->fields[index].get();
+  }
+  return underlying_revision_->mutable_custom_field_values(index);
+}
+
+void Revision::ownAllCustomFields() {
+  if (underlying_revision_.use_count() > 1 ||
+      std::get_deleter<SharedFieldsDeleter>(underlying_revision_) != nullptr) {
+    underlying_revision_.reset(new proto::Revision(*underlying_revision_));
+  }
+}
+
 bool Revision::operator==(const Revision& other) const {
   if (!structureMatch(other)) {
     return false;
@@ -157,6 +298,41 @@ bool Revision::fieldMatch(const Revision& other, int key) const {
   return false;
 }
 
+size_t Revision::fieldHash(int key) const {
+  return fieldHash(underlying_revision_->custom_field_values(key));
+}
+
+size_t Revision::fieldHash(const proto::TableField& field) {
+  switch (field.type()) {
+    case proto::Type::BLOB: {
+      return std::hash<std::string>()(field.blob_value());
+    }
+    case(proto::Type::DOUBLE) : {
+      return std::hash<double>()(field.double_value());
+    }
+    case(proto::Type::HASH128) : {
+      return std::hash<std::string>()(field.string_value());
+    }
+    case(proto::Type::INT32) : {
+      return std::hash<int32_t>()(field.int_value());
+    }
+    case(proto::Type::UINT32) : {
+      return std::hash<uint32_t>()(field.unsigned_int_value());
+    }
+    case(proto::Type::INT64) : {
+      return std::hash<int64_t>()(field.long_value());
+    }
+    case(proto::Type::UINT64) : {
+      return std::hash<uint64_t>()(field.unsigned_long_value());
+    }
+    case(proto::Type::STRING) : {
+      return std::hash<std::string>()(field.string_value());
+    }
+  }
+  CHECK(false) << "Forgot switch case";
+  return 0u;
+}
+
 bool Revision::areAllCustomFieldsEqual(const Revision& other) const {
   for (int i = 0; i < underlying_revision_->custom_field_values_size(); ++i) {
     if (!fieldMatch(other, i)) {
@@ -237,6 +413,7 @@ bool Revision::defaultAutoMergePolicy(const Revision& conflicting_revision,
       VLOG(3) << "Custom fields innovated by both!";
       return false;
     } else {
+      revision_at_hand->ownAllCustomFields();
       revision_at_hand->underlying_revision_->mutable_custom_field_values()
           ->CopyFrom(conflicting_revision.underlying_revision_
                          ->custom_field_values());
@@ -408,12 +585,14 @@ MAP_API_REVISION_GET(LogicalTime /*value*/) {
   return true;
 }
 MAP_API_REVISION_GET(Revision /*value*/) {
-  bool parsed =
-      value->underlying_revision_->ParseFromString(field.blob_value());
-  if (!parsed) {
+  // Parsed into a new underlying revision, as the current one may share its
+  // fields.
+  std::shared_ptr<proto::Revision> parsed(new proto::Revision);
+  if (!parsed->ParseFromString(field.blob_value())) {
     LOG(FATAL) << "Failed to parse revision";
     return false;
   }
+  value->underlying_revision_ = parsed;
   return true;
 }
 MAP_API_REVISION_GET(testBlob /*value*/) {
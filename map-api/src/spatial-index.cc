@@ -425,11 +425,10 @@ void SpatialIndex::handleRoutedRequest(const Message& routed_request_message,
              << request.type();
 }
 
-inline void SpatialIndex::getCellsInBoundingBox(const BoundingBox& bounding_box,
-                                                std::vector<Cell>* cells) {
-  CHECK_NOTNULL(cells)->clear();
+void SpatialIndex::getCellIndicesInBoundingBox(
+    const BoundingBox& bounding_box, std::vector<size_t>* indices) const {
+  CHECK_NOTNULL(indices)->clear();
   CHECK_EQ(bounds_.size(), bounding_box.size());
-  std::vector<size_t> indices;
   // The following loop iterates over the dimensions to obtain the
   // multi-dimensional set of indices corresponding to the bounding box.
   // Each iteration can be considered an extrusion of the lower-dimensional
@@ -452,10 +451,11 @@ inline void SpatialIndex::getCellsInBoundingBox(const BoundingBox& bounding_box,
   // This can then be continued for higher dimensions.
   // In particular, x is most significant while z is least significant.
   size_t lower_dimensions_size = 1;
-  indices.push_back(0);
+  indices->push_back(0);
   for (size_t dimension = 0; dimension < bounds_.size(); ++dimension) {
     CHECK_GE(bounding_box[dimension].min, bounds_[dimension].min);
-    CHECK_LT(bounding_box[dimension].min, bounding_box[dimension].max);
+    // Points, such as landmarks, have zero extent.
+    CHECK_LE(bounding_box[dimension].min, bounding_box[dimension].max);
     CHECK_LE(bounding_box[dimension].max, bounds_[dimension].max);
     // indices in this dimension
     std::vector<size_t> this_dimension_indices;
@@ -466,14 +466,36 @@ inline void SpatialIndex::getCellsInBoundingBox(const BoundingBox& bounding_box,
     // extrusion
     std::vector<size_t> extrusion_step;
     for (size_t this_dimension_index : this_dimension_indices) {
-      for (size_t previous_index : indices) {
+      for (size_t previous_index : *indices) {
         extrusion_step.push_back(previous_index +
                                  this_dimension_index * lower_dimensions_size);
       }
     }
-    indices.swap(extrusion_step);
+    indices->swap(extrusion_step);
+    lower_dimensions_size *= subdivision_[dimension];
+  }
+}
+
+size_t SpatialIndex::getCellIndexOfPoint(
+    const std::vector<double>& point) const {
+  CHECK_EQ(bounds_.size(), point.size());
+  // Same ordering as in getCellIndicesInBoundingBox().
+  size_t index = 0u;
+  size_t lower_dimensions_size = 1u;
+  for (size_t dimension = 0u; dimension < bounds_.size(); ++dimension) {
+    CHECK_GE(point[dimension], bounds_[dimension].min);
+    CHECK_LE(point[dimension], bounds_[dimension].max);
+    index += coefficientOf(dimension, point[dimension]) * lower_dimensions_size;
     lower_dimensions_size *= subdivision_[dimension];
   }
+  return index;
+}
+
+inline void SpatialIndex::getCellsInBoundingBox(const BoundingBox& bounding_box,
+                                                std::vector<Cell>* cells) {
+  CHECK_NOTNULL(cells)->clear();
+  std::vector<size_t> indices;
+  getCellIndicesInBoundingBox(bounding_box, &indices);
   for (size_t index : indices) {
     cells->push_back(Cell(index, this));
   }
@@ -23,6 +23,7 @@
 
 #include <glog/logging.h>
 
+#include "map-api/field-predicate.h"
 #include "map-api/revision.h"
 
 namespace map_api {
@@ -36,6 +37,42 @@ void TableDescriptor::addField(int index, proto::Type type) {
 
 void TableDescriptor::setName(const std::string& name) { set_name(name); }
 
+void TableDescriptor::addIndex(int field) {
+  CHECK_GE(field, 0);
+  CHECK_LT(field, fields_size()) << "Fields must be added before indexing";
+  if (!isIndexed(field)) {
+    add_indexed_fields(field);
+  }
+}
+
+bool TableDescriptor::isIndexed(int field) const {
+  for (int indexed_field : indexed_fields()) {
+    if (indexed_field == field) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TableDescriptor::addSortedIndex(int field) {
+  CHECK_GE(field, 0);
+  CHECK_LT(field, fields_size()) << "Fields must be added before indexing";
+  CHECK(FieldPredicate::isNumeric(fields(field)))
+      << "Only numeric fields can have a sorted index";
+  if (!hasSortedIndex(field)) {
+    add_sorted_indexed_fields(field);
+  }
+}
+
+bool TableDescriptor::hasSortedIndex(int field) const {
+  for (int indexed_field : sorted_indexed_fields()) {
+    if (indexed_field == field) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void TableDescriptor::setSpatialIndex(const SpatialIndex::BoundingBox& extent,
                                       const std::vector<size_t>& subdivision) {
   CHECK_EQ(subdivision.size(), extent.size());
@@ -22,6 +22,7 @@
 #include "map-api/transaction.h"
 
 #include <algorithm>
+#include <vector>
 
 #include <map-api-common/backtrace.h>
 
@@ -48,7 +49,8 @@ Transaction::Transaction(const std::shared_ptr<Workspace>& workspace,
                          const LogicalTime& begin_time,
                          const CommitFutureTree* commit_futures)
     : workspace_(workspace),
-      begin_time_(begin_time),
+      history_reader_(begin_time),
+      begin_time_(history_reader_.beginTime()),
       chunk_tracking_disabled_(false),
       is_parallel_commit_running_(false),
       finalized_(false) {
@@ -58,7 +60,7 @@ Transaction::Transaction(const std::shared_ptr<Workspace>& workspace,
          *commit_futures) {
       net_table_transactions_[table_commit_futures.first] =
           std::shared_ptr<NetTableTransaction>(new NetTableTransaction(
-              begin_time, *workspace, &table_commit_futures.second,
+              begin_time_, *workspace, &table_commit_futures.second,
               table_commit_futures.first));
     }
   }
@@ -102,6 +104,20 @@ void Transaction::dumpActiveChunks(NetTable* table, ConstRevisionMap* result) {
   }
 }
 
+void Transaction::find(const FieldPredicate& predicate, NetTable* table,
+                       ConstRevisionMap* result) {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(result);
+  transactionOf(table)->find(predicate, result);
+}
+
+void Transaction::forEachFound(
+    const FieldPredicate& predicate, NetTable* table,
+    const ChunkDataContainerBase::FoundAction& action) {
+  CHECK_NOTNULL(table);
+  transactionOf(table)->forEachFound(predicate, action);
+}
+
 bool Transaction::fetchAllChunksTrackedByItemsInTable(NetTable* const table) {
   CHECK_NOTNULL(table);
   std::vector<map_api_common::Id> item_ids;
@@ -115,9 +131,6 @@ bool Transaction::fetchAllChunksTrackedByItemsInTable(NetTable* const table) {
     }
   }
   disableDirectAccess();
-  refreshIdToChunkIdMaps();
-  // Id to chunk id maps must be refreshed first, otherwise getAvailableIds will
-  // nor work.
   refreshAvailableIdsInCaches();
   return success;
 }
@@ -234,13 +247,6 @@ size_t Transaction::numChangedItems() const {
   return count;
 }
 
-void Transaction::refreshIdToChunkIdMaps() {
-  CHECK(!finalized_);
-  for (TransactionPair& net_table_transaction : net_table_transactions_) {
-    net_table_transaction.second->refreshIdToChunkIdMap();
-  }
-}
-
 void Transaction::refreshAvailableIdsInCaches() {
   CHECK(!finalized_);
   for (const CacheMap::value_type& cache_pair : caches_) {
@@ -385,18 +391,19 @@ void Transaction::commitImpl(const bool finalize_after_check,
   for (const CacheMap::value_type& cache_pair : caches_) {
     cache_pair.second->discardCachedInsertions();
   }
+  std::vector<ChunkTransaction*> chunk_transactions;
   for (const TransactionPair& net_table_transaction : net_table_transactions_) {
     net_table_transaction.second->lock();
+    net_table_transaction.second->getChunkTransactions(&chunk_transactions);
   }
-  for (const TransactionPair& net_table_transaction : net_table_transactions_) {
-    if (!net_table_transaction.second->hasNoConflicts()) {
-      will_commit_succeed->set_value(false);
-      for (const TransactionPair& net_table_transaction :
-           net_table_transactions_) {
-        net_table_transaction.second->unlock();
-      }
-      return;
+  // With all locks held, the chunks can be checked independently.
+  if (!ChunkTransaction::haveNoConflicts(chunk_transactions)) {
+    will_commit_succeed->set_value(false);
+    for (const TransactionPair& net_table_transaction :
+         net_table_transactions_) {
+      net_table_transaction.second->unlock();
     }
+    return;
   }
 
   if (finalize_after_check) {
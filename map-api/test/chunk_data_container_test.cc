@@ -19,20 +19,38 @@
 // You should have received a copy of the GNU General Public License
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <random>
 #include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <map-api-common/unique-id.h>
 
 #include "map-api/core.h"
+#include "map-api/internal/item-id-filter.h"
+#include "map-api/legacy-chunk-data-columnar-container.h"
+#include "map-api/legacy-chunk-data-log-container.h"
 #include "map-api/legacy-chunk-data-ram-container.h"
 #include "map-api/legacy-chunk-data-stxxl-container.h"
 #include "map-api/logical-time.h"
 #include "map-api/test/testing-entrypoint.h"
+#include "./net-table.pb.h"
 #include "./test_table.cc"
 
+DECLARE_uint64(map_api_item_filter_min_capacity);
+DECLARE_uint64(map_api_log_segment_size_mb);
+DECLARE_uint64(map_api_parallel_scan_threads);
+DECLARE_uint64(map_api_parallel_scan_threshold);
+
 namespace map_api {
 
 template <typename TableType>
@@ -46,7 +64,9 @@ class TableDataContainerTest : public ::testing::Test {
 };
 
 typedef ::testing::Types<LegacyChunkDataRamContainer,
-                         LegacyChunkDataStxxlContainer> TableTypes;
+                         LegacyChunkDataStxxlContainer,
+                         LegacyChunkDataColumnarContainer,
+                         LegacyChunkDataLogContainer> TableTypes;
 TYPED_TEST_CASE(TableDataContainerTest, TableTypes);
 
 TYPED_TEST(TableDataContainerTest, initEmpty) {
@@ -267,7 +287,9 @@ class CruMapIntTestWithInit
       TableDataTypes<table_type, map_api::LogicalTime>
 
 typedef ::testing::Types<ALL_DATA_TYPES(LegacyChunkDataRamContainer),
-                         ALL_DATA_TYPES(LegacyChunkDataStxxlContainer)>
+                         ALL_DATA_TYPES(LegacyChunkDataStxxlContainer),
+                         ALL_DATA_TYPES(LegacyChunkDataColumnarContainer),
+                         ALL_DATA_TYPES(LegacyChunkDataLogContainer)>
     AllTypes;
 
 TYPED_TEST_CASE(FieldTestWithoutInit, AllTypes);
@@ -368,6 +390,549 @@ TYPED_TEST(IntTestWithInit, CreateReadThousand) {
   }
 }
 
+TYPED_TEST(IntTestWithInit, CompactHistory) {
+  typedef FieldTestTable<TableDataTypes<TypeParam, int64_t>>
+      FieldTestTableType;
+  map_api_common::Id id = this->fillRevision(0);
+  ASSERT_TRUE(this->insertRevision());
+  for (int64_t i = 1; i < 4; ++i) {
+    this->getRevision(id);
+    this->query_->set(FieldTestTableType::kTestField, i);
+    this->table_->update(LogicalTime::sample(), this->query_);
+  }
+  const LogicalTime watermark = LogicalTime::sample();
+  this->getRevision(id);
+  this->query_->set(FieldTestTableType::kTestField, static_cast<int64_t>(4));
+  this->table_->update(LogicalTime::sample(), this->query_);
+
+  EXPECT_GT(this->table_->compactHistory(watermark), 0u);
+  EXPECT_EQ(0u, this->table_->compactHistory(watermark));
+  LegacyChunkDataContainerBase::History history;
+  this->table_->itemHistory(id, LogicalTime::sample(), &history);
+  EXPECT_EQ(2u, history.size());
+  int64_t value;
+  this->table_->getById(id, watermark)
+      ->get(FieldTestTableType::kTestField, &value);
+  EXPECT_EQ(3, value);
+  this->table_->getById(id, LogicalTime::sample())
+      ->get(FieldTestTableType::kTestField, &value);
+  EXPECT_EQ(4, value);
+
+  // The removal is kept as a tombstone.
+  this->getRevision(id);
+  this->table_->remove(LogicalTime::sample(), this->query_);
+  EXPECT_GT(this->table_->compactHistory(LogicalTime::sample()), 0u);
+  this->table_->itemHistory(id, LogicalTime::sample(), &history);
+  ASSERT_EQ(1u, history.size());
+  EXPECT_TRUE((*history.begin())->isRemoved());
+  EXPECT_FALSE(this->table_->getById(id, LogicalTime::sample()));
+  EXPECT_EQ(0, this->table_->count(-1, 0, LogicalTime::sample()));
+}
+
+TYPED_TEST(IntTestWithInit, CompactHistoryOfInterleavedItems) {
+  typedef FieldTestTable<TableDataTypes<TypeParam, int64_t>>
+      FieldTestTableType;
+  constexpr int64_t kNumItems = 5;
+  constexpr int64_t kNumUpdates = 4;
+  std::vector<map_api_common::Id> ids;
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    ids.emplace_back(this->fillRevision(i));
+    ASSERT_TRUE(this->insertRevision());
+  }
+  // Updates of the items alternate, so the discarded rows are spread over the
+  // whole container. Odd items are only updated once.
+  for (int64_t update = 1; update <= kNumUpdates; ++update) {
+    for (int64_t i = 0; i < kNumItems; ++i) {
+      if (i % 2 == 1 && update > 1) {
+        continue;
+      }
+      this->getRevision(ids[i]);
+      this->query_->set(FieldTestTableType::kTestField,
+                        update * kNumItems + i);
+      this->table_->update(LogicalTime::sample(), this->query_);
+    }
+  }
+  const LogicalTime watermark = LogicalTime::sample();
+
+  EXPECT_GT(this->table_->compactHistory(watermark), 0u);
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    LegacyChunkDataContainerBase::History history;
+    this->table_->itemHistory(ids[i], watermark, &history);
+    EXPECT_EQ(1u, history.size());
+    const int64_t expected = (i % 2 == 1 ? 1 : kNumUpdates) * kNumItems + i;
+    int64_t value;
+    this->table_->getById(ids[i], watermark)
+        ->get(FieldTestTableType::kTestField, &value);
+    EXPECT_EQ(expected, value);
+    EXPECT_EQ(1, this->table_->count(FieldTestTableType::kTestField, expected,
+                                     watermark));
+  }
+  EXPECT_EQ(kNumItems, this->table_->count(-1, 0, watermark));
+}
+
+TYPED_TEST(IntTestWithInit, SnapshotHistory) {
+  typedef FieldTestTable<TableDataTypes<TypeParam, int64_t>>
+      FieldTestTableType;
+  typedef LegacyChunkDataContainerBase::History History;
+  map_api_common::Id id = this->fillRevision(0);
+  ASSERT_TRUE(this->insertRevision());
+  const map_api_common::Id chunk_id =
+      this->table_->getById(id, LogicalTime::sample())->getChunkId();
+  for (int64_t i = 1; i < 3; ++i) {
+    this->getRevision(id);
+    this->query_->set(FieldTestTableType::kTestField, i);
+    this->table_->update(LogicalTime::sample(), this->query_);
+  }
+  const LogicalTime before_last = LogicalTime::sample();
+  this->getRevision(id);
+  this->query_->set(FieldTestTableType::kTestField, static_cast<int64_t>(3));
+  this->table_->update(LogicalTime::sample(), this->query_);
+  // Inserted after "before_last", so it is visited with an empty view.
+  this->fillRevision(4);
+  ASSERT_TRUE(this->insertRevision());
+
+  History copy;
+  this->table_->itemHistory(id, before_last, &copy);
+  ASSERT_EQ(3u, copy.size());
+  const auto expect_like_copy = [&](const map_api_common::Id& visited_id,
+                                    const History::View& view) {
+    if (visited_id != id) {
+      EXPECT_TRUE(view.empty());
+      return;
+    }
+    ASSERT_EQ(copy.size(), view.size());
+    int64_t value = 2;
+    History::const_iterator copied = copy.begin();
+    for (const History::value_type& revision : view) {
+      EXPECT_EQ((*copied)->getUpdateTime(), revision->getUpdateTime());
+      int64_t stored;
+      revision->get(FieldTestTableType::kTestField, &stored);
+      EXPECT_EQ(value--, stored);
+      ++copied;
+    }
+  };
+  size_t num_visited = 0u;
+  this->table_->visitItemHistory(
+      id, before_last,
+      [&](const map_api_common::Id& visited_id, const History::View& view) {
+        expect_like_copy(visited_id, view);
+        ++num_visited;
+      });
+  this->table_->forEachHistory(
+      -1, *this->table_->getTemplate(), before_last,
+      [&](const map_api_common::Id& visited_id, const History::View& view) {
+        expect_like_copy(visited_id, view);
+        ++num_visited;
+      });
+  this->table_->forEachChunkHistory(
+      chunk_id, before_last,
+      [&](const map_api_common::Id& visited_id, const History::View& view) {
+        expect_like_copy(visited_id, view);
+        ++num_visited;
+      });
+  EXPECT_EQ(5u, num_visited);
+
+  History latest;
+  this->table_->visitItemHistory(
+      id, LogicalTime::sample(),
+      [&latest](const map_api_common::Id& /*id*/, const History::View& view) {
+        latest.assign(view);
+      });
+  EXPECT_EQ(4u, latest.size());
+}
+
+TYPED_TEST(IntTestWithInit, ChunkHistoryOfInterleavedChunks) {
+  typedef FieldTestTable<TableDataTypes<TypeParam, int64_t>>
+      FieldTestTableType;
+  typedef LegacyChunkDataContainerBase::History History;
+  constexpr int64_t kNumChunks = 3;
+  constexpr int64_t kNumItems = 12;
+  std::vector<map_api_common::Id> chunk_ids(kNumChunks);
+  for (map_api_common::Id& chunk_id : chunk_ids) {
+    generateId(&chunk_id);
+  }
+  // Items of the chunks alternate, as they do in a table-wide container.
+  std::vector<map_api_common::Id> ids;
+  std::vector<map_api_common::IdSet> chunk_items(kNumChunks);
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    ids.emplace_back(this->fillRevision(i));
+    this->query_->setChunkId(chunk_ids[i % kNumChunks]);
+    ASSERT_TRUE(this->insertRevision());
+    chunk_items[i % kNumChunks].emplace(ids.back());
+  }
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    this->getRevision(ids[i]);
+    this->query_->set(FieldTestTableType::kTestField, kNumItems + i);
+    this->table_->update(LogicalTime::sample(), this->query_);
+  }
+  const LogicalTime time = LogicalTime::sample();
+
+  for (int64_t chunk = 0; chunk < kNumChunks; ++chunk) {
+    map_api_common::IdSet visited;
+    this->table_->forEachChunkHistory(
+        chunk_ids[chunk], time,
+        [&](const map_api_common::Id& id, const History::View& view) {
+          EXPECT_TRUE(visited.emplace(id).second);
+          EXPECT_EQ(2u, view.size());
+          for (const History::value_type& revision : view) {
+            EXPECT_EQ(id, revision->template getId<map_api_common::Id>());
+            EXPECT_EQ(chunk_ids[chunk], revision->getChunkId());
+          }
+        });
+    EXPECT_EQ(chunk_items[chunk], visited);
+  }
+
+  map_api_common::Id unknown_chunk_id;
+  generateId(&unknown_chunk_id);
+  size_t num_visited = 0u;
+  this->table_->forEachChunkHistory(
+      unknown_chunk_id, time,
+      [&num_visited](const map_api_common::Id& /*id*/,
+                     const History::View& /*view*/) { ++num_visited; });
+  EXPECT_EQ(0u, num_visited);
+}
+
+TYPED_TEST(IntTestWithInit, CountsAt) {
+  typedef FieldTestTable<TableDataTypes<TypeParam, int64_t>>
+      FieldTestTableType;
+  const auto expect_counts_like_dump = [this](const LogicalTime& time) {
+    size_t num_items, size_bytes;
+    ASSERT_TRUE(this->table_->countsAt(time, &num_items, &size_bytes));
+    ConstRevisionMap items;
+    this->table_->dump(time, &items);
+    size_t dumped_size_bytes = 0u;
+    for (const ConstRevisionMap::value_type& item : items) {
+      dumped_size_bytes += item.second->byteSize();
+    }
+    EXPECT_EQ(items.size(), num_items);
+    EXPECT_EQ(dumped_size_bytes, size_bytes);
+  };
+  expect_counts_like_dump(LogicalTime::sample());
+
+  std::vector<map_api_common::Id> ids;
+  for (int64_t i = 0; i < 3; ++i) {
+    ids.emplace_back(this->fillRevision(i));
+    ASSERT_TRUE(this->insertRevision());
+  }
+  const LogicalTime before_writes = LogicalTime::sample();
+  expect_counts_like_dump(LogicalTime::sample());
+
+  // A larger value takes more bytes in the varint encoding.
+  this->getRevision(ids[0]);
+  this->query_->set(FieldTestTableType::kTestField,
+                    std::numeric_limits<int64_t>::max());
+  this->table_->update(LogicalTime::sample(), this->query_);
+  expect_counts_like_dump(LogicalTime::sample());
+  this->getRevision(ids[1]);
+  this->table_->remove(LogicalTime::sample(), this->query_);
+  expect_counts_like_dump(LogicalTime::sample());
+
+  // Earlier times need a scan.
+  size_t num_items, size_bytes;
+  EXPECT_FALSE(this->table_->countsAt(before_writes, &num_items, &size_bytes));
+
+  this->table_->clear();
+  expect_counts_like_dump(LogicalTime::sample());
+}
+
+TYPED_TEST(IntTestWithInit, ItemFilter) {
+  std::vector<map_api_common::Id> ids;
+  for (int i = 0; i < 10; ++i) {
+    ids.emplace_back(this->fillRevision(i));
+    ASSERT_TRUE(this->insertRevision());
+  }
+  // Removed items can't be taken out of the filter.
+  this->getRevision(ids[0]);
+  this->table_->remove(LogicalTime::sample(), this->query_);
+  for (const map_api_common::Id& id : ids) {
+    EXPECT_TRUE(this->table_->mayContainItem(id));
+  }
+
+  // Filters of other containers merge into a filter that covers all of them.
+  internal::ItemIdFilter filter;
+  this->table_->getItemFilter(&filter);
+  map_api_common::Id other_id;
+  map_api_common::generateId(&other_id);
+  internal::ItemIdFilter other_filter;
+  other_filter.add(other_id);
+  proto::ItemIdFilter shipped;
+  other_filter.serialize(&shipped);
+  internal::ItemIdFilter received;
+  received.deserialize(shipped);
+  filter.merge(received);
+  EXPECT_TRUE(filter.mayContain(other_id));
+  EXPECT_TRUE(filter.mayContain(ids[5]));
+
+  this->table_->clear();
+  this->table_->getItemFilter(&filter);
+  EXPECT_TRUE(filter.empty());
+}
+
+TYPED_TEST(IntTestWithInit, ItemFilterGrows) {
+  const uint64_t min_capacity = FLAGS_map_api_item_filter_min_capacity;
+  FLAGS_map_api_item_filter_min_capacity = 10u;
+  this->table_->clear();
+  constexpr size_t kNumItems = 1000u;
+  std::vector<map_api_common::Id> ids;
+  for (size_t i = 0u; i < kNumItems; ++i) {
+    ids.emplace_back(this->fillRevision(i));
+    ASSERT_TRUE(this->insertRevision());
+  }
+  for (const map_api_common::Id& id : ids) {
+    EXPECT_TRUE(this->table_->mayContainItem(id));
+  }
+  internal::ItemIdFilter filter;
+  this->table_->getItemFilter(&filter);
+  EXPECT_GE(filter.capacity(), kNumItems);
+
+  // Filled far past the initial capacity, the filter would report almost
+  // every item.
+  constexpr size_t kNumProbes = 10000u;
+  size_t false_positives = 0u;
+  for (size_t i = 0u; i < kNumProbes; ++i) {
+    map_api_common::Id id;
+    map_api_common::generateId(&id);
+    if (filter.mayContain(id)) {
+      ++false_positives;
+    }
+  }
+  EXPECT_LT(false_positives, kNumProbes / 30u);
+  FLAGS_map_api_item_filter_min_capacity = min_capacity;
+}
+
+class LogContainerTest : public ::testing::Test {
+ protected:
+  enum Fields {
+    kValue
+  };
+
+  virtual void SetUp() override {
+    Core::initializeInstance();
+    ASSERT_TRUE(Core::instance() != nullptr);
+    descriptor_.reset(new TableDescriptor);
+    descriptor_->setName("log_container_test");
+    descriptor_->addField<int64_t>(kValue);
+    generateId(&chunk_id_);
+    reopen();
+  }
+
+  virtual void TearDown() override {
+    container_->clear();
+    container_.reset();
+    EXPECT_EQ(0, rmdir(LegacyChunkDataLogContainer::chunkDirectory(
+                           descriptor_->name(), chunk_id_).c_str()));
+    Core::instance()->kill();
+  }
+
+  void reopen() {
+    container_.reset();
+    container_.reset(new LegacyChunkDataLogContainer(
+        LegacyChunkDataLogContainer::chunkDirectory(descriptor_->name(),
+                                                    chunk_id_)));
+    ASSERT_TRUE(container_->init(descriptor_));
+  }
+
+  map_api_common::Id insert(int64_t value) {
+    std::shared_ptr<Revision> revision = container_->getTemplate();
+    map_api_common::Id id;
+    generateId(&id);
+    revision->setId(id);
+    revision->set(kValue, value);
+    CHECK(container_->insert(LogicalTime::sample(), revision));
+    return id;
+  }
+
+  void update(const map_api_common::Id& id, int64_t value) {
+    std::shared_ptr<Revision> revision;
+    container_->getById(id, LogicalTime::sample())->copyForWrite(&revision);
+    revision->set(kValue, value);
+    container_->update(LogicalTime::sample(), revision);
+  }
+
+  int64_t value(const map_api_common::Id& id) {
+    int64_t result;
+    container_->getById(id, LogicalTime::sample())->get(kValue, &result);
+    return result;
+  }
+
+  std::shared_ptr<TableDescriptor> descriptor_;
+  map_api_common::Id chunk_id_;
+  std::unique_ptr<LegacyChunkDataLogContainer> container_;
+};
+
+TEST_F(LogContainerTest, Reopen) {
+  constexpr int64_t kNumItems = 10;
+  std::vector<map_api_common::Id> ids;
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    ids.emplace_back(insert(i));
+  }
+  update(ids[0], kNumItems);
+  std::shared_ptr<Revision> removed;
+  container_->getById(ids[1], LogicalTime::sample())->copyForWrite(&removed);
+  container_->remove(LogicalTime::sample(), removed);
+  const LogicalTime latest = container_->latestUpdateTime();
+
+  size_t num_items, size_bytes;
+  ASSERT_TRUE(
+      container_->countsAt(LogicalTime::sample(), &num_items, &size_bytes));
+  const size_t expected_size_bytes = size_bytes;
+
+  reopen();
+  EXPECT_EQ(latest, container_->latestUpdateTime());
+  EXPECT_LT(latest, LogicalTime::sample());
+  EXPECT_EQ(kNumItems - 1, container_->count(-1, 0, LogicalTime::sample()));
+  ASSERT_TRUE(
+      container_->countsAt(LogicalTime::sample(), &num_items, &size_bytes));
+  EXPECT_EQ(static_cast<size_t>(kNumItems - 1), num_items);
+  EXPECT_EQ(expected_size_bytes, size_bytes);
+  EXPECT_EQ(kNumItems, value(ids[0]));
+  EXPECT_FALSE(container_->getById(ids[1], LogicalTime::sample()));
+  for (int64_t i = 2; i < kNumItems; ++i) {
+    EXPECT_EQ(i, value(ids[i]));
+  }
+  LegacyChunkDataContainerBase::History history;
+  container_->itemHistory(ids[0], LogicalTime::sample(), &history);
+  EXPECT_EQ(2u, history.size());
+
+  std::vector<map_api_common::Id> chunk_ids;
+  LegacyChunkDataLogContainer::persistedChunks(descriptor_->name(), &chunk_ids);
+  EXPECT_NE(chunk_ids.end(),
+            std::find(chunk_ids.begin(), chunk_ids.end(), chunk_id_));
+
+  // Appending to the reopened log.
+  const map_api_common::Id appended = insert(-1);
+  reopen();
+  EXPECT_EQ(-1, value(appended));
+  EXPECT_EQ(kNumItems, container_->count(-1, 0, LogicalTime::sample()));
+}
+
+TEST_F(LogContainerTest, LocksDirectory) {
+  LegacyChunkDataLogContainer other(LegacyChunkDataLogContainer::chunkDirectory(
+      descriptor_->name(), chunk_id_));
+  EXPECT_DEATH(other.init(descriptor_), "already open");
+}
+
+TEST_F(LogContainerTest, CompactSegments) {
+  const uint64_t segment_size_mb = FLAGS_map_api_log_segment_size_mb;
+  FLAGS_map_api_log_segment_size_mb = 1u;
+  constexpr int64_t kNumItems = 10000;
+  std::vector<map_api_common::Id> ids;
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    ids.emplace_back(insert(i));
+  }
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    update(ids[i], i + 1);
+    update(ids[i], i + 2);
+  }
+  const size_t num_segments = container_->numSegments();
+  const size_t num_log_bytes = container_->numLogBytes();
+  ASSERT_GT(num_segments, 2u);
+
+  EXPECT_GT(container_->compactHistory(LogicalTime::sample()), 0u);
+  EXPECT_LT(container_->numSegments(), num_segments);
+  EXPECT_LT(container_->numLogBytes(), num_log_bytes);
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    EXPECT_EQ(i + 2, value(ids[i]));
+  }
+
+  // Discarded revisions stay discarded after reopening.
+  const size_t compacted_log_bytes = container_->numLogBytes();
+  reopen();
+  EXPECT_EQ(compacted_log_bytes, container_->numLogBytes());
+  LegacyChunkDataContainerBase::History history;
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    EXPECT_EQ(i + 2, value(ids[i]));
+    container_->itemHistory(ids[i], LogicalTime::sample(), &history);
+    EXPECT_EQ(1u, history.size());
+  }
+  FLAGS_map_api_log_segment_size_mb = segment_size_mb;
+}
+
+TEST_F(LogContainerTest, CompactSegmentsKeepsRevisionsAfterWatermark) {
+  const uint64_t segment_size_mb = FLAGS_map_api_log_segment_size_mb;
+  FLAGS_map_api_log_segment_size_mb = 1u;
+  constexpr int64_t kNumItems = 10000;
+  std::vector<map_api_common::Id> ids;
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    ids.emplace_back(insert(i));
+  }
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    update(ids[i], i + 1);
+  }
+  const LogicalTime watermark = LogicalTime::sample();
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    update(ids[i], i + 2);
+  }
+
+  // The revisions valid at and after the watermark are moved out of the
+  // compacted segments.
+  EXPECT_GT(container_->compactHistory(watermark), 0u);
+  reopen();
+  LegacyChunkDataContainerBase::History history;
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    EXPECT_EQ(i + 2, value(ids[i]));
+    int64_t value_at_watermark;
+    container_->getById(ids[i], watermark)
+        ->get(kValue, &value_at_watermark);
+    EXPECT_EQ(i + 1, value_at_watermark);
+    container_->itemHistory(ids[i], LogicalTime::sample(), &history);
+    EXPECT_EQ(2u, history.size());
+  }
+  FLAGS_map_api_log_segment_size_mb = segment_size_mb;
+}
+
+class StxxlRevisionCacheTest
+    : public FieldTestWithInit<
+          TableDataTypes<LegacyChunkDataStxxlContainer, int64_t>> {};
+
+TEST_F(StxxlRevisionCacheTest, RepeatedReadsHitCache) {
+  const map_api_common::Id id = fillRevision(42);
+  ASSERT_TRUE(insertRevision());
+  const LogicalTime time = LogicalTime::sample();
+  Revision::ConstPtr first = table_->getById(id, time);
+  ASSERT_TRUE(first != nullptr);
+  EXPECT_EQ(1u, table_->numRevisionCacheMisses());
+  EXPECT_EQ(0u, table_->numRevisionCacheHits());
+  EXPECT_EQ(first, table_->getById(id, time));
+  EXPECT_EQ(1u, table_->numRevisionCacheMisses());
+  EXPECT_EQ(1u, table_->numRevisionCacheHits());
+}
+
+TEST_F(StxxlRevisionCacheTest, ContainersDontShareCachedRevisions) {
+  // The cache is shared by all containers of the process. Revisions of the
+  // second container are stored at the same positions as those of the first.
+  typedef FieldTestTable<TableDataTypes<LegacyChunkDataStxxlContainer,
+                                        int64_t>> FieldTestTableType;
+  std::unique_ptr<LegacyChunkDataStxxlContainer> other(
+      FieldTestTableType::forge());
+  const map_api_common::Id id = fillRevision(42);
+  ASSERT_TRUE(insertRevision());
+  const LogicalTime time = LogicalTime::sample();
+  ASSERT_TRUE(table_->getById(id, time) != nullptr);
+  ASSERT_TRUE(table_->getById(id, time) != nullptr);
+
+  query_ = other->getTemplate();
+  query_->setId(id);
+  query_->set(FieldTestTableType::kTestField, static_cast<int64_t>(21));
+  ASSERT_TRUE(other->insert(LogicalTime::sample(), query_));
+  int64_t value;
+  other->getById(id, LogicalTime::sample())
+      ->get(FieldTestTableType::kTestField, &value);
+  EXPECT_EQ(21, value);
+  EXPECT_EQ(1u, other->numRevisionCacheMisses());
+  EXPECT_EQ(0u, other->numRevisionCacheHits());
+
+  // Clearing starts a new store, whose revisions aren't confused with the
+  // cached ones either.
+  table_->clear();
+  EXPECT_EQ(0u, table_->numRevisionCacheHits());
+  fillRevision(84);
+  ASSERT_TRUE(insertRevision());
+  table_->getById(query_->getId<map_api_common::Id>(), LogicalTime::sample())
+      ->get(FieldTestTableType::kTestField, &value);
+  EXPECT_EQ(84, value);
+}
+
 TYPED_TEST(CruMapIntTestWithInit, HistoryAtTime) {
   typedef FieldTestTable<TypeParam> FieldTestTableType;
   constexpr int64_t kFirst = 42, kSecond = 21, kThird = 84;
@@ -416,6 +981,356 @@ TYPED_TEST(CruMapIntTestWithInit, Remove) {
   EXPECT_EQ(0u, result.size());
 }
 
+class IndexedFieldTest : public ::testing::Test {
+ protected:
+  enum Fields {
+    kIndexedField
+  };
+
+  virtual void SetUp() override {
+    Core::initializeInstance();
+    ASSERT_TRUE(Core::instance() != nullptr);
+    std::shared_ptr<TableDescriptor> descriptor(new TableDescriptor);
+    descriptor->setName("indexed_field_test_table");
+    descriptor->addField<int64_t>(kIndexedField);
+    descriptor->addIndex(kIndexedField);
+    descriptor->addSortedIndex(kIndexedField);
+    table_.reset(new LegacyChunkDataRamContainer);
+    table_->init(descriptor);
+  }
+  virtual void TearDown() override { Core::instance()->kill(); }
+
+  map_api_common::Id insert(int64_t value) {
+    std::shared_ptr<Revision> revision = table_->getTemplate();
+    map_api_common::Id id;
+    generateId(&id);
+    revision->setId(id);
+    revision->set(kIndexedField, value);
+    CHECK(table_->insert(LogicalTime::sample(), revision));
+    return id;
+  }
+
+  void update(const map_api_common::Id& id, int64_t value) {
+    std::shared_ptr<Revision> revision;
+    table_->getById(id, LogicalTime::sample())->copyForWrite(&revision);
+    revision->set(kIndexedField, value);
+    table_->update(LogicalTime::sample(), revision);
+  }
+
+  int count(int64_t value, const LogicalTime& time) {
+    return table_->count(kIndexedField, value, time);
+  }
+
+  int countRange(int64_t lower, int64_t upper, const LogicalTime& time) {
+    FieldPredicate predicate;
+    predicate.inRange(kIndexedField, lower, upper);
+    return table_->count(predicate, time);
+  }
+
+  std::unique_ptr<LegacyChunkDataRamContainer> table_;
+};
+
+TEST_F(IndexedFieldTest, FindAndCountAtTime) {
+  constexpr int64_t kFirst = 1, kSecond = 2, kAbsent = 3;
+  const map_api_common::Id a = insert(kFirst);
+  const map_api_common::Id b = insert(kFirst);
+  const map_api_common::Id c = insert(kSecond);
+  const LogicalTime before_update = LogicalTime::sample();
+  update(b, kSecond);
+
+  EXPECT_EQ(1, count(kFirst, LogicalTime::sample()));
+  EXPECT_EQ(2, count(kSecond, LogicalTime::sample()));
+  EXPECT_EQ(0, count(kAbsent, LogicalTime::sample()));
+  EXPECT_EQ(2, count(kFirst, before_update));
+  EXPECT_EQ(1, count(kSecond, before_update));
+
+  ConstRevisionMap result;
+  table_->find(kIndexedField, kSecond, LogicalTime::sample(), &result);
+  EXPECT_EQ(2u, result.size());
+  EXPECT_TRUE(result.find(b) != result.end());
+  EXPECT_TRUE(result.find(c) != result.end());
+
+  std::shared_ptr<Revision> revision;
+  table_->getById(a, LogicalTime::sample())->copyForWrite(&revision);
+  table_->remove(LogicalTime::sample(), revision);
+  EXPECT_EQ(0, count(kFirst, LogicalTime::sample()));
+  EXPECT_EQ(2, count(kFirst, before_update));
+}
+
+TEST_F(IndexedFieldTest, RangeAtTime) {
+  const map_api_common::Id a = insert(10);
+  insert(20);
+  insert(30);
+  const LogicalTime before_update = LogicalTime::sample();
+  update(a, 40);
+
+  EXPECT_EQ(2, countRange(15, 45, before_update));
+  EXPECT_EQ(3, countRange(15, 45, LogicalTime::sample()));
+  EXPECT_EQ(1, countRange(10, 10, before_update));
+  EXPECT_EQ(0, countRange(10, 10, LogicalTime::sample()));
+  EXPECT_EQ(0, countRange(45, 15, LogicalTime::sample()));
+
+  // The equality term uses the hash index, the range term filters.
+  FieldPredicate predicate;
+  predicate.equals(kIndexedField, static_cast<int64_t>(40))
+      .inRange(kIndexedField, static_cast<int64_t>(0),
+               static_cast<int64_t>(50));
+  ConstRevisionMap result;
+  table_->find(predicate, LogicalTime::sample(), &result);
+  ASSERT_EQ(1u, result.size());
+  EXPECT_EQ(a, result.begin()->first);
+
+  // Compaction drops the superseded value from the index.
+  table_->compactHistory(LogicalTime::sample());
+  EXPECT_EQ(0, countRange(10, 10, LogicalTime::sample()));
+  EXPECT_EQ(1, countRange(40, 40, LogicalTime::sample()));
+}
+
+DEFINE_uint64(long_history_items, 100u,
+              "Amount of items in IndexedFieldTest.GetByIdInLongHistories");
+DEFINE_uint64(long_history_length, 1000u,
+              "Revisions per item in IndexedFieldTest.GetByIdInLongHistories");
+DEFINE_uint64(long_history_lookups, 100000u,
+              "Amount of getById calls in "
+              "IndexedFieldTest.GetByIdInLongHistories");
+
+TEST_F(IndexedFieldTest, GetByIdInLongHistories) {
+  std::vector<map_api_common::Id> ids;
+  std::vector<LogicalTime> times;
+  for (uint64_t i = 0u; i < FLAGS_long_history_items; ++i) {
+    ids.push_back(insert(0));
+  }
+  for (uint64_t revision = 1u; revision < FLAGS_long_history_length;
+       ++revision) {
+    times.push_back(LogicalTime::sample());
+    for (const map_api_common::Id& id : ids) {
+      update(id, revision);
+    }
+  }
+  ASSERT_FALSE(times.empty());
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<size_t> item_distribution(0u, ids.size() - 1u);
+  std::uniform_int_distribution<size_t> time_distribution(0u,
+                                                          times.size() - 1u);
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (uint64_t i = 0u; i < FLAGS_long_history_lookups; ++i) {
+    const size_t time_index = time_distribution(generator);
+    std::shared_ptr<const Revision> revision = table_->getById(
+        ids[item_distribution(generator)], times[time_index]);
+    ASSERT_TRUE(revision != nullptr);
+    int64_t value;
+    revision->get(kIndexedField, &value);
+    // The revision valid at times[i] has been written before times[i + 1].
+    ASSERT_EQ(static_cast<int64_t>(time_index), value);
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start).count();
+  LOG(INFO) << FLAGS_long_history_lookups << " lookups in histories of "
+            << FLAGS_long_history_length << " revisions took " << seconds
+            << "s, " << seconds * 1e9 / FLAGS_long_history_lookups
+            << "ns per lookup";
+}
+
+DEFINE_uint64(scan_benchmark_items, 100000u,
+              "Amount of items in ScanBenchmark.CountAndFind");
+DEFINE_uint64(scan_benchmark_queries, 100u,
+              "Amount of count and find queries in ScanBenchmark.CountAndFind");
+
+template <typename TableType>
+class ScanBenchmark : public ::testing::Test {
+ protected:
+  enum Fields {
+    kIntField,
+    kDoubleField
+  };
+  static constexpr int64_t kDistinctValues = 100;
+
+  virtual void SetUp() override {
+    Core::initializeInstance();
+    ASSERT_TRUE(Core::instance() != nullptr);
+    std::shared_ptr<TableDescriptor> descriptor(new TableDescriptor);
+    descriptor->setName("scan_benchmark_table");
+    descriptor->addField<int64_t>(kIntField);
+    descriptor->addField<double>(kDoubleField);
+    table_.reset(new TableType);
+    table_->init(descriptor);
+  }
+  virtual void TearDown() override { Core::instance()->kill(); }
+
+  void insertItems() {
+    MutableRevisionMap items;
+    for (uint64_t i = 0u; i < FLAGS_scan_benchmark_items; ++i) {
+      std::shared_ptr<Revision> item = table_->getTemplate();
+      map_api_common::Id id;
+      generateId(&id);
+      item->setId(id);
+      item->set(kIntField, static_cast<int64_t>(i % kDistinctValues));
+      item->set(kDoubleField, static_cast<double>(i));
+      items.emplace(id, item);
+    }
+    ASSERT_TRUE(table_->bulkInsert(LogicalTime::sample(), items));
+  }
+
+  std::unique_ptr<TableType> table_;
+};
+
+typedef ::testing::Types<LegacyChunkDataRamContainer,
+                         LegacyChunkDataColumnarContainer> ScanTableTypes;
+TYPED_TEST_CASE(ScanBenchmark, ScanTableTypes);
+
+TYPED_TEST(ScanBenchmark, CountAndFind) {
+  typedef ScanBenchmark<TypeParam> Fixture;
+  this->insertItems();
+  const LogicalTime time = LogicalTime::sample();
+  const int expected_count =
+      FLAGS_scan_benchmark_items / Fixture::kDistinctValues;
+
+  const std::chrono::steady_clock::time_point count_start =
+      std::chrono::steady_clock::now();
+  for (uint64_t i = 0u; i < FLAGS_scan_benchmark_queries; ++i) {
+    EXPECT_EQ(expected_count,
+              this->table_->count(
+                  Fixture::kIntField,
+                  static_cast<int64_t>(i % Fixture::kDistinctValues), time));
+  }
+  const std::chrono::steady_clock::time_point find_start =
+      std::chrono::steady_clock::now();
+  for (uint64_t i = 0u; i < FLAGS_scan_benchmark_queries; ++i) {
+    ConstRevisionMap result;
+    this->table_->find(Fixture::kDoubleField, static_cast<double>(i), time,
+                       &result);
+    EXPECT_EQ(1u, result.size());
+  }
+  const std::chrono::steady_clock::time_point end =
+      std::chrono::steady_clock::now();
+
+  LOG(INFO) << FLAGS_scan_benchmark_queries << " counts over "
+            << FLAGS_scan_benchmark_items << " items took "
+            << std::chrono::duration<double>(find_start - count_start).count()
+            << "s, finds took "
+            << std::chrono::duration<double>(end - find_start).count() << "s";
+}
+
+TYPED_TEST(ScanBenchmark, FindConjunction) {
+  typedef ScanBenchmark<TypeParam> Fixture;
+  this->insertItems();
+  const LogicalTime time = LogicalTime::sample();
+
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (uint64_t i = 0u; i < FLAGS_scan_benchmark_queries; ++i) {
+    const int64_t int_value = i % Fixture::kDistinctValues;
+    FieldPredicate predicate;
+    predicate.equals(Fixture::kIntField, int_value)
+        .equals(Fixture::kDoubleField, static_cast<double>(i));
+    ConstRevisionMap result;
+    this->table_->find(predicate, time, &result);
+    ASSERT_EQ(1u, result.size());
+    double double_value;
+    result.begin()->second->get(Fixture::kDoubleField, &double_value);
+    EXPECT_EQ(static_cast<double>(i), double_value);
+
+    // Same double, but an int value that never comes with it.
+    FieldPredicate contradiction;
+    contradiction.equals(Fixture::kIntField,
+                         (int_value + 1) % Fixture::kDistinctValues)
+        .equals(Fixture::kDoubleField, static_cast<double>(i));
+    EXPECT_EQ(0, this->table_->count(contradiction, time));
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start).count();
+
+  EXPECT_EQ(FLAGS_scan_benchmark_items,
+            static_cast<uint64_t>(this->table_->count(FieldPredicate(), time)));
+  LOG(INFO) << FLAGS_scan_benchmark_queries << " two-field finds and counts "
+            << "over " << FLAGS_scan_benchmark_items << " items took "
+            << seconds << "s";
+}
+
+TYPED_TEST(ScanBenchmark, RangeAndCondition) {
+  typedef ScanBenchmark<TypeParam> Fixture;
+  this->insertItems();
+  const LogicalTime time = LogicalTime::sample();
+  constexpr uint64_t kRangeSize = 10u;
+  ASSERT_GE(FLAGS_scan_benchmark_items, kRangeSize);
+
+  FieldPredicate range;
+  range.inRange(Fixture::kDoubleField, 10., 10. + kRangeSize - 1u);
+  ConstRevisionMap result;
+  this->table_->find(range, time, &result);
+  EXPECT_EQ(kRangeSize, result.size());
+
+  FieldPredicate int_range;
+  int_range.inRange(Fixture::kIntField, static_cast<int64_t>(0),
+                    static_cast<int64_t>(4));
+  EXPECT_EQ(5 * FLAGS_scan_benchmark_items / Fixture::kDistinctValues,
+            static_cast<uint64_t>(this->table_->count(int_range, time)));
+
+  const double threshold =
+      static_cast<double>(FLAGS_scan_benchmark_items - kRangeSize);
+  FieldPredicate condition;
+  condition.satisfies<double>(
+      Fixture::kDoubleField,
+      [threshold](const double& value) { return value >= threshold; });
+  size_t streamed = 0u;
+  this->table_->forEachFound(condition, time,
+                             [&streamed, threshold](
+                                 const std::shared_ptr<const Revision>& item) {
+    double value;
+    item->get(Fixture::kDoubleField, &value);
+    EXPECT_GE(value, threshold);
+    ++streamed;
+  });
+  EXPECT_EQ(kRangeSize, streamed);
+}
+
+TYPED_TEST(ScanBenchmark, ParallelScaling) {
+  typedef ScanBenchmark<TypeParam> Fixture;
+  this->insertItems();
+  const LogicalTime time = LogicalTime::sample();
+  const uint64_t threshold_before = FLAGS_map_api_parallel_scan_threshold;
+  const uint64_t threads_before = FLAGS_map_api_parallel_scan_threads;
+  FLAGS_map_api_parallel_scan_threshold = 0u;
+
+  const unsigned int max_threads =
+      std::max(1u, std::thread::hardware_concurrency());
+  ConstRevisionMap serial_result;
+  double serial_seconds = 0.;
+  for (unsigned int threads = 1u; threads <= max_threads; threads *= 2u) {
+    FLAGS_map_api_parallel_scan_threads = threads;
+    ConstRevisionMap result;
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (uint64_t i = 0u; i < FLAGS_scan_benchmark_queries; ++i) {
+      this->table_->find(Fixture::kIntField, static_cast<int64_t>(0), time,
+                         &result);
+    }
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      start).count();
+    EXPECT_EQ(FLAGS_scan_benchmark_items / Fixture::kDistinctValues,
+              result.size());
+    if (threads == 1u) {
+      serial_result = result;
+      serial_seconds = seconds;
+    } else {
+      EXPECT_EQ(serial_result.size(), result.size());
+      for (const ConstRevisionMap::value_type& item : serial_result) {
+        EXPECT_TRUE(result.find(item.first) != result.end());
+      }
+    }
+    LOG(INFO) << FLAGS_scan_benchmark_queries << " finds over "
+              << FLAGS_scan_benchmark_items << " items on " << threads
+              << " threads took " << seconds << "s, speedup "
+              << serial_seconds / seconds;
+  }
+
+  FLAGS_map_api_parallel_scan_threshold = threshold_before;
+  FLAGS_map_api_parallel_scan_threads = threads_before;
+}
+
 }  // namespace map_api
 
 MAP_API_UNITTEST_ENTRYPOINT
@@ -19,16 +19,29 @@
 // You should have received a copy of the GNU General Public License
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
+#include <dirent.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <set>
+#include <vector>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
 #include "map-api/hub.h"
+#include "map-api/internal/write-ahead-log.h"
 #include "map-api/ipc.h"
 #include "map-api/test/testing-entrypoint.h"
 #include "./net_table_fixture.h"
 
+DECLARE_uint64(map_api_trigger_coalescing_ms);
+DECLARE_uint64(map_api_trigger_max_pending_batches);
+DECLARE_string(map_api_wal_directory);
+
 namespace map_api {
 
 class ChunkTest : public NetTableFixture {};
@@ -283,6 +296,76 @@ TEST_F(ChunkTest, Grind) {
   }
 }
 
+DEFINE_uint64(lock_contention_duration_ms, 2000u,
+              "Duration for which all processes compete for the write lock "
+              "in ChunkTest.WriteLockContention");
+
+// Benchmark: All processes write-lock the same chunk as often as they can for
+// a fixed duration. Prints the throughput and Jain's fairness index of the
+// acquisitions per process. Every process must make progress.
+TEST_F(ChunkTest, WriteLockContention) {
+  const uint64_t kProcesses = FLAGS_grind_processes;
+  enum Barriers {
+    INIT,
+    ID_SHARED,
+    GO,
+    DONE,
+    DIE
+  };
+  ChunkBase* chunk;
+  if (getSubprocessId() == 0) {
+    for (uint64_t i = 1u; i < kProcesses; ++i) {
+      launchSubprocess(i);
+    }
+    chunk = table_->newChunk();
+    ASSERT_TRUE(chunk);
+    IPC::barrier(INIT, kProcesses - 1);
+    chunk->requestParticipation();
+    IPC::push(chunk->id());
+    IPC::barrier(ID_SHARED, kProcesses - 1);
+  } else {
+    IPC::barrier(INIT, kProcesses - 1);
+    IPC::barrier(ID_SHARED, kProcesses - 1);
+    chunk = table_->getChunk(IPC::pop<map_api_common::Id>());
+    ASSERT_TRUE(chunk);
+  }
+
+  IPC::barrier(GO, kProcesses - 1);
+  const std::chrono::steady_clock::time_point end =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(FLAGS_lock_contention_duration_ms);
+  uint64_t acquisitions = 0u;
+  while (std::chrono::steady_clock::now() < end) {
+    chunk->writeLock();
+    ++acquisitions;
+    chunk->unlock();
+  }
+  if (getSubprocessId() != 0) {
+    IPC::push(acquisitions);
+  }
+  IPC::barrier(DONE, kProcesses - 1);
+
+  if (getSubprocessId() == 0) {
+    std::vector<uint64_t> counts(1u, acquisitions);
+    for (uint64_t i = 1u; i < kProcesses; ++i) {
+      counts.push_back(IPC::pop<uint64_t>());
+    }
+    double sum = 0., sum_of_squares = 0.;
+    for (const uint64_t count : counts) {
+      EXPECT_GT(count, 0u);
+      sum += count;
+      sum_of_squares += static_cast<double>(count) * count;
+    }
+    LOG(INFO) << "Write lock throughput: "
+              << sum * 1e3 / FLAGS_lock_contention_duration_ms
+              << " acquisitions/s over " << kProcesses << " processes";
+    LOG(INFO) << "Jain's fairness index: "
+              << sum * sum / (kProcesses * sum_of_squares);
+    LOG(INFO) << table_->getLockContentionReport(1u);
+  }
+  IPC::barrier(DIE, kProcesses - 1);
+}
+
 TEST_F(ChunkTest, ChunkTransactions) {
   const uint64_t kProcesses = FLAGS_grind_processes;
   enum Barriers {
@@ -488,6 +571,209 @@ TEST_F(ChunkTest, Triggers) {
   }
 }
 
+TEST_F(ChunkTest, TriggerCoalescing) {
+  enum Processes {
+    ROOT,
+    A
+  };
+  enum Barriers {
+    INIT,
+    ID_SHARED,
+    TRIGGER_READY,
+    COMMITTED,
+    DIE
+  };
+  constexpr size_t kNumCommits = 3u;
+  const uint64_t coalescing_ms = FLAGS_map_api_trigger_coalescing_ms;
+  FLAGS_map_api_trigger_coalescing_ms = 2000u;
+  std::mutex mutex;
+  std::vector<size_t> batch_sizes;
+  if (getSubprocessId() == ROOT) {
+    launchSubprocess(A);
+    IPC::barrier(INIT, 1);
+    chunk_ = table_->newChunk();
+    IPC::push(chunk_->id());
+    IPC::barrier(ID_SHARED, 1);
+    chunk_->attachTrigger([&mutex, &batch_sizes](
+        const std::unordered_set<map_api_common::Id>& insertions,
+        const std::unordered_set<map_api_common::Id>& updates) {
+      // Ignore chunk management related unlocks.
+      if (insertions.size() + updates.size() > 0u) {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch_sizes.push_back(insertions.size());
+      }
+    });
+    IPC::barrier(TRIGGER_READY, 1);
+    IPC::barrier(COMMITTED, 1);
+    usleep(3e6);  // Outlasts the coalescing window.
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      EXPECT_EQ(std::vector<size_t>({kNumCommits}), batch_sizes);
+    }
+    IPC::barrier(DIE, 1);
+  }
+  if (getSubprocessId() == A) {
+    IPC::barrier(INIT, 1);
+    IPC::barrier(ID_SHARED, 1);
+    chunk_ = table_->getChunk(IPC::pop<map_api_common::Id>());
+    IPC::barrier(TRIGGER_READY, 1);
+    for (size_t i = 0u; i < kNumCommits; ++i) {
+      Transaction transaction;
+      insert(static_cast<int>(i), nullptr, &transaction);
+      ASSERT_TRUE(transaction.commit());
+    }
+    IPC::barrier(COMMITTED, 1);
+    IPC::barrier(DIE, 1);
+  }
+  FLAGS_map_api_trigger_coalescing_ms = coalescing_ms;
+}
+
+TEST_F(ChunkTest, TriggerBackpressureMergesBatches) {
+  enum Processes {
+    ROOT,
+    A
+  };
+  enum Barriers {
+    INIT,
+    ID_SHARED,
+    TRIGGER_READY,
+    FIRST_COMMITTED,
+    FIRST_DELIVERED,
+    COMMITTED,
+    DIE
+  };
+  constexpr size_t kNumCommits = 4u;
+  const uint64_t max_pending_batches =
+      FLAGS_map_api_trigger_max_pending_batches;
+  FLAGS_map_api_trigger_max_pending_batches = 1u;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<size_t> batch_sizes;
+  bool released = false;
+  if (getSubprocessId() == ROOT) {
+    launchSubprocess(A);
+    IPC::barrier(INIT, 1);
+    chunk_ = table_->newChunk();
+    IPC::push(chunk_->id());
+    IPC::barrier(ID_SHARED, 1);
+    chunk_->attachTrigger([&mutex, &cv, &batch_sizes, &released](
+        const std::unordered_set<map_api_common::Id>& insertions,
+        const std::unordered_set<map_api_common::Id>& updates) {
+      // Ignore chunk management related unlocks.
+      if (insertions.size() + updates.size() == 0u) {
+        return;
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      batch_sizes.push_back(insertions.size());
+      cv.notify_all();
+      // Hold up delivery of the first batch, so the following commits pile
+      // up behind it.
+      cv.wait(lock, [&released]() { return released; });
+    });
+    IPC::barrier(TRIGGER_READY, 1);
+    IPC::barrier(FIRST_COMMITTED, 1);
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      EXPECT_TRUE(cv.wait_for(lock, std::chrono::seconds(5), [&batch_sizes]() {
+        return !batch_sizes.empty();
+      }));
+    }
+    IPC::barrier(FIRST_DELIVERED, 1);
+    IPC::barrier(COMMITTED, 1);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      released = true;
+    }
+    cv.notify_all();
+    usleep(5e5);  // should suffice for the remaining batch to be delivered
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      // Once the limit is reached, the commits after the first are merged
+      // into a single batch.
+      EXPECT_EQ(std::vector<size_t>({1u, kNumCommits - 1u}), batch_sizes);
+    }
+    IPC::barrier(DIE, 1);
+  }
+  if (getSubprocessId() == A) {
+    IPC::barrier(INIT, 1);
+    IPC::barrier(ID_SHARED, 1);
+    chunk_ = table_->getChunk(IPC::pop<map_api_common::Id>());
+    IPC::barrier(TRIGGER_READY, 1);
+    for (size_t i = 0u; i < kNumCommits; ++i) {
+      Transaction transaction;
+      insert(static_cast<int>(i), nullptr, &transaction);
+      ASSERT_TRUE(transaction.commit());
+      if (i == 0u) {
+        IPC::barrier(FIRST_COMMITTED, 1);
+        IPC::barrier(FIRST_DELIVERED, 1);
+      }
+    }
+    IPC::barrier(COMMITTED, 1);
+    IPC::barrier(DIE, 1);
+  }
+  FLAGS_map_api_trigger_max_pending_batches = max_pending_batches;
+}
+
+TEST_F(ChunkTest, WriteAheadLogSyncsRemoteCommitOnce) {
+  enum Processes {
+    ROOT,
+    A
+  };
+  enum Barriers {
+    INIT,
+    ID_SHARED,
+    JOINED,
+    COMMITTED,
+    DIE
+  };
+  constexpr int kNumItems = 10;
+  // Each peer logs to its own directory.
+  const std::string directory =
+      "/tmp/map_api_chunk_test_wal_" +
+      map_api_common::createRandomId<map_api_common::Id>().hexString();
+  FLAGS_map_api_wal_directory = directory;
+  internal::WriteAheadLog& log = internal::WriteAheadLog::instance();
+  log.open(directory);
+  if (getSubprocessId() == ROOT) {
+    launchSubprocess(A);
+    IPC::barrier(INIT, 1);
+    chunk_ = table_->newChunk();
+    IPC::push(chunk_->id());
+    IPC::barrier(ID_SHARED, 1);
+    IPC::barrier(JOINED, 1);
+    const uint64_t num_flushes = log.numFlushes();
+    IPC::barrier(COMMITTED, 1);
+    // The patches of all items are synced together when A unlocks.
+    EXPECT_EQ(num_flushes + 1u, log.numFlushes());
+    IPC::barrier(DIE, 1);
+  }
+  if (getSubprocessId() == A) {
+    IPC::barrier(INIT, 1);
+    IPC::barrier(ID_SHARED, 1);
+    chunk_ = table_->getChunk(IPC::pop<map_api_common::Id>());
+    IPC::barrier(JOINED, 1);
+    Transaction transaction;
+    for (int i = 0; i < kNumItems; ++i) {
+      insert(i, nullptr, &transaction);
+    }
+    EXPECT_TRUE(transaction.commit());
+    IPC::barrier(COMMITTED, 1);
+    IPC::barrier(DIE, 1);
+  }
+  log.close();
+  FLAGS_map_api_wal_directory = "";
+  DIR* directory_handle = opendir(directory.c_str());
+  ASSERT_TRUE(directory_handle != nullptr);
+  while (const dirent* entry = readdir(directory_handle)) {
+    const std::string name(entry->d_name);
+    if (name != "." && name != "..") {
+      EXPECT_EQ(0, unlink((directory + "/" + name).c_str()));
+    }
+  }
+  EXPECT_EQ(0, closedir(directory_handle));
+  EXPECT_EQ(0, rmdir(directory.c_str()));
+}
+
 TEST_F(ChunkTest, SendHistory) {
   enum Processes {
     ROOT,
@@ -560,6 +846,39 @@ TEST_F(ChunkTest, GetCommitTimes) {
   EXPECT_TRUE(commit_times.find(second.getCommitTime()) != commit_times.end());
 }
 
+TEST_F(ChunkTest, LockStatistics) {
+  ChunkBase* chunk = table_->newChunk();
+  ASSERT_TRUE(chunk);
+  const internal::LockContentionStatistics& statistics =
+      chunk->lockStatistics();
+  const uint64_t read_waits = statistics.readWait().count();
+  const uint64_t read_holds = statistics.readHold().count();
+  const uint64_t write_waits = statistics.writeWait().count();
+  const uint64_t write_holds = statistics.writeHold().count();
+
+  chunk->writeLock();
+  chunk->readLock();
+  chunk->unlock();
+  chunk->unlock();
+  chunk->readLock();
+  chunk->readLock();
+  chunk->unlock();
+  chunk->unlock();
+
+  EXPECT_EQ(write_waits + 1u, statistics.writeWait().count());
+  EXPECT_EQ(write_holds + 1u, statistics.writeHold().count());
+  EXPECT_EQ(read_waits + 2u, statistics.readWait().count());
+  // Both read locks are part of the same read-locked phase.
+  EXPECT_EQ(read_holds + 1u, statistics.readHold().count());
+  EXPECT_EQ(1u, statistics.numRecursiveAcquisitions());
+  EXPECT_EQ(2, statistics.maxRecursionDepth());
+  EXPECT_EQ(0u, statistics.numDeclines());
+  EXPECT_EQ(0u, statistics.numRetries());
+
+  const std::string report = table_->getLockContentionReport(1u);
+  EXPECT_NE(std::string::npos, report.find(chunk->id().hexString()));
+}
+
 }  // namespace map_api
 
 MAP_API_UNITTEST_ENTRYPOINT
@@ -19,11 +19,16 @@
 // You should have received a copy of the GNU General Public License
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
+#include <unistd.h>
+
 #include <string>
+#include <vector>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include "map-api/chunk-manager.h"
 #include "map-api/ipc.h"
 #include "map-api/net-table-manager.h"
 #include "map-api/net-table-transaction.h"
@@ -31,6 +36,8 @@
 #include "map-api/transaction.h"
 #include "./net_table_fixture.h"
 
+DECLARE_uint64(map_api_item_filter_announcement_threshold);
+
 namespace map_api {
 
 class NetTableTest : public NetTableFixture {};
@@ -274,6 +281,129 @@ TEST_F(NetTableTest, CommitTime) {
   // TODO(tcies) also test update times, and times accross multiple chunks
 }
 
+TEST_F(NetTableTest, ItemDirectory) {
+  chunk_ = table_->newChunk();
+  const map_api_common::Id existing_id = insert(0, chunk_);
+  map_api_common::Id chunk_id;
+  ASSERT_TRUE(table_->getChunkIdOfItem(existing_id, &chunk_id));
+  EXPECT_EQ(chunk_->id(), chunk_id);
+
+  {
+    // Transactions know their own insertions before the directory does, while
+    // transactions that began before the commit don't see them.
+    Transaction reader;
+    Transaction writer;
+    map_api_common::Id inserted_id;
+    insert(1, &inserted_id, &writer);
+    EXPECT_TRUE(writer.getById(inserted_id, table_) != nullptr);
+    EXPECT_FALSE(table_->getChunkIdOfItem(inserted_id, &chunk_id));
+    ASSERT_TRUE(writer.commit());
+    ASSERT_TRUE(table_->getChunkIdOfItem(inserted_id, &chunk_id));
+    EXPECT_EQ(chunk_->id(), chunk_id);
+    EXPECT_TRUE(reader.getById(existing_id, table_) != nullptr);
+    EXPECT_TRUE(reader.getById(inserted_id, table_) == nullptr);
+    std::vector<map_api_common::Id> available_ids;
+    reader.getAvailableIds(table_, &available_ids);
+    EXPECT_EQ(1u, available_ids.size());
+    Transaction later_reader;
+    later_reader.getAvailableIds(table_, &available_ids);
+    EXPECT_EQ(2u, available_ids.size());
+  }
+
+  table_->leaveAllChunks();
+  EXPECT_FALSE(table_->getChunkIdOfItem(existing_id, &chunk_id));
+}
+
+TEST_F(NetTableTest, ItemFilters) {
+  chunk_ = table_->newChunk();
+  const map_api_common::Id item_id = insert(0, chunk_);
+  const map_api_common::IdSet candidates({chunk_->id()});
+  map_api_common::IdSet chunk_ids;
+  // The chunk was announced before the item was inserted.
+  table_->getChunksThatMayHoldItem(item_id, candidates, &chunk_ids);
+  EXPECT_TRUE(chunk_ids.empty());
+
+  table_->announceItemFilters();
+  table_->getChunksThatMayHoldItem(item_id, candidates, &chunk_ids);
+  ASSERT_EQ(1u, chunk_ids.size());
+  EXPECT_EQ(chunk_->id(), *chunk_ids.begin());
+  map_api_common::Id absent_id;
+  map_api_common::generateId(&absent_id);
+  table_->getChunksThatMayHoldItem(absent_id, candidates, &chunk_ids);
+  EXPECT_TRUE(chunk_ids.empty());
+
+  // The filter goes with the last holder of the chunk.
+  table_->leaveAllChunks();
+  table_->getChunksThatMayHoldItem(item_id, candidates, &chunk_ids);
+  EXPECT_TRUE(chunk_ids.empty());
+}
+
+TEST_F(NetTableTest, ItemFiltersAreReannounced) {
+  constexpr size_t kThreshold = 10u;
+  FLAGS_map_api_item_filter_announcement_threshold = kThreshold;
+  chunk_ = table_->newChunk();
+  const map_api_common::IdSet candidates({chunk_->id()});
+  std::vector<map_api_common::Id> item_ids;
+  for (size_t i = 0u; i < kThreshold; ++i) {
+    item_ids.emplace_back(insert(i, chunk_));
+  }
+  // The announcement is queued by the last insertion.
+  map_api_common::IdSet chunk_ids;
+  for (int i = 0; i < 1000 && chunk_ids.empty(); ++i) {
+    usleep(1000);
+    table_->getChunksThatMayHoldItem(item_ids.back(), candidates, &chunk_ids);
+  }
+  EXPECT_EQ(1u, chunk_ids.size());
+  for (const map_api_common::Id& item_id : item_ids) {
+    table_->getChunksThatMayHoldItem(item_id, candidates, &chunk_ids);
+    EXPECT_EQ(1u, chunk_ids.size());
+  }
+  FLAGS_map_api_item_filter_announcement_threshold = 1000u;
+}
+
+TEST_F(NetTableTest, AdaptiveChunkManagerCountsRemoteCommits) {
+  enum Processes {
+    MASTER,
+    SLAVE
+  };
+  enum Barriers {
+    INIT,
+    CHUNK_SHARED,
+    COMMITTED,
+    DIE
+  };
+  constexpr int kNumCommits = 10;
+  if (getSubprocessId() == MASTER) {
+    launchSubprocess(SLAVE);
+    ChunkManagerAdaptive::Options options;
+    options.rate_smoothing = 1.;
+    options.sample_period = std::chrono::milliseconds(1);
+    ChunkManagerAdaptive manager(options, table_);
+    std::shared_ptr<Revision> item = table_->getTemplate();
+    chunk_ = manager.getChunkForItem(*item);
+    IPC::barrier(INIT, 1);
+    chunk_->requestParticipation();
+    IPC::push(chunk_->id());
+    IPC::barrier(CHUNK_SHARED, 1);
+    IPC::barrier(COMMITTED, 1);
+    EXPECT_EQ(static_cast<uint64_t>(kNumCommits), chunk_->numCommits());
+    usleep(2000);
+    // Samples the rates.
+    EXPECT_EQ(chunk_, manager.getChunkForItem(*item));
+    EXPECT_GT(manager.commitRate(chunk_->id()), 0.);
+  }
+  if (getSubprocessId() == SLAVE) {
+    IPC::barrier(INIT, 1);
+    IPC::barrier(CHUNK_SHARED, 1);
+    chunk_ = CHECK_NOTNULL(table_->getChunk(IPC::pop<map_api_common::Id>()));
+    for (int i = 0; i < kNumCommits; ++i) {
+      insert(i, chunk_);
+    }
+    IPC::barrier(COMMITTED, 1);
+  }
+  IPC::barrier(DIE, 1);
+}
+
 TEST_F(NetTableTest, ChunkLookup) {
   enum Processes {
     MASTER,
@@ -294,17 +424,23 @@ TEST_F(NetTableTest, ChunkLookup) {
     EXPECT_EQ(0u, results.size());
     map_api_common::Id chunk_id;
     chunk_id = IPC::pop<map_api_common::Id>();
+    const map_api_common::Id item_id = IPC::pop<map_api_common::Id>();
+    map_api_common::Id item_chunk_id;
+    EXPECT_FALSE(table_->getChunkIdOfItem(item_id, &item_chunk_id));
     chunk = table_->getChunk(chunk_id);
     EXPECT_TRUE(chunk);
     table_->dumpActiveChunksAtCurrentTime(&results);
     EXPECT_EQ(1u, results.size());
+    ASSERT_TRUE(table_->getChunkIdOfItem(item_id, &item_chunk_id));
+    EXPECT_EQ(chunk_id, item_chunk_id);
   }
   if (getSubprocessId() == SLAVE) {
     IPC::barrier(INIT, 1);
     chunk = table_->newChunk();
     EXPECT_TRUE(chunk);
-    insert(0, chunk);
+    const map_api_common::Id item_id = insert(0, chunk);
     IPC::push(chunk->id());
+    IPC::push(item_id);
     IPC::barrier(CHUNK_CREATED, 1);
   }
   IPC::barrier(DIE, 1);
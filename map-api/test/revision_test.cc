@@ -0,0 +1,163 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "map-api/revision.h"
+#include "map-api/table-descriptor.h"
+#include "map-api/test/testing-entrypoint.h"
+
+namespace map_api {
+
+class RevisionTest : public ::testing::Test {
+ protected:
+  enum Fields {
+    kSmallField,
+    kLargeField
+  };
+
+  virtual void SetUp() override {
+    descriptor_.setName("revision_test_table");
+    descriptor_.addField<std::string>(kSmallField);
+    descriptor_.addField<std::string>(kLargeField);
+    original_ = descriptor_.getTemplate();
+    original_->set(kSmallField, std::string("original"));
+    original_->set(kLargeField, std::string(1000u, 'x'));
+  }
+
+  std::string get(const Revision& revision, int field) const {
+    std::string result;
+    revision.get(field, &result);
+    return result;
+  }
+
+  TableDescriptor descriptor_;
+  std::shared_ptr<Revision> original_;
+};
+
+TEST_F(RevisionTest, CopyForWriteIsIndependent) {
+  std::shared_ptr<Revision> copy;
+  original_->copyForWrite(&copy);
+  EXPECT_TRUE(*copy == *original_);
+
+  copy->set(kSmallField, std::string("copy"));
+  EXPECT_EQ("original", get(*original_, kSmallField));
+  EXPECT_EQ("copy", get(*copy, kSmallField));
+  EXPECT_EQ(get(*original_, kLargeField), get(*copy, kLargeField));
+
+  // Modifying the source must not leak into the copy either.
+  original_->set(kLargeField, std::string("changed"));
+  EXPECT_EQ(std::string(1000u, 'x'), get(*copy, kLargeField));
+
+  // The copy stays valid after the source is gone.
+  original_.reset();
+  EXPECT_EQ(std::string(1000u, 'x'), get(*copy, kLargeField));
+  std::shared_ptr<Revision> parsed =
+      Revision::fromProtoString(copy->serializeUnderlying());
+  EXPECT_TRUE(*parsed == *copy);
+}
+
+TEST_F(RevisionTest, CopiesOfCopies) {
+  std::shared_ptr<Revision> first, second;
+  original_->copyForWrite(&first);
+  first->copyForWrite(&second);
+  first->set(kLargeField, std::string("first"));
+  second->clearCustomFieldValues();
+
+  EXPECT_EQ(std::string(1000u, 'x'), get(*original_, kLargeField));
+  EXPECT_EQ("original", get(*first, kSmallField));
+  EXPECT_EQ("first", get(*first, kLargeField));
+  EXPECT_EQ("", get(*second, kLargeField));
+
+  original_.reset();
+  first.reset();
+  second->set(kSmallField, std::string("second"));
+  EXPECT_EQ("second", get(*second, kSmallField));
+}
+
+TEST_F(RevisionTest, CopyChainsAreReleased) {
+  // Enough updates to overflow the stack if releasing a copy recursed into
+  // the revisions it has been copied from.
+  constexpr int kNumUpdates = 100000;
+  std::shared_ptr<Revision> latest;
+  original_->copyForWrite(&latest);
+  const std::weak_ptr<proto::Revision> intermediate =
+      latest->underlying_revision_;
+  for (int i = 0; i < kNumUpdates; ++i) {
+    std::shared_ptr<Revision> next;
+    latest->copyForWrite(&next);
+    next->set(kSmallField, std::to_string(i));
+    latest = next;
+  }
+  // The large field is shared all along, but doesn't hold on to the copies it
+  // has been shared by.
+  EXPECT_TRUE(intermediate.expired());
+  EXPECT_EQ(std::to_string(kNumUpdates - 1), get(*latest, kSmallField));
+  original_.reset();
+  EXPECT_EQ(std::string(1000u, 'x'), get(*latest, kLargeField));
+  latest.reset();
+}
+
+TEST_F(RevisionTest, ArenaRevisionsOutliveArenaHandle) {
+  constexpr int kNumRevisions = 10;
+  std::shared_ptr<google::protobuf::Arena> arena = Revision::createArena();
+  const std::weak_ptr<google::protobuf::Arena> weak_arena = arena;
+  std::vector<std::shared_ptr<Revision>> parsed;
+  for (int i = 0; i < kNumRevisions; ++i) {
+    original_->set(kSmallField, std::to_string(i));
+    parsed.push_back(
+        Revision::fromProtoString(original_->serializeUnderlying(), arena));
+  }
+  arena.reset();
+  original_.reset();
+  EXPECT_FALSE(weak_arena.expired());
+
+  std::vector<std::shared_ptr<Revision>> copies;
+  for (int i = 0; i < kNumRevisions; ++i) {
+    EXPECT_EQ(std::to_string(i), get(*parsed[i], kSmallField));
+    EXPECT_EQ(std::string(1000u, 'x'), get(*parsed[i], kLargeField));
+    std::shared_ptr<Revision> copy;
+    parsed[i]->copyForWrite(&copy);
+    EXPECT_TRUE(*copy == *parsed[i]);
+    copy->set(kSmallField, std::string("copy"));
+    EXPECT_EQ(std::to_string(i), get(*parsed[i], kSmallField));
+    copies.push_back(copy);
+  }
+
+  // The copies still share the large fields, which live on the arena.
+  parsed.clear();
+  EXPECT_FALSE(weak_arena.expired());
+  for (const std::shared_ptr<Revision>& copy : copies) {
+    EXPECT_EQ("copy", get(*copy, kSmallField));
+    EXPECT_EQ(std::string(1000u, 'x'), get(*copy, kLargeField));
+  }
+  copies.clear();
+  EXPECT_TRUE(weak_arena.expired());
+}
+
+}  // namespace map_api
+
+MAP_API_UNITTEST_ENTRYPOINT
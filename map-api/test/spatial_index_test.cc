@@ -20,9 +20,12 @@
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
 #include <string>
+#include <unordered_set>
+#include <vector>
 
 #include <eigen-checks/gtest.h>
 
+#include "map-api/chunk-manager.h"
 #include "map-api/core.h"
 #include "map-api/ipc.h"
 #include "map-api/net-table.h"
@@ -189,6 +192,132 @@ TEST_F(SpatialIndexTest, CellDimensions) {
   }
 }
 
+TEST_F(SpatialIndexTest, CellIndexOfPoint) {
+  createSpatialIndex();
+  SpatialIndex& index = table_->spatial_index();
+  std::unordered_set<size_t> cell_indices;
+  for (double x : {0.5, 1.5}) {
+    for (double y : {0.5, 1.5}) {
+      for (double z : {0.5, 1.5}) {
+        const size_t cell_index = index.getCellIndexOfPoint({x, y, z});
+        EXPECT_LT(cell_index, 8u);
+        EXPECT_TRUE(cell_indices.emplace(cell_index).second);
+        // Points on the lower cell boundary belong to the cell.
+        EXPECT_EQ(cell_index,
+                  index.getCellIndexOfPoint({x - 0.5, y - 0.5, z - 0.5}));
+        // A box within the cell covers only the cell of its points.
+        std::vector<size_t> box_indices;
+        const double cell_box[] = {x - 0.25, x + 0.25, y - 0.25,
+                                   y + 0.25, z - 0.25, z + 0.25};
+        index.getCellIndicesInBoundingBox(box(cell_box), &box_indices);
+        EXPECT_EQ(std::vector<size_t>({cell_index}), box_indices);
+      }
+    }
+  }
+  // The upper bounds belong to the last cell.
+  EXPECT_EQ(index.getCellIndexOfPoint({1.5, 1.5, 1.5}),
+            index.getCellIndexOfPoint({2, 2, 2}));
+}
+
+TEST_F(SpatialIndexTest, CellIndicesInBoundingBox) {
+  createSpatialIndex();
+  SpatialIndex& index = table_->spatial_index();
+  std::vector<size_t> indices;
+  index.getCellIndicesInBoundingBox(box(kABox), &indices);
+  EXPECT_EQ(std::vector<size_t>({index.getCellIndexOfPoint({0.5, 0.5, 0.5})}),
+            indices);
+
+  index.getCellIndicesInBoundingBox(box(kBBox), &indices);
+  EXPECT_EQ(8u,
+            std::unordered_set<size_t>(indices.begin(), indices.end()).size());
+
+  index.getCellIndicesInBoundingBox(box(kDBox), &indices);
+  EXPECT_EQ(std::unordered_set<size_t>(
+                {index.getCellIndexOfPoint({1.5, 0.5, 1.5}),
+                 index.getCellIndexOfPoint({1.5, 1.5, 1.5})}),
+            std::unordered_set<size_t>(indices.begin(), indices.end()));
+
+  index.getCellIndicesInBoundingBox(box(kBounds), &indices);
+  EXPECT_EQ(8u, indices.size());
+
+  const double kPoint[] = {1.5, 1.5, 0.5, 0.5, 0.5, 0.5};
+  index.getCellIndicesInBoundingBox(box(kPoint), &indices);
+  EXPECT_EQ(std::vector<size_t>({index.getCellIndexOfPoint({1.5, 0.5, 0.5})}),
+            indices);
+}
+
+TEST_F(SpatialIndexTest, ChunkManagerSpatial) {
+  createSpatialIndex();
+  // The field value selects the bounding box of an item.
+  const double* const kBoxes[] = {kABox, kBBox, kCBox, kDBox};
+  ChunkManagerSpatial::BoundingBoxFunction bounding_box_of =
+      [&kBoxes](const Revision& revision) {
+        int box_index;
+        revision.get(kFieldName, &box_index);
+        return box(kBoxes[box_index]);
+      };
+  std::shared_ptr<Revision> a_item = table_->getTemplate();
+  a_item->set(kFieldName, 0);
+  std::shared_ptr<Revision> d_item = table_->getTemplate();
+  d_item->set(kFieldName, 3);
+  // Room for two items per chunk.
+  ChunkManagerSpatial manager(2 * a_item->byteSize() + 1, bounding_box_of,
+                              table_);
+
+  ChunkBase* a_chunk = manager.getChunkForItem(*a_item);
+  ASSERT_TRUE(a_chunk);
+  EXPECT_EQ(a_chunk, manager.getChunkForItem(*a_item));
+  EXPECT_EQ(1u, manager.numCellsWithChunks());
+
+  // Items in another cell go to another chunk.
+  ChunkBase* d_chunk = manager.getChunkForItem(*d_item);
+  ASSERT_TRUE(d_chunk);
+  EXPECT_NE(a_chunk, d_chunk);
+  EXPECT_EQ(2u, manager.numCellsWithChunks());
+
+  // A full chunk is replaced within its cell.
+  ChunkBase* next_a_chunk = manager.getChunkForItem(*a_item);
+  ASSERT_TRUE(next_a_chunk);
+  EXPECT_NE(a_chunk, next_a_chunk);
+  EXPECT_NE(d_chunk, next_a_chunk);
+  EXPECT_EQ(2u, manager.numCellsWithChunks());
+
+  // Chunks are registered in the cells overlapped by their items.
+  std::unordered_set<ChunkBase*> chunks;
+  table_->getChunksInBoundingBox(box(kABox), &chunks);
+  EXPECT_EQ(std::unordered_set<ChunkBase*>({a_chunk, next_a_chunk}), chunks);
+  table_->getChunksInBoundingBox(box(kDBox), &chunks);
+  EXPECT_EQ(std::unordered_set<ChunkBase*>({d_chunk}), chunks);
+}
+
+TEST_F(SpatialIndexTest, ChunkManagerSpatialPointItems) {
+  createSpatialIndex();
+  // The field value is the x coordinate of a point item.
+  ChunkManagerSpatial::BoundingBoxFunction bounding_box_of =
+      [](const Revision& revision) {
+        int x;
+        revision.get(kFieldName, &x);
+        const double point[] = {static_cast<double>(x), static_cast<double>(x),
+                                0.5, 0.5, 0.5, 0.5};
+        return box(point);
+      };
+  std::shared_ptr<Revision> item = table_->getTemplate();
+  item->set(kFieldName, 1);
+  ChunkManagerSpatial manager(1000, bounding_box_of, table_);
+  ChunkBase* chunk = manager.getChunkForItem(*item);
+  ASSERT_TRUE(chunk);
+  EXPECT_EQ(chunk, manager.getChunkForItem(*item));
+
+  // On a cell boundary, the point is registered in the upper cell only.
+  std::unordered_set<ChunkBase*> chunks;
+  const double kUpperCell[] = {1.25, 1.75, 0.25, 0.75, 0.25, 0.75};
+  table_->getChunksInBoundingBox(box(kUpperCell), &chunks);
+  EXPECT_EQ(std::unordered_set<ChunkBase*>({chunk}), chunks);
+  const double kLowerCell[] = {0.25, 0.75, 0.25, 0.75, 0.25, 0.75};
+  table_->getChunksInBoundingBox(box(kLowerCell), &chunks);
+  EXPECT_TRUE(chunks.empty());
+}
+
 class SpatialIndexTwoPeerTest : public SpatialIndexTest {
  public:
   void run() {
@@ -19,12 +19,19 @@
 // You should have received a copy of the GNU General Public License
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
+#include <vector>
+
+#include <gflags/gflags.h>
+
 #include "map-api/conflicts.h"
+#include "map-api/internal/history-watermark.h"
 #include "map-api/ipc.h"
 #include "map-api/test/testing-entrypoint.h"
 #include "map-api/transaction.h"
 #include "./net_table_fixture.h"
 
+DECLARE_uint64(map_api_history_retention);
+
 namespace map_api {
 
 class TransactionTest : public NetTableFixture {
@@ -108,6 +115,62 @@ TEST_F(TransactionTest, MultiCommit) {
   EXPECT_FALSE(transaction.commit());
 }
 
+TEST_F(TransactionTest, MultiChunkCommit) {
+  // Enough chunks to have their conflicts checked in parallel.
+  constexpr size_t kNumChunks = 8u;
+  constexpr size_t kPerturbed = kNumChunks / 2u;
+  std::vector<ChunkBase*> chunks;
+  std::vector<map_api_common::Id> ids;
+  for (size_t i = 0u; i < kNumChunks; ++i) {
+    chunks.emplace_back(table_->newChunk());
+    ids.emplace_back(insert(0, chunks.back()));
+  }
+
+  Transaction transaction;
+  for (size_t i = 0u; i < kNumChunks; ++i) {
+    increment(table_, ids[i], chunks[i], &transaction);
+  }
+  EXPECT_TRUE(transaction.commit());
+
+  Transaction conflicting;
+  for (size_t i = 0u; i < kNumChunks; ++i) {
+    increment(table_, ids[i], chunks[i], &conflicting);
+  }
+  Transaction perturber;
+  increment(table_, ids[kPerturbed], chunks[kPerturbed], &perturber);
+  EXPECT_TRUE(perturber.commit());
+  EXPECT_FALSE(conflicting.commit());
+
+  // A conflict in one chunk keeps the commit out of all of them.
+  Transaction reader;
+  for (size_t i = 0u; i < kNumChunks; ++i) {
+    EXPECT_TRUE(reader.getById(ids[i], table_)
+                    ->verifyEqual(kFieldName, i == kPerturbed ? 2 : 1));
+  }
+}
+
+TEST_F(TransactionTest, BeginBelowWatermark) {
+  map_api_common::Id id;
+  {
+    Transaction inserter;
+    insert(1, &id, &inserter);
+    ASSERT_TRUE(inserter.commit());
+  }
+  const LogicalTime too_early = LogicalTime::sample();
+  const uint64_t retention = FLAGS_map_api_history_retention;
+  FLAGS_map_api_history_retention = 0u;
+  internal::HistoryWatermark::advance();
+  const LogicalTime watermark = internal::HistoryWatermark::advance();
+  FLAGS_map_api_history_retention = retention;
+  ASSERT_LT(too_early, watermark);
+
+  // Reads at the watermark instead of failing.
+  Transaction transaction(too_early);
+  EXPECT_TRUE(static_cast<bool>(transaction.getById(id, table_)));
+  update(2, id, &transaction);
+  EXPECT_TRUE(transaction.commit());
+}
+
 TEST_F(TransactionTest, TandemCommit) {
   constexpr size_t kEnoughForARaceCondition = 100u;
   for (size_t i = 0u; i < kEnoughForARaceCondition; ++i) {
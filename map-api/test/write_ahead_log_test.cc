@@ -0,0 +1,226 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>  // NOLINT
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <map-api-common/unique-id.h>
+
+#include "map-api/core.h"
+#include "map-api/internal/write-ahead-log.h"
+#include "map-api/legacy-chunk-data-ram-container.h"
+#include "map-api/logical-time.h"
+#include "map-api/test/testing-entrypoint.h"
+
+namespace map_api {
+namespace internal {
+
+class WriteAheadLogTest : public ::testing::Test {
+ protected:
+  enum Fields {
+    kValue
+  };
+
+  virtual void SetUp() override {
+    Core::initializeInstance();
+    ASSERT_TRUE(Core::instance() != nullptr);
+    descriptor_.reset(new TableDescriptor);
+    descriptor_->setName(kTableName);
+    descriptor_->addField<int64_t>(kValue);
+    ASSERT_TRUE(container_.init(descriptor_));
+    directory_ = "/tmp/map_api_wal_test_" +
+                 map_api_common::createRandomId<map_api_common::Id>()
+                     .hexString();
+    log().open(directory_);
+  }
+
+  virtual void TearDown() override {
+    if (log().isOpen()) {
+      log().close();
+    }
+    DIR* directory = opendir(directory_.c_str());
+    ASSERT_TRUE(directory != nullptr);
+    while (const dirent* entry = readdir(directory)) {
+      const std::string name(entry->d_name);
+      if (name != "." && name != "..") {
+        EXPECT_EQ(0, unlink((directory_ + "/" + name).c_str()));
+      }
+    }
+    EXPECT_EQ(0, closedir(directory));
+    EXPECT_EQ(0, rmdir(directory_.c_str()));
+    Core::instance()->kill();
+  }
+
+  static WriteAheadLog& log() { return WriteAheadLog::instance(); }
+
+  // Inserts into the container and logs the revision, as LegacyChunk does.
+  map_api_common::Id insert(int64_t value) {
+    std::shared_ptr<Revision> revision = container_.getTemplate();
+    map_api_common::Id id;
+    generateId(&id);
+    revision->setId(id);
+    revision->set(kValue, value);
+    CHECK(container_.insert(LogicalTime::sample(), revision));
+    log().sync(log().appendRevision(kTableName, *revision));
+    ids_.push_back(id);
+    return id;
+  }
+
+  void update(const map_api_common::Id& id, int64_t value) {
+    std::shared_ptr<Revision> revision;
+    container_.getById(id, LogicalTime::sample())->copyForWrite(&revision);
+    revision->set(kValue, value);
+    container_.update(LogicalTime::sample(), revision);
+    log().sync(log().appendRevision(kTableName, *revision));
+  }
+
+  void dump(const WriteAheadLog::RevisionSink& sink) {
+    for (const map_api_common::Id& id : ids_) {
+      LegacyChunkDataContainerBase::History history;
+      container_.itemHistory(id, LogicalTime::sample(), &history);
+      std::vector<std::shared_ptr<const Revision> > oldest_first(
+          history.begin(), history.end());
+      for (std::vector<std::shared_ptr<const Revision> >::reverse_iterator it =
+               oldest_first.rbegin();
+           it != oldest_first.rend(); ++it) {
+        sink(kTableName, **it);
+      }
+    }
+  }
+
+  // Restores the recovered revisions of the chunk into a new container.
+  void recover(LegacyChunkDataRamContainer* destination) {
+    WriteAheadLog::TableRevisions recovered;
+    WriteAheadLog::recover(directory_, &recovered);
+    ASSERT_EQ(1u, recovered.size());
+    ASSERT_EQ(1u, recovered[kTableName].size());
+    ASSERT_TRUE(destination->init(descriptor_));
+    for (const std::shared_ptr<Revision>& revision :
+         recovered[kTableName][chunk_id_]) {
+      ASSERT_TRUE(destination->patch(revision));
+    }
+  }
+
+  size_t numFiles() const {
+    size_t result = 0u;
+    DIR* directory = opendir(directory_.c_str());
+    CHECK(directory != nullptr);
+    while (const dirent* entry = readdir(directory)) {
+      if (entry->d_name[0] != '.') {
+        ++result;
+      }
+    }
+    CHECK_EQ(0, closedir(directory));
+    return result;
+  }
+
+  static const std::string kTableName;
+  std::shared_ptr<TableDescriptor> descriptor_;
+  LegacyChunkDataRamContainer container_;
+  // The revisions aren't assigned to a chunk, so they are recovered as part
+  // of the invalid chunk id.
+  const map_api_common::Id chunk_id_;
+  std::vector<map_api_common::Id> ids_;
+  std::string directory_;
+};
+
+const std::string WriteAheadLogTest::kTableName = "write_ahead_log_test";
+
+TEST_F(WriteAheadLogTest, Recover) {
+  constexpr int64_t kNumItems = 10;
+  std::vector<map_api_common::Id> ids;
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    ids.emplace_back(insert(i));
+  }
+  update(ids[0], kNumItems);
+  const uint32_t segment = log().currentSegment();
+  log().close();
+
+  // A record torn by the crash is ignored.
+  {
+    char name[32];
+    snprintf(name, sizeof(name), "/wal_%08u.log", segment);
+    std::ofstream segment_file(directory_ + name,
+                               std::ios::binary | std::ios::app);
+    segment_file << "torn";
+  }
+
+  LegacyChunkDataRamContainer recovered;
+  recover(&recovered);
+  EXPECT_EQ(kNumItems, recovered.count(-1, 0, LogicalTime::sample()));
+  int64_t value;
+  recovered.getById(ids[0], LogicalTime::sample())->get(kValue, &value);
+  EXPECT_EQ(kNumItems, value);
+  LegacyChunkDataContainerBase::History history;
+  recovered.itemHistory(ids[0], LogicalTime::sample(), &history);
+  EXPECT_EQ(2u, history.size());
+
+  // Logging resumes in a new segment.
+  log().open(directory_);
+  EXPECT_GT(log().currentSegment(), segment);
+}
+
+TEST_F(WriteAheadLogTest, Checkpoint) {
+  constexpr int64_t kNumItems = 10;
+  std::vector<map_api_common::Id> ids;
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    ids.emplace_back(insert(i));
+  }
+  log().checkpoint(
+      [this](const WriteAheadLog::RevisionSink& sink) { dump(sink); });
+  // The checkpoint and the new segment.
+  EXPECT_EQ(2u, numFiles());
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    update(ids[i], i + kNumItems);
+  }
+  log().close();
+
+  LegacyChunkDataRamContainer recovered;
+  recover(&recovered);
+  for (int64_t i = 0; i < kNumItems; ++i) {
+    int64_t value;
+    recovered.getById(ids[i], LogicalTime::sample())->get(kValue, &value);
+    EXPECT_EQ(i + kNumItems, value);
+    LegacyChunkDataContainerBase::History history;
+    recovered.itemHistory(ids[i], LogicalTime::sample(), &history);
+    EXPECT_EQ(2u, history.size());
+  }
+}
+
+TEST_F(WriteAheadLogTest, LeftChunksAreNotRecovered) {
+  insert(0);
+  log().sync(log().appendLeave(kTableName, chunk_id_));
+  log().close();
+  WriteAheadLog::TableRevisions recovered;
+  WriteAheadLog::recover(directory_, &recovered);
+  EXPECT_TRUE(recovered[kTableName].empty());
+}
+
+}  // namespace internal
+}  // namespace map_api
+
+MAP_API_UNITTEST_ENTRYPOINT